@@ -0,0 +1,1052 @@
+// In-process benchmark of grofs handlers, no mount is needed.
+//
+// Generates synthetic repositories, calls grofs_fuse_operations directly and prints
+// one JSON object per repository and operation to stdout. Heap allocations made by
+// grofs and libgit2 during each operation are counted by wrapping glibc malloc.
+
+#define _GNU_SOURCE
+
+#define GROFS_NO_MAIN
+
+#include "../libgrofs.c"
+#include "../grofs.c"
+
+#include <git2/sys/mempack.h>
+#include <stdarg.h>
+#include <ftw.h>
+#include <sys/wait.h>
+
+#define GROFS_BENCH_MIN_ITERATIONS 10
+#define GROFS_BENCH_MAX_ITERATIONS 200000
+#define GROFS_BENCH_DEFAULT_DURATION_MS 500
+#define GROFS_BENCH_READ_CHUNK (128 * 1024)
+// approximation of kernel readdir buffer, entries are 24 bytes plus name aligned to 8
+#define GROFS_BENCH_READDIR_BUFF 4096
+
+#define GROFS_BENCH_WIDE_FILES 20000
+#define GROFS_BENCH_DEEP_LEVELS 32
+#define GROFS_BENCH_DEEP_SIBLINGS 8
+#define GROFS_BENCH_LARGE_BLOBS 4
+#define GROFS_BENCH_LARGE_BLOB_SIZE (16 * 1024 * 1024)
+#define GROFS_BENCH_HISTORY_COMMITS 2000
+#define GROFS_BENCH_HISTORY_FILES 100
+#define GROFS_BENCH_DEFAULT_OBJECTS 100000
+#define GROFS_BENCH_OBJECTS_PER_DIR 10000
+#define GROFS_BENCH_OBJECTS_PER_PACK 1000000
+#define GROFS_BENCH_VERSIONS 12
+#define GROFS_BENCH_VERSION_SIZE (8 * 1024 * 1024)
+#define GROFS_BENCH_VERSION_EDITS 4
+#define GROFS_BENCH_VERSION_EDIT_LEN 64
+#define GROFS_BENCH_CHUNKED_KB 1024
+
+#define GROFS_BENCH_PATH_MAX 4096
+
+struct grofs_bench_samples {
+    uint64_t *ns;
+    size_t count;
+    size_t capacity;
+    uint64_t total_ns;
+    uint64_t bytes;
+    uint64_t allocs;
+};
+
+struct grofs_bench_readdir_context {
+    size_t used;
+    off_t last_offset;
+    size_t entries;
+};
+
+// Paths used by benchmarks of a single repository, filled in while generating it
+struct grofs_bench_repo {
+    const char *name;
+    char path[GROFS_BENCH_PATH_MAX];
+    char *file_paths[GROFS_BENCH_WIDE_FILES];
+    size_t file_paths_count;
+    char dir_path[GROFS_BENCH_PATH_MAX];
+    char read_path[GROFS_BENCH_PATH_MAX];
+    int list_commits;
+    int list_blobs;
+    int read_versions; // file_paths are versions of one file, all of them are read and memory they take is reported
+    unsigned int chunk_min_kb; // passed to grofs as is, 0 caches blobs whole
+};
+
+typedef int (*grofs_bench_op)(struct grofs_bench_repo *repo, size_t i, uint64_t *bytes);
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static atomic_size_t grofs_bench_allocs;
+
+// Executable's definitions take precedence over glibc's, for libgit2 as well
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&grofs_bench_allocs, 1, memory_order_relaxed);
+
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&grofs_bench_allocs, 1, memory_order_relaxed);
+
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&grofs_bench_allocs, 1, memory_order_relaxed);
+
+    return __libc_realloc(ptr, size);
+}
+
+static struct fuse_context grofs_bench_fuse_context;
+static uint64_t grofs_bench_duration_ms = GROFS_BENCH_DEFAULT_DURATION_MS;
+static size_t grofs_bench_objects = GROFS_BENCH_DEFAULT_OBJECTS;
+static uint64_t grofs_bench_seed = 0x9e3779b97f4a7c15ULL;
+
+// Handlers run outside of a FUSE session so context is a static one
+struct fuse_context *fuse_get_context(void) {
+    return &grofs_bench_fuse_context;
+}
+
+static uint64_t grofs_bench_now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static uint64_t grofs_bench_random(void) {
+    grofs_bench_seed ^= grofs_bench_seed << 13;
+    grofs_bench_seed ^= grofs_bench_seed >> 7;
+    grofs_bench_seed ^= grofs_bench_seed << 17;
+
+    return grofs_bench_seed;
+}
+
+static void grofs_bench_fill_random(char *buff, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        buff[i] = 'a' + grofs_bench_random() % 26;
+    }
+}
+
+static int grofs_bench_samples_add(struct grofs_bench_samples *samples, uint64_t ns) {
+    if (samples->count == samples->capacity) {
+        size_t capacity = 0 == samples->capacity ? 1024 : samples->capacity * 2;
+
+        uint64_t *ns_list = (uint64_t *) realloc(samples->ns, capacity * sizeof(uint64_t));
+
+        if (NULL == ns_list) {
+            return ENOMEM;
+        }
+
+        samples->ns = ns_list;
+        samples->capacity = capacity;
+    }
+
+    samples->ns[samples->count++] = ns;
+    samples->total_ns += ns;
+
+    return 0;
+}
+
+static int grofs_bench_compare_ns(const void *a, const void *b) {
+    uint64_t left = *(const uint64_t *) a;
+    uint64_t right = *(const uint64_t *) b;
+
+    return left < right ? -1 : left > right;
+}
+
+static void grofs_bench_report(const struct grofs_bench_repo *repo, const char *op, struct grofs_bench_samples *samples, int errors) {
+    qsort(samples->ns, samples->count, sizeof(uint64_t), grofs_bench_compare_ns);
+
+    double seconds = samples->total_ns / 1e9;
+
+    printf(
+        "{\"repo\":\"%s\",\"op\":\"%s\",\"iterations\":%zu,\"errors\":%d,\"ops_per_sec\":%.1f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f,\"bytes_per_sec\":%.0f,\"allocs_per_op\":%.2f}\n",
+        repo->name,
+        op,
+        samples->count,
+        errors,
+        samples->count / seconds,
+        samples->ns[samples->count / 2] / 1e3,
+        samples->ns[samples->count * 99 / 100] / 1e3,
+        samples->ns[samples->count - 1] / 1e3,
+        samples->bytes / seconds,
+        (double) samples->allocs / samples->count
+    );
+
+    fflush(stdout);
+}
+
+static void grofs_bench_run(struct grofs_bench_repo *repo, const char *op_name, grofs_bench_op op) {
+    struct grofs_bench_samples samples = { NULL, 0, 0, 0, 0, 0 };
+
+    int errors = 0;
+
+    uint64_t deadline = grofs_bench_now_ns() + grofs_bench_duration_ms * 1000000ULL;
+
+    size_t i;
+
+    for (i = 0; i < GROFS_BENCH_MAX_ITERATIONS; i++) {
+        size_t allocs = atomic_load_explicit(&grofs_bench_allocs, memory_order_relaxed);
+
+        uint64_t started = grofs_bench_now_ns();
+
+        if (0 != op(repo, i, &samples.bytes)) {
+            errors++;
+        }
+
+        uint64_t finished = grofs_bench_now_ns();
+
+        // background threads allocate too, they're idle once the repository is warmed up
+        samples.allocs += atomic_load_explicit(&grofs_bench_allocs, memory_order_relaxed) - allocs;
+
+        if (0 != grofs_bench_samples_add(&samples, finished - started)) {
+            break;
+        }
+
+        if (i >= GROFS_BENCH_MIN_ITERATIONS && finished >= deadline) {
+            break;
+        }
+    }
+
+    if (samples.count > 0) {
+        grofs_bench_report(repo, op_name, &samples, errors);
+    }
+
+    free(samples.ns);
+}
+
+static const char *grofs_bench_file_path(struct grofs_bench_repo *repo, size_t i) {
+    return repo->file_paths[i % repo->file_paths_count];
+}
+
+static int grofs_bench_op_parse_path(struct grofs_bench_repo *repo, size_t i, uint64_t *bytes) {
+    (void) bytes;
+
+    struct grofs_path_storage path_storage;
+    struct grofs_path_spec path_spec;
+
+    int ret = grofs_parse_path(&path_spec, &path_storage, grofs_bench_file_path(repo, i));
+
+    if (0 == ret) {
+        grofs_free_path_spec(&path_spec);
+    }
+
+    return ret;
+}
+
+static int grofs_bench_op_resolve(struct grofs_bench_repo *repo, size_t i, uint64_t *bytes) {
+    (void) bytes;
+
+    struct grofs_node node;
+
+    return grofs_node_init_from_path(grofs_fs, &node, grofs_bench_file_path(repo, i));
+}
+
+static int grofs_bench_op_getattr(struct grofs_bench_repo *repo, size_t i, uint64_t *bytes) {
+    (void) bytes;
+
+    struct stat stat;
+
+    return grofs_fuse_operations.getattr(grofs_bench_file_path(repo, i), &stat);
+}
+
+static int grofs_bench_readdir_filler(void *buffer, const char *name, const struct stat *stat, off_t offset) {
+    (void) stat;
+
+    struct grofs_bench_readdir_context *context = (struct grofs_bench_readdir_context *) buffer;
+
+    size_t entry_len = (24 + strlen(name) + 7) & ~((size_t) 7);
+
+    if (context->used + entry_len > GROFS_BENCH_READDIR_BUFF) {
+        return 1;
+    }
+
+    context->used += entry_len;
+    context->last_offset = offset;
+    context->entries++;
+
+    return 0;
+}
+
+// Full listing the way kernel does it, a buffer at a time continuing from last accepted offset
+static int grofs_bench_op_readdir(struct grofs_bench_repo *repo, size_t i, uint64_t *bytes) {
+    (void) i;
+
+    const char *path = repo->list_commits ? "/" GROFS_STR_COMMITS : repo->list_blobs ? "/" GROFS_STR_BLOBS : repo->dir_path;
+
+    struct fuse_file_info file_info;
+
+    memset(&file_info, 0, sizeof(struct fuse_file_info));
+
+    int ret = grofs_fuse_operations.opendir(path, &file_info);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    struct grofs_bench_readdir_context context = { 0, 0, 0 };
+
+    do {
+        size_t entries = context.entries;
+
+        context.used = 0;
+
+        ret = grofs_fuse_operations.readdir(path, &context, grofs_bench_readdir_filler, context.last_offset, &file_info);
+
+        if (0 != ret || entries == context.entries) {
+            break;
+        }
+
+        *bytes += context.used;
+    } while (1);
+
+    grofs_fuse_operations.releasedir(path, &file_info);
+
+    return ret;
+}
+
+static int grofs_bench_read_file(const char *path, uint64_t *bytes) {
+    static char buff[GROFS_BENCH_READ_CHUNK];
+
+    struct fuse_file_info file_info;
+
+    memset(&file_info, 0, sizeof(struct fuse_file_info));
+
+    int ret = grofs_fuse_operations.open(path, &file_info);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    off_t offset = 0;
+
+    while ((ret = grofs_fuse_operations.read(path, buff, GROFS_BENCH_READ_CHUNK, offset, &file_info)) > 0) {
+        offset += ret;
+    }
+
+    *bytes += offset;
+
+    grofs_fuse_operations.release(path, &file_info);
+
+    return ret < 0 ? ret : 0;
+}
+
+static int grofs_bench_op_read(struct grofs_bench_repo *repo, size_t i, uint64_t *bytes) {
+    (void) i;
+
+    return grofs_bench_read_file(repo->read_path, bytes);
+}
+
+static int grofs_bench_op_read_versions(struct grofs_bench_repo *repo, size_t i, uint64_t *bytes) {
+    return grofs_bench_read_file(grofs_bench_file_path(repo, i), bytes);
+}
+
+static int grofs_bench_add_file_path(struct grofs_bench_repo *repo, const char *fmt, ...) {
+    if (repo->file_paths_count == GROFS_BENCH_WIDE_FILES) {
+        return 0;
+    }
+
+    va_list args;
+
+    va_start(args, fmt);
+
+    int ret = vasprintf(repo->file_paths + repo->file_paths_count, fmt, args);
+
+    va_end(args);
+
+    if (ret < 0) {
+        return ENOMEM;
+    }
+
+    repo->file_paths_count++;
+
+    return 0;
+}
+
+static int grofs_bench_insert_blob(git_repository *repo, git_treebuilder *builder, const char *name, const char *data, size_t len) {
+    git_oid oid;
+
+    if (0 != git_blob_create_from_buffer(&oid, repo, data, len)) {
+        return EIO;
+    }
+
+    if (0 != git_treebuilder_insert(NULL, builder, name, &oid, GIT_FILEMODE_BLOB)) {
+        return EIO;
+    }
+
+    return 0;
+}
+
+static int grofs_bench_commit(git_repository *repo, git_oid *commit_oid, const git_oid *tree_oid, const git_oid *parent_oid, git_time_t time) {
+    git_signature *signature;
+    git_tree *tree;
+    git_commit *parent = NULL;
+
+    if (0 != git_signature_new(&signature, "grofs bench", "bench@grofs", time, 0)) {
+        return EIO;
+    }
+
+    if (0 != git_tree_lookup(&tree, repo, tree_oid)) {
+        git_signature_free(signature);
+
+        return EIO;
+    }
+
+    if (NULL != parent_oid && 0 != git_commit_lookup(&parent, repo, parent_oid)) {
+        git_tree_free(tree);
+        git_signature_free(signature);
+
+        return EIO;
+    }
+
+    const git_commit *parents[1] = { parent };
+
+    int ret = git_commit_create(commit_oid, repo, NULL, signature, signature, NULL, "bench", tree, NULL == parent ? 0 : 1, parents);
+
+    git_commit_free(parent);
+    git_tree_free(tree);
+    git_signature_free(signature);
+
+    return 0 == ret ? 0 : EIO;
+}
+
+static int grofs_bench_generate_wide(git_repository *git_repo, struct grofs_bench_repo *repo) {
+    git_treebuilder *builder;
+
+    if (0 != git_treebuilder_new(&builder, git_repo, NULL)) {
+        return EIO;
+    }
+
+    char name[64];
+    char data[128];
+
+    int ret = 0;
+
+    int i;
+
+    for (i = 0; i < GROFS_BENCH_WIDE_FILES && 0 == ret; i++) {
+        snprintf(name, sizeof(name), "file-%05d.txt", i);
+
+        grofs_bench_fill_random(data, sizeof(data));
+
+        ret = grofs_bench_insert_blob(git_repo, builder, name, data, sizeof(data));
+    }
+
+    git_oid tree_oid;
+    git_oid commit_oid;
+
+    if (0 == ret && 0 != git_treebuilder_write(&tree_oid, builder)) {
+        ret = EIO;
+    }
+
+    git_treebuilder_free(builder);
+
+    if (0 == ret) {
+        ret = grofs_bench_commit(git_repo, &commit_oid, &tree_oid, NULL, 1500000000);
+    }
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    const char *sha = git_oid_tostr_s(&commit_oid);
+
+    for (i = 0; i < GROFS_BENCH_WIDE_FILES && 0 == ret; i++) {
+        ret = grofs_bench_add_file_path(repo, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE "/file-%05d.txt", sha, (int) (grofs_bench_random() % GROFS_BENCH_WIDE_FILES));
+    }
+
+    snprintf(repo->dir_path, GROFS_BENCH_PATH_MAX, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE, sha);
+    snprintf(repo->read_path, GROFS_BENCH_PATH_MAX, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE "/file-00000.txt", sha);
+
+    return ret;
+}
+
+// Nested trees built bottom up, every level also has a few files next to the sub tree
+static int grofs_bench_generate_deep(git_repository *git_repo, struct grofs_bench_repo *repo) {
+    git_oid tree_oid;
+    char name[64];
+    char data[256];
+
+    int has_sub_tree = 0;
+
+    int level;
+
+    for (level = GROFS_BENCH_DEEP_LEVELS - 1; level >= 0; level--) {
+        git_treebuilder *builder;
+
+        if (0 != git_treebuilder_new(&builder, git_repo, NULL)) {
+            return EIO;
+        }
+
+        int ret = 0;
+
+        int i;
+
+        for (i = 0; i < GROFS_BENCH_DEEP_SIBLINGS && 0 == ret; i++) {
+            snprintf(name, sizeof(name), "file-%d-%d.txt", level, i);
+
+            grofs_bench_fill_random(data, sizeof(data));
+
+            ret = grofs_bench_insert_blob(git_repo, builder, name, data, sizeof(data));
+        }
+
+        if (0 == ret && has_sub_tree) {
+            snprintf(name, sizeof(name), "dir-%02d", level + 1);
+
+            if (0 != git_treebuilder_insert(NULL, builder, name, &tree_oid, GIT_FILEMODE_TREE)) {
+                ret = EIO;
+            }
+        }
+
+        if (0 == ret && 0 != git_treebuilder_write(&tree_oid, builder)) {
+            ret = EIO;
+        }
+
+        git_treebuilder_free(builder);
+
+        if (0 != ret) {
+            return ret;
+        }
+
+        has_sub_tree = 1;
+    }
+
+    git_oid commit_oid;
+
+    int ret = grofs_bench_commit(git_repo, &commit_oid, &tree_oid, NULL, 1500000000);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    int len = snprintf(repo->dir_path, GROFS_BENCH_PATH_MAX, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE, git_oid_tostr_s(&commit_oid));
+
+    for (level = 1; level < GROFS_BENCH_DEEP_LEVELS; level++) {
+        len += snprintf(repo->dir_path + len, GROFS_BENCH_PATH_MAX - len, "/dir-%02d", level);
+    }
+
+    snprintf(repo->read_path, GROFS_BENCH_PATH_MAX, "%.4000s/file-%d-0.txt", repo->dir_path, GROFS_BENCH_DEEP_LEVELS - 1);
+
+    int i;
+
+    for (i = 0; i < GROFS_BENCH_DEEP_SIBLINGS && 0 == ret; i++) {
+        ret = grofs_bench_add_file_path(repo, "%s/file-%d-%d.txt", repo->dir_path, GROFS_BENCH_DEEP_LEVELS - 1, i);
+    }
+
+    return ret;
+}
+
+static int grofs_bench_generate_large(git_repository *git_repo, struct grofs_bench_repo *repo) {
+    char *data = (char *) malloc(GROFS_BENCH_LARGE_BLOB_SIZE);
+
+    if (NULL == data) {
+        return ENOMEM;
+    }
+
+    git_treebuilder *builder;
+
+    if (0 != git_treebuilder_new(&builder, git_repo, NULL)) {
+        free(data);
+
+        return EIO;
+    }
+
+    char name[64];
+
+    int ret = 0;
+
+    int i;
+
+    for (i = 0; i < GROFS_BENCH_LARGE_BLOBS && 0 == ret; i++) {
+        snprintf(name, sizeof(name), "large-%d.bin", i);
+
+        grofs_bench_fill_random(data, GROFS_BENCH_LARGE_BLOB_SIZE);
+
+        ret = grofs_bench_insert_blob(git_repo, builder, name, data, GROFS_BENCH_LARGE_BLOB_SIZE);
+    }
+
+    free(data);
+
+    git_oid tree_oid;
+    git_oid commit_oid;
+
+    if (0 == ret && 0 != git_treebuilder_write(&tree_oid, builder)) {
+        ret = EIO;
+    }
+
+    git_treebuilder_free(builder);
+
+    if (0 == ret) {
+        ret = grofs_bench_commit(git_repo, &commit_oid, &tree_oid, NULL, 1500000000);
+    }
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    const char *sha = git_oid_tostr_s(&commit_oid);
+
+    for (i = 0; i < GROFS_BENCH_LARGE_BLOBS && 0 == ret; i++) {
+        ret = grofs_bench_add_file_path(repo, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE "/large-%d.bin", sha, i);
+    }
+
+    snprintf(repo->dir_path, GROFS_BENCH_PATH_MAX, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE, sha);
+    snprintf(repo->read_path, GROFS_BENCH_PATH_MAX, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE "/large-0.bin", sha);
+
+    return ret;
+}
+
+// Linear history where each commit changes one of a few files
+static int grofs_bench_generate_history(git_repository *git_repo, struct grofs_bench_repo *repo) {
+    git_oid tree_oid;
+    git_oid commit_oid;
+    git_oid *commit_oids = (git_oid *) malloc(GROFS_BENCH_HISTORY_COMMITS * sizeof(git_oid));
+
+    if (NULL == commit_oids) {
+        return ENOMEM;
+    }
+
+    char name[64];
+    char data[512];
+
+    int ret = 0;
+
+    int i;
+
+    for (i = 0; i < GROFS_BENCH_HISTORY_COMMITS && 0 == ret; i++) {
+        git_tree *tree = NULL;
+
+        if (i > 0 && 0 != git_tree_lookup(&tree, git_repo, &tree_oid)) {
+            ret = EIO;
+
+            break;
+        }
+
+        git_treebuilder *builder;
+
+        ret = git_treebuilder_new(&builder, git_repo, tree) ? EIO : 0;
+
+        git_tree_free(tree);
+
+        if (0 != ret) {
+            break;
+        }
+
+        int j;
+
+        // first commit adds all files, following ones change only one of them
+        for (j = 0 == i ? 0 : i % GROFS_BENCH_HISTORY_FILES; j < GROFS_BENCH_HISTORY_FILES && 0 == ret; j++) {
+            snprintf(name, sizeof(name), "file-%03d.txt", j);
+
+            grofs_bench_fill_random(data, sizeof(data));
+
+            ret = grofs_bench_insert_blob(git_repo, builder, name, data, sizeof(data));
+
+            if (i > 0) {
+                break;
+            }
+        }
+
+        if (0 == ret && 0 != git_treebuilder_write(&tree_oid, builder)) {
+            ret = EIO;
+        }
+
+        git_treebuilder_free(builder);
+
+        if (0 == ret) {
+            ret = grofs_bench_commit(git_repo, &commit_oid, &tree_oid, 0 == i ? NULL : commit_oids + i - 1, 1500000000 + i * 60);
+        }
+
+        git_oid_cpy(commit_oids + i, &commit_oid);
+    }
+
+    for (i = 0; i < GROFS_BENCH_HISTORY_COMMITS && 0 == ret; i++) {
+        const git_oid *oid = commit_oids + grofs_bench_random() % GROFS_BENCH_HISTORY_COMMITS;
+
+        ret = grofs_bench_add_file_path(repo, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE "/file-%03d.txt", git_oid_tostr_s(oid), (int) (grofs_bench_random() % GROFS_BENCH_HISTORY_FILES));
+    }
+
+    snprintf(repo->read_path, GROFS_BENCH_PATH_MAX, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_PARENT, git_oid_tostr_s(&commit_oid));
+
+    repo->list_commits = 1;
+
+    free(commit_oids);
+
+    return ret;
+}
+
+// Versions of one large file, each with a few small edits of the previous one
+static int grofs_bench_generate_versions(git_repository *git_repo, struct grofs_bench_repo *repo) {
+    char *data = (char *) malloc(GROFS_BENCH_VERSION_SIZE);
+
+    if (NULL == data) {
+        return ENOMEM;
+    }
+
+    grofs_bench_fill_random(data, GROFS_BENCH_VERSION_SIZE);
+
+    git_oid tree_oid;
+    git_oid commit_oid;
+
+    int ret = 0;
+
+    int i;
+
+    for (i = 0; i < GROFS_BENCH_VERSIONS && 0 == ret; i++) {
+        int j;
+
+        for (j = 0; i > 0 && j < GROFS_BENCH_VERSION_EDITS; j++) {
+            grofs_bench_fill_random(data + grofs_bench_random() % (GROFS_BENCH_VERSION_SIZE - GROFS_BENCH_VERSION_EDIT_LEN), GROFS_BENCH_VERSION_EDIT_LEN);
+        }
+
+        git_treebuilder *builder;
+
+        if (0 != git_treebuilder_new(&builder, git_repo, NULL)) {
+            ret = EIO;
+
+            break;
+        }
+
+        ret = grofs_bench_insert_blob(git_repo, builder, "model.bin", data, GROFS_BENCH_VERSION_SIZE);
+
+        if (0 == ret && 0 != git_treebuilder_write(&tree_oid, builder)) {
+            ret = EIO;
+        }
+
+        git_treebuilder_free(builder);
+
+        if (0 == ret) {
+            ret = grofs_bench_commit(git_repo, &commit_oid, &tree_oid, 0 == i ? NULL : &commit_oid, 1500000000 + i * 60);
+        }
+
+        if (0 == ret) {
+            ret = grofs_bench_add_file_path(repo, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE "/model.bin", git_oid_tostr_s(&commit_oid));
+        }
+    }
+
+    free(data);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    snprintf(repo->dir_path, GROFS_BENCH_PATH_MAX, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE, git_oid_tostr_s(&commit_oid));
+    snprintf(repo->read_path, GROFS_BENCH_PATH_MAX, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE "/model.bin", git_oid_tostr_s(&commit_oid));
+
+    repo->read_versions = 1;
+
+    return 0;
+}
+
+// Objects written so far go into a pack of their own, only the ones reachable from commits are dumped
+static int grofs_bench_mempack_flush(git_repository *git_repo, git_odb *odb, git_odb_backend *mempack) {
+    git_buf pack = GIT_BUF_INIT;
+    git_odb_writepack *writepack;
+    git_indexer_progress progress;
+
+    if (0 != git_mempack_dump(&pack, git_repo, mempack)) {
+        return EIO;
+    }
+
+    if (0 != git_odb_write_pack(&writepack, odb, NULL, NULL)) {
+        git_buf_dispose(&pack);
+
+        return EIO;
+    }
+
+    int ret = 0;
+
+    if (0 != writepack->append(writepack, pack.ptr, pack.size, &progress) || 0 != writepack->commit(writepack, &progress)) {
+        ret = EIO;
+    }
+
+    writepack->free(writepack);
+
+    git_buf_dispose(&pack);
+
+    if (0 == ret) {
+        git_mempack_reset(mempack);
+    }
+
+    return ret;
+}
+
+// Many small packed blobs in directories of a commit per pack, for listing of blobs/
+static int grofs_bench_generate_objects(git_repository *git_repo, struct grofs_bench_repo *repo) {
+    git_odb *odb;
+    git_odb_backend *mempack;
+
+    if (0 != git_repository_odb(&odb, git_repo)) {
+        return EIO;
+    }
+
+    // objects are kept in memory and written as packs instead of millions of loose files
+    if (0 != git_mempack_new(&mempack) || 0 != git_odb_add_backend(odb, mempack, 999)) {
+        git_odb_free(odb);
+
+        return EIO;
+    }
+
+    git_treebuilder *root = NULL;
+    git_treebuilder *dir = NULL;
+    git_oid commit_oid;
+    git_oid first_commit_oid;
+
+    char name[64];
+    char data[64];
+
+    int ret = 0;
+
+    size_t i;
+
+    for (i = 0; i < grofs_bench_objects && 0 == ret; i++) {
+        if (NULL == root && 0 != git_treebuilder_new(&root, git_repo, NULL)) {
+            ret = EIO;
+
+            break;
+        }
+
+        if (NULL == dir && 0 != git_treebuilder_new(&dir, git_repo, NULL)) {
+            ret = EIO;
+
+            break;
+        }
+
+        snprintf(name, sizeof(name), "file-%05d.txt", (int) (i % GROFS_BENCH_OBJECTS_PER_DIR));
+
+        grofs_bench_fill_random(data, sizeof(data));
+
+        ret = grofs_bench_insert_blob(git_repo, dir, name, data, sizeof(data));
+
+        int last = i + 1 == grofs_bench_objects;
+
+        if (0 == ret && (last || 0 == (i + 1) % GROFS_BENCH_OBJECTS_PER_DIR)) {
+            git_oid dir_oid;
+
+            snprintf(name, sizeof(name), "dir-%05d", (int) (i / GROFS_BENCH_OBJECTS_PER_DIR));
+
+            if (0 != git_treebuilder_write(&dir_oid, dir) || 0 != git_treebuilder_insert(NULL, root, name, &dir_oid, GIT_FILEMODE_TREE)) {
+                ret = EIO;
+            }
+
+            git_treebuilder_free(dir);
+
+            dir = NULL;
+        }
+
+        if (0 == ret && (last || 0 == (i + 1) % GROFS_BENCH_OBJECTS_PER_PACK)) {
+            git_oid tree_oid;
+
+            if (0 != git_treebuilder_write(&tree_oid, root)) {
+                ret = EIO;
+            }
+
+            git_treebuilder_free(root);
+
+            root = NULL;
+
+            if (0 == ret) {
+                ret = grofs_bench_commit(git_repo, &commit_oid, &tree_oid, i < GROFS_BENCH_OBJECTS_PER_PACK ? NULL : &commit_oid, 1500000000 + i);
+            }
+
+            if (0 == ret && i < GROFS_BENCH_OBJECTS_PER_PACK) {
+                git_oid_cpy(&first_commit_oid, &commit_oid);
+            }
+
+            if (0 == ret) {
+                ret = grofs_bench_mempack_flush(git_repo, odb, mempack);
+            }
+        }
+    }
+
+    git_treebuilder_free(dir);
+    git_treebuilder_free(root);
+    git_odb_free(odb);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    const char *sha = git_oid_tostr_s(&first_commit_oid);
+    size_t files = grofs_bench_objects < GROFS_BENCH_OBJECTS_PER_DIR ? grofs_bench_objects : GROFS_BENCH_OBJECTS_PER_DIR;
+
+    for (i = 0; i < GROFS_BENCH_WIDE_FILES && 0 == ret; i++) {
+        ret = grofs_bench_add_file_path(repo, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE "/dir-00000/file-%05d.txt", sha, (int) (grofs_bench_random() % files));
+    }
+
+    snprintf(repo->dir_path, GROFS_BENCH_PATH_MAX, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE "/dir-00000", sha);
+    snprintf(repo->read_path, GROFS_BENCH_PATH_MAX, "/" GROFS_STR_COMMITS "/%s/" GROFS_STR_TREE "/dir-00000/file-00000.txt", sha);
+
+    repo->list_blobs = 1;
+
+    return ret;
+}
+
+static int grofs_bench_generate(struct grofs_bench_repo *repo, const char *work_dir, int (*generate)(git_repository *git_repo, struct grofs_bench_repo *repo)) {
+    snprintf(repo->path, GROFS_BENCH_PATH_MAX, "%s/%s.git", work_dir, repo->name);
+
+    git_repository *git_repo;
+
+    if (0 != git_repository_init(&git_repo, repo->path, 1)) {
+        fprintf(stderr, "Failed to create repository %s: %s\n", repo->path, git_error_last()->message);
+
+        return EIO;
+    }
+
+    int ret = generate(git_repo, repo);
+
+    if (0 != ret) {
+        fprintf(stderr, "Failed to generate repository %s\n", repo->path);
+    }
+
+    git_repository_free(git_repo);
+
+    return ret;
+}
+
+// Runs in a child process so every repository starts with fresh caches and globals
+static int grofs_bench_repo_run(struct grofs_bench_repo *repo) {
+    struct grofs_options options;
+
+    grofs_options_init(&options);
+
+    options.chunk_min_kb = repo->chunk_min_kb;
+
+    if (0 != grofs_open(&grofs_fs, repo->path, &options)) {
+        return 1;
+    }
+
+    grofs_bench_fuse_context.private_data = grofs_fs;
+
+    grofs_bench_run(repo, "parse_path", grofs_bench_op_parse_path);
+    grofs_bench_run(repo, "resolve", grofs_bench_op_resolve);
+    grofs_bench_run(repo, "getattr", grofs_bench_op_getattr);
+    grofs_bench_run(repo, "readdir", grofs_bench_op_readdir);
+    grofs_bench_run(repo, "read", grofs_bench_op_read);
+
+    if (repo->read_versions) {
+        grofs_bench_run(repo, "read_versions", grofs_bench_op_read_versions);
+
+        uint64_t bytes = 0;
+
+        size_t i;
+
+        // once every version was read, this is what keeping all of them cached takes
+        for (i = 0; i < repo->file_paths_count; i++) {
+            grofs_bench_read_file(repo->file_paths[i], &bytes);
+        }
+
+        printf("{\"repo\":\"%s\",\"op\":\"cache\",\"blob_cache_bytes\":%zu,\"chunk_list_cache_bytes\":%zu}\n", repo->name, atomic_load(&grofs_blob_cache.cost), atomic_load(&grofs_chunk_list_cache.cost));
+    }
+
+    grofs_cleanup_on_exit_cb();
+
+    return 0;
+}
+
+static int grofs_bench_remove_cb(const char *path, const struct stat *stat, int flag, struct FTW *ftw) {
+    (void) stat;
+    (void) flag;
+    (void) ftw;
+
+    return remove(path);
+}
+
+int main(int argc, char **argv) {
+    struct grofs_bench_repo repos[] = {
+        { .name = "wide" },
+        { .name = "deep" },
+        { .name = "large" },
+        { .name = "history" },
+        { .name = "objects" },
+        { .name = "versions" },
+        { .name = "versions_chunked", .chunk_min_kb = GROFS_BENCH_CHUNKED_KB }
+    };
+
+    int (*generators[])(git_repository *git_repo, struct grofs_bench_repo *repo) = {
+        grofs_bench_generate_wide,
+        grofs_bench_generate_deep,
+        grofs_bench_generate_large,
+        grofs_bench_generate_history,
+        grofs_bench_generate_objects,
+        grofs_bench_generate_versions,
+        grofs_bench_generate_versions
+    };
+
+    const char *duration = getenv("GROFS_BENCH_DURATION_MS");
+
+    if (NULL != duration && atoi(duration) > 0) {
+        grofs_bench_duration_ms = atoi(duration);
+    }
+
+    const char *objects = getenv("GROFS_BENCH_OBJECTS");
+
+    if (NULL != objects && atol(objects) > 0) {
+        grofs_bench_objects = atol(objects);
+    }
+
+    char work_dir[] = "/tmp/grofs-bench-XXXXXX";
+
+    if (NULL == mkdtemp(work_dir)) {
+        fprintf(stderr, "Failed to create work directory\n");
+
+        return 1;
+    }
+
+    int ret = 0;
+
+    git_libgit2_init();
+
+    size_t i;
+
+    for (i = 0; i < sizeof(repos) / sizeof(repos[0]) && 0 == ret; i++) {
+        // only selected repositories when names are given
+        if (argc > 1) {
+            int j;
+
+            for (j = 1; j < argc && strcmp(argv[j], repos[i].name) != 0; j++);
+
+            if (j == argc) {
+                continue;
+            }
+        }
+
+        if (0 != grofs_bench_generate(repos + i, work_dir, generators[i])) {
+            ret = 1;
+
+            break;
+        }
+
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            ret = 1;
+        } else if (0 == pid) {
+            exit(grofs_bench_repo_run(repos + i));
+        } else {
+            int status;
+
+            if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || 0 != WEXITSTATUS(status)) {
+                fprintf(stderr, "Benchmark of %s repository failed\n", repos[i].name);
+
+                ret = 1;
+            }
+        }
+
+        size_t j;
+
+        for (j = 0; j < repos[i].file_paths_count; j++) {
+            free(repos[i].file_paths[j]);
+        }
+    }
+
+    git_libgit2_shutdown();
+
+    nftw(work_dir, grofs_bench_remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+
+    return ret;
+}
@@ -0,0 +1,877 @@
+// End-to-end benchmark of a mounted grofs.
+//
+// Generates a repository, mounts it with given grofs binary and replays client workloads
+// through the kernel. Every scenario runs on a fresh mount twice, first cold then warm,
+// and prints one JSON object per run to stdout.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <git2.h>
+
+#define GROFS_E2E_DIRS 64
+#define GROFS_E2E_FILES_PER_DIR 32
+#define GROFS_E2E_MIN_FILE_SIZE 256
+#define GROFS_E2E_MAX_FILE_SIZE (32 * 1024)
+#define GROFS_E2E_LARGE_BLOBS 4
+#define GROFS_E2E_LARGE_BLOB_SIZE (32 * 1024 * 1024)
+#define GROFS_E2E_READ_CHUNK (128 * 1024)
+#define GROFS_E2E_RANDOM_READ_SIZE 4096
+#define GROFS_E2E_RANDOM_READS_PER_READER 2000
+#define GROFS_E2E_DEFAULT_READERS 8
+#define GROFS_E2E_MAX_READERS 256
+#define GROFS_E2E_MOUNT_TIMEOUT_MS 10000
+
+#define GROFS_E2E_PATH_MAX 4096
+#define GROFS_E2E_WORK_PATH_MAX 256
+
+struct grofs_e2e_samples {
+    uint64_t *ns;
+    size_t count;
+    size_t capacity;
+};
+
+struct grofs_e2e_files {
+    char **paths;
+    off_t *sizes;
+    size_t count;
+    size_t capacity;
+};
+
+// Shared by all readers of a scenario, each reader keeps its own samples
+struct grofs_e2e_run {
+    const struct grofs_e2e_files *files;
+    atomic_size_t next;
+    atomic_uint_fast64_t bytes;
+    atomic_int errors;
+};
+
+struct grofs_e2e_reader {
+    pthread_t thread;
+    struct grofs_e2e_run *run;
+    struct grofs_e2e_samples samples;
+    uint64_t seed;
+};
+
+struct grofs_e2e_scenario {
+    const char *name;
+    // returns number of readers which were used
+    int (*run)(const char *tree_path, struct grofs_e2e_samples *samples, uint64_t *bytes, int *errors);
+};
+
+static const char *grofs_e2e_bin;
+static char grofs_e2e_repo_path[GROFS_E2E_WORK_PATH_MAX];
+static char grofs_e2e_mount_path[GROFS_E2E_WORK_PATH_MAX];
+static char grofs_e2e_commit_sha[GIT_OID_HEXSZ + 1];
+static int grofs_e2e_readers = GROFS_E2E_DEFAULT_READERS;
+static uint64_t grofs_e2e_seed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t grofs_e2e_now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static uint64_t grofs_e2e_random(uint64_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+
+    return *seed;
+}
+
+static int grofs_e2e_samples_add(struct grofs_e2e_samples *samples, uint64_t ns) {
+    if (samples->count == samples->capacity) {
+        size_t capacity = 0 == samples->capacity ? 1024 : samples->capacity * 2;
+
+        uint64_t *ns_list = (uint64_t *) realloc(samples->ns, capacity * sizeof(uint64_t));
+
+        if (NULL == ns_list) {
+            return ENOMEM;
+        }
+
+        samples->ns = ns_list;
+        samples->capacity = capacity;
+    }
+
+    samples->ns[samples->count++] = ns;
+
+    return 0;
+}
+
+static int grofs_e2e_samples_merge(struct grofs_e2e_samples *samples, const struct grofs_e2e_samples *other) {
+    size_t i;
+
+    for (i = 0; i < other->count; i++) {
+        if (0 != grofs_e2e_samples_add(samples, other->ns[i])) {
+            return ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+static int grofs_e2e_compare_ns(const void *a, const void *b) {
+    uint64_t left = *(const uint64_t *) a;
+    uint64_t right = *(const uint64_t *) b;
+
+    return left < right ? -1 : left > right;
+}
+
+static int grofs_e2e_files_add(struct grofs_e2e_files *files, const char *path, off_t size) {
+    if (files->count == files->capacity) {
+        size_t capacity = 0 == files->capacity ? 256 : files->capacity * 2;
+
+        char **paths = (char **) realloc(files->paths, capacity * sizeof(char *));
+
+        if (NULL == paths) {
+            return ENOMEM;
+        }
+
+        files->paths = paths;
+
+        off_t *sizes = (off_t *) realloc(files->sizes, capacity * sizeof(off_t));
+
+        if (NULL == sizes) {
+            return ENOMEM;
+        }
+
+        files->sizes = sizes;
+        files->capacity = capacity;
+    }
+
+    files->paths[files->count] = strdup(path);
+
+    if (NULL == files->paths[files->count]) {
+        return ENOMEM;
+    }
+
+    files->sizes[files->count++] = size;
+
+    return 0;
+}
+
+static void grofs_e2e_files_free(struct grofs_e2e_files *files) {
+    size_t i;
+
+    for (i = 0; i < files->count; i++) {
+        free(files->paths[i]);
+    }
+
+    free(files->paths);
+    free(files->sizes);
+
+    memset(files, 0, sizeof(struct grofs_e2e_files));
+}
+
+// Same as find -type f, listing is not measured
+static int grofs_e2e_files_collect(struct grofs_e2e_files *files, const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+
+    if (NULL == dir) {
+        return errno;
+    }
+
+    char path[GROFS_E2E_PATH_MAX];
+
+    int ret = 0;
+
+    struct dirent *entry;
+
+    while (0 == ret && NULL != (entry = readdir(dir))) {
+        if (0 == strcmp(entry->d_name, ".") || 0 == strcmp(entry->d_name, "..")) {
+            continue;
+        }
+
+        snprintf(path, GROFS_E2E_PATH_MAX, "%s/%s", dir_path, entry->d_name);
+
+        struct stat stat;
+
+        if (0 != lstat(path, &stat)) {
+            ret = errno;
+        } else if (S_ISDIR(stat.st_mode)) {
+            ret = grofs_e2e_files_collect(files, path);
+        } else {
+            ret = grofs_e2e_files_add(files, path, stat.st_size);
+        }
+    }
+
+    closedir(dir);
+
+    return ret;
+}
+
+static int grofs_e2e_insert_blob(git_repository *repo, git_treebuilder *builder, const char *name, const char *data, size_t len) {
+    git_oid oid;
+
+    if (0 != git_blob_create_from_buffer(&oid, repo, data, len)) {
+        return EIO;
+    }
+
+    if (0 != git_treebuilder_insert(NULL, builder, name, &oid, GIT_FILEMODE_BLOB)) {
+        return EIO;
+    }
+
+    return 0;
+}
+
+static int grofs_e2e_insert_tree(git_treebuilder *builder, const char *name, git_treebuilder *sub_builder) {
+    git_oid oid;
+
+    if (0 != git_treebuilder_write(&oid, sub_builder)) {
+        return EIO;
+    }
+
+    if (0 != git_treebuilder_insert(NULL, builder, name, &oid, GIT_FILEMODE_TREE)) {
+        return EIO;
+    }
+
+    return 0;
+}
+
+static int grofs_e2e_fill_src(git_repository *repo, git_treebuilder *src_builder, char *data) {
+    char name[64];
+
+    int ret = 0;
+
+    int i;
+
+    for (i = 0; i < GROFS_E2E_DIRS && 0 == ret; i++) {
+        git_treebuilder *dir_builder;
+
+        if (0 != git_treebuilder_new(&dir_builder, repo, NULL)) {
+            return EIO;
+        }
+
+        int j;
+
+        for (j = 0; j < GROFS_E2E_FILES_PER_DIR && 0 == ret; j++) {
+            size_t len = GROFS_E2E_MIN_FILE_SIZE + grofs_e2e_random(&grofs_e2e_seed) % (GROFS_E2E_MAX_FILE_SIZE - GROFS_E2E_MIN_FILE_SIZE);
+
+            size_t k;
+
+            for (k = 0; k < len; k++) {
+                data[k] = 'a' + grofs_e2e_random(&grofs_e2e_seed) % 26;
+            }
+
+            snprintf(name, sizeof(name), "file-%02d.c", j);
+
+            ret = grofs_e2e_insert_blob(repo, dir_builder, name, data, len);
+        }
+
+        snprintf(name, sizeof(name), "dir-%02d", i);
+
+        if (0 == ret) {
+            ret = grofs_e2e_insert_tree(src_builder, name, dir_builder);
+        }
+
+        git_treebuilder_free(dir_builder);
+    }
+
+    return ret;
+}
+
+static int grofs_e2e_fill_large(git_repository *repo, git_treebuilder *large_builder, char *data) {
+    char name[64];
+
+    int ret = 0;
+
+    int i;
+
+    for (i = 0; i < GROFS_E2E_LARGE_BLOBS && 0 == ret; i++) {
+        size_t k;
+
+        for (k = 0; k < GROFS_E2E_LARGE_BLOB_SIZE; k++) {
+            data[k] = 'a' + grofs_e2e_random(&grofs_e2e_seed) % 26;
+        }
+
+        snprintf(name, sizeof(name), "large-%d.bin", i);
+
+        ret = grofs_e2e_insert_blob(repo, large_builder, name, data, GROFS_E2E_LARGE_BLOB_SIZE);
+    }
+
+    return ret;
+}
+
+// One commit with src/ holding many small files in a few directories and large/ holding big blobs
+static int grofs_e2e_generate(const char *repo_path) {
+    git_repository *repo;
+
+    if (0 != git_repository_init(&repo, repo_path, 1)) {
+        return EIO;
+    }
+
+    char *data = (char *) malloc(GROFS_E2E_LARGE_BLOB_SIZE);
+
+    git_treebuilder *root_builder = NULL;
+    git_treebuilder *src_builder = NULL;
+    git_treebuilder *large_builder = NULL;
+
+    int ret = NULL == data ? ENOMEM : 0;
+
+    if (
+        0 == ret
+        && (
+            0 != git_treebuilder_new(&root_builder, repo, NULL)
+            || 0 != git_treebuilder_new(&src_builder, repo, NULL)
+            || 0 != git_treebuilder_new(&large_builder, repo, NULL)
+        )
+    ) {
+        ret = EIO;
+    }
+
+    if (0 == ret) {
+        ret = grofs_e2e_fill_src(repo, src_builder, data);
+    }
+
+    if (0 == ret) {
+        ret = grofs_e2e_fill_large(repo, large_builder, data);
+    }
+
+    if (0 == ret) {
+        ret = grofs_e2e_insert_tree(root_builder, "src", src_builder);
+    }
+
+    if (0 == ret) {
+        ret = grofs_e2e_insert_tree(root_builder, "large", large_builder);
+    }
+
+    git_oid tree_oid;
+    git_oid commit_oid;
+    git_tree *tree = NULL;
+    git_signature *signature = NULL;
+
+    if (0 == ret && 0 != git_treebuilder_write(&tree_oid, root_builder)) {
+        ret = EIO;
+    }
+
+    if (0 == ret && 0 != git_tree_lookup(&tree, repo, &tree_oid)) {
+        ret = EIO;
+    }
+
+    if (0 == ret && 0 != git_signature_new(&signature, "grofs bench", "bench@grofs", 1500000000, 0)) {
+        ret = EIO;
+    }
+
+    if (0 == ret && 0 != git_commit_create(&commit_oid, repo, "HEAD", signature, signature, NULL, "bench", tree, 0, NULL)) {
+        ret = EIO;
+    }
+
+    if (0 == ret) {
+        git_oid_tostr(grofs_e2e_commit_sha, sizeof(grofs_e2e_commit_sha), &commit_oid);
+    }
+
+    git_signature_free(signature);
+    git_tree_free(tree);
+    git_treebuilder_free(large_builder);
+    git_treebuilder_free(src_builder);
+    git_treebuilder_free(root_builder);
+    git_repository_free(repo);
+
+    free(data);
+
+    return ret;
+}
+
+static pid_t grofs_e2e_mount(void) {
+    struct stat parent_stat;
+
+    char parent_path[GROFS_E2E_PATH_MAX];
+
+    snprintf(parent_path, GROFS_E2E_PATH_MAX, "%s/..", grofs_e2e_mount_path);
+
+    if (0 != stat(parent_path, &parent_stat)) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        return -1;
+    }
+
+    if (0 == pid) {
+        execl(grofs_e2e_bin, grofs_e2e_bin, grofs_e2e_repo_path, grofs_e2e_mount_path, "-f", (char *) NULL);
+
+        fprintf(stderr, "Failed to run %s: %s\n", grofs_e2e_bin, strerror(errno));
+
+        _exit(127);
+    }
+
+    uint64_t deadline = grofs_e2e_now_ns() + GROFS_E2E_MOUNT_TIMEOUT_MS * 1000000ULL;
+
+    // mounted once mount point is on a different device than its parent
+    while (grofs_e2e_now_ns() < deadline) {
+        struct stat mount_stat;
+
+        if (0 == stat(grofs_e2e_mount_path, &mount_stat) && mount_stat.st_dev != parent_stat.st_dev) {
+            return pid;
+        }
+
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return -1;
+        }
+
+        usleep(10000);
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+}
+
+// grofs runs in foreground so SIGTERM makes it unmount and exit
+static void grofs_e2e_unmount(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+static int grofs_e2e_join_readers(struct grofs_e2e_reader *readers, int count, struct grofs_e2e_samples *samples) {
+    int ret = 0;
+
+    int i;
+
+    for (i = 0; i < count; i++) {
+        pthread_join(readers[i].thread, NULL);
+
+        if (0 == ret) {
+            ret = grofs_e2e_samples_merge(samples, &readers[i].samples);
+        }
+
+        free(readers[i].samples.ns);
+    }
+
+    return ret;
+}
+
+static int grofs_e2e_start_readers(struct grofs_e2e_reader *readers, struct grofs_e2e_run *run, void *(*reader_thread)(void *)) {
+    int i;
+
+    for (i = 0; i < grofs_e2e_readers; i++) {
+        memset(readers + i, 0, sizeof(struct grofs_e2e_reader));
+
+        readers[i].run = run;
+        readers[i].seed = grofs_e2e_seed + i * 7919;
+
+        if (0 != pthread_create(&readers[i].thread, NULL, reader_thread, readers + i)) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+// find -type f | xargs stat
+static int grofs_e2e_scenario_find_stat(const char *tree_path, struct grofs_e2e_samples *samples, uint64_t *bytes, int *errors) {
+    (void) bytes;
+
+    struct grofs_e2e_files files = { NULL, NULL, 0, 0 };
+
+    if (0 != grofs_e2e_files_collect(&files, tree_path)) {
+        (*errors)++;
+    }
+
+    size_t i;
+
+    for (i = 0; i < files.count; i++) {
+        struct stat stat_buff;
+
+        uint64_t started = grofs_e2e_now_ns();
+
+        if (0 != stat(files.paths[i], &stat_buff)) {
+            (*errors)++;
+        }
+
+        grofs_e2e_samples_add(samples, grofs_e2e_now_ns() - started);
+    }
+
+    grofs_e2e_files_free(&files);
+
+    return 1;
+}
+
+// ls -lR, each listing and each lstat is one operation
+static void grofs_e2e_ls_recursive(const char *dir_path, struct grofs_e2e_samples *samples, uint64_t *bytes, int *errors) {
+    char (*names)[256] = NULL;
+    size_t names_count = 0;
+
+    uint64_t started = grofs_e2e_now_ns();
+
+    DIR *dir = opendir(dir_path);
+
+    if (NULL == dir) {
+        (*errors)++;
+
+        return ;
+    }
+
+    struct dirent *entry;
+
+    while (NULL != (entry = readdir(dir))) {
+        if (0 == strcmp(entry->d_name, ".") || 0 == strcmp(entry->d_name, "..")) {
+            continue;
+        }
+
+        char (*new_names)[256] = realloc(names, (names_count + 1) * sizeof(*names));
+
+        if (NULL == new_names) {
+            (*errors)++;
+
+            break;
+        }
+
+        names = new_names;
+
+        snprintf(names[names_count++], 256, "%s", entry->d_name);
+
+        *bytes += strlen(entry->d_name);
+    }
+
+    closedir(dir);
+
+    grofs_e2e_samples_add(samples, grofs_e2e_now_ns() - started);
+
+    char path[GROFS_E2E_PATH_MAX];
+
+    size_t i;
+
+    for (i = 0; i < names_count; i++) {
+        snprintf(path, GROFS_E2E_PATH_MAX, "%s/%s", dir_path, names[i]);
+
+        struct stat stat;
+
+        started = grofs_e2e_now_ns();
+
+        int ret = lstat(path, &stat);
+
+        grofs_e2e_samples_add(samples, grofs_e2e_now_ns() - started);
+
+        if (0 != ret) {
+            (*errors)++;
+        } else if (S_ISDIR(stat.st_mode)) {
+            grofs_e2e_ls_recursive(path, samples, bytes, errors);
+        }
+    }
+
+    free(names);
+}
+
+static int grofs_e2e_scenario_ls_lr(const char *tree_path, struct grofs_e2e_samples *samples, uint64_t *bytes, int *errors) {
+    grofs_e2e_ls_recursive(tree_path, samples, bytes, errors);
+
+    return 1;
+}
+
+static void *grofs_e2e_cat_thread(void *data) {
+    struct grofs_e2e_reader *reader = (struct grofs_e2e_reader *) data;
+    struct grofs_e2e_run *run = reader->run;
+
+    char *buff = (char *) malloc(GROFS_E2E_READ_CHUNK);
+
+    if (NULL == buff) {
+        atomic_fetch_add(&run->errors, 1);
+
+        return NULL;
+    }
+
+    size_t i;
+
+    while ((i = atomic_fetch_add(&run->next, 1)) < run->files->count) {
+        uint64_t started = grofs_e2e_now_ns();
+
+        int fd = open(run->files->paths[i], O_RDONLY);
+
+        if (fd < 0) {
+            atomic_fetch_add(&run->errors, 1);
+
+            continue;
+        }
+
+        ssize_t len;
+
+        while ((len = read(fd, buff, GROFS_E2E_READ_CHUNK)) > 0) {
+            atomic_fetch_add(&run->bytes, len);
+        }
+
+        if (len < 0) {
+            atomic_fetch_add(&run->errors, 1);
+        }
+
+        close(fd);
+
+        grofs_e2e_samples_add(&reader->samples, grofs_e2e_now_ns() - started);
+    }
+
+    free(buff);
+
+    return NULL;
+}
+
+// Readers cat whole tree in parallel, each file is one operation
+static int grofs_e2e_scenario_parallel_cat(const char *tree_path, struct grofs_e2e_samples *samples, uint64_t *bytes, int *errors) {
+    struct grofs_e2e_files files = { NULL, NULL, 0, 0 };
+
+    if (0 != grofs_e2e_files_collect(&files, tree_path)) {
+        (*errors)++;
+    }
+
+    struct grofs_e2e_run run = { .files = &files };
+
+    struct grofs_e2e_reader readers[GROFS_E2E_MAX_READERS];
+
+    int count = grofs_e2e_start_readers(readers, &run, grofs_e2e_cat_thread);
+
+    grofs_e2e_join_readers(readers, count, samples);
+
+    *bytes += atomic_load(&run.bytes);
+    *errors += atomic_load(&run.errors);
+
+    grofs_e2e_files_free(&files);
+
+    return count;
+}
+
+static void *grofs_e2e_random_read_thread(void *data) {
+    struct grofs_e2e_reader *reader = (struct grofs_e2e_reader *) data;
+    struct grofs_e2e_run *run = reader->run;
+
+    int fds[GROFS_E2E_LARGE_BLOBS];
+
+    size_t i;
+
+    for (i = 0; i < run->files->count && i < GROFS_E2E_LARGE_BLOBS; i++) {
+        fds[i] = open(run->files->paths[i], O_RDONLY);
+
+        if (fds[i] < 0) {
+            atomic_fetch_add(&run->errors, 1);
+
+            while (i-- > 0) {
+                close(fds[i]);
+            }
+
+            return NULL;
+        }
+    }
+
+    size_t fds_count = i;
+
+    char buff[GROFS_E2E_RANDOM_READ_SIZE];
+
+    int j;
+
+    for (j = 0; j < GROFS_E2E_RANDOM_READS_PER_READER && fds_count > 0; j++) {
+        size_t file = grofs_e2e_random(&reader->seed) % fds_count;
+
+        off_t offset = grofs_e2e_random(&reader->seed) % (run->files->sizes[file] - GROFS_E2E_RANDOM_READ_SIZE);
+
+        uint64_t started = grofs_e2e_now_ns();
+
+        ssize_t len = pread(fds[file], buff, GROFS_E2E_RANDOM_READ_SIZE, offset);
+
+        grofs_e2e_samples_add(&reader->samples, grofs_e2e_now_ns() - started);
+
+        if (len < 0) {
+            atomic_fetch_add(&run->errors, 1);
+        } else {
+            atomic_fetch_add(&run->bytes, len);
+        }
+    }
+
+    for (i = 0; i < fds_count; i++) {
+        close(fds[i]);
+    }
+
+    return NULL;
+}
+
+// Readers pread small chunks at random offsets of large blobs
+static int grofs_e2e_scenario_random_read(const char *tree_path, struct grofs_e2e_samples *samples, uint64_t *bytes, int *errors) {
+    char large_path[GROFS_E2E_PATH_MAX];
+
+    snprintf(large_path, GROFS_E2E_PATH_MAX, "%s/large", tree_path);
+
+    struct grofs_e2e_files files = { NULL, NULL, 0, 0 };
+
+    if (0 != grofs_e2e_files_collect(&files, large_path) || 0 == files.count) {
+        (*errors)++;
+
+        grofs_e2e_files_free(&files);
+
+        return 0;
+    }
+
+    struct grofs_e2e_run run = { .files = &files };
+
+    struct grofs_e2e_reader readers[GROFS_E2E_MAX_READERS];
+
+    int count = grofs_e2e_start_readers(readers, &run, grofs_e2e_random_read_thread);
+
+    grofs_e2e_join_readers(readers, count, samples);
+
+    *bytes += atomic_load(&run.bytes);
+    *errors += atomic_load(&run.errors);
+
+    grofs_e2e_files_free(&files);
+
+    return count;
+}
+
+static void grofs_e2e_report(const char *scenario, const char *cache, int readers, struct grofs_e2e_samples *samples, uint64_t bytes, int errors, uint64_t elapsed_ns) {
+    double seconds = elapsed_ns / 1e9;
+
+    if (0 == samples->count) {
+        printf("{\"scenario\":\"%s\",\"cache\":\"%s\",\"readers\":%d,\"ops\":0,\"errors\":%d}\n", scenario, cache, readers, errors);
+
+        return ;
+    }
+
+    qsort(samples->ns, samples->count, sizeof(uint64_t), grofs_e2e_compare_ns);
+
+    printf(
+        "{\"scenario\":\"%s\",\"cache\":\"%s\",\"readers\":%d,\"ops\":%zu,\"errors\":%d,\"seconds\":%.3f,\"ops_per_sec\":%.1f,\"bytes_per_sec\":%.0f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}\n",
+        scenario,
+        cache,
+        readers,
+        samples->count,
+        errors,
+        seconds,
+        samples->count / seconds,
+        bytes / seconds,
+        samples->ns[samples->count / 2] / 1e3,
+        samples->ns[samples->count * 99 / 100] / 1e3,
+        samples->ns[samples->count * 999 / 1000] / 1e3,
+        samples->ns[samples->count - 1] / 1e3
+    );
+
+    fflush(stdout);
+}
+
+static int grofs_e2e_run_scenario(const struct grofs_e2e_scenario *scenario) {
+    pid_t pid = grofs_e2e_mount();
+
+    if (pid < 0) {
+        fprintf(stderr, "Failed to mount %s at %s\n", grofs_e2e_repo_path, grofs_e2e_mount_path);
+
+        return 1;
+    }
+
+    char tree_path[GROFS_E2E_PATH_MAX];
+
+    snprintf(tree_path, GROFS_E2E_PATH_MAX, "%s/commits/%s/tree", grofs_e2e_mount_path, grofs_e2e_commit_sha);
+
+    const char *caches[] = { "cold", "warm" };
+
+    size_t i;
+
+    for (i = 0; i < sizeof(caches) / sizeof(caches[0]); i++) {
+        struct grofs_e2e_samples samples = { NULL, 0, 0 };
+
+        uint64_t bytes = 0;
+
+        int errors = 0;
+
+        uint64_t started = grofs_e2e_now_ns();
+
+        int readers = scenario->run(tree_path, &samples, &bytes, &errors);
+
+        grofs_e2e_report(scenario->name, caches[i], readers, &samples, bytes, errors, grofs_e2e_now_ns() - started);
+
+        free(samples.ns);
+    }
+
+    grofs_e2e_unmount(pid);
+
+    return 0;
+}
+
+static int grofs_e2e_remove_cb(const char *path, const struct stat *stat, int flag, struct FTW *ftw) {
+    (void) stat;
+    (void) flag;
+    (void) ftw;
+
+    return remove(path);
+}
+
+int main(int argc, char **argv) {
+    const struct grofs_e2e_scenario scenarios[] = {
+        { "find_stat", grofs_e2e_scenario_find_stat },
+        { "ls_lr", grofs_e2e_scenario_ls_lr },
+        { "parallel_cat", grofs_e2e_scenario_parallel_cat },
+        { "random_read", grofs_e2e_scenario_random_read }
+    };
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s grofs-binary [scenario...]\n", argv[0]);
+
+        return 1;
+    }
+
+    grofs_e2e_bin = argv[1];
+
+    const char *readers = getenv("GROFS_E2E_READERS");
+
+    if (NULL != readers && atoi(readers) > 0) {
+        grofs_e2e_readers = atoi(readers) < GROFS_E2E_MAX_READERS ? atoi(readers) : GROFS_E2E_MAX_READERS;
+    }
+
+    char work_dir[] = "/tmp/grofs-e2e-XXXXXX";
+
+    if (NULL == mkdtemp(work_dir)) {
+        fprintf(stderr, "Failed to create work directory\n");
+
+        return 1;
+    }
+
+    snprintf(grofs_e2e_repo_path, GROFS_E2E_WORK_PATH_MAX, "%s/repo.git", work_dir);
+    snprintf(grofs_e2e_mount_path, GROFS_E2E_WORK_PATH_MAX, "%s/mnt", work_dir);
+
+    int ret = 0;
+
+    git_libgit2_init();
+
+    if (0 != mkdir(grofs_e2e_mount_path, 0755) || 0 != grofs_e2e_generate(grofs_e2e_repo_path)) {
+        fprintf(stderr, "Failed to generate repository at %s\n", grofs_e2e_repo_path);
+
+        ret = 1;
+    }
+
+    size_t i;
+
+    for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]) && 0 == ret; i++) {
+        // only selected scenarios when names are given
+        if (argc > 2) {
+            int j;
+
+            for (j = 2; j < argc && strcmp(argv[j], scenarios[i].name) != 0; j++);
+
+            if (j == argc) {
+                continue;
+            }
+        }
+
+        ret = grofs_e2e_run_scenario(scenarios + i);
+    }
+
+    git_libgit2_shutdown();
+
+    nftw(work_dir, grofs_e2e_remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+
+    return ret;
+}
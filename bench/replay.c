@@ -0,0 +1,588 @@
+// Replays operations recorded with --trace against an in-process grofs.
+//
+// Operations of every recorded thread run on their own thread, at original pace or as fast
+// as possible. Operations on the same file handle keep their recorded order. Prints original
+// and replayed latency per operation as JSON lines.
+
+#define _GNU_SOURCE
+
+#define GROFS_NO_MAIN
+
+#include "../libgrofs.c"
+#include "../grofs.c"
+
+#define GROFS_REPLAY_MAX_THREADS 1024
+#define GROFS_REPLAY_READ_BUFF (1024 * 1024)
+// approximation of kernel readdir buffer, entries are 24 bytes plus name aligned to 8
+#define GROFS_REPLAY_READDIR_BUFF 4096
+
+struct grofs_replay_op {
+    struct grofs_trace_record record;
+    long open_index; // record which created the handle, -1 when it was not recorded
+    long prev_index; // previous record using the same handle, -1 when there is none
+    uint64_t duration_ns;
+    int result;
+    int opened;
+    int done;
+    struct fuse_file_info file_info;
+};
+
+struct grofs_replay_thread {
+    pthread_t thread;
+    uint32_t tid;
+    long *indexes;
+    size_t count;
+    size_t capacity;
+};
+
+struct grofs_replay_handle {
+    uint64_t fh;
+    long open_index;
+    long last_index;
+    int used;
+};
+
+struct grofs_replay_readdir_context {
+    size_t used;
+};
+
+static struct fuse_context grofs_replay_fuse_context;
+static struct grofs_replay_op *grofs_replay_ops = NULL;
+static size_t grofs_replay_ops_count = 0;
+static struct grofs_replay_thread grofs_replay_threads[GROFS_REPLAY_MAX_THREADS];
+static size_t grofs_replay_threads_count = 0;
+static pthread_mutex_t grofs_replay_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t grofs_replay_cond = PTHREAD_COND_INITIALIZER;
+static int grofs_replay_max_speed = 0;
+static uint64_t grofs_replay_started_ns;
+static uint64_t grofs_replay_trace_started_ns;
+
+// Handlers run outside of a FUSE session so context is a static one
+struct fuse_context *fuse_get_context(void) {
+    return &grofs_replay_fuse_context;
+}
+
+static uint64_t grofs_replay_now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int grofs_replay_compare_seq(const void *a, const void *b) {
+    uint64_t left = atomic_load_explicit(&((const struct grofs_replay_op *) a)->record.seq, memory_order_relaxed);
+    uint64_t right = atomic_load_explicit(&((const struct grofs_replay_op *) b)->record.seq, memory_order_relaxed);
+
+    return left < right ? -1 : left > right;
+}
+
+static int grofs_replay_compare_ns(const void *a, const void *b) {
+    uint64_t left = *(const uint64_t *) a;
+    uint64_t right = *(const uint64_t *) b;
+
+    return left < right ? -1 : left > right;
+}
+
+// Copies complete records out of the ring buffer ordered by sequence
+static int grofs_replay_load(const char *path) {
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return errno;
+    }
+
+    struct stat stat;
+
+    if (fstat(fd, &stat) != 0 || (size_t) stat.st_size < sizeof(struct grofs_trace_header)) {
+        close(fd);
+
+        return EINVAL;
+    }
+
+    void *mapped = mmap(NULL, stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (MAP_FAILED == mapped) {
+        return errno;
+    }
+
+    const struct grofs_trace_header *header = (const struct grofs_trace_header *) mapped;
+
+    if (
+        memcmp(header->magic, GROFS_TRACE_MAGIC, sizeof(header->magic)) != 0
+        || GROFS_TRACE_VERSION != header->version
+        || sizeof(struct grofs_trace_record) != header->record_size
+        || sizeof(struct grofs_trace_header) + header->capacity * sizeof(struct grofs_trace_record) > (size_t) stat.st_size
+    ) {
+        munmap(mapped, stat.st_size);
+
+        return EINVAL;
+    }
+
+    grofs_replay_ops = (struct grofs_replay_op *) calloc(header->capacity, sizeof(struct grofs_replay_op));
+
+    if (NULL == grofs_replay_ops) {
+        munmap(mapped, stat.st_size);
+
+        return ENOMEM;
+    }
+
+    const struct grofs_trace_record *records = (const struct grofs_trace_record *) (header + 1);
+
+    size_t i;
+
+    for (i = 0; i < header->capacity; i++) {
+        uint64_t seq = atomic_load_explicit(&records[i].seq, memory_order_acquire);
+
+        if (0 == seq || (seq - 1) % header->capacity != i || records[i].op >= GROFS_STATS_OP_COUNT || records[i].path_truncated) {
+            continue;
+        }
+
+        memcpy(&grofs_replay_ops[grofs_replay_ops_count++].record, records + i, sizeof(struct grofs_trace_record));
+    }
+
+    munmap(mapped, stat.st_size);
+
+    qsort(grofs_replay_ops, grofs_replay_ops_count, sizeof(struct grofs_replay_op), grofs_replay_compare_seq);
+
+    return 0;
+}
+
+static int grofs_replay_uses_handle(uint8_t op) {
+    return GROFS_STATS_OP_GETATTR != op && GROFS_STATS_OP_READLINK != op;
+}
+
+static int grofs_replay_creates_handle(uint8_t op) {
+    return GROFS_STATS_OP_OPEN == op || GROFS_STATS_OP_OPENDIR == op;
+}
+
+// Links every operation to the open which created its handle and to the previous user of that handle
+static int grofs_replay_link(void) {
+    size_t capacity = 64;
+
+    while (capacity < grofs_replay_ops_count * 2) {
+        capacity *= 2;
+    }
+
+    struct grofs_replay_handle *handles = (struct grofs_replay_handle *) calloc(capacity, sizeof(struct grofs_replay_handle));
+
+    if (NULL == handles) {
+        return ENOMEM;
+    }
+
+    size_t i;
+
+    for (i = 0; i < grofs_replay_ops_count; i++) {
+        struct grofs_replay_op *op = grofs_replay_ops + i;
+
+        op->open_index = -1;
+        op->prev_index = -1;
+
+        if (!grofs_replay_uses_handle(op->record.op) || op->record.result < 0) {
+            continue;
+        }
+
+        size_t slot = (op->record.fh * 0x9e3779b97f4a7c15ULL) & (capacity - 1);
+
+        while (handles[slot].used && handles[slot].fh != op->record.fh) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+
+        if (!handles[slot].used) {
+            handles[slot].used = 1;
+            handles[slot].fh = op->record.fh;
+            handles[slot].open_index = -1;
+            handles[slot].last_index = -1;
+        }
+
+        if (grofs_replay_creates_handle(op->record.op)) {
+            handles[slot].open_index = i;
+        } else {
+            op->open_index = handles[slot].open_index;
+            op->prev_index = handles[slot].last_index;
+        }
+
+        handles[slot].last_index = i;
+
+        // handle values are reused once released
+        if (GROFS_STATS_OP_RELEASE == op->record.op || GROFS_STATS_OP_RELEASEDIR == op->record.op) {
+            handles[slot].open_index = -1;
+        }
+    }
+
+    free(handles);
+
+    return 0;
+}
+
+static int grofs_replay_assign_threads(void) {
+    size_t i;
+
+    for (i = 0; i < grofs_replay_ops_count; i++) {
+        uint32_t tid = grofs_replay_ops[i].record.tid;
+
+        size_t j;
+
+        for (j = 0; j < grofs_replay_threads_count && grofs_replay_threads[j].tid != tid; j++);
+
+        if (j == grofs_replay_threads_count) {
+            // too many threads recorded, rest shares the last one
+            if (GROFS_REPLAY_MAX_THREADS == grofs_replay_threads_count) {
+                j = GROFS_REPLAY_MAX_THREADS - 1;
+            } else {
+                grofs_replay_threads[grofs_replay_threads_count++].tid = tid;
+            }
+        }
+
+        struct grofs_replay_thread *thread = grofs_replay_threads + j;
+
+        if (thread->count == thread->capacity) {
+            size_t capacity = 0 == thread->capacity ? 256 : thread->capacity * 2;
+
+            long *indexes = (long *) realloc(thread->indexes, capacity * sizeof(long));
+
+            if (NULL == indexes) {
+                return ENOMEM;
+            }
+
+            thread->indexes = indexes;
+            thread->capacity = capacity;
+        }
+
+        thread->indexes[thread->count++] = i;
+    }
+
+    return 0;
+}
+
+static void grofs_replay_wait_for(long index) {
+    if (index < 0) {
+        return ;
+    }
+
+    pthread_mutex_lock(&grofs_replay_lock);
+
+    while (!grofs_replay_ops[index].done) {
+        pthread_cond_wait(&grofs_replay_cond, &grofs_replay_lock);
+    }
+
+    pthread_mutex_unlock(&grofs_replay_lock);
+}
+
+static void grofs_replay_mark_done(struct grofs_replay_op *op) {
+    pthread_mutex_lock(&grofs_replay_lock);
+
+    op->done = 1;
+
+    pthread_cond_broadcast(&grofs_replay_cond);
+    pthread_mutex_unlock(&grofs_replay_lock);
+}
+
+static int grofs_replay_readdir_filler(void *buffer, const char *name, const struct stat *stat, off_t offset) {
+    (void) stat;
+    (void) offset;
+
+    struct grofs_replay_readdir_context *context = (struct grofs_replay_readdir_context *) buffer;
+
+    size_t entry_len = (24 + strlen(name) + 7) & ~((size_t) 7);
+
+    if (context->used + entry_len > GROFS_REPLAY_READDIR_BUFF) {
+        return 1;
+    }
+
+    context->used += entry_len;
+
+    return 0;
+}
+
+// Handle of an operation whose open was not recorded, e.g. because ring buffer wrapped, is opened by path
+static struct fuse_file_info *grofs_replay_file_info(struct grofs_replay_op *op, struct fuse_file_info *own_file_info) {
+    if (op->open_index >= 0) {
+        struct grofs_replay_op *open_op = grofs_replay_ops + op->open_index;
+
+        return open_op->opened ? &open_op->file_info : NULL;
+    }
+
+    memset(own_file_info, 0, sizeof(struct fuse_file_info));
+
+    int ret = GROFS_STATS_OP_READDIR == op->record.op
+        ? grofs_fuse_operations.opendir(op->record.path, own_file_info)
+        : grofs_fuse_operations.open(op->record.path, own_file_info);
+
+    return 0 == ret ? own_file_info : NULL;
+}
+
+static void grofs_replay_release_own(struct grofs_replay_op *op, struct fuse_file_info *file_info, struct fuse_file_info *own_file_info) {
+    if (file_info != own_file_info) {
+        return ;
+    }
+
+    if (GROFS_STATS_OP_READDIR == op->record.op) {
+        grofs_fuse_operations.releasedir(op->record.path, own_file_info);
+    } else {
+        grofs_fuse_operations.release(op->record.path, own_file_info);
+    }
+}
+
+static int grofs_replay_run_op(struct grofs_replay_op *op, char *buff) {
+    struct fuse_file_info own_file_info;
+    struct fuse_file_info *file_info;
+    struct stat stat;
+
+    int ret;
+
+    switch (op->record.op) {
+        case GROFS_STATS_OP_GETATTR:
+            return grofs_fuse_operations.getattr(op->record.path, &stat);
+        case GROFS_STATS_OP_READLINK:
+            return grofs_fuse_operations.readlink(op->record.path, buff, GROFS_REPLAY_READ_BUFF);
+        case GROFS_STATS_OP_OPEN:
+        case GROFS_STATS_OP_OPENDIR:
+            memset(&op->file_info, 0, sizeof(struct fuse_file_info));
+
+            ret = GROFS_STATS_OP_OPEN == op->record.op
+                ? grofs_fuse_operations.open(op->record.path, &op->file_info)
+                : grofs_fuse_operations.opendir(op->record.path, &op->file_info);
+
+            op->opened = 0 == ret;
+
+            return ret;
+        case GROFS_STATS_OP_READ:
+            file_info = grofs_replay_file_info(op, &own_file_info);
+
+            if (NULL == file_info) {
+                return -EBADF;
+            }
+
+            ret = grofs_fuse_operations.read(op->record.path, buff, grofs_min(op->record.size, GROFS_REPLAY_READ_BUFF), op->record.offset, file_info);
+
+            grofs_replay_release_own(op, file_info, &own_file_info);
+
+            return ret;
+        case GROFS_STATS_OP_READDIR:
+            file_info = grofs_replay_file_info(op, &own_file_info);
+
+            if (NULL == file_info) {
+                return -EBADF;
+            }
+
+            struct grofs_replay_readdir_context context = { 0 };
+
+            // kernel buffer boundaries differ between runs so listing continues where this handle stopped
+            ret = grofs_fuse_operations.readdir(op->record.path, &context, grofs_replay_readdir_filler, ((struct grofs_dir_handle *) file_info->fh)->last_offset, file_info);
+
+            grofs_replay_release_own(op, file_info, &own_file_info);
+
+            return ret;
+        case GROFS_STATS_OP_RELEASE:
+        case GROFS_STATS_OP_RELEASEDIR:
+            if (op->open_index < 0 || !grofs_replay_ops[op->open_index].opened) {
+                return 0;
+            }
+
+            file_info = &grofs_replay_ops[op->open_index].file_info;
+
+            grofs_replay_ops[op->open_index].opened = 0;
+
+            return GROFS_STATS_OP_RELEASE == op->record.op
+                ? grofs_fuse_operations.release(op->record.path, file_info)
+                : grofs_fuse_operations.releasedir(op->record.path, file_info);
+    }
+
+    return -EINVAL;
+}
+
+static void *grofs_replay_thread_run(void *data) {
+    struct grofs_replay_thread *thread = (struct grofs_replay_thread *) data;
+
+    char *buff = (char *) malloc(GROFS_REPLAY_READ_BUFF);
+
+    size_t i;
+
+    for (i = 0; i < thread->count; i++) {
+        struct grofs_replay_op *op = grofs_replay_ops + thread->indexes[i];
+
+        if (!grofs_replay_max_speed) {
+            uint64_t due_ns = grofs_replay_started_ns + (op->record.started_ns - grofs_replay_trace_started_ns);
+
+            struct timespec due = { due_ns / 1000000000ULL, due_ns % 1000000000ULL };
+
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+        }
+
+        grofs_replay_wait_for(op->prev_index);
+
+        uint64_t started = grofs_replay_now_ns();
+
+        op->result = NULL == buff ? -ENOMEM : grofs_replay_run_op(op, buff);
+        op->duration_ns = grofs_replay_now_ns() - started;
+
+        grofs_replay_mark_done(op);
+    }
+
+    free(buff);
+
+    return NULL;
+}
+
+static void grofs_replay_report(void) {
+    uint64_t *original = (uint64_t *) malloc(grofs_replay_ops_count * sizeof(uint64_t));
+    uint64_t *replayed = (uint64_t *) malloc(grofs_replay_ops_count * sizeof(uint64_t));
+
+    if (NULL == original || NULL == replayed) {
+        free(original);
+        free(replayed);
+
+        return ;
+    }
+
+    int op;
+
+    for (op = 0; op < GROFS_STATS_OP_COUNT; op++) {
+        size_t count = 0;
+        size_t mismatches = 0;
+
+        size_t i;
+
+        for (i = 0; i < grofs_replay_ops_count; i++) {
+            if (grofs_replay_ops[i].record.op != op) {
+                continue;
+            }
+
+            original[count] = grofs_replay_ops[i].record.duration_ns;
+            replayed[count] = grofs_replay_ops[i].duration_ns;
+
+            // only success or failure is compared, content of directories and files may differ
+            if ((grofs_replay_ops[i].record.result < 0) != (grofs_replay_ops[i].result < 0)) {
+                mismatches++;
+            }
+
+            count++;
+        }
+
+        if (0 == count) {
+            continue;
+        }
+
+        qsort(original, count, sizeof(uint64_t), grofs_replay_compare_ns);
+        qsort(replayed, count, sizeof(uint64_t), grofs_replay_compare_ns);
+
+        printf(
+            "{\"op\":\"%s\",\"count\":%zu,\"mismatches\":%zu,\"original_p50_us\":%.3f,\"original_p99_us\":%.3f,\"replay_p50_us\":%.3f,\"replay_p99_us\":%.3f,\"replay_max_us\":%.3f}\n",
+            grofs_stats_op_names[op],
+            count,
+            mismatches,
+            original[count / 2] / 1e3,
+            original[count * 99 / 100] / 1e3,
+            replayed[count / 2] / 1e3,
+            replayed[count * 99 / 100] / 1e3,
+            replayed[count - 1] / 1e3
+        );
+    }
+
+    free(original);
+    free(replayed);
+}
+
+int main(int argc, char **argv) {
+    int arg = 1;
+
+    if (argc > arg && 0 == strcmp(argv[arg], "--max-speed")) {
+        grofs_replay_max_speed = 1;
+
+        arg++;
+    }
+
+    if (argc - arg != 2) {
+        fprintf(stderr, "usage: %s [--max-speed] git-repo-path trace-file\n", argv[0]);
+
+        return 1;
+    }
+
+    int ret = grofs_replay_load(argv[arg + 1]);
+
+    if (0 != ret) {
+        fprintf(stderr, "Failed to load trace %s: %s\n", argv[arg + 1], strerror(ret));
+
+        return 1;
+    }
+
+    if (0 == grofs_replay_ops_count) {
+        fprintf(stderr, "Trace %s has no operations\n", argv[arg + 1]);
+
+        return 1;
+    }
+
+    if (grofs_replay_link() != 0 || grofs_replay_assign_threads() != 0) {
+        fprintf(stderr, "Failed to allocate memory\n");
+
+        return 1;
+    }
+
+    struct grofs_options options;
+
+    grofs_options_init(&options);
+
+    if (0 != grofs_open(&grofs_fs, argv[arg], &options)) {
+        return 1;
+    }
+
+    grofs_replay_fuse_context.private_data = grofs_fs;
+
+    grofs_replay_trace_started_ns = grofs_replay_ops[0].record.started_ns;
+    grofs_replay_started_ns = grofs_replay_now_ns();
+
+    size_t i;
+
+    for (i = 0; i < grofs_replay_threads_count; i++) {
+        if (0 != pthread_create(&grofs_replay_threads[i].thread, NULL, grofs_replay_thread_run, grofs_replay_threads + i)) {
+            fprintf(stderr, "Failed to start replay thread\n");
+
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < grofs_replay_threads_count; i++) {
+        pthread_join(grofs_replay_threads[i].thread, NULL);
+    }
+
+    uint64_t replay_ns = grofs_replay_now_ns() - grofs_replay_started_ns;
+
+    const struct grofs_trace_record *last = &grofs_replay_ops[grofs_replay_ops_count - 1].record;
+
+    printf(
+        "{\"records\":%zu,\"threads\":%zu,\"max_speed\":%s,\"original_seconds\":%.3f,\"replay_seconds\":%.3f}\n",
+        grofs_replay_ops_count,
+        grofs_replay_threads_count,
+        grofs_replay_max_speed ? "true" : "false",
+        (last->started_ns + last->duration_ns - grofs_replay_trace_started_ns) / 1e9,
+        replay_ns / 1e9
+    );
+
+    grofs_replay_report();
+
+    // handles left open by trace
+    for (i = 0; i < grofs_replay_ops_count; i++) {
+        struct grofs_replay_op *op = grofs_replay_ops + i;
+
+        if (op->opened) {
+            if (GROFS_STATS_OP_OPEN == op->record.op) {
+                grofs_fuse_operations.release(op->record.path, &op->file_info);
+            } else {
+                grofs_fuse_operations.releasedir(op->record.path, &op->file_info);
+            }
+        }
+    }
+
+    for (i = 0; i < grofs_replay_threads_count; i++) {
+        free(grofs_replay_threads[i].indexes);
+    }
+
+    free(grofs_replay_ops);
+
+    grofs_cleanup_on_exit_cb();
+
+    return 0;
+}
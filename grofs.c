@@ -1,80 +1,41 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <git2.h>
 #include <errno.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <threads.h>
 #include <fcntl.h>
-#include <errno.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <semaphore.h>
+#include <signal.h>
 
 #define FUSE_USE_VERSION 30
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 
-#define GROFS_STR_COMMITS "commits"
-#define GROFS_STR_BLOBS "blobs"
-#define GROFS_STR_TREE "tree"
-#define GROFS_STR_PARENT "parent"
-
-#define GROFS_VERSION "0.1.0-alpha"
-
-#define GROFS_GIT_OBJECT_ID_LEN GIT_OID_HEXSZ
-
-#define GROFS_LOGIC_ERROR 64
-
-// Halts in case of a logic error because it's better to exit since we don't know what else could be wrong
-#define GROFS_HALT_FMT(fmt, ...) fprintf(stderr, "ERROR [file: %s, line: %d]: " fmt, __FILE__, __LINE__, __VA_ARGS__); exit(GROFS_LOGIC_ERROR)
-#define GROFS_HALT(fmt) GROFS_HALT_FMT(fmt "%s", "")
+#include "grofs_internal.h"
 
 #define FUSE_ERR(r) -(r)
 
-enum grofs_dir_entry_type {
-    NONE, LIST, ID, PATH_IN_GIT, TREE, PARENT
-};
-
-enum grofs_root_child_type {
-    ROOT, COMMIT, BLOB
-};
-
-struct grofs_path_spec {
-    char *buff;
-    char **parts;
-    int parts_count;
-    enum grofs_dir_entry_type entry_type;
-    enum grofs_root_child_type root_child_type;
-};
-
-enum grofs_node_type {
-    DATA /* since I can't have FILE */, DIR
-};
-
-struct grofs_node {
-    enum grofs_node_type type;
-    enum grofs_dir_entry_type entry_type;
-    enum grofs_root_child_type root_child_type;
-    git_oid oid;
-    time_t time;
-    size_t size;
-};
-
-struct grofs_readdir_context {
-    int fd;
-    git_otype wanted_type;
-};
-
-struct grofs_file_handle {
-    char *buff;
-    int len;
-};
-
 struct grofs_cli_opts {
     int show_version;
     int show_help;
+    int no_keep_cache;
+    char *trace_path;
+    unsigned int trace_mb;
+    unsigned int workers;
+    char *worker_cpus;
+    struct grofs_options options;
 };
 
 #define GROFS_STRUCT_OPT(tpl, field, value) { tpl, offsetof(struct grofs_cli_opts, field), value }
@@ -88,8 +49,7 @@ struct grofs_buff {
 
 struct grofs_readdir_thread_data {
     int fd;
-    void (*iter) (int fd, void *);
-    void *iter_payload; // must be a valid pointer to be freed later or NULL
+    struct grofs_dir *dir;
     int should_stop;
 };
 
@@ -101,80 +61,183 @@ struct grofs_dir_handle {
     struct grofs_buff buff;
 };
 
+// read from pipe at once, about a hundred ids of commits/ or blobs/
+#define GROFS_READDIR_BUFF_LEN 4096
+
+#define GROFS_OPT_SCOPE "--scope="
+#define GROFS_OPT_PRELOAD "--preload="
+#define GROFS_OPT_PRELOAD_PATH "--preload-path="
+#define GROFS_OPT_REPO "--repo="
+
+#define GROFS_TRACE_MAGIC "GROFSTR1"
+#define GROFS_TRACE_VERSION 1
+#define GROFS_TRACE_RECORD_SIZE 512
+#define GROFS_TRACE_PATH_MAX (GROFS_TRACE_RECORD_SIZE - 56)
+#define GROFS_DEFAULT_TRACE_MB 64
+
+// from linux/fuse.h, gives the opened /dev/fuse its own queue of replies to requests of the session it's cloned from
+#define GROFS_FUSE_DEV_IOC_CLONE _IOR(229, 0, uint32_t)
+#define GROFS_MAX_WORKERS 1024
+#define GROFS_MAX_CPUS 4096
+
+#ifdef GROFS_HAVE_LZ4
+#define GROFS_HELP_LZ4_NOTE ""
+#else
+#define GROFS_HELP_LZ4_NOTE ",\n                           this build has no LZ4 so it's ignored"
+#endif
+
+enum grofs_opt_key {
+    GROFS_OPT_KEY_SCOPE,
+    GROFS_OPT_KEY_PRELOAD,
+    GROFS_OPT_KEY_PRELOAD_PATH,
+    GROFS_OPT_KEY_REPO
+};
+
+// Trace file is this header followed by fixed size records used as a ring buffer
+struct grofs_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity;
+    uint64_t started_realtime_ns;
+    atomic_uint_fast64_t next_seq;
+    char reserved[24];
+};
+
+// seq is written last, it's seq + 1 of the slot's current record once record is complete, 0 while slot is empty
+struct grofs_trace_record {
+    atomic_uint_fast64_t seq;
+    uint64_t started_ns;
+    uint64_t duration_ns;
+    uint64_t fh;
+    int64_t offset;
+    uint32_t size;
+    uint32_t tid;
+    int32_t result;
+    uint8_t op;
+    uint8_t path_truncated;
+    uint16_t path_len;
+    char path[GROFS_TRACE_PATH_MAX];
+};
+
+// Worker serving requests read from its own clone of /dev/fuse
+struct grofs_worker {
+    pthread_t thread;
+    unsigned int index;
+    int cpu; // -1 when not pinned
+    struct fuse_chan *chan;
+    int cloned; // 0 when clone failed and chan is the one shared by the session
+    char *buff;
+    size_t buff_len;
+    atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t busy_us;
+};
+
+struct grofs_workers {
+    struct fuse_session *session;
+    struct grofs_worker *items;
+    unsigned int count;
+    int *cpus; // workers are pinned to these round-robin, NULL leaves them to scheduler
+    size_t cpus_count;
+    sem_t finished; // posted by each worker once it stops
+};
+
+_Static_assert(sizeof(struct grofs_trace_record) == GROFS_TRACE_RECORD_SIZE, "trace record size is part of file format");
 
-#define GROFS_READDIR_BUFF_LEN 64
-
-static const char *grofs_root_child_type_to_str(enum grofs_root_child_type type);
-static char *grofs_path_spec_full_path(const struct grofs_path_spec *path_spec);
-static char *grofs_path_spec_sub_path(const struct grofs_path_spec *path_spec, int start_part);
-static const char *grofs_path_spec_blob_name(const struct grofs_path_spec *path_spec);
-static char *grofs_path_spec_git_path(const struct grofs_path_spec *path_spec);
-static inline int grofs_min(int a, int b);
-static void grofs_free_path_spec(struct grofs_path_spec *path_spec);
-static int grofs_count_char_in_string(const char *str, char needle);
-static int grofs_parse_path_info_resolve_root_child(enum grofs_root_child_type *root_child_type, const char *part);
-static int grofs_path_parse_commit_sub_path(struct grofs_path_spec *path_spec, int level);
-static int grofs_path_parse_blob_sub_path(struct grofs_path_spec *path_spec, int level);
-static int grofs_parse_path_init_dir_entry_type(struct grofs_path_spec *path_spec);
-static int grofs_parse_path_as_root(struct grofs_path_spec **path_spec);
-static int grofs_path_parse_as_root_child(struct grofs_path_spec *path_spec);
-static int grofs_parse_path(struct grofs_path_spec **path_spec, const char *path);
 static void grofs_cleanup_on_exit_cb();
 static int grofs_fuse_args_process_cb(void *data, const char *arg, int key, struct fuse_args *out_args);
-static int grofs_git_commit_parent_lookup(const git_oid *commit_oid, git_oid *parent_oid);
-static int grofs_git_commit_has_parent(const git_oid *commit_oid);
+static int grofs_trace_open(const char *path, size_t size);
+static void grofs_trace_close(void);
+static void grofs_trace_write(enum grofs_stats_op op, const char *path, uint64_t fh, int64_t offset, size_t size, const struct timespec *started, const struct timespec *finished, int ret);
+static int grofs_cpu_list_parse(const char *list, int **cpus, size_t *count);
+static int grofs_worker_pin(int cpu);
+static int grofs_worker_chan_receive(struct fuse_chan **chan, char *buff, size_t size);
+static int grofs_worker_chan_send(struct fuse_chan *chan, const struct iovec iov[], size_t count);
+static void grofs_worker_chan_destroy(struct fuse_chan *chan);
+static struct fuse_chan *grofs_worker_chan_clone(struct fuse_chan *chan);
+static void *grofs_worker_thread(void *data);
+static void grofs_workers_write_stats(FILE *out);
+static int grofs_workers_loop(struct fuse *fuse);
+static int grofs_serve_with_workers(void);
 static void grofs_getattr_init_stat_as_dir(struct stat *stat, time_t started_time);
 static void grofs_getattr_init_stat_as_file(struct stat *stat, time_t started_time, int size);
-static int grofs_resolve_node_for_path_spec_for_commit_children(struct grofs_node *node, const git_commit *commit, const struct grofs_path_spec *path_spec);
-static int grofs_resolve_node_for_path_spec_for_commit_type(struct grofs_node *node, const struct grofs_path_spec *path_spec);
-static int grofs_resolve_node_for_path_spec_for_blob_type(struct grofs_node *node, const struct grofs_path_spec *path_spec);
-static int grofs_node_init_from_path(struct grofs_node *node, const char *path);
-static int grofs_write_bin_with_local_cancel(int fd, const char *data);
-static void grofs_dir_iter_root(int fd, void *iter_payload);
-static void grofs_dir_iter_commit_id(int fd, void *iter_payload);
-static void grofs_dir_iter_commit_list(int fd, void *iter_payload);
-static void grofs_dir_iter_for_blob_list(int fd, void *iter_payload);
-static void grofs_dir_iter_for_blob_list_tree(int fd, void *iter_payload);
+static void grofs_getattr_init_stat_as_link(struct stat *stat, time_t mtime, int size);
+static int grofs_readdir_write_cb(const char *name, void *payload);
+static int grofs_readdir_write_block_cb(const char *names, size_t len, size_t count, void *payload);
 static void *grofs_readdir_thread(void *data);
-static int grofs_open_dir_create_thread_data(struct grofs_readdir_thread_data *thread_data, const struct grofs_node *node);
 static int grofs_spawn_read_thread(struct grofs_dir_handle *dir_handle);
-static int grofs_opendir_create_dir_handle_from_node(struct grofs_dir_handle **dir_handle, struct grofs_node *node);
+static int grofs_opendir_create_dir_handle(struct grofs_dir_handle **dir_handle, struct grofs_dir *dir);
 static int grofs_fill_from_dir_handle(struct grofs_dir_handle *dir_handle, void *buffer, fuse_fill_dir_t filler);
 static void grofs_buff_align_to_start(struct grofs_buff *buff);
 static int grofs_buff_realloc(struct grofs_buff *buff);
-static int grofs_resolve_node_for_path_spec(struct grofs_node *node, const struct grofs_path_spec *path_spec);
-static int grofs_resolve_node_for_path(struct grofs_node **node, const char *path);
-static int grofs_readdir_git_collect_object_cb(const git_oid *id, void *payload);
-static struct grofs_file_handle *grofs_file_nandle_new(int buff_len);
-static int grofs_open_node_commit_parent(const git_oid *oid, struct fuse_file_info * file_info);
-static int grofs_open_node_blob(const git_oid *oid, struct fuse_file_info *file_info);
-static int grofs_open_node(const struct grofs_node *node, struct fuse_file_info *file_info);
 static void grofs_releasedir_close_thread(int read_fd, pthread_t read_thr, struct grofs_readdir_thread_data *thread_data);
+static int grofs_open_cli_repos(void);
 static void grofs_print_help(const char *bin_path);
-
-static int grofs_getattr(const char *path, struct stat *stat);
-static int grofs_opendir(const char *path, struct fuse_file_info *file_info);
-static int grofs_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *file_info);
-static int grofs_releasedir(const char *path, struct fuse_file_info *file_info);
-static int grofs_open(const char *path, struct fuse_file_info *file_info);
-static int grofs_read(const char *path, char *buff, size_t size, off_t offset, struct fuse_file_info *file_info);
-static int grofs_release(const char* path, struct fuse_file_info *file_info);
+static int grofs_fuse_getattr(const char *path, struct stat *stat);
+static int grofs_fuse_readlink(const char *path, char *buff, size_t size);
+static int grofs_fuse_opendir(const char *path, struct fuse_file_info *file_info);
+static int grofs_fuse_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *file_info);
+static int grofs_fuse_releasedir(const char *path, struct fuse_file_info *file_info);
+static int grofs_fuse_open(const char *path, struct fuse_file_info *file_info);
+static int grofs_fuse_read(const char *path, char *buff, size_t size, off_t offset, struct fuse_file_info *file_info);
+static int grofs_fuse_release(const char* path, struct fuse_file_info *file_info);
+static int grofs_stats_getattr(const char *path, struct stat *stat);
+static int grofs_stats_readlink(const char *path, char *buff, size_t size);
+static int grofs_stats_opendir(const char *path, struct fuse_file_info *file_info);
+static int grofs_stats_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *file_info);
+static int grofs_stats_releasedir(const char *path, struct fuse_file_info *file_info);
+static int grofs_stats_open(const char *path, struct fuse_file_info *file_info);
+static int grofs_stats_read(const char *path, char *buff, size_t size, off_t offset, struct fuse_file_info *file_info);
+static int grofs_stats_release(const char* path, struct fuse_file_info *file_info);
+static void *grofs_init(struct fuse_conn_info *conn);
+static void grofs_destroy(void *private_data);
 
 static char *grofs_repo_path = NULL;
-static git_repository *grofs_repo = NULL;
-static time_t grofs_started_time;
+static struct grofs *grofs_fs = NULL;
+static struct grofs_str_list grofs_cli_scope_revs = { NULL, 0 };
+static struct grofs_str_list grofs_cli_preload_revs = { NULL, 0 };
+static struct grofs_str_list grofs_cli_preload_paths = { NULL, 0 };
+static struct grofs_str_list grofs_cli_repos = { NULL, 0 }; // NAME=PATH of each --repo
+static struct grofs_trace_header *grofs_trace = NULL; // NULL when operations are not recorded
+static size_t grofs_trace_mapped_len = 0;
+static struct grofs_workers grofs_workers = {
+    .session = NULL,
+    .items = NULL,
+    .count = 0,
+    .cpus = NULL,
+    .cpus_count = 0
+};
+static struct fuse_chan_ops grofs_worker_chan_ops = {
+    .receive = grofs_worker_chan_receive,
+    .send = grofs_worker_chan_send,
+    .destroy = grofs_worker_chan_destroy
+};
 struct fuse_args grofs_args = FUSE_ARGS_INIT(0, NULL);
 
-thread_local int *grofs_should_stop_local;
+// options of the library are filled in with their defaults by main before parsing
+static struct grofs_cli_opts grofs_cli_opts = {
+    .show_version = 0,
+    .show_help = 0,
+    .no_keep_cache = 0,
+    .trace_path = NULL,
+    .trace_mb = GROFS_DEFAULT_TRACE_MB,
+    .workers = 0,
+    .worker_cpus = NULL
+};
+
+thread_local uint32_t grofs_trace_tid_local = 0;
 
 struct fuse_operations grofs_fuse_operations = {
-    .getattr	= grofs_getattr,
-    .opendir	= grofs_opendir,
-    .readdir	= grofs_readdir,
-    .releasedir	= grofs_releasedir,
-    .open       = grofs_open,
-    .read       = grofs_read,
-    .release    = grofs_release
+    .getattr	= grofs_stats_getattr,
+    .readlink	= grofs_stats_readlink,
+    .opendir	= grofs_stats_opendir,
+    .readdir	= grofs_stats_readdir,
+    .releasedir	= grofs_stats_releasedir,
+    .open       = grofs_stats_open,
+    .read       = grofs_stats_read,
+    .release    = grofs_stats_release,
+    .init       = grofs_init,
+    .destroy    = grofs_destroy
 };
 
 static struct fuse_opt grofs_fuse_opts[] = {
@@ -182,802 +245,659 @@ static struct fuse_opt grofs_fuse_opts[] = {
     GROFS_STRUCT_OPT("--version", show_version, 1),
     GROFS_STRUCT_OPT("-h", show_help, 1),
     GROFS_STRUCT_OPT("--help", show_help, 1),
+    GROFS_STRUCT_OPT("--preload-blobs", options.preload_blobs, 1),
+    GROFS_STRUCT_OPT("--bg-threads=%u", options.bg_threads, 0),
+    GROFS_STRUCT_OPT("--blob-cache-size=%u", options.blob_cache_mb, 0),
+    GROFS_STRUCT_OPT("--meta-cache-size=%u", options.meta_cache_mb, 0),
+    GROFS_STRUCT_OPT("--compressed-cache-size=%u", options.compressed_cache_mb, 0),
+    GROFS_STRUCT_OPT("--prefetch-threads=%u", options.prefetch_threads, 0),
+    GROFS_STRUCT_OPT("--prefetch-budget=%u", options.prefetch_budget_mb, 0),
+    GROFS_STRUCT_OPT("--no-attr-prefetch", options.no_attr_prefetch, 1),
+    GROFS_STRUCT_OPT("--bulk-threads=%u", options.bulk_threads, 0),
+    GROFS_STRUCT_OPT("--bulk-size=%u", options.bulk_min_kb, 0),
+    GROFS_STRUCT_OPT("--listing-slots=%u", options.listing_slots, 0),
+    GROFS_STRUCT_OPT("--spill-dir=%s", options.spill_dir, 0),
+    GROFS_STRUCT_OPT("--spill-size=%u", options.spill_min_kb, 0),
+    GROFS_STRUCT_OPT("--chunked-size=%u", options.chunk_min_kb, 0),
+    GROFS_STRUCT_OPT("--mtime-depth=%u", options.mtime_depth, 0),
+    GROFS_STRUCT_OPT("--mtime-index=%s", options.mtime_index_dir, 0),
+    GROFS_STRUCT_OPT("--index-sizes", options.index_sizes, 1),
+    GROFS_STRUCT_OPT("--no-memory-governor", options.no_memory_governor, 1),
+    GROFS_STRUCT_OPT("--memory-pressure=%u", options.memory_pressure_pct, 0),
+    GROFS_STRUCT_OPT("--grep-threads=%u", options.grep_threads, 0),
+    GROFS_STRUCT_OPT("--grep-cache-size=%u", options.grep_cache_mb, 0),
+    GROFS_STRUCT_OPT("--no-keep-cache", no_keep_cache, 1),
+    GROFS_STRUCT_OPT("--trace=%s", trace_path, 0),
+    GROFS_STRUCT_OPT("--trace-size=%u", trace_mb, 0),
+    GROFS_STRUCT_OPT("--workers=%u", workers, 0),
+    GROFS_STRUCT_OPT("--worker-cpus=%s", worker_cpus, 0),
+    FUSE_OPT_KEY(GROFS_OPT_SCOPE, GROFS_OPT_KEY_SCOPE),
+    FUSE_OPT_KEY(GROFS_OPT_PRELOAD, GROFS_OPT_KEY_PRELOAD),
+    FUSE_OPT_KEY(GROFS_OPT_PRELOAD_PATH, GROFS_OPT_KEY_PRELOAD_PATH),
+    FUSE_OPT_KEY(GROFS_OPT_REPO, GROFS_OPT_KEY_REPO),
     FUSE_OPT_END
 };
 
-static const char *grofs_root_child_type_to_str(enum grofs_root_child_type type) {
-    switch (type) {
-        case ROOT:
-            return "ROOT";
-        case COMMIT:
-            return "COMMIT";
-        case BLOB:
-            return "BLOB";
-        default:
-            GROFS_HALT_FMT("Unknown %d", type);
-    }
-}
-
-static const char *grofs_node_type_to_str(enum grofs_node_type type) {
-    switch (type) {
-        case DIR:
-            return "DIR";
-        case DATA:
-            return "DATA";
-        default:
-            GROFS_HALT_FMT("Unknown %d", type);
-    }
-}
-
-static const char *path_spec_commit_name(const struct grofs_path_spec *path_spec) {
-    if (path_spec->parts_count < 2 || COMMIT != path_spec->root_child_type) {
-        return NULL;
-    }
+static void grofs_cleanup_on_exit_cb() {
+    grofs_trace_close();
 
-    return path_spec->parts[1];
-}
+    if (NULL != grofs_workers.cpus) {
+        free(grofs_workers.cpus);
 
-static const char *grofs_path_spec_blob_name(const struct grofs_path_spec *path_spec) {
-    if (path_spec->parts_count < 2 || BLOB != path_spec->root_child_type) {
-        return NULL;
+        grofs_workers.cpus = NULL;
     }
 
-    return path_spec->parts[1];
-}
+    if (NULL != grofs_fs) {
+        grofs_close(grofs_fs);
 
-static char *grofs_path_spec_sub_path(const struct grofs_path_spec *path_spec, int start_part) {
-    if (start_part < 0 || start_part >= path_spec->parts_count) {
-        return NULL;
+        grofs_fs = NULL;
     }
 
-    size_t path_len = 1;
-
-    char *last_part = path_spec->parts[path_spec->parts_count - 1];
-
-    void *parts_buff_end = last_part + strlen(last_part);
+    grofs_str_list_free(&grofs_cli_preload_revs);
+    grofs_str_list_free(&grofs_cli_preload_paths);
+    grofs_str_list_free(&grofs_cli_scope_revs);
+    grofs_str_list_free(&grofs_cli_repos);
 
-    path_len += (parts_buff_end - (void *) *(path_spec->parts + start_part));
-
-    char *buff = (char *) malloc(sizeof(char) * (path_len + 1));
+    if (NULL != grofs_repo_path) {
+        free(grofs_repo_path);
 
-    if (NULL == buff) {
-        return NULL;
+        grofs_repo_path = NULL;
     }
 
-    *buff = '/';
-    *(buff + 1) = '\0';
+    if (grofs_args.argc > 0) {
+        fuse_opt_free_args(&grofs_args);
+    }
+}
 
-    memcpy(buff + 1, *(path_spec->parts + start_part), sizeof(char) * (path_len - 1 + 1));
+static int grofs_fuse_args_process_cb(void *data, const char *arg, int key, struct fuse_args *out_args) {
+    (void) data;
+    (void) out_args;
 
-    size_t i;
+    // with --repo the only non-option is the mount point, main() hands it back to FUSE if it was taken here
+    if (FUSE_OPT_KEY_NONOPT == key && NULL == grofs_repo_path && 0 == grofs_cli_repos.count) {
+        grofs_repo_path = strdup(arg);
 
-    for (i = 1; i < path_len; i++) {
-        if ('\0' == *(buff + i)) {
-            *(buff + i) = '/';
-        }
+        return 0;
     }
 
-    return buff;
-}
-
-static char *grofs_path_spec_git_path(const struct grofs_path_spec *path_spec) {
-    return grofs_path_spec_sub_path(path_spec, 3);
-}
-
-static char *grofs_path_spec_full_path(const struct grofs_path_spec *path_spec) {
-    if (path_spec->parts_count > 0) {
-        return grofs_path_spec_sub_path(path_spec, 0);
+    if (GROFS_OPT_KEY_SCOPE == key) {
+        return grofs_str_list_add(&grofs_cli_scope_revs, arg + strlen(GROFS_OPT_SCOPE)) == 0 ? 0 : -1;
     }
 
-    char *buff = (char *) malloc(sizeof(char) * (1 + 1));
+    if (GROFS_OPT_KEY_PRELOAD == key) {
+        return grofs_str_list_add(&grofs_cli_preload_revs, arg + strlen(GROFS_OPT_PRELOAD)) == 0 ? 0 : -1;
+    }
 
-    if (NULL == buff) {
-        return NULL;
+    if (GROFS_OPT_KEY_PRELOAD_PATH == key) {
+        return grofs_str_list_add(&grofs_cli_preload_paths, arg + strlen(GROFS_OPT_PRELOAD_PATH)) == 0 ? 0 : -1;
     }
 
-    *buff = '/';
-    *(buff + 1) = '\0';
+    if (GROFS_OPT_KEY_REPO == key) {
+        return grofs_str_list_add(&grofs_cli_repos, arg + strlen(GROFS_OPT_REPO)) == 0 ? 0 : -1;
+    }
 
-    return buff;
+    return 1;
 }
 
-static inline int grofs_min(int a, int b) {
-    return a < b ? a : b;
+static void grofs_getattr_init_stat_as_dir(struct stat *stat, time_t started_time) {
+    stat->st_atime = started_time;
+    stat->st_mtime = started_time;
+    stat->st_mode = S_IFDIR | 0555;
+    stat->st_nlink = 2;
 }
 
-static void grofs_free_path_spec(struct grofs_path_spec *path_spec) {
-    free(path_spec);
+static void grofs_getattr_init_stat_as_file(struct stat *stat, time_t started_time, int size) {
+    stat->st_atime = started_time;
+    stat->st_mtime = started_time;
+    stat->st_mode = S_IFREG | 0444;
+    stat->st_nlink = 1;
+    stat->st_size = size;
 }
 
-static int grofs_count_char_in_string(const char *str, char needle) {
-    int count = 0;
-
-    for (; *str; count += needle == *str, str++);
-
-    return count;
+static void grofs_getattr_init_stat_as_link(struct stat *stat, time_t mtime, int size) {
+    stat->st_atime = mtime;
+    stat->st_mtime = mtime;
+    stat->st_mode = S_IFLNK | 0777;
+    stat->st_nlink = 1;
+    stat->st_size = size;
 }
 
-static int grofs_parse_path_info_resolve_root_child(enum grofs_root_child_type *root_child_type, const char *part) {
-    if (strcmp(GROFS_STR_COMMITS, part) == 0) {
-        *root_child_type = COMMIT;
+static int grofs_trace_open(const char *path, size_t size) {
+    size_t capacity = (size - sizeof(struct grofs_trace_header)) / sizeof(struct grofs_trace_record);
 
-        return 0;
+    if (size <= sizeof(struct grofs_trace_header) || 0 == capacity) {
+        return EINVAL;
     }
 
-    if (strcmp(GROFS_STR_BLOBS, part) == 0) {
-        *root_child_type = BLOB;
+    size_t mapped_len = sizeof(struct grofs_trace_header) + capacity * sizeof(struct grofs_trace_record);
 
-        return 0;
-    }
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
 
-    return 1;
-}
+    if (fd < 0) {
+        return errno;
+    }
 
-static int grofs_path_parse_commit_sub_path(struct grofs_path_spec *path_spec, int level) {
-    char *ref;
+    if (ftruncate(fd, mapped_len) != 0) {
+        int ret = errno;
 
-    ref = path_spec->parts[level];
+        close(fd);
 
-    if (strlen(ref) != GROFS_GIT_OBJECT_ID_LEN) {
-        return ENOENT;
+        return ret;
     }
 
-    if (++level == path_spec->parts_count) {
-        path_spec->entry_type = ID;
+    void *mapped = mmap(NULL, mapped_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 
-        return 0;
+    close(fd);
+
+    if (MAP_FAILED == mapped) {
+        return errno;
     }
 
-    char *commit_dir_item = path_spec->parts[level];
+    struct grofs_trace_header *header = (struct grofs_trace_header *) mapped;
 
-    if (strcmp(GROFS_STR_TREE, commit_dir_item) == 0) {
-        if (++level == path_spec->parts_count) {
-            path_spec->entry_type = TREE;
+    struct timespec now;
 
-            return 0;
-        }
+    clock_gettime(CLOCK_REALTIME, &now);
 
-        path_spec->entry_type = PATH_IN_GIT;
+    memcpy(header->magic, GROFS_TRACE_MAGIC, sizeof(header->magic));
+    header->version = GROFS_TRACE_VERSION;
+    header->record_size = sizeof(struct grofs_trace_record);
+    header->capacity = capacity;
+    header->started_realtime_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
 
-        return 0;
-    } else if (strcmp(GROFS_STR_PARENT, commit_dir_item) == 0) {
-        if (++level == path_spec->parts_count) {
-            path_spec->entry_type = PARENT;
+    atomic_init(&header->next_seq, 0);
 
-            return 0;
-        }
-    }
+    grofs_trace = header;
+    grofs_trace_mapped_len = mapped_len;
 
-    return ENOENT;
+    return 0;
 }
 
-static int grofs_path_parse_blob_sub_path(struct grofs_path_spec *path_spec, int level) {
-    char *ref;
-
-    ref = path_spec->parts[level];
-
-    if (strlen(ref) != GROFS_GIT_OBJECT_ID_LEN) {
-        return ENOENT;
+static void grofs_trace_close(void) {
+    if (NULL == grofs_trace) {
+        return ;
     }
 
-    if (++level == path_spec->parts_count) {
-        path_spec->entry_type = ID;
-
-        return 0;
-    }
+    msync(grofs_trace, grofs_trace_mapped_len, MS_SYNC);
+    munmap(grofs_trace, grofs_trace_mapped_len);
 
-    return ENOENT;
+    grofs_trace = NULL;
 }
 
-static int grofs_parse_path_init_dir_entry_type(struct grofs_path_spec *path_spec) {
-    int level = 0;
+static void grofs_trace_write(enum grofs_stats_op op, const char *path, uint64_t fh, int64_t offset, size_t size, const struct timespec *started, const struct timespec *finished, int ret) {
+    uint64_t seq = atomic_fetch_add_explicit(&grofs_trace->next_seq, 1, memory_order_relaxed);
 
-    if (level == path_spec->parts_count) {
-        path_spec->root_child_type = ROOT;
-        path_spec->entry_type = NONE;
+    struct grofs_trace_record *record = (struct grofs_trace_record *) (grofs_trace + 1) + seq % grofs_trace->capacity;
 
-        return 0;
-    }
+    // slot is being overwritten, readers skip it until seq is set again
+    atomic_store_explicit(&record->seq, 0, memory_order_relaxed);
 
-    enum grofs_root_child_type root_child_type;
+    atomic_thread_fence(memory_order_release);
 
-    if (grofs_parse_path_info_resolve_root_child(&root_child_type, path_spec->parts[level]) != 0) {
-        return ENOENT;
+    if (0 == grofs_trace_tid_local) {
+        grofs_trace_tid_local = syscall(SYS_gettid);
     }
 
-    path_spec->root_child_type = root_child_type;
+    size_t path_len = NULL == path ? 0 : strlen(path);
 
-    if (++level == path_spec->parts_count) {
-        path_spec->entry_type = LIST;
+    record->started_ns = started->tv_sec * 1000000000ULL + started->tv_nsec;
+    record->duration_ns = (finished->tv_sec - started->tv_sec) * 1000000000ULL + (finished->tv_nsec - started->tv_nsec);
+    record->fh = fh;
+    record->offset = offset;
+    record->size = size;
+    record->tid = grofs_trace_tid_local;
+    record->result = ret;
+    record->op = op;
+    record->path_truncated = path_len >= GROFS_TRACE_PATH_MAX;
+    record->path_len = record->path_truncated ? GROFS_TRACE_PATH_MAX - 1 : path_len;
 
-        return 0;
-    }
+    memcpy(record->path, path, record->path_len);
 
-    switch (root_child_type) {
-        case COMMIT:
-            return grofs_path_parse_commit_sub_path(path_spec, level);
-        case  BLOB:
-            return grofs_path_parse_blob_sub_path(path_spec, level);
-        default:
-            GROFS_HALT_FMT("Unexpected %s for path %s", grofs_root_child_type_to_str(root_child_type), grofs_path_spec_full_path(path_spec));
-    }
+    record->path[record->path_len] = '\0';
 
-    return ENOENT;
+    atomic_store_explicit(&record->seq, seq + 1, memory_order_release);
 }
 
-static int grofs_parse_path_as_root(struct grofs_path_spec **path_spec) {
-    struct grofs_path_spec *new_path_spec = NULL;
+static int grofs_cpu_list_parse(const char *list, int **cpus, size_t *count) {
+    size_t capacity = 0;
 
-    new_path_spec = (struct grofs_path_spec *) malloc(sizeof(struct grofs_path_spec));
+    *cpus = NULL;
+    *count = 0;
 
-    if (NULL == new_path_spec) {
-        return ENOMEM;
-    }
-
-    new_path_spec->parts = NULL;
-    new_path_spec->buff = NULL;
-    new_path_spec->parts_count = 0;
-
-    int grofs_path_parse_result = -grofs_parse_path_init_dir_entry_type(new_path_spec);
-
-    if (0 != grofs_path_parse_result) {
-        free(new_path_spec);
-
-        return grofs_path_parse_result;
-    }
+    // same format as /sys/devices/system/node/node0/cpulist, e.g. "0-7,16-23"
+    while ('\0' != *list) {
+        char *end;
 
-    *path_spec = new_path_spec;
+        long first = strtol(list, &end, 10);
+        long last = first;
 
-    return 0;
-}
+        if (end == list) {
+            return EINVAL;
+        }
 
-static int grofs_path_parse_as_root_child(struct grofs_path_spec *path_spec) {
-    char **parts = path_spec->parts;
+        if ('-' == *end) {
+            list = end + 1;
 
-    char *start = path_spec->buff;
-    char *current = start;
-    int i = 0;
+            last = strtol(list, &end, 10);
 
-    while (*current) {
-        if ('/' == *current) {
-            if (current == start) {
-                return ENOENT;
+            if (end == list) {
+                return EINVAL;
             }
-
-            *current = 0;
-            parts[i++] = start;
-
-            start = current + 1;
         }
 
-        current++;
-    };
-
-    if (current == start) {
-        return ENOENT;
-    }
-
-    parts[i++] = start;
+        if (first < 0 || last < first || last >= GROFS_MAX_CPUS) {
+            return EINVAL;
+        }
 
-    return grofs_parse_path_init_dir_entry_type(path_spec);
-}
+        long cpu;
 
-static int grofs_parse_path(struct grofs_path_spec **path_spec, const char *path) {
-    int path_len = strlen(path);
+        for (cpu = first; cpu <= last; cpu++) {
+            if (*count == capacity) {
+                capacity = 0 == capacity ? 16 : capacity * 2;
 
-    if (0 == path_len || '/' != *path) {
-        return ENOENT;
-    }
+                int *grown = (int *) realloc(*cpus, capacity * sizeof(int));
 
-    if (strcmp(path, "/") == 0) {
-        return grofs_parse_path_as_root(path_spec);
-    }
+                if (NULL == grown) {
+                    return ENOMEM;
+                }
 
-    struct grofs_path_spec *new_path_spec = NULL;
+                *cpus = grown;
+            }
 
-    int parts_count = grofs_count_char_in_string(path, '/');
+            (*cpus)[(*count)++] = (int) cpu;
+        }
 
-    // keep it all as one chunk of memory
-    void *buff = malloc(sizeof(struct grofs_path_spec) + parts_count * sizeof(char *) + strlen(path) * sizeof(char));
+        if (',' == *end) {
+            end++;
+        } else if ('\0' != *end) {
+            return EINVAL;
+        }
 
-    if (NULL == buff) {
-        return ENOMEM;
+        list = end;
     }
 
-    new_path_spec = (struct grofs_path_spec *) buff;
-    new_path_spec->parts = (char **) (buff + sizeof(struct grofs_path_spec));
-    new_path_spec->buff = (char *) (buff + sizeof(struct grofs_path_spec) + parts_count * sizeof(char *));
-
-    memcpy(new_path_spec->buff, path + 1, path_len * sizeof(char));
+    return 0 == *count ? EINVAL : 0;
+}
 
-    new_path_spec->parts_count = parts_count;
+static int grofs_worker_pin(int cpu) {
+    unsigned long mask[GROFS_MAX_CPUS / (8 * sizeof(unsigned long))];
 
-    int grofs_path_parse_result = grofs_path_parse_as_root_child(new_path_spec);
+    memset(mask, 0, sizeof(mask));
 
-    if (0 != grofs_path_parse_result) {
-        free(new_path_spec);
+    mask[cpu / (8 * sizeof(unsigned long))] |= 1UL << (cpu % (8 * sizeof(unsigned long)));
 
-        return grofs_path_parse_result;
+    // pid 0 is the calling thread, the syscall spares defining _GNU_SOURCE for pthread_setaffinity_np()
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) != 0) {
+        return errno;
     }
 
-    *path_spec = new_path_spec;
-
     return 0;
 }
 
-static void grofs_cleanup_on_exit_cb() {
-    if (NULL != grofs_repo) {
-        git_repository_free(grofs_repo);
-
-        grofs_repo = NULL;
-    }
+static int grofs_worker_chan_receive(struct fuse_chan **chan, char *buff, size_t size) {
+    ssize_t len;
 
-    git_libgit2_shutdown();
-
-    if (NULL != grofs_repo_path) {
-        free(grofs_repo_path);
+    // ENOENT means request was interrupted before it was read
+    do {
+        len = read(fuse_chan_fd(*chan), buff, size);
+    } while (-1 == len && ENOENT == errno);
 
-        grofs_repo_path = NULL;
+    if (len >= 0) {
+        return (int) len;
     }
 
-    if (grofs_args.argc > 0) {
-        fuse_opt_free_args(&grofs_args);
-    }
-}
+    int ret = errno;
 
-static int grofs_fuse_args_process_cb(void *data, const char *arg, int key, struct fuse_args *out_args) {
-    (void) data;
-    (void) out_args;
-
-    if (FUSE_OPT_KEY_NONOPT == key && NULL == grofs_repo_path) {
-        grofs_repo_path = strdup(arg);
+    // file system was unmounted
+    if (ENODEV == ret) {
+        fuse_session_exit(grofs_workers.session);
 
         return 0;
     }
 
-    return 1;
-}
-
-static void grofs_getattr_init_stat_as_dir(struct stat *stat, time_t started_time) {
-    stat->st_atime = started_time;
-    stat->st_mtime = started_time;
-    stat->st_mode = S_IFDIR | 0555;
-    stat->st_nlink = 2;
-}
+    if (EINTR != ret && EAGAIN != ret) {
+        perror("Failed to read FUSE request");
+    }
 
-static void grofs_getattr_init_stat_as_file(struct stat *stat, time_t started_time, int size) {
-    stat->st_atime = started_time;
-    stat->st_mtime = started_time;
-    stat->st_mode = S_IFREG | 0444;
-    stat->st_nlink = 1;
-    stat->st_size = size;
+    return -ret;
 }
 
-static int grofs_git_commit_parent_lookup(const git_oid *commit_oid, git_oid *parent_oid) {
-    git_commit *commit;
-
-    if (git_commit_lookup(&commit, grofs_repo, commit_oid) != 0) {
-        return 1;
+static int grofs_worker_chan_send(struct fuse_chan *chan, const struct iovec iov[], size_t count) {
+    if (NULL == iov) {
+        return 0;
     }
 
-    if (git_commit_parentcount(commit) == 0) {
-        git_commit_free(commit);
-
-        return 1;
-    }
+    if (writev(fuse_chan_fd(chan), iov, count) == -1) {
+        int ret = errno;
 
-    git_oid_cpy(parent_oid, git_commit_parent_id(commit, 0));
+        // ENOENT means request was interrupted meanwhile
+        if (ENOENT != ret && !fuse_session_exited(grofs_workers.session)) {
+            perror("Failed to send FUSE reply");
+        }
 
-    git_commit_free(commit);
+        return -ret;
+    }
 
     return 0;
 }
 
-static int grofs_git_commit_has_parent(const git_oid *commit_oid) {
-    git_oid oid;
-
-    return grofs_git_commit_parent_lookup(commit_oid, &oid) == 0;
+static void grofs_worker_chan_destroy(struct fuse_chan *chan) {
+    close(fuse_chan_fd(chan));
 }
 
-static int grofs_resolve_node_for_path_spec_for_commit_children(struct grofs_node *node, const git_commit *commit, const struct grofs_path_spec *path_spec) {
-    node->time = git_commit_time(commit);
-
-    if (ID == path_spec->entry_type) {
-        node->type = DIR;
-
-        return 0;
-    }
-
-    git_tree *tree;
+static struct fuse_chan *grofs_worker_chan_clone(struct fuse_chan *chan) {
+    int fd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
 
-    if (git_commit_tree(&tree, commit) != 0) {
-        return ENOENT;
+    if (fd < 0) {
+        return NULL;
     }
 
-    if (TREE == path_spec->entry_type) {
-        node->type = DIR;
+    uint32_t session_fd = (uint32_t) fuse_chan_fd(chan);
 
-        git_oid_cpy(&node->oid, git_tree_id(tree));
+    // requests still come from the queue of the session, replies go back through fd they were read from
+    if (ioctl(fd, GROFS_FUSE_DEV_IOC_CLONE, &session_fd) != 0) {
+        close(fd);
 
-        git_tree_free(tree);
-
-        return 0;
+        return NULL;
     }
 
-    if (PARENT == path_spec->entry_type) {
-        git_oid parent_oid;
-        if (grofs_git_commit_parent_lookup(git_commit_id(commit), &parent_oid) != 0) {
-            return ENOENT;
-        }
-
-        git_oid_cpy(&node->oid, &parent_oid);
+    struct fuse_chan *clone = fuse_chan_new(&grofs_worker_chan_ops, fd, fuse_chan_bufsize(chan), NULL);
 
-        node->type = DATA;
-        node->size = GIT_OID_HEXSZ;
-
-        git_tree_free(tree);
-
-        return 0;
+    if (NULL == clone) {
+        close(fd);
     }
 
-    git_tree_entry *tree_entry;
-
-    char *path = grofs_path_spec_git_path(path_spec);
+    return clone;
+}
 
-    if (NULL == path) {
-        git_tree_free(tree);
+static void *grofs_worker_thread(void *data) {
+    struct grofs_worker *worker = (struct grofs_worker *) data;
+    struct fuse_session *session = grofs_workers.session;
+    struct fuse_chan *chan = worker->chan;
 
-        return ENOENT;
+    if (-1 != worker->cpu && grofs_worker_pin(worker->cpu) != 0) {
+        fprintf(stderr, "Failed to pin worker %u to CPU %d\n", worker->index, worker->cpu);
     }
 
-    if (git_tree_entry_bypath(&tree_entry, tree, path + 1) != 0) {
-        free(path);
+    // worker is canceled once session exits, only while it waits for a request
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-        git_tree_free(tree);
+    while (!fuse_session_exited(session)) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 
-        return ENOENT;
-    }
+        int len = fuse_chan_recv(&chan, worker->buff, worker->buff_len);
 
-    free(path);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-    git_oid_cpy(&node->oid, git_tree_entry_id(tree_entry));
+        if (-EINTR == len || -EAGAIN == len) {
+            continue ;
+        }
 
-    switch (git_tree_entry_type(tree_entry)) {
-        case GIT_OBJ_TREE:
-            node->type = DIR;
+        if (len <= 0) {
+            if (len < 0) {
+                fuse_session_exit(session);
+            }
 
             break;
-        case GIT_OBJ_BLOB:
+        }
 
-            node->type = DATA;
+        struct fuse_buf buf = {
+            .size = (size_t) len,
+            .flags = 0,
+            .mem = worker->buff,
+            .fd = -1,
+            .pos = 0
+        };
 
-            git_blob *blob;
-            git_blob_lookup(&blob, grofs_repo, git_tree_entry_id(tree_entry));
+        struct timespec started;
+        struct timespec finished;
 
-            node->size = git_blob_rawsize(blob);
+        clock_gettime(CLOCK_MONOTONIC, &started);
 
-            git_blob_free(blob);
-            break;
-        default:
-            GROFS_HALT_FMT("Unexpected %s (sha1 %s)", git_object_type2string(git_tree_entry_type(tree_entry)), git_oid_tostr_s(git_tree_entry_id(tree_entry)));
-    }
+        fuse_session_process_buf(session, &buf, chan);
 
-    git_tree_entry_free(tree_entry);
+        clock_gettime(CLOCK_MONOTONIC, &finished);
 
-    git_tree_free(tree);
+        atomic_fetch_add_explicit(&worker->requests, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&worker->busy_us, (finished.tv_sec - started.tv_sec) * 1000000ULL + (finished.tv_nsec - started.tv_nsec) / 1000, memory_order_relaxed);
+    }
 
-    return 0;
-}
+    sem_post(&grofs_workers.finished);
 
-static int grofs_resolve_node_for_path_spec_for_commit_type(struct grofs_node *node, const struct grofs_path_spec *path_spec) {
-    const char *id = path_spec_commit_name(path_spec);
+    return NULL;
+}
 
-    git_commit *commit;
+static void grofs_workers_write_stats(FILE *out) {
+    unsigned int i;
+    unsigned int cloned = 0;
+    char cpu_label[32];
 
-    git_oid_fromstr(&node->oid, id);
+    fprintf(out, "# TYPE grofs_worker_requests_total counter\n");
 
-    if (0 != git_commit_lookup(&commit, grofs_repo, &node->oid)) {
-        return ENOENT;
-    }
+    for (i = 0; i < grofs_workers.count; i++) {
+        const struct grofs_worker *worker = grofs_workers.items + i;
 
-    int ret = grofs_resolve_node_for_path_spec_for_commit_children(node, commit, path_spec);
+        cpu_label[0] = '\0';
 
-    git_commit_free(commit);
+        if (-1 != worker->cpu) {
+            snprintf(cpu_label, sizeof(cpu_label), ",cpu=\"%d\"", worker->cpu);
+        }
 
-    return ret;
-}
+        fprintf(out, "grofs_worker_requests_total{worker=\"%u\"%s} %llu\n", i, cpu_label, (unsigned long long) atomic_load_explicit(&worker->requests, memory_order_relaxed));
 
-static int grofs_resolve_node_for_path_spec_for_blob_type(struct grofs_node *node, const struct grofs_path_spec *path_spec) {
-    if (ID != path_spec->entry_type) {
-        return ENOENT;
+        cloned += worker->cloned;
     }
 
-    git_oid oid;
-    git_oid_fromstr(&oid, grofs_path_spec_blob_name(path_spec));
+    fprintf(out, "# TYPE grofs_worker_busy_microseconds_total counter\n");
 
-    git_blob *blob;
-    git_blob_lookup(&blob, grofs_repo, &oid);
-
-    git_oid_cpy(&node->oid, &oid);
+    for (i = 0; i < grofs_workers.count; i++) {
+        fprintf(out, "grofs_worker_busy_microseconds_total{worker=\"%u\"} %llu\n", i, (unsigned long long) atomic_load_explicit(&grofs_workers.items[i].busy_us, memory_order_relaxed));
+    }
 
-    node->size = git_blob_rawsize(blob);
+    fprintf(out, "# TYPE grofs_workers gauge\n");
+    fprintf(out, "grofs_workers %u\n", grofs_workers.count);
+    fprintf(out, "# TYPE grofs_workers_cloned gauge\n");
+    fprintf(out, "grofs_workers_cloned %u\n", cloned);
+}
 
-    node->type = DATA;
+static int grofs_workers_loop(struct fuse *fuse) {
+    struct fuse_session *session = fuse_get_session(fuse);
+    struct fuse_chan *session_chan = fuse_session_next_chan(session, NULL);
+    unsigned int count = grofs_cli_opts.workers;
 
-    git_blob_free(blob);
+    struct grofs_worker *workers = (struct grofs_worker *) calloc(count, sizeof(struct grofs_worker));
 
-    return 0;
-}
+    if (NULL == workers) {
+        return -1;
+    }
 
-static int grofs_resolve_node_for_path_spec(struct grofs_node *node, const struct grofs_path_spec *path_spec) {
-    int ret = ENOENT;
+    unsigned int i;
 
-    if (ROOT == path_spec->root_child_type || LIST == path_spec->entry_type) {
-        node->type = DIR;
+    for (i = 0; i < count; i++) {
+        struct grofs_worker *worker = workers + i;
 
-        return 0;
-    }
+        worker->index = i;
+        worker->cpu = NULL != grofs_workers.cpus ? grofs_workers.cpus[i % grofs_workers.cpus_count] : -1;
+        worker->chan = grofs_worker_chan_clone(session_chan);
+        worker->cloned = NULL != worker->chan;
 
-    switch (path_spec->root_child_type) {
-        case COMMIT:
-            ret = grofs_resolve_node_for_path_spec_for_commit_type(node, path_spec);
+        // kernels before 4.5 can't clone, the worker then shares fd of the session
+        if (!worker->cloned) {
+            worker->chan = session_chan;
+        }
 
-            break;
-        case BLOB:
-            ret = grofs_resolve_node_for_path_spec_for_blob_type(node, path_spec);
+        worker->buff_len = fuse_chan_bufsize(worker->chan);
+        worker->buff = (char *) malloc(worker->buff_len);
 
+        if (NULL == worker->buff) {
             break;
-        default:
-            GROFS_HALT_FMT("Unexpected %s for path %s", grofs_root_child_type_to_str(path_spec->root_child_type), grofs_path_spec_full_path(path_spec));
+        }
     }
 
-    return ret;
-}
+    int ret = i == count ? 0 : -1;
+    unsigned int started = 0;
 
-static int grofs_node_init_from_path(struct grofs_node *node, const char *path) {
-    struct grofs_path_spec *path_spec;
-
-    int ret = grofs_parse_path(&path_spec, path);
-
-    if (ret != 0) {
-        return ret;
+    if (0 == ret && fuse_start_cleanup_thread(fuse) != 0) {
+        ret = -1;
     }
 
-    node->root_child_type = path_spec->root_child_type;
-    node->entry_type = path_spec->entry_type;
-    node->size = 0;
-    node->time = grofs_started_time;
+    if (0 == ret) {
+        grofs_workers.session = session;
+        grofs_workers.items = workers;
+        grofs_workers.count = count;
 
-    ret = grofs_resolve_node_for_path_spec(node, path_spec);
+        sem_init(&grofs_workers.finished, 0, 0);
 
-    grofs_free_path_spec(path_spec);
+        grofs_stats_set_extra_writer(grofs_workers_write_stats);
 
-    return ret;
-}
+        // signals are left to this thread, which is woken up by them, workers and pools started from init inherit the mask
+        sigset_t blocked;
+        sigset_t previous;
 
-static int grofs_resolve_node_for_path(struct grofs_node **node, const char *path) {
-    struct grofs_node *new_node = (struct grofs_node *) malloc(sizeof(struct grofs_node));
+        sigfillset(&blocked);
+        pthread_sigmask(SIG_BLOCK, &blocked, &previous);
 
-    if (NULL == new_node) {
-        return ENOMEM;
-    }
+        for (started = 0; started < count; started++) {
+            if (pthread_create(&workers[started].thread, NULL, grofs_worker_thread, workers + started) != 0) {
+                fprintf(stderr, "Failed to start worker %u\n", started);
 
-    int ret = grofs_node_init_from_path(new_node, path);
+                fuse_session_exit(session);
 
-    if (0 == ret) {
-        *node = new_node;
+                ret = -1;
 
-        return 0;
-    }
+                break;
+            }
+        }
 
-    free(new_node);
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
 
-    return ret;
-}
+        // woken up by a worker which stopped or by a signal
+        while (!fuse_session_exited(session)) {
+            sem_wait(&grofs_workers.finished);
+        }
 
-static int grofs_write_bin_with_local_cancel(int fd, const char *data) {
-    if (*grofs_should_stop_local) {
-        return ECANCELED;
-    }
+        for (i = 0; i < started; i++) {
+            pthread_cancel(workers[i].thread);
+            pthread_join(workers[i].thread, NULL);
+        }
 
-    int ret = write(fd, data, strlen(data) + 1);
+        grofs_stats_set_extra_writer(NULL);
 
-    if (ret < 0) {
-        return errno;
-    }
+        sem_destroy(&grofs_workers.finished);
 
-    return 0;
-}
+        grofs_workers.items = NULL;
+        grofs_workers.count = 0;
 
-// Returns negative because of https://github.com/libgit2/libgit2/issues/4946
-static int grofs_readdir_git_collect_object_cb(const git_oid *id, void *payload) {
-    if (*grofs_should_stop_local) {
-        return -ECANCELED;
+        fuse_stop_cleanup_thread(fuse);
     }
 
-    git_object *obj;
-
-    struct grofs_readdir_context *context = (struct grofs_readdir_context *) payload;
+    for (i = 0; i < count; i++) {
+        if (workers[i].cloned) {
+            fuse_chan_destroy(workers[i].chan);
+        }
 
-    if (0 != git_object_lookup(&obj, grofs_repo, id, context->wanted_type)) {
-        return 0;
+        free(workers[i].buff);
     }
 
-    char sha[GIT_OID_HEXSZ + 1];
-
-    git_oid_tostr(sha, GIT_OID_HEXSZ + 1, id);
-
-    int ret = -grofs_write_bin_with_local_cancel(context->fd, sha);
+    free(workers);
 
-    git_object_free(obj);
+    fuse_session_reset(session);
 
     return ret;
 }
 
-static void grofs_dir_iter_root(int fd, void *iter_payload) {
-    (void) iter_payload;
+static int grofs_serve_with_workers(void) {
+    char *mountpoint;
+    int multithreaded;
 
-    if (grofs_write_bin_with_local_cancel(fd, GROFS_STR_COMMITS)) {
-        return ;
-    }
-    if (grofs_write_bin_with_local_cancel(fd, GROFS_STR_BLOBS)) {
-        return ;
-    }
-}
-
-static void grofs_dir_iter_commit_id(int fd, void *iter_payload) {
-    grofs_write_bin_with_local_cancel(fd, GROFS_STR_TREE);
+    // same as fuse_main() apart from the loop, it mounts, daemonizes and sets up signal handlers
+    struct fuse *fuse = fuse_setup(grofs_args.argc, grofs_args.argv, &grofs_fuse_operations, sizeof(grofs_fuse_operations), &mountpoint, &multithreaded, grofs_fs);
 
-    if (grofs_git_commit_has_parent((git_oid *) iter_payload)) {
-        grofs_write_bin_with_local_cancel(fd, GROFS_STR_PARENT);
+    if (NULL == fuse) {
+        return 1;
     }
-}
-
-static void grofs_dir_iter_commit_list(int fd, void *iter_payload) {
-    (void) iter_payload;
 
-    struct grofs_readdir_context context = {
-        .fd = fd,
-        .wanted_type = GIT_OBJ_COMMIT
-    };
+    // -s asks for a single thread
+    int ret = multithreaded ? grofs_workers_loop(fuse) : fuse_loop(fuse);
 
-    git_odb *odb;
-    git_repository_odb(&odb, grofs_repo);
+    fuse_teardown(fuse, mountpoint);
 
-    git_odb_foreach(odb, grofs_readdir_git_collect_object_cb, &context);
-
-    git_odb_free(odb);
+    return -1 == ret ? 1 : 0;
 }
 
-static void grofs_dir_iter_for_blob_list(int fd, void *iter_payload) {
-    (void) iter_payload;
+static int grofs_readdir_write_cb(const char *name, void *payload) {
+    struct grofs_readdir_thread_data *thread_data = (struct grofs_readdir_thread_data *) payload;
 
-    struct grofs_readdir_context context = {
-        .fd = fd,
-        .wanted_type = GIT_OBJ_BLOB
-    };
+    if (thread_data->should_stop) {
+        return ECANCELED;
+    }
 
-    git_odb *odb;
-    git_repository_odb(&odb, grofs_repo);
+    int ret = write(thread_data->fd, name, strlen(name) + 1);
 
-    git_odb_foreach(odb, grofs_readdir_git_collect_object_cb, &context);
+    if (ret < 0) {
+        return errno;
+    }
 
-    git_odb_free(odb);
+    return 0;
 }
 
-static void grofs_dir_iter_for_blob_list_tree(int fd, void *iter_payload) {
-    git_tree *tree = (git_tree *) iter_payload;
+static int grofs_readdir_write_block_cb(const char *names, size_t len, size_t count, void *payload) {
+    (void) count;
 
-    size_t count = git_tree_entrycount(tree);
+    struct grofs_readdir_thread_data *thread_data = (struct grofs_readdir_thread_data *) payload;
 
-    size_t i = 0;
-
-    for (i = 0; i < count; i++) {
-        const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
-
-        if (NULL == entry) {
-            return;
+    while (len > 0) {
+        if (thread_data->should_stop) {
+            return ECANCELED;
         }
 
-        git_otype entry_type = git_tree_entry_type(entry);
+        ssize_t written = write(thread_data->fd, names, len);
 
-        if (GIT_OBJ_BLOB != entry_type && GIT_OBJ_TREE != entry_type) {
-            continue ;
-        }
-
-        const char *entry_name = git_tree_entry_name(entry);
+        if (written < 0) {
+            if (EINTR == errno) {
+                continue ;
+            }
 
-        if (grofs_write_bin_with_local_cancel(fd, entry_name)) {
-            return ;
+            return errno;
         }
-    }
-}
 
-static void grofs_dir_iter_for_blob_list_tree_oid(int fd, void *iter_payload) {
-    git_tree *tree;
-    if (git_tree_lookup(&tree, grofs_repo, (git_oid *) iter_payload) != 0) {
-        return ;
+        names += written;
+        len -= written;
     }
 
-    grofs_dir_iter_for_blob_list_tree(fd, (void *) tree);
-
-    git_tree_free(tree);
+    return 0;
 }
 
 static void *grofs_readdir_thread(void *data) {
     struct grofs_readdir_thread_data *thread_data = (struct grofs_readdir_thread_data *) data;
 
-    grofs_should_stop_local = &thread_data->should_stop;
+    sigset_t blocked;
+
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGPIPE);
 
-    if (grofs_write_bin_with_local_cancel(thread_data->fd, ".")) {
+    // releasedir stops the thread by closing the read end, a write then fails with EPIPE rather than raising SIGPIPE
+    pthread_sigmask(SIG_BLOCK, &blocked, NULL);
+
+    if (grofs_readdir_write_cb(".", thread_data)) {
         close(thread_data->fd);
 
         return NULL;
     }
 
-    if (grofs_write_bin_with_local_cancel(thread_data->fd, "..")) {
+    if (grofs_readdir_write_cb("..", thread_data)) {
         close(thread_data->fd);
 
         return NULL;
     }
 
-    thread_data->iter(thread_data->fd, thread_data->iter_payload);
+    grofs_dir_list_blocks(thread_data->dir, grofs_readdir_write_block_cb, thread_data);
 
     close(thread_data->fd);
 
     return NULL;
 }
 
-static int grofs_open_dir_create_thread_data(struct grofs_readdir_thread_data *thread_data, const struct grofs_node *node) {
-    thread_data->should_stop = 0;
-
-    if (ROOT == node->root_child_type) {
-        thread_data->iter = grofs_dir_iter_root;
-
-        return 0;
-    } else if (COMMIT == node->root_child_type && LIST == node->entry_type) {
-        thread_data->iter = grofs_dir_iter_commit_list;
-
-        return 0;
-    } else if (BLOB == node->root_child_type && LIST == node->entry_type) {
-        thread_data->iter = grofs_dir_iter_for_blob_list;
-
-        return 0;
-    } else if (COMMIT == node->root_child_type && ID == node->entry_type) {
-        git_oid *oid = (git_oid *) malloc(sizeof(git_oid));
-
-        if (NULL == oid) {
-            return ENOMEM;
-        }
-
-        git_oid_cpy(oid, &node->oid);
-
-        thread_data->iter = grofs_dir_iter_commit_id;
-        thread_data->iter_payload = oid;
-
-        return 0;
-    } else if (
-        PATH_IN_GIT == node->entry_type
-        ||
-        (COMMIT == node->root_child_type && TREE == node->entry_type)
-    ) {
-        git_oid *oid = (git_oid *) malloc(sizeof(git_oid));
-
-        if (NULL == oid) {
-            return ENOMEM;
-        }
-
-        git_oid_cpy(oid, &node->oid);
-
-        thread_data->iter = grofs_dir_iter_for_blob_list_tree_oid;
-        thread_data->iter_payload = oid;
-
-        return 0;
-    }
-
-    return ENOENT;
-}
-
 static int grofs_spawn_read_thread(struct grofs_dir_handle *dir_handle) {
     int fds[2];
 
@@ -1001,7 +921,7 @@ static int grofs_spawn_read_thread(struct grofs_dir_handle *dir_handle) {
     return ret;
 }
 
-static int grofs_opendir_create_dir_handle_from_node(struct grofs_dir_handle **dir_handle, struct grofs_node *node) {
+static int grofs_opendir_create_dir_handle(struct grofs_dir_handle **dir_handle, struct grofs_dir *dir) {
     struct grofs_dir_handle *new_dir_handle = (struct grofs_dir_handle *) malloc(sizeof(struct grofs_dir_handle));
 
     if (NULL == new_dir_handle) {
@@ -1020,13 +940,10 @@ static int grofs_opendir_create_dir_handle_from_node(struct grofs_dir_handle **d
     new_dir_handle->buff.pos = 0;
     new_dir_handle->buff.size = GROFS_READDIR_BUFF_LEN;
 
-    new_dir_handle->thread_data.iter_payload = NULL;
+    new_dir_handle->thread_data.dir = dir;
+    new_dir_handle->thread_data.should_stop = 0;
 
-    int ret = grofs_open_dir_create_thread_data(&(new_dir_handle->thread_data), node);
-
-    if (0 == ret) {
-        ret = grofs_spawn_read_thread(new_dir_handle);
-    }
+    int ret = grofs_spawn_read_thread(new_dir_handle);
 
     if (0 == ret) {
         *dir_handle = new_dir_handle;
@@ -1034,6 +951,7 @@ static int grofs_opendir_create_dir_handle_from_node(struct grofs_dir_handle **d
         return 0;
     }
 
+    free(new_dir_handle->buff.data);
     free(new_dir_handle);
 
     return ret;
@@ -1042,26 +960,26 @@ static int grofs_opendir_create_dir_handle_from_node(struct grofs_dir_handle **d
 static int grofs_fill_from_dir_handle(struct grofs_dir_handle *dir_handle, void *buffer, fuse_fill_dir_t filler) {
     struct grofs_buff *buff = &dir_handle->buff;
 
-    size_t start = buff->pos;
-
-    while (start < buff->len) {
-        if (*(buff->data + start) != '\0') {
-            start++;
+    while (buff->pos < buff->len) {
+        char *name = buff->data + buff->pos;
+        char *end = (char *) memchr(name, '\0', buff->len - buff->pos);
 
-            continue;
+        // rest of the name is still in the pipe
+        if (NULL == end) {
+            break;
         }
 
-        if (start == buff->pos) {
+        if (end == name) {
             GROFS_HALT("Unexpected empty line");
         }
 
-        size_t new_offset = dir_handle->last_offset + start - buff->pos;
+        size_t new_offset = dir_handle->last_offset + (end - name);
 
-        if (filler(buffer, buff->data + buff->pos, NULL, new_offset) == 1) {
+        if (filler(buffer, name, NULL, new_offset) == 1) {
             return 1;
         }
 
-        buff->pos = ++start;
+        buff->pos += end - name + 1;
         dir_handle->last_offset = new_offset;
     }
 
@@ -1100,150 +1018,79 @@ static int grofs_buff_realloc(struct grofs_buff *buff) {
     return 0;
 }
 
+// Closes read_fd as well, draining the pipe instead could leave the thread blocked on a write of a block larger than
+// what the pipe holds
 static void grofs_releasedir_close_thread(int read_fd, pthread_t read_thr, struct grofs_readdir_thread_data *thread_data) {
     thread_data->should_stop = 1;
 
-    fcntl(read_fd, F_SETFL, fcntl(read_fd, F_GETFL) | O_NONBLOCK);
-
-    char buff[4096];
-
-    // @todo: would semaphores work better?
-    while (read(read_fd, buff, 4096) > 0);
+    close(read_fd);
 
     pthread_join(read_thr, NULL);
 }
 
-static struct grofs_file_handle *grofs_file_nandle_new(int buff_len) {
-    void *buff = malloc(sizeof(struct grofs_file_handle) + sizeof(char) * buff_len);
-
-    if (NULL == buff) {
-        return NULL;
-    }
-
-    struct grofs_file_handle *file_handle = (struct grofs_file_handle *) buff;
-
-    file_handle->buff = buff + sizeof(struct grofs_file_handle);
-    file_handle->len = buff_len;
-
-    return file_handle;
-}
-
-static void grofs_file_handle_free(struct grofs_file_handle *file_handle) {
-    free(file_handle);
-}
-
-static int grofs_open_node_commit_parent(const git_oid *oid, struct fuse_file_info * file_info) {
-    struct grofs_file_handle *file_handle = grofs_file_nandle_new(GIT_OID_HEXSZ);
-
-    if (NULL == file_handle) {
-        return ENOMEM;
-    }
-
-    git_oid_nfmt(file_handle->buff, GIT_OID_HEXSZ, oid);
-
-    file_info->fh = (uint64_t) file_handle;
-
-    return 0;
-}
-
-static int grofs_open_node_blob(const git_oid *oid, struct fuse_file_info *file_info) {
-    git_blob *blob;
-
-    if (git_blob_lookup(&blob, grofs_repo, oid) != 0) {
-        return ENOENT;
-    }
-
-    int size = git_blob_rawsize(blob);
-
-    struct grofs_file_handle *file_handle = grofs_file_nandle_new(size);
-
-    if (NULL == file_handle) {
-        return ENOMEM;
-    }
-
-    memcpy(file_handle->buff, git_blob_rawcontent(blob), size);
-
-    git_blob_free(blob);
-
-    file_info->fh = (uint64_t) file_handle;
-
-    return 0;
-}
-
-static int grofs_open_node(const struct grofs_node *node, struct fuse_file_info *file_info) {
-    if (COMMIT == node->root_child_type && PARENT == node->entry_type) {
-        return grofs_open_node_commit_parent(&node->oid, file_info);
-    } else if (PATH_IN_GIT == node->entry_type) {
-        return grofs_open_node_blob(&node->oid, file_info);
-    } else if (BLOB == node->root_child_type && ID == node->entry_type) {
-        return grofs_open_node_blob(&node->oid, file_info);
-    }
-
-    return ENOENT;
-}
-
-static int grofs_getattr(const char *path, struct stat *stat) {
+static int grofs_fuse_getattr(const char *path, struct stat *stat) {
     struct fuse_context *fuse_context = fuse_get_context();
 
-    struct grofs_node *node;
+    struct grofs_attr attr;
 
-    int ret = grofs_resolve_node_for_path(&node, path);
+    int ret = grofs_stat((struct grofs *) fuse_context->private_data, path, &attr);
 
     if (0 != ret) {
         return FUSE_ERR(ret);
     }
 
-    // @todo: remote globals through fuse data
     stat->st_uid = fuse_context->uid;
     stat->st_gid = fuse_context->gid;
 
-    switch (node->type) {
-        case DATA:
-            grofs_getattr_init_stat_as_file(stat, node->time, node->size);
+    switch (attr.type) {
+        case GROFS_ATTR_FILE:
+            grofs_getattr_init_stat_as_file(stat, attr.mtime, attr.size);
+
+            break;
+        case GROFS_ATTR_DIR:
+            grofs_getattr_init_stat_as_dir(stat, attr.mtime);
 
             break;
-        case DIR:
-            grofs_getattr_init_stat_as_dir(stat, node->time);
+        case GROFS_ATTR_LINK:
+            grofs_getattr_init_stat_as_link(stat, attr.mtime, attr.size);
 
             break;
         default:
-        GROFS_HALT_FMT("Unexpected %s for path %s", grofs_node_type_to_str(node->type), path);
+        GROFS_HALT_FMT("Unexpected attr type %d for path %s", attr.type, path);
     }
 
-    free(node);
+    return 0;
+}
+
+static int grofs_fuse_readlink(const char *path, char *buff, size_t size) {
+    int ret = grofs_readlink((struct grofs *) fuse_get_context()->private_data, path, buff, size);
 
     return FUSE_ERR(ret);
 }
 
-static int grofs_opendir(const char *path, struct fuse_file_info *file_info) {
-    struct grofs_node *node;
+static int grofs_fuse_opendir(const char *path, struct fuse_file_info *file_info) {
+    struct grofs_dir *dir;
 
-    int ret = grofs_resolve_node_for_path(&node, path);
+    int ret = grofs_dir_open((struct grofs *) fuse_get_context()->private_data, path, &dir);
 
     if (0 != ret) {
         return FUSE_ERR(ret);
     }
 
-    if (DATA == node->type) {
-        free(node);
-
-        return FUSE_ERR(ENOTDIR);
-    }
-
     struct grofs_dir_handle *dir_handle;
 
-    ret = grofs_opendir_create_dir_handle_from_node(&dir_handle, node);
-
-    free(node);
+    ret = grofs_opendir_create_dir_handle(&dir_handle, dir);
 
     if (0 == ret) {
         file_info->fh = (uint64_t) dir_handle;
+    } else {
+        grofs_dir_close(dir);
     }
 
     return FUSE_ERR(ret);
 }
 
-static int grofs_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *file_info) {
+static int grofs_fuse_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *file_info) {
     (void) path;
 
     struct grofs_dir_handle *dir_handle = (struct grofs_dir_handle *) file_info->fh;
@@ -1269,8 +1116,12 @@ static int grofs_readdir(const char *path, void *buffer, fuse_fill_dir_t filler,
             return FUSE_ERR(ret);
         }
 
+        GROFS_PROBE1(readdir_pipe_entry, dir_handle->fd);
+
         ret = read(dir_handle->fd, buff->data + buff->len, sizeof(char) * GROFS_READDIR_BUFF_LEN);
 
+        GROFS_PROBE2(readdir_pipe_return, dir_handle->fd, ret);
+
         if (ret < 0) {
             return FUSE_ERR(errno);
         }
@@ -1281,113 +1132,275 @@ static int grofs_readdir(const char *path, void *buffer, fuse_fill_dir_t filler,
     return 0;
 }
 
-static int grofs_releasedir(const char *path, struct fuse_file_info *file_info) {
+static int grofs_fuse_releasedir(const char *path, struct fuse_file_info *file_info) {
     (void) path;
 
     struct grofs_dir_handle *dir_handle = (struct grofs_dir_handle *) file_info->fh;
 
-    if (NULL != dir_handle->thread_data.iter_payload) {
-        free(dir_handle->thread_data.iter_payload);
-    }
-
     if (NULL != dir_handle->buff.data) {
         free(dir_handle->buff.data);
     }
 
     grofs_releasedir_close_thread(dir_handle->fd, dir_handle->read_thr, &dir_handle->thread_data);
 
-    close(dir_handle->fd);
+    grofs_dir_close(dir_handle->thread_data.dir);
 
     free(dir_handle);
 
     return 0;
 }
 
-static int grofs_open(const char *path, struct fuse_file_info *file_info) {
+static int grofs_fuse_open(const char *path, struct fuse_file_info *file_info) {
     if (file_info->flags & (O_WRONLY | O_RDWR)) {
         return FUSE_ERR(EROFS);
     }
 
-    struct grofs_node *node;
+    struct grofs_file *file;
 
-    if (grofs_resolve_node_for_path(&node, path) != 0) {
-        return FUSE_ERR(ENOENT);
-    }
-
-    int ret = FUSE_ERR(ENOENT);
+    int ret = grofs_file_open((struct grofs *) fuse_get_context()->private_data, path, &file);
 
-    if (DIR == node->type) {
-        ret = FUSE_ERR(EISDIR);
-    } else if (DATA == node->type) {
-        ret = grofs_open_node(node, file_info);
+    if (0 != ret) {
+        return FUSE_ERR(ret);
     }
 
-    free(node);
+    int generated = grofs_file_is_generated(file);
 
-    return FUSE_ERR(ret);
+    // size reported by getattr is 0 so reads must not be limited by it
+    file_info->direct_io = generated;
+    // content of a path never changes, so pages cached by earlier opens stay valid and reads of hot files don't reach grofs
+    file_info->keep_cache = !generated && !grofs_cli_opts.no_keep_cache;
+    file_info->fh = (uint64_t) file;
+
+    return 0;
 }
 
-static int grofs_read(const char *path, char *buff, size_t size, off_t offset, struct fuse_file_info *file_info) {
+static int grofs_fuse_read(const char *path, char *buff, size_t size, off_t offset, struct fuse_file_info *file_info) {
     (void) path;
 
-    struct grofs_file_handle *file_handle = (struct grofs_file_handle *) file_info->fh;
+    size_t read_len;
 
-    if (offset >= file_handle->len) {
-        return 0;
-    }
-
-    int to_read = grofs_min(size, file_handle->len - offset);
+    int ret = grofs_file_read((struct grofs_file *) file_info->fh, buff, size, offset, &read_len);
 
-    memcpy(buff, file_handle->buff + offset, sizeof(char) * to_read);
+    if (0 != ret) {
+        return FUSE_ERR(ret);
+    }
 
-    return to_read;
+    return read_len;
 }
 
-static int grofs_release(const char* path, struct fuse_file_info *file_info) {
+static int grofs_fuse_release(const char* path, struct fuse_file_info *file_info) {
     (void) path;
 
-    grofs_file_handle_free((struct grofs_file_handle *) file_info->fh);
+    grofs_file_close((struct grofs_file *) file_info->fh);
 
     return 0;
 }
 
+#define GROFS_STATS_WRAP(op, call, fh, offset, size) \
+    struct timespec started; \
+    struct timespec finished; \
+    GROFS_PROBE2(op_entry, grofs_stats_op_names[op], path); \
+    clock_gettime(CLOCK_MONOTONIC, &started); \
+    int ret = call; \
+    clock_gettime(CLOCK_MONOTONIC, &finished); \
+    grofs_stats_record(op, &started, &finished, ret); \
+    if (NULL != grofs_trace) { \
+        grofs_trace_write(op, path, fh, offset, size, &started, &finished, ret); \
+    } \
+    GROFS_PROBE3(op_return, grofs_stats_op_names[op], path, ret); \
+    return ret
+
+static int grofs_stats_getattr(const char *path, struct stat *stat) {
+    GROFS_STATS_WRAP(GROFS_STATS_OP_GETATTR, grofs_fuse_getattr(path, stat), 0, 0, 0);
+}
+
+static int grofs_stats_readlink(const char *path, char *buff, size_t size) {
+    GROFS_STATS_WRAP(GROFS_STATS_OP_READLINK, grofs_fuse_readlink(path, buff, size), 0, 0, size);
+}
+
+static int grofs_stats_opendir(const char *path, struct fuse_file_info *file_info) {
+    GROFS_STATS_WRAP(GROFS_STATS_OP_OPENDIR, grofs_fuse_opendir(path, file_info), file_info->fh, 0, 0);
+}
+
+static int grofs_stats_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *file_info) {
+    GROFS_STATS_WRAP(GROFS_STATS_OP_READDIR, grofs_fuse_readdir(path, buffer, filler, offset, file_info), file_info->fh, offset, 0);
+}
+
+static int grofs_stats_releasedir(const char *path, struct fuse_file_info *file_info) {
+    GROFS_STATS_WRAP(GROFS_STATS_OP_RELEASEDIR, grofs_fuse_releasedir(path, file_info), file_info->fh, 0, 0);
+}
+
+static int grofs_stats_open(const char *path, struct fuse_file_info *file_info) {
+    GROFS_STATS_WRAP(GROFS_STATS_OP_OPEN, grofs_fuse_open(path, file_info), file_info->fh, 0, 0);
+}
+
+static int grofs_stats_read(const char *path, char *buff, size_t size, off_t offset, struct fuse_file_info *file_info) {
+    GROFS_STATS_WRAP(GROFS_STATS_OP_READ, grofs_fuse_read(path, buff, size, offset, file_info), file_info->fh, offset, size);
+}
+
+static int grofs_stats_release(const char* path, struct fuse_file_info *file_info) {
+    GROFS_STATS_WRAP(GROFS_STATS_OP_RELEASE, grofs_fuse_release(path, file_info), file_info->fh, 0, 0);
+}
+
+static void *grofs_init(struct fuse_conn_info *conn) {
+    (void) conn;
+
+    struct grofs *grofs = (struct grofs *) fuse_get_context()->private_data;
+
+    // threads have to be started here because fuse_main forks when it daemonizes
+    if (grofs_start(grofs) != 0) {
+        fprintf(stderr, "Failed to start background threads\n");
+    }
+
+    return grofs;
+}
+
+static void grofs_destroy(void *private_data) {
+    grofs_stop((struct grofs *) private_data);
+}
+
+static int grofs_open_cli_repos(void) {
+    if (0 == grofs_cli_repos.count) {
+        struct grofs_repo_spec repo = {
+            .name = NULL,
+            .path = grofs_repo_path
+        };
+
+        return grofs_open_repositories(&grofs_fs, &repo, 1, &grofs_cli_opts.options);
+    }
+
+    struct grofs_repo_spec *repos = (struct grofs_repo_spec *) malloc(sizeof(struct grofs_repo_spec) * grofs_cli_repos.count);
+
+    if (NULL == repos) {
+        return ENOMEM;
+    }
+
+    size_t i;
+
+    // items are owned by the list, splitting them in place is fine
+    for (i = 0; i < grofs_cli_repos.count; i++) {
+        char *separator = strchr(grofs_cli_repos.items[i], '=');
+
+        if (NULL == separator || '\0' == separator[1]) {
+            fprintf(stderr, "Repository must be given as NAME=PATH: %s\n", grofs_cli_repos.items[i]);
+
+            free(repos);
+
+            return EINVAL;
+        }
+
+        *separator = '\0';
+
+        repos[i].name = grofs_cli_repos.items[i];
+        repos[i].path = separator + 1;
+    }
+
+    int ret = grofs_open_repositories(&grofs_fs, repos, grofs_cli_repos.count, &grofs_cli_opts.options);
+
+    free(repos);
+
+    return ret;
+}
+
 static void grofs_print_help(const char *bin_path) {
     const char *help_format =
         "usage: %s git-repo-path mount-point [options]\n"
+        "       %s --repo=NAME=PATH... mount-point [options]\n"
         "\n"
         "Mounts local Git repository and exposes commits/blobs as folders/files.\n"
         "\n"
         "grofs options:\n"
         "    -h   --help            print help\n"
         "    -V   --version         print version\n"
+        "         --repo=NAME=PATH  serve repository at PATH under /NAME, can be repeated,\n"
+        "                           repositories share threads and caches\n"
+        "         --scope=REV       expose only commits and blobs reachable from REV\n"
+        "                           (ref, revision, range A..B or ref glob), can be repeated\n"
+        "         --preload=REV     load trees and blob sizes of REV in background after mount,\n"
+        "                           can be repeated, progress is in /" GROFS_STR_CONTROL "/" GROFS_STR_CONTROL_PRELOAD "\n"
+        "         --preload-path=GLOB\n"
+        "                           preload only paths matching GLOB, can be repeated\n"
+        "         --preload-blobs   preload blob content as well\n"
+        "         --bg-threads=N    number of background threads (default: %d)\n"
+        "         --blob-cache-size=MB\n"
+        "                           memory for blob content cache (default: %d)\n"
+        "         --meta-cache-size=MB\n"
+        "                           memory for blob type and size cache (default: %d)\n"
+        "         --compressed-cache-size=MB\n"
+        "                           memory for LZ4 compressed copies of blobs evicted from blob\n"
+        "                           cache, 0 disables it (default: %d)%s\n"
+        "         --prefetch-threads=N\n"
+        "                           number of low priority threads which load blobs of a tree\n"
+        "                           once its files are opened one after another, 0 disables\n"
+        "                           prefetching (default: %d)\n"
+        "         --prefetch-budget=MB\n"
+        "                           memory for prefetched blobs which were not opened yet\n"
+        "                           (default: %d)\n"
+        "         --no-attr-prefetch\n"
+        "                           don't load sizes of all tree entries in background when\n"
+        "                           tree is opened as a directory\n"
+        "         --bulk-threads=N  number of low priority threads which inflate large blobs,\n"
+        "                           0 inflates them on the thread serving open (default: %d)\n"
+        "         --bulk-size=KB    blobs at least this large are inflated by bulk threads\n"
+        "                           (default: %d)\n"
+        "         --listing-slots=N\n"
+        "                           number of concurrent listings of commits/ or blobs/ which\n"
+        "                           enumerate the object database, 0 for no limit (default: %d)\n"
+        "         --spill-dir=DIR   write large blobs into DIR once inflated so that later reads\n"
+        "                           at any offset cost only the range read, files are named by\n"
+        "                           blob id and are kept after unmount\n"
+        "         --spill-size=KB   blobs at least this large are spilled (default: %d)\n"
+        "         --chunked-size=KB blobs at least this large are cached as content defined chunks\n"
+        "                           which versions of a file share, 0 caches blobs whole (default: 0)\n"
+        "         --mtime-depth=N   number of commits searched for the last one changing a path\n"
+        "                           which gives the path its mtime, 0 gives every path commit\n"
+        "                           time (default: %d)\n"
+        "         --mtime-index=DIR keep what commits searched for mtime changed in DIR, one file\n"
+        "                           per repository, so that later mounts don't diff them again\n"
+        "         --index-sizes     follow each id in commits.idx and blobs.idx by object size\n"
+        "                           as 8 bytes big endian, which reads header of every object\n"
+        "         --memory-pressure=PCT\n"
+        "                           halve caches each second while memory pressure (PSI some\n"
+        "                           avg10) is at least PCT or cgroup is near memory.max\n"
+        "                           (default: %d)\n"
+        "         --no-memory-governor\n"
+        "                           keep cache sizes regardless of memory pressure\n"
+        "         --grep-threads=N  number of threads searching blobs of a commit along with\n"
+        "                           the one opening commits/<sha>/grep/<pattern> (default: %d)\n"
+        "         --grep-cache-size=MB\n"
+        "                           memory for results of searches (default: %d)\n"
+        "         --no-keep-cache   drop kernel page cache of a file each time it's opened\n"
+        "         --trace=FILE      record every operation into FILE, see bench/replay.c\n"
+        "         --trace-size=MB   size of trace file, oldest operations are overwritten once\n"
+        "                           it's full (default: %d)\n"
+        "         --workers=N       serve requests by N threads each reading its own clone of\n"
+        "                           /dev/fuse, 0 uses FUSE's own thread pool (default: 0)\n"
+        "         --worker-cpus=LIST\n"
+        "                           pin workers round-robin to CPUs in LIST, e.g. 0-7,16-23\n"
+        "                           or cpulist of a NUMA node from /sys/devices/system/node/,\n"
+        "                           needs --workers\n"
         "\n";
 
-    fprintf(stderr, help_format, bin_path);
+    fprintf(stderr, help_format, bin_path, bin_path, GROFS_DEFAULT_BG_THREADS, GROFS_DEFAULT_BLOB_CACHE_MB, GROFS_DEFAULT_META_CACHE_MB, GROFS_DEFAULT_COMPRESSED_CACHE_MB, GROFS_HELP_LZ4_NOTE, GROFS_DEFAULT_PREFETCH_THREADS, GROFS_DEFAULT_PREFETCH_BUDGET_MB, GROFS_DEFAULT_BULK_THREADS, GROFS_DEFAULT_BULK_MIN_KB, GROFS_DEFAULT_LISTING_SLOTS, GROFS_DEFAULT_SPILL_MIN_KB, GROFS_DEFAULT_MTIME_DEPTH, GROFS_DEFAULT_MEMORY_PRESSURE_PCT, GROFS_DEFAULT_GREP_THREADS, GROFS_DEFAULT_GREP_CACHE_MB, GROFS_DEFAULT_TRACE_MB);
 }
 
+#ifndef GROFS_NO_MAIN
 int main(int argc, char **argv) {
-    grofs_started_time = time(NULL);
-
-    git_libgit2_init();
-
     atexit(grofs_cleanup_on_exit_cb);
 
+    grofs_options_init(&grofs_cli_opts.options);
+
     grofs_args.argc = argc;
     grofs_args.argv = argv;
     grofs_args.allocated = 0;
 
-    struct grofs_cli_opts cli_opts = {
-        .show_version = 0,
-        .show_help = 0
-    };
-
-    if(fuse_opt_parse(&grofs_args, &cli_opts, grofs_fuse_opts, grofs_fuse_args_process_cb) == -1) {
+    if(fuse_opt_parse(&grofs_args, &grofs_cli_opts, grofs_fuse_opts, grofs_fuse_args_process_cb) == -1) {
         fprintf(stderr, "Failed to parse options");
 
         return 1;
     }
 
-    if (cli_opts.show_help) {
+    if (grofs_cli_opts.show_help) {
         grofs_print_help(grofs_args.argv[0]);
 
         fuse_opt_add_arg(&grofs_args, "-ho");
@@ -1395,7 +1408,7 @@ int main(int argc, char **argv) {
         return fuse_main(grofs_args.argc, grofs_args.argv, &grofs_fuse_operations, NULL);
     }
 
-    if (cli_opts.show_version) {
+    if (grofs_cli_opts.show_version) {
         fprintf(stderr, "grofs version: %s\n", GROFS_VERSION);
 
         fuse_opt_add_arg(&grofs_args, "--version");
@@ -1403,7 +1416,12 @@ int main(int argc, char **argv) {
         return fuse_main(grofs_args.argc, grofs_args.argv, &grofs_fuse_operations, NULL);
     }
 
-    if (NULL == grofs_repo_path) {
+    // mount point came before the first --repo so it was taken for repository path
+    if (grofs_cli_repos.count > 0 && NULL != grofs_repo_path) {
+        fuse_opt_add_arg(&grofs_args, grofs_repo_path);
+    }
+
+    if (NULL == grofs_repo_path && 0 == grofs_cli_repos.count) {
         fprintf(stderr, "Git repository path not provided\n\n");
 
         grofs_print_help(grofs_args.argv[0]);
@@ -1411,13 +1429,54 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    int error = git_repository_open(&grofs_repo, grofs_repo_path);
+    if (0 == grofs_cli_opts.options.bg_threads) {
+        fprintf(stderr, "Number of background threads must be positive\n");
 
-    if (0 != error) {
-        fprintf(stderr, "Failed to find Git repository at path: %s\n", grofs_repo_path);
+        return 1;
+    }
+
+    grofs_cli_opts.options.scope_revs = grofs_cli_scope_revs.items;
+    grofs_cli_opts.options.scope_revs_count = grofs_cli_scope_revs.count;
+    grofs_cli_opts.options.preload_revs = grofs_cli_preload_revs.items;
+    grofs_cli_opts.options.preload_revs_count = grofs_cli_preload_revs.count;
+    grofs_cli_opts.options.preload_paths = grofs_cli_preload_paths.items;
+    grofs_cli_opts.options.preload_paths_count = grofs_cli_preload_paths.count;
+
+    if (grofs_cli_opts.workers > GROFS_MAX_WORKERS) {
+        fprintf(stderr, "Number of workers can't exceed %d\n", GROFS_MAX_WORKERS);
 
         return 1;
     }
 
-    return fuse_main(grofs_args.argc, grofs_args.argv, &grofs_fuse_operations, NULL);
+    if (NULL != grofs_cli_opts.worker_cpus) {
+        if (0 == grofs_cli_opts.workers) {
+            fprintf(stderr, "Worker CPUs need --workers\n");
+
+            return 1;
+        }
+
+        if (0 != grofs_cpu_list_parse(grofs_cli_opts.worker_cpus, &grofs_workers.cpus, &grofs_workers.cpus_count)) {
+            fprintf(stderr, "Invalid list of worker CPUs: %s\n", grofs_cli_opts.worker_cpus);
+
+            return 1;
+        }
+    }
+
+    if (0 != grofs_open_cli_repos()) {
+        return 1;
+    }
+
+    // mapping is shared so it survives fork done by fuse_main when it daemonizes
+    if (NULL != grofs_cli_opts.trace_path && 0 != grofs_trace_open(grofs_cli_opts.trace_path, (size_t) grofs_cli_opts.trace_mb * GROFS_MB)) {
+        fprintf(stderr, "Failed to create trace file: %s\n", grofs_cli_opts.trace_path);
+
+        return 1;
+    }
+
+    if (grofs_cli_opts.workers > 0) {
+        return grofs_serve_with_workers();
+    }
+
+    return fuse_main(grofs_args.argc, grofs_args.argv, &grofs_fuse_operations, grofs_fs);
 }
+#endif
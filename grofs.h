@@ -0,0 +1,99 @@
+#ifndef GROFS_H
+#define GROFS_H
+
+// libgrofs, in-process access to the tree grofs mounts: commits/, blobs/, their sorted id files commits.idx and
+// blobs.idx, links to commits of refs at a given time in at/, searches of commits in commits/<sha>/grep/, and
+// .grofs/ of a Git repository.
+//
+// Paths are the ones seen below the mount point, e.g. "/commits/<sha>/tree/README.md", or
+// "/<name>/commits/<sha>/tree/README.md" when repositories are opened by name. Functions
+// returning int return 0 on success or an errno value. Handles may be used from any thread.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct grofs;
+struct grofs_dir;
+struct grofs_file;
+
+struct grofs_options {
+    unsigned int bg_threads;
+    unsigned int blob_cache_mb;
+    unsigned int compressed_cache_mb; // blobs evicted from blob cache are kept LZ4 compressed, needs grofs built with LZ4
+    unsigned int meta_cache_mb;
+    unsigned int prefetch_threads; // 0 disables prefetching of blobs of a tree whose files are opened one after another
+    unsigned int prefetch_budget_mb;
+    unsigned int bulk_threads; // low priority threads inflating large blobs, 0 inflates them on the opening thread
+    unsigned int bulk_min_kb; // blobs at least this large are inflated by bulk threads
+    unsigned int listing_slots; // concurrent listings of the whole object database, 0 doesn't limit them
+    const char *spill_dir; // large blobs are written here once inflated and later read by ranges, NULL keeps them in memory only
+    unsigned int spill_min_kb;
+    unsigned int chunk_min_kb; // blobs at least this large are cached as content defined chunks shared by their versions, 0 caches them whole
+    unsigned int mtime_depth; // commits searched for the last one changing a path, 0 gives every path commit time
+    const char *mtime_index_dir; // what commits changed is appended to a file per repository here, NULL keeps it in memory only
+    int index_sizes; // records of commits.idx and blobs.idx get object size after oid
+    int no_memory_governor;
+    unsigned int memory_pressure_pct; // caches shrink while share of time stalled on memory (PSI some avg10) is at least this
+    int no_attr_prefetch;
+    unsigned int grep_threads; // search commits/<sha>/grep/<pattern> along with the thread opening it, 0 searches on that thread only
+    unsigned int grep_cache_mb;
+    int preload_blobs;
+    char * const *scope_revs; // expose only commits and blobs reachable from these revisions
+    size_t scope_revs_count;
+    char * const *preload_revs; // load trees and blob sizes of these revisions in background once opened
+    size_t preload_revs_count;
+    char * const *preload_paths; // globs limiting preload
+    size_t preload_paths_count;
+};
+
+enum grofs_attr_type {
+    GROFS_ATTR_FILE, GROFS_ATTR_DIR, GROFS_ATTR_LINK
+};
+
+struct grofs_repo_spec {
+    const char *name; // served under /<name>/, only a single repository may leave it NULL to be served at /
+    const char *path;
+};
+
+struct grofs_attr {
+    enum grofs_attr_type type;
+    uint64_t size; // 0 for files under .grofs/ and results of searches since their content is generated on open, for commits.idx and blobs.idx until first opened, length of target for links
+    int64_t mtime; // time of last commit changing the path for paths inside a commit, mount time otherwise
+};
+
+// Return non-zero to stop listing, the value is then returned by grofs_dir_list()
+typedef int (*grofs_list_cb)(const char *name, void *payload);
+
+void grofs_options_init(struct grofs_options *options);
+
+// Only one instance can be open in a process at a time, EBUSY is returned otherwise
+int grofs_open(struct grofs **grofs, const char *repo_path, const struct grofs_options *options);
+// Repositories share threads and caches, options apply to each of them
+int grofs_open_repos(struct grofs **grofs, const struct grofs_repo_spec *repos, size_t repos_count, const struct grofs_options *options);
+void grofs_close(struct grofs *grofs);
+
+int grofs_stat(struct grofs *grofs, const char *path, struct grofs_attr *attr);
+// Target of a link under at/, relative to the link, is NUL terminated and truncated to fit size
+int grofs_readlink(struct grofs *grofs, const char *path, char *buff, size_t size);
+
+int grofs_dir_open(struct grofs *grofs, const char *path, struct grofs_dir **dir);
+int grofs_dir_list(struct grofs_dir *dir, grofs_list_cb cb, void *payload);
+void grofs_dir_close(struct grofs_dir *dir);
+int grofs_list(struct grofs *grofs, const char *path, grofs_list_cb cb, void *payload);
+
+int grofs_file_open(struct grofs *grofs, const char *path, struct grofs_file **file);
+uint64_t grofs_file_size(const struct grofs_file *file);
+int grofs_file_is_generated(const struct grofs_file *file);
+int grofs_file_read(struct grofs_file *file, char *buff, size_t size, uint64_t offset, size_t *read_len);
+void grofs_file_close(struct grofs_file *file);
+int grofs_read(struct grofs *grofs, const char *path, char *buff, size_t size, uint64_t offset, size_t *read_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef GROFS_INTERNAL_H
+#define GROFS_INTERNAL_H
+
+// Shared by libgrofs.c and the FUSE glue in grofs.c, not installed
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "grofs.h"
+
+// USDT probes are a single nop each until a tracer attaches, build with -DGROFS_NO_PROBES to leave them out entirely
+#if !defined(GROFS_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define GROFS_HAVE_PROBES
+#endif
+#endif
+
+#ifdef GROFS_HAVE_PROBES
+#define GROFS_PROBE1(name, a1) DTRACE_PROBE1(grofs, name, a1)
+#define GROFS_PROBE2(name, a1, a2) DTRACE_PROBE2(grofs, name, a1, a2)
+#define GROFS_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(grofs, name, a1, a2, a3)
+#else
+#define GROFS_PROBE1(name, a1)
+#define GROFS_PROBE2(name, a1, a2)
+#define GROFS_PROBE3(name, a1, a2, a3)
+#endif
+
+#define GROFS_STR_COMMITS "commits"
+#define GROFS_STR_BLOBS "blobs"
+#define GROFS_STR_COMMITS_INDEX "commits.idx"
+#define GROFS_STR_BLOBS_INDEX "blobs.idx"
+#define GROFS_STR_AT "at"
+#define GROFS_STR_TREE "tree"
+#define GROFS_STR_PARENT "parent"
+#define GROFS_STR_GREP "grep"
+#define GROFS_STR_CONTROL ".grofs"
+#define GROFS_STR_CONTROL_PRELOAD "preload"
+#define GROFS_STR_CONTROL_STATS "stats"
+
+#define GROFS_VERSION "0.1.0-alpha"
+
+#define GROFS_LOGIC_ERROR 64
+
+// Halts in case of a logic error because it's better to exit since we don't know what else could be wrong
+#define GROFS_HALT_FMT(fmt, ...) fprintf(stderr, "ERROR [file: %s, line: %d]: " fmt, __FILE__, __LINE__, __VA_ARGS__); exit(GROFS_LOGIC_ERROR)
+#define GROFS_HALT(fmt) GROFS_HALT_FMT(fmt "%s", "")
+
+#define GROFS_MB (1024 * 1024)
+#define GROFS_DEFAULT_BG_THREADS 4
+#define GROFS_DEFAULT_BLOB_CACHE_MB 256
+#define GROFS_DEFAULT_COMPRESSED_CACHE_MB 64
+#define GROFS_DEFAULT_META_CACHE_MB 32
+#define GROFS_DEFAULT_PREFETCH_THREADS 2
+#define GROFS_DEFAULT_PREFETCH_BUDGET_MB 64
+#define GROFS_DEFAULT_BULK_THREADS 2
+#define GROFS_DEFAULT_BULK_MIN_KB 1024
+#define GROFS_DEFAULT_LISTING_SLOTS 1
+#define GROFS_DEFAULT_SPILL_MIN_KB (16 * 1024)
+#define GROFS_DEFAULT_MTIME_DEPTH 1000
+#define GROFS_DEFAULT_MEMORY_PRESSURE_PCT 10
+#define GROFS_DEFAULT_GREP_THREADS 4
+#define GROFS_DEFAULT_GREP_CACHE_MB 16
+
+struct grofs_str_list {
+    char **items;
+    size_t count;
+};
+
+enum grofs_stats_op {
+    GROFS_STATS_OP_GETATTR,
+    GROFS_STATS_OP_OPENDIR,
+    GROFS_STATS_OP_READDIR,
+    GROFS_STATS_OP_RELEASEDIR,
+    GROFS_STATS_OP_OPEN,
+    GROFS_STATS_OP_READ,
+    GROFS_STATS_OP_RELEASE,
+    GROFS_STATS_OP_READLINK, // last so that traces recorded before it replay the same
+    GROFS_STATS_OP_COUNT
+};
+
+extern const char *grofs_stats_op_names[GROFS_STATS_OP_COUNT];
+
+int grofs_str_list_add(struct grofs_str_list *list, const char *str);
+void grofs_str_list_free(struct grofs_str_list *list);
+void grofs_stats_record(enum grofs_stats_op op, const struct timespec *started, const struct timespec *finished, int ret);
+// writer is called at the end of .grofs/stats, set before serving
+void grofs_stats_set_extra_writer(void (*writer)(FILE *out));
+
+// Names of a directory packed one after another, each NUL terminated, return non-zero to stop listing
+typedef int (*grofs_list_block_cb)(const char *names, size_t len, size_t count, void *payload);
+
+// grofs_dir_list() handing over names in blocks, ids of commits/ and blobs/ are formatted straight into them
+int grofs_dir_list_blocks(struct grofs_dir *dir, grofs_list_block_cb cb, void *payload);
+
+// grofs_open_repos() split in two for FUSE, which forks after repositories are opened when it daemonizes
+int grofs_open_repositories(struct grofs **grofs, const struct grofs_repo_spec *repos, size_t repos_count, const struct grofs_options *options);
+int grofs_start(struct grofs *grofs);
+void grofs_stop(struct grofs *grofs);
+
+#endif
@@ -0,0 +1,8288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <git2.h>
+#include <errno.h>
+#include <time.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <threads.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <fnmatch.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <ctype.h>
+#include <regex.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#ifdef GROFS_HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "grofs_internal.h"
+
+#define GROFS_GIT_OBJECT_ID_LEN GIT_OID_HEXSZ
+
+// listings of commits/ and blobs/ are handed to grofs_dir_list_blocks() callers in blocks of about 1600 ids
+#define GROFS_LIST_BLOCK_LEN (64 * 1024)
+
+enum grofs_dir_entry_type {
+    NONE, LIST, ID, PATH_IN_GIT, TREE, PARENT, REF, GREP, QUERY
+};
+
+enum grofs_root_child_type {
+    ROOT, COMMIT, BLOB, CONTROL, COMMIT_INDEX, BLOB_INDEX, AT
+};
+
+#define GROFS_PATH_INLINE_LEN 1024
+#define GROFS_PATH_INLINE_PARTS 64
+
+struct grofs_path_spec {
+    char *buff;
+    char **parts;
+    void *heap; // NULL when buff and parts are in caller's storage
+    int parts_count;
+    enum grofs_dir_entry_type entry_type;
+    enum grofs_root_child_type root_child_type;
+};
+
+// Paths which fit are parsed into this on the caller's stack, so that operations don't allocate
+struct grofs_path_storage {
+    char buff[GROFS_PATH_INLINE_LEN];
+    char *parts[GROFS_PATH_INLINE_PARTS];
+};
+
+enum grofs_node_type {
+    DATA /* since I can't have FILE */, DIR, LINK
+};
+
+struct grofs_control_file {
+    const char *name;
+    void (*write)(FILE *out);
+};
+
+struct grofs_node {
+    const struct grofs_repository *repo; // NULL for mount root and .grofs when repositories are named
+    enum grofs_node_type type;
+    enum grofs_dir_entry_type entry_type;
+    enum grofs_root_child_type root_child_type;
+    git_oid oid;
+    git_oid parent_oid; // tree holding the entry, only for PATH_IN_GIT
+    time_t time;
+    size_t size;
+    const struct grofs_control_file *control_file;
+    int link_depth; // directories between a LINK and root of its repository
+    const char *query; // pattern of a QUERY, points into the path the node was resolved from
+};
+
+// Commits and blobs reachable from --scope revisions, sorted by oid
+struct grofs_scope {
+    git_oid *oids;
+    uint64_t *commit_bits; // bit is set if oid at that index is a commit, otherwise it's a blob
+    size_t count;
+};
+
+// Paths changed by a commit compared to its first parent, as hashes of paths relative to the root tree
+struct grofs_mtime_record {
+    struct grofs_mtime_record *next;
+    git_oid oid;
+    git_oid parent_oid; // zero for root commits
+    int64_t time;
+    uint32_t count;
+    uint64_t hashes[]; // sorted, directories of changed paths are included
+};
+
+// Persisted form of a record, followed by its hashes
+struct grofs_mtime_disk_record {
+    unsigned char oid[GIT_OID_RAWSZ];
+    unsigned char parent_oid[GIT_OID_RAWSZ];
+    int64_t time;
+    uint32_t count;
+    uint32_t check;
+};
+
+// Records of commits visited while looking for last modifying commits, loaded from and appended to a file
+struct grofs_mtime_index {
+    pthread_mutex_t lock;
+    struct grofs_mtime_record **buckets;
+    size_t buckets_count;
+    size_t count;
+    int fd; // -1 when records are kept in memory only
+};
+
+struct grofs_mtime_stats {
+    atomic_size_t loaded;
+    atomic_size_t built;
+    atomic_size_t lookups;
+    atomic_size_t steps;
+};
+
+// Sorted raw ids of all commits or blobs in a repository, optionally each followed by object size, built on first use
+struct grofs_object_index {
+    pthread_mutex_t lock;
+    atomic_int built;
+    char *data;
+    size_t len;
+};
+
+// Commit on first parent history of a ref, time never grows going back in history so that it can be binary searched
+struct grofs_at_commit {
+    git_oid oid;
+    int64_t time;
+};
+
+// First parent history of a ref tip, walked only as far back as lookups needed so far
+struct grofs_at_chain {
+    const struct grofs_repository *repo; // NULL for a free slot
+    git_oid tip_oid;
+    struct grofs_at_commit *commits;
+    size_t count;
+    size_t capacity;
+    git_oid next_oid; // first parent of the last commit, zero once root commit is reached
+    uint64_t last_used;
+};
+
+struct grofs_at_stats {
+    atomic_size_t lookups;
+    atomic_size_t walked;
+    atomic_size_t spliced;
+};
+
+// Pack .idx (version 2) mapped to find where objects are, so that batches can be read in pack order
+struct grofs_pack_index {
+    const unsigned char *map;
+    size_t map_len;
+    uint32_t count;
+    int pack_fd; // -1 when .pack can't be opened, its objects are still ordered but not read ahead
+};
+
+// Packs of a repository at some moment, replaced as a whole once objects/pack changes
+struct grofs_pack_set {
+    atomic_int refs;
+    size_t count;
+    struct grofs_pack_index packs[];
+};
+
+struct grofs_pack_order {
+    pthread_mutex_t lock;
+    char dir_path[PATH_MAX];
+    struct grofs_pack_set *set; // NULL until first batch or when there are no packs
+    struct timespec dir_mtime;
+    long long checked_ms;
+};
+
+enum grofs_object_index_type {
+    GROFS_OBJECT_INDEX_COMMITS, GROFS_OBJECT_INDEX_BLOBS, GROFS_OBJECT_INDEX_COUNT
+};
+
+// Caches and threads are shared by all repositories, only what libgit2 opens is per repository
+struct grofs_repository {
+    char *name; // NULL when the only repository is served at mount root
+    git_repository *repo;
+    git_odb *odb;
+    struct grofs_scope *scope; // NULL when every object in odb is exposed
+    struct grofs_mtime_index *mtime_index; // NULL when paths get commit time
+    struct grofs_object_index *object_indexes; // one for each grofs_object_index_type
+    struct grofs_pack_order *pack_order;
+};
+
+struct grofs {
+    struct grofs_repository *repos;
+    size_t repos_count;
+    int started;
+};
+
+// NUL terminated names packed one after another, flushed to cb once next one doesn't fit
+struct grofs_list_block {
+    char *data;
+    size_t len;
+    size_t count;
+    grofs_list_block_cb cb;
+    void *payload;
+    int ret;
+};
+
+// Splits blocks back into names for grofs_dir_list() callers
+struct grofs_list_split_context {
+    grofs_list_cb cb;
+    void *payload;
+};
+
+struct grofs_readdir_context {
+    const struct grofs_repository *repo;
+    struct grofs_list_block *block;
+    git_otype wanted_type;
+};
+
+struct grofs_dir {
+    int (*iter) (const struct grofs_dir *dir, grofs_list_cb cb, void *payload);
+    int (*iter_blocks) (const struct grofs_dir *dir, struct grofs_list_block *block); // NULL when names are listed one by one
+    const struct grofs *grofs;
+    const struct grofs_repository *repo;
+    git_oid oid;
+};
+
+struct grofs_file {
+    char *buff;
+    size_t len;
+    struct grofs_blob_entry *blob_entry; // NULL when buff is owned by the handle or by an object index
+    struct grofs_grep_entry *grep_entry; // set when buff holds results of a search
+    struct grofs_chunk_list_entry *chunk_list; // set when content is read from chunks instead of buff
+    const struct grofs_repository *repo; // repository of the blob of chunk_list, which is inflated again for evicted chunks
+    _Atomic(struct grofs_blob_entry *) chunk_source; // blob inflated for evicted chunks, kept until close so it's inflated once
+    int spill_fd; // content is read from spill file instead of buff when not -1
+    int generated;
+};
+
+#define GROFS_OID_SET_MIN_CAPACITY 1024
+
+// libgit2 by default keeps only trees smaller than 4k in its object cache
+#define GROFS_TREE_CACHE_OBJECT_LIMIT (1024 * 1024)
+
+#define GROFS_MTIME_INDEX_SUFFIX ".mtime.idx"
+#define GROFS_MTIME_INDEX_DEFAULT_NAME "default"
+#define GROFS_MTIME_INDEX_MAGIC "GROFSMT1"
+#define GROFS_MTIME_MIN_BUCKETS 1024
+
+#define GROFS_PACK_IDX_MAGIC "\377tOc"
+#define GROFS_PACK_IDX_HEADER_LEN (8 + 256 * 4) // magic, version and fanout table
+#define GROFS_PACK_REFRESH_MS 1000
+
+#define GROFS_FETCH_RUN_GAP (1024 * 1024) // objects closer than this in a pack are read ahead as one range
+#define GROFS_FETCH_RUN_TAIL (64 * 1024) // .idx doesn't know object lengths, last object of a range is assumed this long
+
+#define GROFS_AT_CHAIN_SLOTS 16
+#define GROFS_AT_MIN_CAPACITY 256
+
+#define GROFS_OBJECT_INDEX_MIN_CAPACITY 4096
+#define GROFS_OBJECT_INDEX_SIZE_LEN 8 // big endian
+
+#define GROFS_FNV_OFFSET 14695981039346656037ULL
+#define GROFS_FNV_PRIME 1099511628211ULL
+
+#define GROFS_CACHE_SHARDS 16
+#define GROFS_CACHE_MIN_BUCKETS 64
+
+#define GROFS_PREFETCH_NICE 19
+#define GROFS_PREFETCH_SLOTS 64
+#define GROFS_PREFETCH_WINDOW_MS 1000
+#define GROFS_PREFETCH_TRIGGER_OPENS 2
+#define GROFS_PREFETCH_MAX_PENDING 16
+#define GROFS_PREFETCH_BACKOFF_MISSES 64
+#define GROFS_PREFETCH_MIN_BACKOFF_MS 1000
+#define GROFS_PREFETCH_MAX_BACKOFF_MS 60000
+
+#define GROFS_ATTR_PREFETCH_SLOTS 64
+#define GROFS_ATTR_PREFETCH_WINDOW_MS 10000
+#define GROFS_ATTR_PREFETCH_MAX_PENDING 64
+
+#define GROFS_BULK_NICE 10
+
+#define GROFS_MEMORY_POLL_MS 1000
+#define GROFS_MEMORY_MAX_SHRINK_LEVEL 6 // caches keep at least 1/64 of their budget
+#define GROFS_MEMORY_CALM_POLLS 10 // polls without pressure before caches grow back one level
+#define GROFS_MEMORY_CGROUP_FULL_PCT 90
+#define GROFS_CGROUP_ROOT "/sys/fs/cgroup"
+#define GROFS_PSI_MEMORY_PATH "/proc/pressure/memory"
+
+// bucket i counts operations which took at most 2^i microseconds, last one also counts everything slower
+#define GROFS_STATS_BUCKETS 32
+
+// FastCDC, cut points are where gear hash of the last bytes has masked bits zero, the harder mask before
+// average length and the easier one after it keep chunk lengths close to average
+#define GROFS_CHUNK_MIN_LEN (4 * 1024)
+#define GROFS_CHUNK_AVG_LEN (16 * 1024)
+#define GROFS_CHUNK_MAX_LEN (64 * 1024)
+#define GROFS_CHUNK_MASK_HARD (~0ULL << (64 - 16))
+#define GROFS_CHUNK_MASK_EASY (~0ULL << (64 - 12))
+#define GROFS_CHUNK_GEAR_SEED 0x67726f6673ULL // "grofs"
+
+#define GROFS_GREP_BINARY_PEEK 8000 // same as git, a NUL this early makes a blob binary
+#define GROFS_GREP_MAX_OUTPUT (64 * 1024 * 1024) // blobs after the one crossing it are not searched
+#define GROFS_GREP_MIN_CAPACITY 256
+
+#define GROFS_PRELOAD_BATCH_LEN 64
+#define GROFS_PRELOAD_PATH_MAX 4096
+
+// Open addressing set used while collecting reachable objects, types[i] is 0 for an empty slot
+struct grofs_oid_set {
+    git_oid *oids;
+    unsigned char *types;
+    size_t count;
+    size_t capacity;
+};
+
+struct grofs_typed_oid {
+    git_oid oid;
+    git_otype type;
+};
+
+struct grofs_scope_walk_context {
+    struct grofs_oid_set *set;
+    int ret;
+};
+
+// Where an object of a batch is read from, objects not found in any pack sort after packed ones
+struct grofs_fetch_item {
+    git_oid oid;
+    uint32_t pack; // UINT32_MAX when not in a pack, e.g. loose or in an alternate
+    uint64_t offset;
+};
+
+// Return non-zero to skip the rest of the batch
+typedef int (*grofs_fetch_cb)(const struct grofs_repository *repo, const git_oid *oid, void *payload);
+
+struct grofs_fetch_stats {
+    atomic_size_t batches;
+    atomic_size_t objects;
+    atomic_size_t packed;
+    atomic_size_t readahead_bytes;
+};
+
+struct grofs_prefetch_fetch_context {
+    size_t budget;
+};
+
+struct grofs_object_index_record {
+    git_oid oid;
+    uint64_t size;
+};
+
+struct grofs_object_index_context {
+    const struct grofs_repository *repo;
+    git_otype wanted_type;
+    struct grofs_object_index_record *records;
+    size_t count;
+    size_t capacity;
+    int ret;
+};
+
+struct grofs_object_index_stats {
+    atomic_size_t builds;
+    atomic_size_t records;
+    atomic_size_t bytes;
+};
+
+struct grofs_cache_entry {
+    git_oid oid;
+    struct grofs_cache_entry *hash_next;
+    struct grofs_cache_entry *lru_prev;
+    struct grofs_cache_entry *lru_next;
+    size_t cost;
+    atomic_int refs; // cache itself holds one reference while entry is cached
+    int cached;
+};
+
+struct grofs_cache_shard {
+    pthread_mutex_t lock;
+    struct grofs_cache_entry **buckets;
+    size_t buckets_count;
+    size_t count;
+    size_t cost;
+    struct grofs_cache_entry *lru_head; // most recently used
+    struct grofs_cache_entry *lru_tail;
+};
+
+struct grofs_cache {
+    const char *name;
+    size_t budget;
+    atomic_size_t limit; // budget lowered by memory governor under pressure
+    void (*free_entry)(struct grofs_cache_entry *entry);
+    void (*evict_entry)(struct grofs_cache_entry *entry); // optional, called before evicted entry is released
+    atomic_size_t cost;
+    atomic_size_t hits;
+    atomic_size_t misses;
+    atomic_size_t evictions;
+    struct grofs_cache_shard shards[GROFS_CACHE_SHARDS];
+};
+
+struct grofs_meta_entry {
+    struct grofs_cache_entry entry;
+    git_otype type;
+    size_t size;
+    atomic_int binary; // set once a search found a NUL near the start of the blob
+};
+
+struct grofs_blob_entry {
+    struct grofs_cache_entry entry;
+    git_odb_object *object;
+    const char *data;
+    size_t len;
+    atomic_int prefetched; // loaded ahead of demand and not opened since
+    char buff[]; // content when it's not owned by an odb object
+};
+
+// Chunk of a large blob, its content is cached in blob cache by the id git would give it as a blob
+struct grofs_chunk {
+    git_oid oid;
+    uint64_t offset;
+};
+
+// Large blob cached as content defined chunks, versions of a file then share chunks which didn't change
+struct grofs_chunk_list_entry {
+    struct grofs_cache_entry entry;
+    size_t len;
+    size_t count;
+    struct grofs_chunk chunks[];
+};
+
+struct grofs_chunk_stats {
+    atomic_size_t blobs;
+    atomic_size_t chunks;
+    atomic_size_t shared; // chunks already cached when their blob was split
+    atomic_size_t shared_bytes;
+    atomic_size_t refills; // opened files whose evicted chunks inflated their blob again
+};
+
+// Blob evicted from blob cache, kept compressed so that more of working set fits in memory
+struct grofs_zblob_entry {
+    struct grofs_cache_entry entry;
+    size_t len;
+    int zlen;
+    char zdata[];
+};
+
+// Results of a search of a tree, keyed by hash of tree oid and pattern
+struct grofs_grep_entry {
+    struct grofs_cache_entry entry;
+    size_t len;
+    char data[];
+};
+
+// Blob of a searched tree, matching lines are kept per blob and joined in tree order once all are searched
+struct grofs_grep_item {
+    git_oid oid;
+    size_t path_offset; // into paths of the search
+    char *out;
+    size_t out_len;
+    size_t out_capacity;
+};
+
+struct grofs_grep_search {
+    const struct grofs_repository *repo;
+    char pattern[NAME_MAX + 1];
+    char literal[NAME_MAX + 1]; // longest run of characters every match contains, empty when there is none
+    size_t literal_len;
+    struct grofs_grep_item *items;
+    size_t count;
+    size_t capacity;
+    char *paths;
+    size_t paths_len;
+    size_t paths_capacity;
+    atomic_size_t next; // next item to be claimed, a thread done with its item takes the next one
+    atomic_size_t done;
+    atomic_size_t out_len;
+    atomic_int truncated;
+    atomic_int refs; // opener and each job submitted to the pool
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int ret;
+};
+
+struct grofs_grep_job {
+    struct grofs_grep_search *search;
+};
+
+struct grofs_grep_stats {
+    atomic_size_t searches;
+    atomic_size_t blobs;
+    atomic_size_t binary; // blobs skipped as binary, found now or by an earlier search
+    atomic_size_t prefiltered; // blobs without the literal part of the pattern, never matched line by line
+    atomic_size_t matches;
+    atomic_size_t truncated;
+};
+
+struct grofs_job {
+    void (*run)(void *payload);
+    void (*free_payload)(void *payload); // called after run or when the job is dropped, NULL frees payload with free()
+    void *payload; // must be a valid pointer to be freed after run or NULL
+    struct grofs_job *next;
+};
+
+struct grofs_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct grofs_job *head;
+    struct grofs_job *tail;
+    pthread_t *threads;
+    int threads_count;
+    int nice;
+    atomic_int should_stop;
+};
+
+enum grofs_preload_state {
+    PRELOAD_IDLE, PRELOAD_RUNNING, PRELOAD_DONE
+};
+
+struct grofs_preload_progress {
+    atomic_int state;
+    atomic_size_t pending_jobs;
+    atomic_size_t revs;
+    atomic_size_t trees;
+    atomic_size_t blobs;
+    atomic_size_t blob_bytes;
+    atomic_size_t errors;
+    struct timespec started;
+    struct timespec finished;
+};
+
+// Recently opened tree, slots are picked by tree oid so unrelated trees simply replace each other
+struct grofs_prefetch_slot {
+    git_oid tree_oid;
+    int opens;
+    int triggered;
+    long long last_open_ms;
+};
+
+struct grofs_spill_stats {
+    atomic_size_t writes;
+    atomic_size_t write_bytes;
+    atomic_size_t opens;
+    atomic_size_t read_bytes;
+    atomic_size_t errors;
+};
+
+struct grofs_prefetch_stats {
+    atomic_size_t pending_jobs;
+    atomic_size_t jobs;
+    atomic_size_t blobs;
+    atomic_size_t hits;
+    atomic_size_t misses;
+    atomic_size_t backoffs;
+    atomic_size_t unused_bytes; // prefetched content that was not opened yet
+    atomic_size_t misses_run;
+    atomic_llong backoff_until_ms;
+    atomic_llong backoff_ms;
+};
+
+// Tree whose entries had their attributes loaded recently
+struct grofs_attr_prefetch_slot {
+    git_oid tree_oid;
+    long long started_ms;
+};
+
+// Metadata operations and reads of small or cached blobs run on the calling thread without limits,
+// classes below are the ones which can take a thread for long and get bounded concurrency instead
+enum grofs_sched_class {
+    GROFS_SCHED_BULK_READ, GROFS_SCHED_LISTING, GROFS_SCHED_COUNT
+};
+
+struct grofs_sched_gate {
+    const char *name;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned int limit; // 0 when not limited
+    atomic_uint active;
+    atomic_size_t ops;
+    atomic_size_t waits;
+    atomic_size_t wait_us;
+};
+
+// Lives on the stack of the opening thread which waits until a bulk thread marks it done
+struct grofs_bulk_request {
+    const struct grofs_repository *repo;
+    const git_oid *oid;
+    struct grofs_blob_entry *blob_entry;
+    int ret;
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct grofs_bulk_job {
+    struct grofs_bulk_request *request;
+};
+
+// Shrinks caches one level, halving them, on each poll which sees memory pressure and grows them back once it's gone
+struct grofs_memory_governor {
+    char pressure_path[PATH_MAX]; // empty when PSI is not available
+    char cgroup_current_path[PATH_MAX]; // empty outside of a cgroup v2 with memory controller
+    char cgroup_max_path[PATH_MAX];
+    char cgroup_stat_path[PATH_MAX];
+    ssize_t libgit2_cache_max;
+    pthread_t thread;
+    int running;
+    int should_stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    atomic_int level;
+    atomic_size_t shrinks;
+    atomic_size_t grows;
+    atomic_size_t pressure_centi; // some avg10 in hundredths of a percent
+    atomic_size_t cgroup_current;
+    atomic_size_t cgroup_working_set; // current less inactive page cache, which is reclaimed without stalling anyone
+    atomic_size_t cgroup_max; // 0 when not limited
+};
+
+struct grofs_attr_prefetch_stats {
+    atomic_size_t pending_jobs;
+    atomic_size_t jobs;
+    atomic_size_t skipped;
+    atomic_size_t headers;
+};
+
+// Only the owning thread writes, readers sum them up so relaxed atomics are enough
+struct grofs_stats_op_counters {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t errors;
+    atomic_uint_fast64_t total_us;
+    atomic_uint_fast64_t buckets[GROFS_STATS_BUCKETS];
+};
+
+// Never freed, once its thread exits it's reused by the next one so counts keep accumulating
+struct grofs_stats_thread {
+    struct grofs_stats_thread *next;
+    atomic_int in_use;
+    struct grofs_stats_op_counters ops[GROFS_STATS_OP_COUNT];
+};
+
+
+// Payload of jobs working on a single tree
+struct grofs_tree_job {
+    const struct grofs_repository *repo;
+    git_oid tree_oid;
+};
+
+struct grofs_preload_rev {
+    const struct grofs_repository *repo;
+    char rev[];
+};
+
+struct grofs_preload_batch {
+    const struct grofs_repository *repo;
+    size_t count;
+    git_oid oids[GROFS_PRELOAD_BATCH_LEN];
+};
+
+struct grofs_preload_walk_context {
+    const struct grofs_repository *repo;
+    struct grofs_preload_batch *batch;
+    char path[GROFS_PRELOAD_PATH_MAX];
+};
+
+static const char *grofs_root_child_type_to_str(enum grofs_root_child_type type);
+static char *grofs_path_spec_full_path(const struct grofs_path_spec *path_spec);
+static char *grofs_path_spec_sub_path(const struct grofs_path_spec *path_spec, int start_part);
+static const char *grofs_path_spec_blob_name(const struct grofs_path_spec *path_spec);
+static inline int grofs_min(int a, int b);
+static void grofs_free_path_spec(struct grofs_path_spec *path_spec);
+static int grofs_count_char_in_string(const char *str, char needle);
+static int grofs_parse_path_info_resolve_root_child(enum grofs_root_child_type *root_child_type, const char *part);
+static int grofs_path_parse_commit_sub_path(struct grofs_path_spec *path_spec, int level);
+static int grofs_path_parse_blob_sub_path(struct grofs_path_spec *path_spec, int level);
+static int grofs_path_parse_control_sub_path(struct grofs_path_spec *path_spec, int level);
+static int grofs_path_parse_at_sub_path(struct grofs_path_spec *path_spec, int level);
+static int grofs_parse_path_init_dir_entry_type(struct grofs_path_spec *path_spec);
+static void grofs_parse_path_as_root(struct grofs_path_spec *path_spec);
+static int grofs_path_parse_as_root_child(struct grofs_path_spec *path_spec);
+static int grofs_parse_path(struct grofs_path_spec *path_spec, struct grofs_path_storage *storage, const char *path);
+static int grofs_git_commit_parent_lookup(const struct grofs_repository *repo, const git_oid *commit_oid, git_oid *parent_oid);
+static int grofs_git_commit_has_parent(const struct grofs_repository *repo, const git_oid *commit_oid);
+static int grofs_git_rev_commit_lookup(const struct grofs_repository *repo, const char *rev, git_oid *commit_oid);
+static uint64_t grofs_oid_hash(const git_oid *oid);
+static int grofs_oid_set_init(struct grofs_oid_set *set, size_t capacity);
+static void grofs_oid_set_free(struct grofs_oid_set *set);
+static int grofs_oid_set_add(struct grofs_oid_set *set, const git_oid *oid, git_otype type, int *added);
+static int grofs_scope_walk_tree_cb(const char *root, const git_tree_entry *entry, void *payload);
+static int grofs_scope_collect_commit(const struct grofs_repository *repo, struct grofs_oid_set *set, const git_oid *commit_oid);
+static int grofs_scope_push_rev(const struct grofs_repository *repo, git_revwalk *walk, const char *rev);
+static int grofs_scope_collect_rev(const struct grofs_repository *repo, struct grofs_oid_set *set, const char *rev);
+static int grofs_typed_oid_cmp(const void *a, const void *b);
+static int grofs_scope_init_from_set(struct grofs_scope *scope, const struct grofs_oid_set *set);
+static int grofs_scope_build(struct grofs_repository *repo);
+static void grofs_scope_free(struct grofs_scope *scope);
+static int grofs_scope_contains(const struct grofs_scope *scope, const git_oid *oid, git_otype type);
+static void grofs_oid_hex(char *out, const git_oid *oid);
+static int grofs_list_block_flush(struct grofs_list_block *block);
+static int grofs_list_block_add_oid(struct grofs_list_block *block, const git_oid *oid);
+static int grofs_list_block_add_name_cb(const char *name, void *payload);
+static int grofs_list_split_cb(const char *names, size_t len, size_t count, void *payload);
+static int grofs_scope_list_objects(const struct grofs_scope *scope, git_otype wanted_type, struct grofs_list_block *block);
+static int grofs_at_parse_digits(const char *str, int count, int *value);
+static int grofs_at_parse_time(const char *str, int64_t *time);
+static int grofs_at_chain_reserve(struct grofs_at_chain *chain, size_t count);
+static void grofs_at_chain_push(struct grofs_at_chain *chain, const git_oid *oid, int64_t time);
+static int grofs_at_chain_append(struct grofs_at_chain *chain, const struct grofs_at_chain *older);
+static int grofs_at_chain_covers(const struct grofs_at_chain *chain, int64_t time);
+static struct grofs_at_chain *grofs_at_chain_slot(const struct grofs_repository *repo, const git_oid *tip_oid);
+static int grofs_at_chain_splice(struct grofs_at_chain *chain);
+static size_t grofs_at_chain_tips(const struct grofs_at_chain *chain, git_oid *tips);
+static int grofs_at_chain_walk(struct grofs_at_chain *walked, const git_oid *oid, int64_t time, const git_oid *tips, size_t tips_count);
+static int grofs_at_resolve(const struct grofs_repository *repo, const git_oid *tip_oid, int64_t time, git_oid *commit_oid);
+static int grofs_at_ref_prefix_exists(const struct grofs_repository *repo, const char *prefix);
+static void grofs_at_chains_free(void);
+static int grofs_object_index_record_cmp(const void *a, const void *b);
+static int grofs_object_index_add(struct grofs_object_index_context *context, const git_oid *oid, size_t size);
+static int grofs_object_index_collect_cb(const git_oid *id, void *payload);
+static int grofs_object_index_collect_scope(struct grofs_object_index_context *context);
+static int grofs_object_index_build(const struct grofs_repository *repo, struct grofs_object_index *index, git_otype type);
+static struct grofs_object_index *grofs_object_index_for(const struct grofs_repository *repo, enum grofs_root_child_type root_child_type);
+static int grofs_object_index_get(const struct grofs_repository *repo, enum grofs_root_child_type root_child_type, const struct grofs_object_index **index);
+static int grofs_object_indexes_init(struct grofs_repository *repo);
+static void grofs_object_indexes_free(struct grofs_repository *repo);
+static size_t grofs_cache_shard_index(const git_oid *oid);
+static int grofs_cache_init(struct grofs_cache *cache, const char *name, size_t budget, void (*free_entry)(struct grofs_cache_entry *entry));
+static void grofs_cache_destroy(struct grofs_cache *cache);
+static void grofs_cache_entry_init(struct grofs_cache_entry *entry, const git_oid *oid, size_t cost);
+static struct grofs_cache_entry **grofs_cache_shard_link(struct grofs_cache_shard *shard, const git_oid *oid);
+static void grofs_cache_shard_lru_unlink(struct grofs_cache_shard *shard, struct grofs_cache_entry *entry);
+static void grofs_cache_shard_lru_push(struct grofs_cache_shard *shard, struct grofs_cache_entry *entry);
+static void grofs_cache_shard_grow(struct grofs_cache_shard *shard);
+static struct grofs_cache_entry *grofs_cache_shard_evict(struct grofs_cache *cache, struct grofs_cache_shard *shard, size_t budget);
+static struct grofs_cache_entry *grofs_cache_get(struct grofs_cache *cache, const git_oid *oid);
+static int grofs_cache_contains(struct grofs_cache *cache, const git_oid *oid);
+static struct grofs_cache_entry *grofs_cache_put(struct grofs_cache *cache, struct grofs_cache_entry *entry);
+static void grofs_cache_release(struct grofs_cache *cache, struct grofs_cache_entry *entry);
+static void grofs_cache_release_evicted(struct grofs_cache *cache, struct grofs_cache_entry *evicted);
+static void grofs_cache_set_limit(struct grofs_cache *cache, size_t limit);
+static void grofs_meta_entry_free(struct grofs_cache_entry *entry);
+static void grofs_meta_cache_put(const git_oid *oid, git_otype type, size_t size);
+static int grofs_object_header_lookup(const struct grofs_repository *repo, const git_oid *oid, git_otype *type, size_t *size);
+static void grofs_blob_entry_free(struct grofs_cache_entry *entry);
+static int grofs_blob_entry_read(const struct grofs_repository *repo, const git_oid *oid, struct grofs_blob_entry **blob_entry);
+static int grofs_blob_entry_inflate(const struct grofs_repository *repo, const git_oid *oid, struct grofs_blob_entry **blob_entry);
+static int grofs_blob_load(const struct grofs_repository *repo, const git_oid *oid, struct grofs_blob_entry **blob_entry);
+static void grofs_zblob_entry_free(struct grofs_cache_entry *entry);
+static void grofs_zblob_demote(struct grofs_cache_entry *entry);
+static void grofs_zblob_compress_job(void *payload);
+static void grofs_zblob_compress_job_free(void *payload);
+static int grofs_zblob_load(const git_oid *oid, struct grofs_blob_entry **blob_entry);
+static void grofs_chunk_gear_init(void);
+static size_t grofs_chunk_cut(const unsigned char *data, size_t len);
+static int grofs_chunk_wanted(const struct grofs_repository *repo, const git_oid *oid);
+static void grofs_chunk_list_entry_free(struct grofs_cache_entry *entry);
+static size_t grofs_chunk_index(const struct grofs_chunk_list_entry *chunk_list, uint64_t offset);
+static size_t grofs_chunk_len(const struct grofs_chunk_list_entry *chunk_list, size_t index);
+static struct grofs_blob_entry *grofs_chunk_store(const git_oid *oid, const char *data, size_t len, int splitting);
+static int grofs_chunks_store(const struct grofs_chunk_list_entry *chunk_list, const char *data, size_t first, struct grofs_blob_entry **first_chunk);
+static int grofs_chunks_split(const struct grofs_repository *repo, const git_oid *oid, struct grofs_chunk_list_entry **chunk_list);
+static int grofs_chunks_load(const struct grofs_repository *repo, const git_oid *oid, struct grofs_chunk_list_entry **chunk_list);
+static void grofs_chunk_list_cache_fit(size_t cost);
+static int grofs_chunk_load(struct grofs_file *file, size_t index, struct grofs_blob_entry **chunk);
+static void grofs_spill_path(char *path, const git_oid *oid);
+static void grofs_spill_write(const struct grofs_blob_entry *blob_entry);
+static int grofs_spill_open(const struct grofs_repository *repo, const git_oid *oid, struct grofs_file **file);
+static void *grofs_pool_thread(void *data);
+static int grofs_pool_start(struct grofs_pool *pool, int threads_count, int nice);
+static int grofs_pool_submit(struct grofs_pool *pool, void (*run)(void *payload), void *payload);
+static int grofs_pool_submit_with_free(struct grofs_pool *pool, void (*run)(void *payload), void (*free_payload)(void *payload), void *payload);
+static void grofs_job_free(struct grofs_job *job);
+static void grofs_pool_stop(struct grofs_pool *pool);
+static long long grofs_now_ms(void);
+static int grofs_pack_index_load(struct grofs_pack_index *index, const char *idx_path);
+static void grofs_pack_index_free(struct grofs_pack_index *index);
+static int grofs_pack_index_find(const struct grofs_pack_index *index, const git_oid *oid, uint64_t *offset);
+static int grofs_pack_set_load(const char *dir_path, struct grofs_pack_set **set);
+static void grofs_pack_set_release(struct grofs_pack_set *set);
+static struct grofs_pack_set *grofs_pack_set_acquire(const struct grofs_repository *repo);
+static int grofs_pack_order_init(struct grofs_repository *repo);
+static void grofs_pack_order_free(struct grofs_repository *repo);
+static int grofs_fetch_item_cmp(const void *a, const void *b);
+static void grofs_fetch_readahead(const struct grofs_pack_set *set, const struct grofs_fetch_item *items, size_t count);
+static void grofs_fetch_batch(const struct grofs_repository *repo, const git_oid *oids, size_t count, grofs_fetch_cb cb, void *payload);
+static void grofs_prefetch_mark_opened(struct grofs_blob_entry *blob_entry);
+static void grofs_prefetch_mark_unused(struct grofs_blob_entry *blob_entry);
+static int grofs_prefetch_blob(const struct grofs_repository *repo, const git_oid *oid);
+static int grofs_prefetch_fetch_cb(const struct grofs_repository *repo, const git_oid *oid, void *payload);
+static void grofs_prefetch_tree_job(void *payload);
+static struct grofs_tree_job *grofs_tree_job_new(const struct grofs_repository *repo, const git_oid *tree_oid);
+static void grofs_prefetch_note_open(const struct grofs_repository *repo, const git_oid *tree_oid);
+static int grofs_attr_prefetch_fetch_cb(const struct grofs_repository *repo, const git_oid *oid, void *payload);
+static void grofs_attr_prefetch_tree_job(void *payload);
+static void grofs_attr_prefetch_start(const struct grofs_repository *repo, const git_oid *tree_oid);
+static int grofs_read_file_line(const char *path, const char *prefix, char *line, size_t line_len);
+static size_t grofs_read_file_size(const char *path);
+static void grofs_memory_governor_init_paths(struct grofs_memory_governor *governor);
+static int grofs_memory_governor_poll(struct grofs_memory_governor *governor);
+static void grofs_memory_governor_apply(struct grofs_memory_governor *governor, int level);
+static void *grofs_memory_governor_thread(void *data);
+static int grofs_memory_governor_start(struct grofs_memory_governor *governor);
+static void grofs_memory_governor_stop(struct grofs_memory_governor *governor);
+static size_t grofs_memory_resident(void);
+static void grofs_sched_enter(enum grofs_sched_class sched_class);
+static void grofs_sched_leave(enum grofs_sched_class sched_class);
+static void grofs_bulk_read_job(void *payload);
+static void grofs_bulk_job_free(void *payload);
+static int grofs_bulk_blob_entry_read(const struct grofs_repository *repo, const git_oid *oid, struct grofs_blob_entry **blob_entry);
+static void grofs_grep_literal(const char *pattern, char *literal, size_t *literal_len);
+static const char *grofs_grep_find(const char *data, size_t len, const char *literal, size_t literal_len);
+static size_t grofs_grep_count_lines(const char *data, size_t len);
+static int grofs_grep_known_binary(const git_oid *oid);
+static void grofs_grep_mark_binary(const git_oid *oid, size_t size);
+static int grofs_grep_item_append(struct grofs_grep_item *item, const char *path, size_t line_no, const char *line, size_t line_len);
+static void grofs_grep_item_run(struct grofs_grep_search *search, regex_t *regex, struct grofs_grep_item *item);
+static void grofs_grep_search_run(struct grofs_grep_search *search);
+static void grofs_grep_search_release(struct grofs_grep_search *search);
+static void grofs_grep_job(void *payload);
+static void grofs_grep_job_free(void *payload);
+static int grofs_grep_walk_cb(const char *root, const git_tree_entry *entry, void *payload);
+static int grofs_grep_search_new(const struct grofs_repository *repo, const git_oid *tree_oid, const char *pattern, struct grofs_grep_search **search);
+static void grofs_grep_entry_free(struct grofs_cache_entry *entry);
+static int grofs_grep_entry_new(struct grofs_grep_search *search, const git_oid *key, struct grofs_grep_entry **grep_entry);
+static int grofs_grep(const struct grofs_repository *repo, const git_oid *tree_oid, const char *pattern, struct grofs_grep_entry **grep_entry);
+static void grofs_preload_job_done(void);
+static int grofs_preload_submit(void (*run)(void *payload), void *payload);
+static int grofs_preload_path_matches(const char *path);
+static int grofs_preload_dir_may_match(const char *dir_path);
+static int grofs_preload_fetch_cb(const struct grofs_repository *repo, const git_oid *oid, void *payload);
+static void grofs_preload_batch_job(void *payload);
+static int grofs_preload_walk_cb(const char *root, const git_tree_entry *entry, void *payload);
+static void grofs_preload_rev_job(void *payload);
+static void grofs_preload_start(const struct grofs *grofs);
+static const struct grofs_control_file *grofs_control_file_lookup(const char *name);
+static void grofs_control_write_preload(FILE *out);
+static void grofs_stats_thread_key_create(void);
+static void grofs_stats_thread_release_cb(void *data);
+static struct grofs_stats_thread *grofs_stats_thread_acquire(void);
+static void grofs_stats_write_caches(FILE *out, const char *metric, const char *type, size_t (*value)(const struct grofs_cache *cache));
+static size_t grofs_stats_cache_hits(const struct grofs_cache *cache);
+static size_t grofs_stats_cache_misses(const struct grofs_cache *cache);
+static size_t grofs_stats_cache_evictions(const struct grofs_cache *cache);
+static size_t grofs_stats_cache_bytes(const struct grofs_cache *cache);
+static size_t grofs_stats_cache_budget(const struct grofs_cache *cache);
+static size_t grofs_stats_cache_limit(const struct grofs_cache *cache);
+static void grofs_stats_write_sched(FILE *out, const char *metric, const char *type, size_t (*value)(const struct grofs_sched_gate *gate));
+static size_t grofs_stats_sched_ops(const struct grofs_sched_gate *gate);
+static size_t grofs_stats_sched_waits(const struct grofs_sched_gate *gate);
+static size_t grofs_stats_sched_wait_us(const struct grofs_sched_gate *gate);
+static size_t grofs_stats_sched_active(const struct grofs_sched_gate *gate);
+static size_t grofs_stats_sched_limit(const struct grofs_sched_gate *gate);
+static void grofs_control_write_stats(FILE *out);
+static uint64_t grofs_path_hash_update(uint64_t hash, const char *str, size_t len);
+static int grofs_uint64_cmp(const void *a, const void *b);
+static uint32_t grofs_mtime_record_check(const struct grofs_mtime_record *record);
+static int grofs_read_full(int fd, void *buff, size_t len);
+static int grofs_mtime_index_load(struct grofs_mtime_index *index, int fd);
+static int grofs_mtime_index_open(struct grofs_repository *repo);
+static void grofs_mtime_index_free(struct grofs_mtime_index *index);
+static const struct grofs_mtime_record *grofs_mtime_index_find(const struct grofs_mtime_index *index, const git_oid *oid);
+static void grofs_mtime_index_insert(struct grofs_mtime_index *index, struct grofs_mtime_record *record);
+static void grofs_mtime_index_persist(struct grofs_mtime_index *index, const struct grofs_mtime_record *record);
+static int grofs_mtime_hashes_add(uint64_t **hashes, size_t *count, size_t *capacity, uint64_t hash);
+static int grofs_mtime_record_build(const struct grofs_repository *repo, const git_oid *oid, struct grofs_mtime_record **record);
+static int grofs_mtime_record_get(const struct grofs_repository *repo, const git_oid *oid, const struct grofs_mtime_record **record);
+static int grofs_mtime_record_contains(const struct grofs_mtime_record *record, uint64_t hash);
+static void grofs_mtime_node_init(struct grofs_node *node, const git_commit *commit, const struct grofs_path_spec *path_spec);
+static int grofs_resolve_node_for_path_spec_for_commit_children(struct grofs_node *node, const git_commit *commit, const struct grofs_path_spec *path_spec);
+static int grofs_resolve_node_for_path_spec_for_commit_type(struct grofs_node *node, const struct grofs_path_spec *path_spec);
+static int grofs_resolve_node_for_path_spec_for_blob_type(struct grofs_node *node, const struct grofs_path_spec *path_spec);
+static int grofs_resolve_node_for_path_spec_for_control_type(struct grofs_node *node, const struct grofs_path_spec *path_spec);
+static int grofs_resolve_node_for_path_spec_for_index_type(struct grofs_node *node, const struct grofs_path_spec *path_spec);
+static int grofs_resolve_node_for_path_spec_for_at_type(struct grofs_node *node, const struct grofs_path_spec *path_spec);
+static int grofs_repository_lookup_for_path(const struct grofs *grofs, const char **path, const struct grofs_repository **repo);
+static int grofs_node_init_from_path(const struct grofs *grofs, struct grofs_node *node, const char *path);
+static int grofs_dir_iter_root(const struct grofs_dir *dir, grofs_list_cb cb, void *payload);
+static int grofs_dir_iter_commit_id(const struct grofs_dir *dir, grofs_list_cb cb, void *payload);
+static int grofs_dir_iter_commit_list(const struct grofs_dir *dir, grofs_list_cb cb, void *payload);
+static int grofs_dir_iter_for_blob_list(const struct grofs_dir *dir, grofs_list_cb cb, void *payload);
+static int grofs_dir_iter_objects(const struct grofs_dir *dir, grofs_list_cb cb, void *payload, git_otype wanted_type);
+static int grofs_dir_iter_objects_blocks(const struct grofs_dir *dir, struct grofs_list_block *block, git_otype wanted_type);
+static int grofs_dir_iter_commit_list_blocks(const struct grofs_dir *dir, struct grofs_list_block *block);
+static int grofs_dir_iter_for_blob_list_blocks(const struct grofs_dir *dir, struct grofs_list_block *block);
+static int grofs_dir_iter_for_blob_list_tree(const git_tree *tree, grofs_list_cb cb, void *payload);
+static int grofs_dir_iter_control(const struct grofs_dir *dir, grofs_list_cb cb, void *payload);
+static int grofs_dir_iter_empty(const struct grofs_dir *dir, grofs_list_cb cb, void *payload);
+static int grofs_dir_iter_for_blob_list_tree_oid(const struct grofs_dir *dir, grofs_list_cb cb, void *payload);
+static int grofs_dir_init_from_node(const struct grofs *grofs, struct grofs_dir *dir, const struct grofs_node *node);
+static int grofs_resolve_node_for_path_spec(struct grofs_node *node, const struct grofs_path_spec *path_spec);
+static int grofs_readdir_git_collect_object_cb(const git_oid *id, void *payload);
+static struct grofs_file *grofs_file_nandle_new(size_t buff_len);
+static struct grofs_file *grofs_file_handle_new_for_blob(struct grofs_blob_entry *blob_entry);
+static struct grofs_file *grofs_file_handle_new_for_index(const struct grofs_object_index *index);
+static struct grofs_file *grofs_file_handle_new_for_grep(struct grofs_grep_entry *grep_entry);
+static struct grofs_file *grofs_file_handle_new_for_chunks(const struct grofs_repository *repo, struct grofs_chunk_list_entry *chunk_list);
+static void grofs_file_handle_free(struct grofs_file *file_handle);
+static int grofs_open_node_commit_parent(const git_oid *oid, struct grofs_file **file);
+static int grofs_open_node_blob(const struct grofs_repository *repo, const git_oid *oid, struct grofs_file **file);
+static int grofs_open_node_control(const struct grofs_node *node, struct grofs_file **file);
+static int grofs_open_node_index(const struct grofs_node *node, struct grofs_file **file);
+static int grofs_open_node_grep(const struct grofs_node *node, struct grofs_file **file);
+static int grofs_open_node(const struct grofs_node *node, struct grofs_file **file);
+
+
+static struct grofs grofs_instance;
+static atomic_int grofs_instance_opened;
+static struct grofs_options grofs_options;
+static struct grofs_str_list grofs_scope_revs = { NULL, 0 };
+static struct grofs_cache grofs_meta_cache;
+static struct grofs_cache grofs_blob_cache;
+static struct grofs_cache grofs_zblob_cache;
+static atomic_size_t grofs_zblob_demote_pending; // bytes of evicted blobs waiting on bg pool to be compressed
+static atomic_size_t grofs_zblob_demote_dropped;
+static struct grofs_cache grofs_grep_cache;
+static struct grofs_cache grofs_chunk_list_cache;
+static uint64_t grofs_chunk_gear[256];
+static pthread_once_t grofs_chunk_gear_once = PTHREAD_ONCE_INIT;
+static struct grofs_chunk_stats grofs_chunk_stats;
+static atomic_size_t grofs_chunk_list_min_limit; // chunk list cache limit under which the largest list split so far fits no shard
+static struct grofs_pool grofs_bg_pool;
+static struct grofs_pool grofs_prefetch_pool;
+static struct grofs_pool grofs_bulk_pool;
+static struct grofs_pool grofs_grep_pool;
+static struct grofs_grep_stats grofs_grep_stats;
+static pthread_mutex_t grofs_prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct grofs_prefetch_slot grofs_prefetch_slots[GROFS_PREFETCH_SLOTS];
+static struct grofs_prefetch_stats grofs_prefetch_stats;
+static struct grofs_spill_stats grofs_spill_stats;
+static struct grofs_fetch_stats grofs_fetch_stats;
+static struct grofs_mtime_stats grofs_mtime_stats;
+static struct grofs_object_index_stats grofs_object_index_stats;
+static pthread_mutex_t grofs_at_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct grofs_at_chain grofs_at_chains[GROFS_AT_CHAIN_SLOTS];
+static uint64_t grofs_at_clock;
+static struct grofs_at_stats grofs_at_stats;
+static char *grofs_spill_dir; // NULL when large blobs are not spilled
+static char *grofs_mtime_index_dir; // NULL when mtime indexes are kept in memory only
+static pthread_mutex_t grofs_attr_prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct grofs_attr_prefetch_slot grofs_attr_prefetch_slots[GROFS_ATTR_PREFETCH_SLOTS];
+static struct grofs_attr_prefetch_stats grofs_attr_prefetch_stats;
+static void (*grofs_stats_extra_writer)(FILE *out); // NULL unless FUSE glue has metrics of its own
+static struct grofs_memory_governor grofs_memory_governor = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+static struct grofs_sched_gate grofs_sched_gates[GROFS_SCHED_COUNT] = {
+    { .name = "bulk_read", .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER },
+    { .name = "listing", .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER }
+};
+static _Atomic(struct grofs_stats_thread *) grofs_stats_threads = NULL;
+static pthread_key_t grofs_stats_thread_key;
+static pthread_once_t grofs_stats_thread_key_once = PTHREAD_ONCE_INIT;
+static atomic_int grofs_readdir_threads_count; // listings in progress, each FUSE one runs in its own thread
+static struct grofs_str_list grofs_preload_revs = { NULL, 0 };
+static struct grofs_str_list grofs_preload_paths = { NULL, 0 };
+static struct grofs_preload_progress grofs_preload_progress;
+static time_t grofs_started_time;
+
+static const struct grofs_control_file grofs_control_files[] = {
+    { GROFS_STR_CONTROL_PRELOAD, grofs_control_write_preload },
+    { GROFS_STR_CONTROL_STATS, grofs_control_write_stats },
+    { NULL, NULL }
+};
+
+thread_local struct grofs_stats_thread *grofs_stats_thread_local = NULL;
+
+const char *grofs_stats_op_names[GROFS_STATS_OP_COUNT] = {
+    "getattr", "opendir", "readdir", "releasedir", "open", "read", "release", "readlink"
+};
+
+static const char *grofs_root_child_type_to_str(enum grofs_root_child_type type) {
+    switch (type) {
+        case ROOT:
+            return "ROOT";
+        case COMMIT:
+            return "COMMIT";
+        case BLOB:
+            return "BLOB";
+        case CONTROL:
+            return "CONTROL";
+        case COMMIT_INDEX:
+            return "COMMIT_INDEX";
+        case BLOB_INDEX:
+            return "BLOB_INDEX";
+        case AT:
+            return "AT";
+        default:
+            GROFS_HALT_FMT("Unknown %d", type);
+    }
+}
+
+static const char *grofs_node_type_to_str(enum grofs_node_type type) {
+    switch (type) {
+        case DIR:
+            return "DIR";
+        case DATA:
+            return "DATA";
+        case LINK:
+            return "LINK";
+        default:
+            GROFS_HALT_FMT("Unknown %d", type);
+    }
+}
+
+static const char *path_spec_commit_name(const struct grofs_path_spec *path_spec) {
+    if (path_spec->parts_count < 2 || COMMIT != path_spec->root_child_type) {
+        return NULL;
+    }
+
+    return path_spec->parts[1];
+}
+
+static const char *grofs_path_spec_blob_name(const struct grofs_path_spec *path_spec) {
+    if (path_spec->parts_count < 2 || BLOB != path_spec->root_child_type) {
+        return NULL;
+    }
+
+    return path_spec->parts[1];
+}
+
+static char *grofs_path_spec_sub_path(const struct grofs_path_spec *path_spec, int start_part) {
+    if (start_part < 0 || start_part >= path_spec->parts_count) {
+        return NULL;
+    }
+
+    size_t path_len = 1;
+
+    char *last_part = path_spec->parts[path_spec->parts_count - 1];
+
+    void *parts_buff_end = last_part + strlen(last_part);
+
+    path_len += (parts_buff_end - (void *) *(path_spec->parts + start_part));
+
+    char *buff = (char *) malloc(sizeof(char) * (path_len + 1));
+
+    if (NULL == buff) {
+        return NULL;
+    }
+
+    *buff = '/';
+    *(buff + 1) = '\0';
+
+    memcpy(buff + 1, *(path_spec->parts + start_part), sizeof(char) * (path_len - 1 + 1));
+
+    size_t i;
+
+    for (i = 1; i < path_len; i++) {
+        if ('\0' == *(buff + i)) {
+            *(buff + i) = '/';
+        }
+    }
+
+    return buff;
+}
+
+static char *grofs_path_spec_full_path(const struct grofs_path_spec *path_spec) {
+    if (path_spec->parts_count > 0) {
+        return grofs_path_spec_sub_path(path_spec, 0);
+    }
+
+    char *buff = (char *) malloc(sizeof(char) * (1 + 1));
+
+    if (NULL == buff) {
+        return NULL;
+    }
+
+    *buff = '/';
+    *(buff + 1) = '\0';
+
+    return buff;
+}
+
+static inline int grofs_min(int a, int b) {
+    return a < b ? a : b;
+}
+
+static void grofs_free_path_spec(struct grofs_path_spec *path_spec) {
+    free(path_spec->heap);
+}
+
+static int grofs_count_char_in_string(const char *str, char needle) {
+    int count = 0;
+
+    for (; *str; count += needle == *str, str++);
+
+    return count;
+}
+
+int grofs_str_list_add(struct grofs_str_list *list, const char *str) {
+    if ('\0' == *str) {
+        return EINVAL;
+    }
+
+    char **new_items = (char **) realloc(list->items, sizeof(char *) * (list->count + 1));
+
+    if (NULL == new_items) {
+        return ENOMEM;
+    }
+
+    list->items = new_items;
+
+    char *new_item = strdup(str);
+
+    if (NULL == new_item) {
+        return ENOMEM;
+    }
+
+    list->items[list->count++] = new_item;
+
+    return 0;
+}
+
+void grofs_str_list_free(struct grofs_str_list *list) {
+    size_t i;
+
+    for (i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+
+    free(list->items);
+
+    list->items = NULL;
+    list->count = 0;
+}
+
+static int grofs_parse_path_info_resolve_root_child(enum grofs_root_child_type *root_child_type, const char *part) {
+    if (strcmp(GROFS_STR_COMMITS, part) == 0) {
+        *root_child_type = COMMIT;
+
+        return 0;
+    }
+
+    if (strcmp(GROFS_STR_BLOBS, part) == 0) {
+        *root_child_type = BLOB;
+
+        return 0;
+    }
+
+    if (strcmp(GROFS_STR_CONTROL, part) == 0) {
+        *root_child_type = CONTROL;
+
+        return 0;
+    }
+
+    if (strcmp(GROFS_STR_COMMITS_INDEX, part) == 0) {
+        *root_child_type = COMMIT_INDEX;
+
+        return 0;
+    }
+
+    if (strcmp(GROFS_STR_BLOBS_INDEX, part) == 0) {
+        *root_child_type = BLOB_INDEX;
+
+        return 0;
+    }
+
+    if (strcmp(GROFS_STR_AT, part) == 0) {
+        *root_child_type = AT;
+
+        return 0;
+    }
+
+    return 1;
+}
+
+static int grofs_path_parse_commit_sub_path(struct grofs_path_spec *path_spec, int level) {
+    char *ref;
+
+    ref = path_spec->parts[level];
+
+    if (strlen(ref) != GROFS_GIT_OBJECT_ID_LEN) {
+        return ENOENT;
+    }
+
+    if (++level == path_spec->parts_count) {
+        path_spec->entry_type = ID;
+
+        return 0;
+    }
+
+    char *commit_dir_item = path_spec->parts[level];
+
+    if (strcmp(GROFS_STR_TREE, commit_dir_item) == 0) {
+        if (++level == path_spec->parts_count) {
+            path_spec->entry_type = TREE;
+
+            return 0;
+        }
+
+        path_spec->entry_type = PATH_IN_GIT;
+
+        return 0;
+    } else if (strcmp(GROFS_STR_PARENT, commit_dir_item) == 0) {
+        if (++level == path_spec->parts_count) {
+            path_spec->entry_type = PARENT;
+
+            return 0;
+        }
+    } else if (strcmp(GROFS_STR_GREP, commit_dir_item) == 0) {
+        if (++level == path_spec->parts_count) {
+            path_spec->entry_type = GREP;
+
+            return 0;
+        }
+
+        if (++level == path_spec->parts_count) {
+            path_spec->entry_type = QUERY;
+
+            return 0;
+        }
+    }
+
+    return ENOENT;
+}
+
+static int grofs_path_parse_blob_sub_path(struct grofs_path_spec *path_spec, int level) {
+    char *ref;
+
+    ref = path_spec->parts[level];
+
+    if (strlen(ref) != GROFS_GIT_OBJECT_ID_LEN) {
+        return ENOENT;
+    }
+
+    if (++level == path_spec->parts_count) {
+        path_spec->entry_type = ID;
+
+        return 0;
+    }
+
+    return ENOENT;
+}
+
+static int grofs_path_parse_control_sub_path(struct grofs_path_spec *path_spec, int level) {
+    if (NULL == grofs_control_file_lookup(path_spec->parts[level])) {
+        return ENOENT;
+    }
+
+    if (++level == path_spec->parts_count) {
+        path_spec->entry_type = ID;
+
+        return 0;
+    }
+
+    return ENOENT;
+}
+
+static int grofs_path_parse_at_sub_path(struct grofs_path_spec *path_spec, int level) {
+    int64_t time;
+
+    if (grofs_at_parse_time(path_spec->parts[level], &time) != 0) {
+        return ENOENT;
+    }
+
+    if (++level == path_spec->parts_count) {
+        path_spec->entry_type = ID;
+
+        return 0;
+    }
+
+    // everything after time is the ref, which may have slashes in it
+    path_spec->entry_type = REF;
+
+    return 0;
+}
+
+static int grofs_parse_path_init_dir_entry_type(struct grofs_path_spec *path_spec) {
+    int level = 0;
+
+    if (level == path_spec->parts_count) {
+        path_spec->root_child_type = ROOT;
+        path_spec->entry_type = NONE;
+
+        return 0;
+    }
+
+    enum grofs_root_child_type root_child_type;
+
+    if (grofs_parse_path_info_resolve_root_child(&root_child_type, path_spec->parts[level]) != 0) {
+        return ENOENT;
+    }
+
+    path_spec->root_child_type = root_child_type;
+
+    if (++level == path_spec->parts_count) {
+        // index files are the only root children which are not directories
+        path_spec->entry_type = COMMIT_INDEX == root_child_type || BLOB_INDEX == root_child_type ? ID : LIST;
+
+        return 0;
+    }
+
+    switch (root_child_type) {
+        case COMMIT:
+            return grofs_path_parse_commit_sub_path(path_spec, level);
+        case  BLOB:
+            return grofs_path_parse_blob_sub_path(path_spec, level);
+        case CONTROL:
+            return grofs_path_parse_control_sub_path(path_spec, level);
+        case AT:
+            return grofs_path_parse_at_sub_path(path_spec, level);
+        case COMMIT_INDEX:
+        case BLOB_INDEX:
+            return ENOENT;
+        default:
+            GROFS_HALT_FMT("Unexpected %s for path %s", grofs_root_child_type_to_str(root_child_type), grofs_path_spec_full_path(path_spec));
+    }
+
+    return ENOENT;
+}
+
+static void grofs_parse_path_as_root(struct grofs_path_spec *path_spec) {
+    path_spec->parts = NULL;
+    path_spec->buff = NULL;
+    path_spec->heap = NULL;
+    path_spec->parts_count = 0;
+
+    // root has no parts so it can't fail
+    grofs_parse_path_init_dir_entry_type(path_spec);
+}
+
+static int grofs_path_parse_as_root_child(struct grofs_path_spec *path_spec) {
+    char **parts = path_spec->parts;
+
+    char *start = path_spec->buff;
+    char *current = start;
+    int i = 0;
+
+    while (*current) {
+        if ('/' == *current) {
+            if (current == start) {
+                return ENOENT;
+            }
+
+            *current = 0;
+            parts[i++] = start;
+
+            start = current + 1;
+        }
+
+        current++;
+    };
+
+    if (current == start) {
+        return ENOENT;
+    }
+
+    parts[i++] = start;
+
+    return grofs_parse_path_init_dir_entry_type(path_spec);
+}
+
+// Path spec must be freed with grofs_free_path_spec, which is a no-op unless path didn't fit the storage
+static int grofs_parse_path(struct grofs_path_spec *path_spec, struct grofs_path_storage *storage, const char *path) {
+    int path_len = strlen(path);
+
+    if (0 == path_len || '/' != *path) {
+        return ENOENT;
+    }
+
+    if (strcmp(path, "/") == 0) {
+        grofs_parse_path_as_root(path_spec);
+
+        return 0;
+    }
+
+    int parts_count = grofs_count_char_in_string(path, '/');
+
+    path_spec->heap = NULL;
+
+    // path without the leading slash and with its terminator takes path_len bytes
+    if (path_len <= GROFS_PATH_INLINE_LEN && parts_count <= GROFS_PATH_INLINE_PARTS) {
+        path_spec->parts = storage->parts;
+        path_spec->buff = storage->buff;
+    } else {
+        // keep it all as one chunk of memory
+        void *buff = malloc(parts_count * sizeof(char *) + path_len * sizeof(char));
+
+        if (NULL == buff) {
+            return ENOMEM;
+        }
+
+        path_spec->heap = buff;
+        path_spec->parts = (char **) buff;
+        path_spec->buff = (char *) (buff + parts_count * sizeof(char *));
+    }
+
+    memcpy(path_spec->buff, path + 1, path_len * sizeof(char));
+
+    path_spec->parts_count = parts_count;
+
+    int grofs_path_parse_result = grofs_path_parse_as_root_child(path_spec);
+
+    if (0 != grofs_path_parse_result) {
+        grofs_free_path_spec(path_spec);
+
+        return grofs_path_parse_result;
+    }
+
+    return 0;
+}
+
+static int grofs_git_commit_parent_lookup(const struct grofs_repository *repo, const git_oid *commit_oid, git_oid *parent_oid) {
+    git_commit *commit;
+
+    if (git_commit_lookup(&commit, repo->repo, commit_oid) != 0) {
+        return 1;
+    }
+
+    if (git_commit_parentcount(commit) == 0) {
+        git_commit_free(commit);
+
+        return 1;
+    }
+
+    git_oid_cpy(parent_oid, git_commit_parent_id(commit, 0));
+
+    git_commit_free(commit);
+
+    // parent outside of the scope is treated as if there was none
+    if (!grofs_scope_contains(repo->scope, parent_oid, GIT_OBJ_COMMIT)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static int grofs_git_commit_has_parent(const struct grofs_repository *repo, const git_oid *commit_oid) {
+    git_oid oid;
+
+    return grofs_git_commit_parent_lookup(repo, commit_oid, &oid) == 0;
+}
+
+static int grofs_git_rev_commit_lookup(const struct grofs_repository *repo, const char *rev, git_oid *commit_oid) {
+    git_object *object;
+
+    if (git_revparse_single(&object, repo->repo, rev) != 0) {
+        return ENOENT;
+    }
+
+    git_object *commit;
+
+    int ret = git_object_peel(&commit, object, GIT_OBJ_COMMIT);
+
+    git_object_free(object);
+
+    if (0 != ret) {
+        return ENOENT;
+    }
+
+    git_oid_cpy(commit_oid, git_object_id(commit));
+
+    git_object_free(commit);
+
+    return 0;
+}
+
+// SHA1 is already uniformly distributed so first bytes are good enough as a hash
+static uint64_t grofs_oid_hash(const git_oid *oid) {
+    uint64_t hash;
+
+    memcpy(&hash, oid->id, sizeof(uint64_t));
+
+    return hash;
+}
+
+static int grofs_oid_set_init(struct grofs_oid_set *set, size_t capacity) {
+    set->oids = (git_oid *) malloc(sizeof(git_oid) * capacity);
+    set->types = (unsigned char *) calloc(capacity, sizeof(unsigned char));
+
+    if (NULL == set->oids || NULL == set->types) {
+        free(set->oids);
+        free(set->types);
+
+        return ENOMEM;
+    }
+
+    set->count = 0;
+    set->capacity = capacity;
+
+    return 0;
+}
+
+static void grofs_oid_set_free(struct grofs_oid_set *set) {
+    free(set->oids);
+    free(set->types);
+
+    set->oids = NULL;
+    set->types = NULL;
+    set->count = 0;
+    set->capacity = 0;
+}
+
+static int grofs_oid_set_add(struct grofs_oid_set *set, const git_oid *oid, git_otype type, int *added) {
+    // keep load factor under 1/2 so probing stays short
+    if ((set->count + 1) << 1 > set->capacity) {
+        struct grofs_oid_set new_set;
+
+        if (grofs_oid_set_init(&new_set, set->capacity << 1) != 0) {
+            return ENOMEM;
+        }
+
+        size_t i;
+
+        for (i = 0; i < set->capacity; i++) {
+            if (0 == set->types[i]) {
+                continue ;
+            }
+
+            size_t slot = grofs_oid_hash(set->oids + i) & (new_set.capacity - 1);
+
+            while (0 != new_set.types[slot]) {
+                slot = (slot + 1) & (new_set.capacity - 1);
+            }
+
+            git_oid_cpy(new_set.oids + slot, set->oids + i);
+            new_set.types[slot] = set->types[i];
+            new_set.count++;
+        }
+
+        grofs_oid_set_free(set);
+
+        *set = new_set;
+    }
+
+    size_t slot = grofs_oid_hash(oid) & (set->capacity - 1);
+
+    while (0 != set->types[slot]) {
+        if (git_oid_equal(set->oids + slot, oid)) {
+            *added = 0;
+
+            return 0;
+        }
+
+        slot = (slot + 1) & (set->capacity - 1);
+    }
+
+    git_oid_cpy(set->oids + slot, oid);
+    set->types[slot] = (unsigned char) type;
+    set->count++;
+
+    *added = 1;
+
+    return 0;
+}
+
+static int grofs_scope_walk_tree_cb(const char *root, const git_tree_entry *entry, void *payload) {
+    (void) root;
+
+    struct grofs_scope_walk_context *context = (struct grofs_scope_walk_context *) payload;
+
+    git_otype entry_type = git_tree_entry_type(entry);
+
+    // submodules point to commits from other repositories
+    if (GIT_OBJ_BLOB != entry_type && GIT_OBJ_TREE != entry_type) {
+        return 0;
+    }
+
+    int added;
+
+    context->ret = grofs_oid_set_add(context->set, git_tree_entry_id(entry), entry_type, &added);
+
+    if (0 != context->ret) {
+        return -1;
+    }
+
+    // everything under a tree that was already seen is already collected
+    return GIT_OBJ_TREE == entry_type && !added;
+}
+
+static int grofs_scope_collect_commit(const struct grofs_repository *repo, struct grofs_oid_set *set, const git_oid *commit_oid) {
+    int added;
+
+    int ret = grofs_oid_set_add(set, commit_oid, GIT_OBJ_COMMIT, &added);
+
+    if (0 != ret || !added) {
+        return ret;
+    }
+
+    git_commit *commit;
+
+    if (git_commit_lookup(&commit, repo->repo, commit_oid) != 0) {
+        return ENOENT;
+    }
+
+    ret = grofs_oid_set_add(set, git_commit_tree_id(commit), GIT_OBJ_TREE, &added);
+
+    if (0 != ret || !added) {
+        git_commit_free(commit);
+
+        return ret;
+    }
+
+    git_tree *tree;
+
+    if (git_commit_tree(&tree, commit) != 0) {
+        git_commit_free(commit);
+
+        return ENOENT;
+    }
+
+    struct grofs_scope_walk_context context = {
+        .set = set,
+        .ret = 0
+    };
+
+    if (git_tree_walk(tree, GIT_TREEWALK_PRE, grofs_scope_walk_tree_cb, &context) != 0 && 0 == context.ret) {
+        context.ret = ENOENT;
+    }
+
+    git_tree_free(tree);
+
+    git_commit_free(commit);
+
+    return context.ret;
+}
+
+static int grofs_scope_push_rev(const struct grofs_repository *repo, git_revwalk *walk, const char *rev) {
+    if (strchr(rev, '*') != NULL) {
+        return git_revwalk_push_glob(walk, rev);
+    }
+
+    if (strstr(rev, "..") != NULL) {
+        return git_revwalk_push_range(walk, rev);
+    }
+
+    git_oid commit_oid;
+
+    if (grofs_git_rev_commit_lookup(repo, rev, &commit_oid) != 0) {
+        return -1;
+    }
+
+    return git_revwalk_push(walk, &commit_oid);
+}
+
+// Every revision gets its own walk so that hidden commits of one range don't hide commits of another
+static int grofs_scope_collect_rev(const struct grofs_repository *repo, struct grofs_oid_set *set, const char *rev) {
+    git_revwalk *walk;
+
+    if (git_revwalk_new(&walk, repo->repo) != 0) {
+        return ENOMEM;
+    }
+
+    if (grofs_scope_push_rev(repo, walk, rev) != 0) {
+        git_revwalk_free(walk);
+
+        return ENOENT;
+    }
+
+    git_oid commit_oid;
+
+    int ret = 0;
+
+    while (0 == ret && git_revwalk_next(&commit_oid, walk) == 0) {
+        ret = grofs_scope_collect_commit(repo, set, &commit_oid);
+    }
+
+    git_revwalk_free(walk);
+
+    return ret;
+}
+
+static int grofs_typed_oid_cmp(const void *a, const void *b) {
+    return git_oid_cmp(&((const struct grofs_typed_oid *) a)->oid, &((const struct grofs_typed_oid *) b)->oid);
+}
+
+static int grofs_scope_init_from_set(struct grofs_scope *scope, const struct grofs_oid_set *set) {
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; i < set->capacity; i++) {
+        count += GIT_OBJ_COMMIT == set->types[i] || GIT_OBJ_BLOB == set->types[i];
+    }
+
+    struct grofs_typed_oid *typed_oids = (struct grofs_typed_oid *) malloc(sizeof(struct grofs_typed_oid) * (count + 1));
+
+    scope->oids = (git_oid *) malloc(sizeof(git_oid) * (count + 1));
+    scope->commit_bits = (uint64_t *) calloc(count / 64 + 1, sizeof(uint64_t));
+    scope->count = count;
+
+    if (NULL == typed_oids || NULL == scope->oids || NULL == scope->commit_bits) {
+        free(typed_oids);
+        free(scope->oids);
+        free(scope->commit_bits);
+
+        return ENOMEM;
+    }
+
+    size_t j = 0;
+
+    // trees are only needed while walking, they are not exposed anywhere
+    for (i = 0; i < set->capacity; i++) {
+        if (GIT_OBJ_COMMIT != set->types[i] && GIT_OBJ_BLOB != set->types[i]) {
+            continue ;
+        }
+
+        git_oid_cpy(&typed_oids[j].oid, set->oids + i);
+        typed_oids[j].type = (git_otype) set->types[i];
+        j++;
+    }
+
+    qsort(typed_oids, count, sizeof(struct grofs_typed_oid), grofs_typed_oid_cmp);
+
+    for (i = 0; i < count; i++) {
+        git_oid_cpy(scope->oids + i, &typed_oids[i].oid);
+
+        if (GIT_OBJ_COMMIT == typed_oids[i].type) {
+            scope->commit_bits[i >> 6] |= (uint64_t) 1 << (i & 63);
+        }
+    }
+
+    free(typed_oids);
+
+    return 0;
+}
+
+static int grofs_scope_build(struct grofs_repository *repo) {
+    struct grofs_oid_set set;
+
+    if (grofs_oid_set_init(&set, GROFS_OID_SET_MIN_CAPACITY) != 0) {
+        return ENOMEM;
+    }
+
+    size_t i;
+
+    for (i = 0; i < grofs_scope_revs.count; i++) {
+        int ret = grofs_scope_collect_rev(repo, &set, grofs_scope_revs.items[i]);
+
+        if (0 != ret) {
+            fprintf(stderr, "Failed to collect objects reachable from: %s\n", grofs_scope_revs.items[i]);
+
+            grofs_oid_set_free(&set);
+
+            return ret;
+        }
+    }
+
+    struct grofs_scope *scope = (struct grofs_scope *) malloc(sizeof(struct grofs_scope));
+
+    if (NULL == scope) {
+        grofs_oid_set_free(&set);
+
+        return ENOMEM;
+    }
+
+    int ret = grofs_scope_init_from_set(scope, &set);
+
+    grofs_oid_set_free(&set);
+
+    if (0 != ret) {
+        free(scope);
+
+        return ret;
+    }
+
+    repo->scope = scope;
+
+    return 0;
+}
+
+static void grofs_scope_free(struct grofs_scope *scope) {
+    free(scope->oids);
+    free(scope->commit_bits);
+    free(scope);
+}
+
+static int grofs_scope_contains(const struct grofs_scope *scope, const git_oid *oid, git_otype type) {
+    if (NULL == scope) {
+        return 1;
+    }
+
+    size_t low = 0;
+    size_t high = scope->count;
+
+    while (low < high) {
+        size_t mid = low + ((high - low) >> 1);
+
+        int cmp = git_oid_cmp(scope->oids + mid, oid);
+
+        if (0 == cmp) {
+            int is_commit = (scope->commit_bits[mid >> 6] >> (mid & 63)) & 1;
+
+            return is_commit == (GIT_OBJ_COMMIT == type);
+        }
+
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return 0;
+}
+
+static void grofs_oid_hex(char *out, const git_oid *oid) {
+    static const char digits[] = "0123456789abcdef";
+
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // 16 bytes at a time, nibble n becomes '0' + n and 'a' - '0' - 10 more above 9
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero_char = _mm_set1_epi8('0');
+    const __m128i letter_offset = _mm_set1_epi8('a' - '0' - 10);
+
+    __m128i bytes = _mm_loadu_si128((const __m128i *) oid->id);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_mask);
+    __m128i low = _mm_and_si128(bytes, low_mask);
+    __m128i first = _mm_unpacklo_epi8(high, low);
+    __m128i second = _mm_unpackhi_epi8(high, low);
+
+    first = _mm_add_epi8(_mm_add_epi8(first, zero_char), _mm_and_si128(_mm_cmpgt_epi8(first, nine), letter_offset));
+    second = _mm_add_epi8(_mm_add_epi8(second, zero_char), _mm_and_si128(_mm_cmpgt_epi8(second, nine), letter_offset));
+
+    _mm_storeu_si128((__m128i *) out, first);
+    _mm_storeu_si128((__m128i *) (out + 16), second);
+
+    i = 16;
+#endif
+
+    for (; i < GIT_OID_RAWSZ; i++) {
+        out[i * 2] = digits[oid->id[i] >> 4];
+        out[i * 2 + 1] = digits[oid->id[i] & 0x0f];
+    }
+}
+
+static int grofs_list_block_flush(struct grofs_list_block *block) {
+    if (0 == block->len || block->ret) {
+        return block->ret;
+    }
+
+    block->ret = block->cb(block->data, block->len, block->count, block->payload);
+    block->len = 0;
+    block->count = 0;
+
+    return block->ret;
+}
+
+static int grofs_list_block_add_oid(struct grofs_list_block *block, const git_oid *oid) {
+    if (block->len + GIT_OID_HEXSZ + 1 > GROFS_LIST_BLOCK_LEN && grofs_list_block_flush(block)) {
+        return block->ret;
+    }
+
+    grofs_oid_hex(block->data + block->len, oid);
+
+    block->data[block->len + GIT_OID_HEXSZ] = '\0';
+    block->len += GIT_OID_HEXSZ + 1;
+    block->count++;
+
+    return 0;
+}
+
+static int grofs_list_block_add_name_cb(const char *name, void *payload) {
+    struct grofs_list_block *block = (struct grofs_list_block *) payload;
+
+    size_t len = strlen(name) + 1;
+
+    if (block->len + len > GROFS_LIST_BLOCK_LEN && grofs_list_block_flush(block)) {
+        return block->ret;
+    }
+
+    // names are at most NAME_MAX long so they always fit into an empty block
+    memcpy(block->data + block->len, name, len);
+
+    block->len += len;
+    block->count++;
+
+    return 0;
+}
+
+static int grofs_list_split_cb(const char *names, size_t len, size_t count, void *payload) {
+    (void) len;
+
+    struct grofs_list_split_context *context = (struct grofs_list_split_context *) payload;
+
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        int ret = context->cb(names, context->payload);
+
+        if (ret) {
+            return ret;
+        }
+
+        names += strlen(names) + 1;
+    }
+
+    return 0;
+}
+
+static int grofs_scope_list_objects(const struct grofs_scope *scope, git_otype wanted_type, struct grofs_list_block *block) {
+    int want_commit = GIT_OBJ_COMMIT == wanted_type;
+
+    size_t i;
+
+    for (i = 0; i < scope->count; i++) {
+        int is_commit = (scope->commit_bits[i >> 6] >> (i & 63)) & 1;
+
+        if (is_commit != want_commit) {
+            continue ;
+        }
+
+        if (grofs_list_block_add_oid(block, scope->oids + i)) {
+            return block->ret;
+        }
+    }
+
+    return 0;
+}
+
+// Parses exactly count decimal digits, no sign or spaces
+static int grofs_at_parse_digits(const char *str, int count, int *value) {
+    *value = 0;
+
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (str[i] < '0' || str[i] > '9') {
+            return EINVAL;
+        }
+
+        *value = *value * 10 + (str[i] - '0');
+    }
+
+    return 0;
+}
+
+// Seconds since epoch, or UTC date as 2026-01-01 or 2026-01-01T12:00:00 with optional trailing Z
+static int grofs_at_parse_time(const char *str, int64_t *time) {
+    char *end;
+
+    errno = 0;
+
+    long long seconds = strtoll(str, &end, 10);
+
+    if (end != str && '\0' == *end && ('-' == *str || isdigit((unsigned char) *str))) {
+        if (ERANGE == errno) {
+            return EINVAL;
+        }
+
+        *time = seconds;
+
+        return 0;
+    }
+
+    struct tm tm;
+
+    memset(&tm, 0, sizeof(struct tm));
+
+    if (grofs_at_parse_digits(str, 4, &tm.tm_year) != 0 || '-' != str[4] ||
+        grofs_at_parse_digits(str + 5, 2, &tm.tm_mon) != 0 || '-' != str[7] ||
+        grofs_at_parse_digits(str + 8, 2, &tm.tm_mday) != 0) {
+        return EINVAL;
+    }
+
+    str += 10;
+
+    if ('T' == *str) {
+        if (grofs_at_parse_digits(str + 1, 2, &tm.tm_hour) != 0 || ':' != str[3] ||
+            grofs_at_parse_digits(str + 4, 2, &tm.tm_min) != 0 || ':' != str[6] ||
+            grofs_at_parse_digits(str + 7, 2, &tm.tm_sec) != 0) {
+            return EINVAL;
+        }
+
+        str += 9;
+    }
+
+    if ('Z' == *str) {
+        str++;
+    }
+
+    if ('\0' != *str) {
+        return EINVAL;
+    }
+
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+
+    struct tm expected = tm;
+
+    time_t result = timegm(&tm);
+
+    // timegm() normalises out of range fields, e.g. 2026-02-30 into March 2nd, so reject anything that moved
+    if (NULL == gmtime_r(&result, &tm) || tm.tm_year != expected.tm_year || tm.tm_mon != expected.tm_mon || tm.tm_mday != expected.tm_mday ||
+        tm.tm_hour != expected.tm_hour || tm.tm_min != expected.tm_min || tm.tm_sec != expected.tm_sec) {
+        return EINVAL;
+    }
+
+    *time = result;
+
+    return 0;
+}
+
+static int grofs_at_chain_reserve(struct grofs_at_chain *chain, size_t count) {
+    if (chain->capacity - chain->count >= count) {
+        return 0;
+    }
+
+    size_t capacity = chain->capacity < GROFS_AT_MIN_CAPACITY ? GROFS_AT_MIN_CAPACITY : chain->capacity * 2;
+
+    if (capacity < chain->count + count) {
+        capacity = chain->count + count;
+    }
+
+    struct grofs_at_commit *commits = (struct grofs_at_commit *) realloc(chain->commits, capacity * sizeof(struct grofs_at_commit));
+
+    if (NULL == commits) {
+        return ENOMEM;
+    }
+
+    chain->commits = commits;
+    chain->capacity = capacity;
+
+    return 0;
+}
+
+// Room must be reserved
+static void grofs_at_chain_push(struct grofs_at_chain *chain, const git_oid *oid, int64_t time) {
+    // clock skew can make a parent newer than its child, it then gets the child's time
+    if (chain->count > 0 && time > chain->commits[chain->count - 1].time) {
+        time = chain->commits[chain->count - 1].time;
+    }
+
+    struct grofs_at_commit *commit = chain->commits + chain->count++;
+
+    git_oid_cpy(&commit->oid, oid);
+
+    commit->time = time;
+}
+
+// Continues chain with commits of older, which start at its next_oid, chain is left as it was on failure
+static int grofs_at_chain_append(struct grofs_at_chain *chain, const struct grofs_at_chain *older) {
+    int ret = grofs_at_chain_reserve(chain, older->count);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    size_t i;
+
+    for (i = 0; i < older->count; i++) {
+        grofs_at_chain_push(chain, &older->commits[i].oid, older->commits[i].time);
+    }
+
+    git_oid_cpy(&chain->next_oid, &older->next_oid);
+
+    return 0;
+}
+
+// Whether chain holds a commit not newer than time or all of history
+static int grofs_at_chain_covers(const struct grofs_at_chain *chain, int64_t time) {
+    return git_oid_iszero(&chain->next_oid) || (chain->count > 0 && chain->commits[chain->count - 1].time <= time);
+}
+
+// Must be called with grofs_at_lock held, least recently used chain is replaced when all slots are taken
+static struct grofs_at_chain *grofs_at_chain_slot(const struct grofs_repository *repo, const git_oid *tip_oid) {
+    struct grofs_at_chain *victim = grofs_at_chains;
+
+    int i;
+
+    for (i = 0; i < GROFS_AT_CHAIN_SLOTS; i++) {
+        struct grofs_at_chain *chain = grofs_at_chains + i;
+
+        if (repo == chain->repo && git_oid_equal(tip_oid, &chain->tip_oid)) {
+            chain->last_used = ++grofs_at_clock;
+
+            return chain;
+        }
+
+        if (NULL == victim->repo) {
+            continue ;
+        }
+
+        if (NULL == chain->repo || chain->last_used < victim->last_used) {
+            victim = chain;
+        }
+    }
+
+    free(victim->commits);
+
+    victim->repo = repo;
+    victim->commits = NULL;
+    victim->count = 0;
+    victim->capacity = 0;
+    victim->last_used = ++grofs_at_clock;
+
+    git_oid_cpy(&victim->tip_oid, tip_oid);
+    git_oid_cpy(&victim->next_oid, tip_oid);
+
+    return victim;
+}
+
+// Must be called with grofs_at_lock held, continues chain with history already walked for older tips of the same ref
+static int grofs_at_chain_splice(struct grofs_at_chain *chain) {
+    while (!git_oid_iszero(&chain->next_oid)) {
+        int i;
+
+        for (i = 0; i < GROFS_AT_CHAIN_SLOTS; i++) {
+            const struct grofs_at_chain *older = grofs_at_chains + i;
+
+            if (older != chain && chain->repo == older->repo && older->count > 0 && git_oid_equal(&chain->next_oid, &older->tip_oid)) {
+                break;
+            }
+        }
+
+        if (i == GROFS_AT_CHAIN_SLOTS) {
+            break;
+        }
+
+        int ret = grofs_at_chain_append(chain, grofs_at_chains + i);
+
+        if (0 != ret) {
+            return ret;
+        }
+
+        atomic_fetch_add(&grofs_at_stats.spliced, grofs_at_chains[i].count);
+    }
+
+    return 0;
+}
+
+// Must be called with grofs_at_lock held, copies tips of other walked chains of the same repository
+static size_t grofs_at_chain_tips(const struct grofs_at_chain *chain, git_oid *tips) {
+    size_t count = 0;
+
+    int i;
+
+    for (i = 0; i < GROFS_AT_CHAIN_SLOTS; i++) {
+        const struct grofs_at_chain *older = grofs_at_chains + i;
+
+        if (older != chain && chain->repo == older->repo && older->count > 0) {
+            git_oid_cpy(tips + count++, &older->tip_oid);
+        }
+    }
+
+    return count;
+}
+
+// Walks first parents from oid without grofs_at_lock held, until a commit not newer than time, root commit or one of tips
+static int grofs_at_chain_walk(struct grofs_at_chain *walked, const git_oid *oid, int64_t time, const git_oid *tips, size_t tips_count) {
+    git_oid_cpy(&walked->next_oid, oid);
+
+    while (!grofs_at_chain_covers(walked, time)) {
+        size_t i;
+
+        for (i = 0; i < tips_count; i++) {
+            if (git_oid_equal(&walked->next_oid, tips + i)) {
+                return 0;
+            }
+        }
+
+        git_commit *commit;
+
+        // missing parent, e.g. in a shallow clone, ends history just like a root commit
+        if (git_commit_lookup(&commit, walked->repo->repo, &walked->next_oid) != 0) {
+            memset(&walked->next_oid, 0, sizeof(git_oid));
+
+            break;
+        }
+
+        int ret = grofs_at_chain_reserve(walked, 1);
+
+        if (0 == ret) {
+            grofs_at_chain_push(walked, git_commit_id(commit), git_commit_time(commit));
+
+            if (git_commit_parentcount(commit) > 0) {
+                git_oid_cpy(&walked->next_oid, git_commit_parent_id(commit, 0));
+            } else {
+                memset(&walked->next_oid, 0, sizeof(git_oid));
+            }
+        }
+
+        git_commit_free(commit);
+
+        if (0 != ret) {
+            return ret;
+        }
+
+        atomic_fetch_add(&grofs_at_stats.walked, 1);
+    }
+
+    return 0;
+}
+
+// Newest commit on first parent history of tip which is not newer than time
+static int grofs_at_resolve(const struct grofs_repository *repo, const git_oid *tip_oid, int64_t time, git_oid *commit_oid) {
+    atomic_fetch_add(&grofs_at_stats.lookups, 1);
+
+    pthread_mutex_lock(&grofs_at_lock);
+
+    struct grofs_at_chain *chain = grofs_at_chain_slot(repo, tip_oid);
+
+    int ret = grofs_at_chain_splice(chain);
+
+    // commits are looked up with the lock released so that a long walk doesn't hold up lookups of other refs
+    while (0 == ret && !grofs_at_chain_covers(chain, time)) {
+        git_oid from_oid;
+        git_oid tips[GROFS_AT_CHAIN_SLOTS];
+
+        git_oid_cpy(&from_oid, &chain->next_oid);
+
+        size_t tips_count = grofs_at_chain_tips(chain, tips);
+
+        pthread_mutex_unlock(&grofs_at_lock);
+
+        struct grofs_at_chain walked = {
+            .repo = repo
+        };
+
+        ret = grofs_at_chain_walk(&walked, &from_oid, time, tips, tips_count);
+
+        pthread_mutex_lock(&grofs_at_lock);
+
+        chain = grofs_at_chain_slot(repo, tip_oid);
+
+        // chain may have been extended by another lookup or replaced meanwhile, the walk is then dropped
+        if (0 == ret && git_oid_equal(&chain->next_oid, &from_oid)) {
+            ret = grofs_at_chain_append(chain, &walked);
+        }
+
+        free(walked.commits);
+
+        if (0 == ret) {
+            ret = grofs_at_chain_splice(chain);
+        }
+    }
+
+    if (0 != ret) {
+        pthread_mutex_unlock(&grofs_at_lock);
+
+        return ret;
+    }
+
+    size_t low = 0;
+    size_t high = chain->count;
+
+    // times are not growing along the chain, so this finds the first commit not newer than time
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+
+        if (chain->commits[mid].time > time) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    ret = ENOENT;
+
+    if (low < chain->count) {
+        git_oid_cpy(commit_oid, &chain->commits[low].oid);
+
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&grofs_at_lock);
+
+    return ret;
+}
+
+// Whether any ref is below prefix, which then is a directory like origin in origin/main
+static int grofs_at_ref_prefix_exists(const struct grofs_repository *repo, const char *prefix) {
+    static const char *namespaces[] = { "", "refs/", "refs/heads/", "refs/tags/", "refs/remotes/" };
+
+    git_reference_iterator *iter;
+
+    if (git_reference_iterator_new(&iter, repo->repo) != 0) {
+        return 0;
+    }
+
+    size_t prefix_len = strlen(prefix);
+
+    const char *name;
+
+    int found = 0;
+
+    while (!found && git_reference_next_name(&name, iter) == 0) {
+        size_t i;
+
+        for (i = 0; i < sizeof(namespaces) / sizeof(namespaces[0]); i++) {
+            size_t namespace_len = strlen(namespaces[i]);
+
+            if (
+                strncmp(name, namespaces[i], namespace_len) == 0
+                &&
+                strncmp(name + namespace_len, prefix, prefix_len) == 0
+                &&
+                '/' == name[namespace_len + prefix_len]
+            ) {
+                found = 1;
+
+                break;
+            }
+        }
+    }
+
+    git_reference_iterator_free(iter);
+
+    return found;
+}
+
+static void grofs_at_chains_free(void) {
+    int i;
+
+    for (i = 0; i < GROFS_AT_CHAIN_SLOTS; i++) {
+        free(grofs_at_chains[i].commits);
+    }
+
+    memset(grofs_at_chains, 0, sizeof(grofs_at_chains));
+}
+
+static int grofs_object_index_record_cmp(const void *a, const void *b) {
+    return git_oid_cmp(&((const struct grofs_object_index_record *) a)->oid, &((const struct grofs_object_index_record *) b)->oid);
+}
+
+static int grofs_object_index_add(struct grofs_object_index_context *context, const git_oid *oid, size_t size) {
+    if (context->count == context->capacity) {
+        size_t capacity = context->capacity < GROFS_OBJECT_INDEX_MIN_CAPACITY ? GROFS_OBJECT_INDEX_MIN_CAPACITY : context->capacity * 2;
+
+        struct grofs_object_index_record *records = (struct grofs_object_index_record *) realloc(context->records, capacity * sizeof(struct grofs_object_index_record));
+
+        if (NULL == records) {
+            return ENOMEM;
+        }
+
+        context->records = records;
+        context->capacity = capacity;
+    }
+
+    struct grofs_object_index_record *record = context->records + context->count++;
+
+    git_oid_cpy(&record->oid, oid);
+
+    record->size = size;
+
+    return 0;
+}
+
+// Returns negative because of https://github.com/libgit2/libgit2/issues/4946
+static int grofs_object_index_collect_cb(const git_oid *id, void *payload) {
+    struct grofs_object_index_context *context = (struct grofs_object_index_context *) payload;
+
+    size_t size;
+    git_otype type;
+
+    // only the header is read, the same as listing of commits/ and blobs/
+    if (git_odb_read_header(&size, &type, context->repo->odb, id) != 0 || type != context->wanted_type) {
+        return 0;
+    }
+
+    context->ret = grofs_object_index_add(context, id, size);
+
+    return context->ret ? GIT_EUSER : 0;
+}
+
+static int grofs_object_index_collect_scope(struct grofs_object_index_context *context) {
+    const struct grofs_scope *scope = context->repo->scope;
+
+    int want_commit = GIT_OBJ_COMMIT == context->wanted_type;
+
+    size_t i;
+
+    for (i = 0; i < scope->count; i++) {
+        int is_commit = (scope->commit_bits[i >> 6] >> (i & 63)) & 1;
+
+        if (is_commit != want_commit) {
+            continue ;
+        }
+
+        size_t size = 0;
+        git_otype type;
+
+        if (grofs_options.index_sizes && git_odb_read_header(&size, &type, context->repo->odb, scope->oids + i) != 0) {
+            continue ;
+        }
+
+        int ret = grofs_object_index_add(context, scope->oids + i, size);
+
+        if (0 != ret) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static int grofs_object_index_build(const struct grofs_repository *repo, struct grofs_object_index *index, git_otype type) {
+    struct grofs_object_index_context context = {
+        .repo = repo,
+        .wanted_type = type,
+        .records = NULL,
+        .count = 0,
+        .capacity = 0,
+        .ret = 0
+    };
+
+    if (NULL != repo->scope) {
+        context.ret = grofs_object_index_collect_scope(&context);
+    } else {
+        grofs_sched_enter(GROFS_SCHED_LISTING);
+
+        if (git_odb_foreach(repo->odb, grofs_object_index_collect_cb, &context) != 0 && 0 == context.ret) {
+            context.ret = EIO;
+        }
+
+        grofs_sched_leave(GROFS_SCHED_LISTING);
+    }
+
+    if (0 != context.ret) {
+        free(context.records);
+
+        return context.ret;
+    }
+
+    // scope is sorted already, odb yields objects in pack order and the same object may be in more than one pack
+    if (NULL == repo->scope) {
+        qsort(context.records, context.count, sizeof(struct grofs_object_index_record), grofs_object_index_record_cmp);
+    }
+
+    size_t record_len = GIT_OID_RAWSZ + (grofs_options.index_sizes ? GROFS_OBJECT_INDEX_SIZE_LEN : 0);
+
+    char *data = NULL;
+
+    if (context.count > 0) {
+        data = (char *) malloc(context.count * record_len);
+
+        if (NULL == data) {
+            free(context.records);
+
+            return ENOMEM;
+        }
+    }
+
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; i < context.count; i++) {
+        const struct grofs_object_index_record *record = context.records + i;
+
+        if (count > 0 && git_oid_equal(&record->oid, &context.records[i - 1].oid)) {
+            continue ;
+        }
+
+        unsigned char *out = (unsigned char *) data + count++ * record_len;
+
+        memcpy(out, record->oid.id, GIT_OID_RAWSZ);
+
+        if (grofs_options.index_sizes) {
+            int byte;
+
+            for (byte = 0; byte < GROFS_OBJECT_INDEX_SIZE_LEN; byte++) {
+                out[GIT_OID_RAWSZ + byte] = (unsigned char) ((uint64_t) record->size >> (8 * (GROFS_OBJECT_INDEX_SIZE_LEN - 1 - byte)));
+            }
+        }
+    }
+
+    free(context.records);
+
+    index->data = data;
+    index->len = count * record_len;
+
+    atomic_fetch_add(&grofs_object_index_stats.builds, 1);
+    atomic_fetch_add(&grofs_object_index_stats.records, count);
+    atomic_fetch_add(&grofs_object_index_stats.bytes, index->len);
+
+    return 0;
+}
+
+static struct grofs_object_index *grofs_object_index_for(const struct grofs_repository *repo, enum grofs_root_child_type root_child_type) {
+    return repo->object_indexes + (COMMIT_INDEX == root_child_type ? GROFS_OBJECT_INDEX_COMMITS : GROFS_OBJECT_INDEX_BLOBS);
+}
+
+// Index is built once per mount by the first open, objects added to the repository later are not in it
+static int grofs_object_index_get(const struct grofs_repository *repo, enum grofs_root_child_type root_child_type, const struct grofs_object_index **index) {
+    int is_commit = COMMIT_INDEX == root_child_type;
+
+    struct grofs_object_index *object_index = grofs_object_index_for(repo, root_child_type);
+
+    int ret = 0;
+
+    if (!atomic_load(&object_index->built)) {
+        pthread_mutex_lock(&object_index->lock);
+
+        if (!atomic_load(&object_index->built)) {
+            ret = grofs_object_index_build(repo, object_index, is_commit ? GIT_OBJ_COMMIT : GIT_OBJ_BLOB);
+
+            if (0 == ret) {
+                atomic_store(&object_index->built, 1);
+            }
+        }
+
+        pthread_mutex_unlock(&object_index->lock);
+    }
+
+    *index = object_index;
+
+    return ret;
+}
+
+static int grofs_object_indexes_init(struct grofs_repository *repo) {
+    repo->object_indexes = (struct grofs_object_index *) calloc(GROFS_OBJECT_INDEX_COUNT, sizeof(struct grofs_object_index));
+
+    if (NULL == repo->object_indexes) {
+        return ENOMEM;
+    }
+
+    int i;
+
+    for (i = 0; i < GROFS_OBJECT_INDEX_COUNT; i++) {
+        pthread_mutex_init(&repo->object_indexes[i].lock, NULL);
+    }
+
+    return 0;
+}
+
+static void grofs_object_indexes_free(struct grofs_repository *repo) {
+    if (NULL == repo->object_indexes) {
+        return ;
+    }
+
+    int i;
+
+    for (i = 0; i < GROFS_OBJECT_INDEX_COUNT; i++) {
+        pthread_mutex_destroy(&repo->object_indexes[i].lock);
+
+        free(repo->object_indexes[i].data);
+    }
+
+    free(repo->object_indexes);
+
+    repo->object_indexes = NULL;
+}
+
+static size_t grofs_cache_shard_index(const git_oid *oid) {
+    // bucket index uses leading bytes so shard is picked by the trailing one
+    return oid->id[GIT_OID_RAWSZ - 1] & (GROFS_CACHE_SHARDS - 1);
+}
+
+static int grofs_cache_init(struct grofs_cache *cache, const char *name, size_t budget, void (*free_entry)(struct grofs_cache_entry *entry)) {
+    cache->name = name;
+    cache->budget = budget;
+    cache->free_entry = free_entry;
+    cache->evict_entry = NULL;
+
+    atomic_init(&cache->limit, budget);
+    atomic_init(&cache->cost, 0);
+    atomic_init(&cache->hits, 0);
+    atomic_init(&cache->misses, 0);
+    atomic_init(&cache->evictions, 0);
+
+    int i;
+
+    for (i = 0; i < GROFS_CACHE_SHARDS; i++) {
+        struct grofs_cache_shard *shard = cache->shards + i;
+
+        shard->buckets = (struct grofs_cache_entry **) calloc(GROFS_CACHE_MIN_BUCKETS, sizeof(struct grofs_cache_entry *));
+
+        if (NULL == shard->buckets) {
+            grofs_cache_destroy(cache);
+
+            return ENOMEM;
+        }
+
+        pthread_mutex_init(&shard->lock, NULL);
+
+        shard->buckets_count = GROFS_CACHE_MIN_BUCKETS;
+        shard->count = 0;
+        shard->cost = 0;
+        shard->lru_head = NULL;
+        shard->lru_tail = NULL;
+    }
+
+    return 0;
+}
+
+static void grofs_cache_destroy(struct grofs_cache *cache) {
+    int i;
+
+    for (i = 0; i < GROFS_CACHE_SHARDS; i++) {
+        struct grofs_cache_shard *shard = cache->shards + i;
+
+        if (NULL == shard->buckets) {
+            continue ;
+        }
+
+        struct grofs_cache_entry *entry = shard->lru_head;
+
+        while (NULL != entry) {
+            struct grofs_cache_entry *next = entry->lru_next;
+
+            entry->cached = 0;
+
+            grofs_cache_release(cache, entry);
+
+            entry = next;
+        }
+
+        free(shard->buckets);
+
+        shard->buckets = NULL;
+
+        pthread_mutex_destroy(&shard->lock);
+    }
+}
+
+static void grofs_cache_entry_init(struct grofs_cache_entry *entry, const git_oid *oid, size_t cost) {
+    git_oid_cpy(&entry->oid, oid);
+
+    entry->hash_next = NULL;
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+    entry->cost = cost;
+    entry->cached = 0;
+
+    atomic_init(&entry->refs, 1);
+}
+
+// Returns link which points to the entry with given oid, or the NULL link at the end of the bucket
+static struct grofs_cache_entry **grofs_cache_shard_link(struct grofs_cache_shard *shard, const git_oid *oid) {
+    struct grofs_cache_entry **link = shard->buckets + (grofs_oid_hash(oid) & (shard->buckets_count - 1));
+
+    while (NULL != *link && !git_oid_equal(&(*link)->oid, oid)) {
+        link = &(*link)->hash_next;
+    }
+
+    return link;
+}
+
+static void grofs_cache_shard_lru_unlink(struct grofs_cache_shard *shard, struct grofs_cache_entry *entry) {
+    if (NULL == entry->lru_prev) {
+        shard->lru_head = entry->lru_next;
+    } else {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+
+    if (NULL == entry->lru_next) {
+        shard->lru_tail = entry->lru_prev;
+    } else {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void grofs_cache_shard_lru_push(struct grofs_cache_shard *shard, struct grofs_cache_entry *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->lru_head;
+
+    if (NULL == shard->lru_head) {
+        shard->lru_tail = entry;
+    } else {
+        shard->lru_head->lru_prev = entry;
+    }
+
+    shard->lru_head = entry;
+}
+
+static void grofs_cache_shard_grow(struct grofs_cache_shard *shard) {
+    if (shard->count <= shard->buckets_count) {
+        return ;
+    }
+
+    size_t new_buckets_count = shard->buckets_count << 1;
+
+    struct grofs_cache_entry **new_buckets = (struct grofs_cache_entry **) calloc(new_buckets_count, sizeof(struct grofs_cache_entry *));
+
+    // longer chains are still correct so failure here is not fatal
+    if (NULL == new_buckets) {
+        return ;
+    }
+
+    size_t i;
+
+    for (i = 0; i < shard->buckets_count; i++) {
+        struct grofs_cache_entry *entry = shard->buckets[i];
+
+        while (NULL != entry) {
+            struct grofs_cache_entry *next = entry->hash_next;
+
+            size_t bucket = grofs_oid_hash(&entry->oid) & (new_buckets_count - 1);
+
+            entry->hash_next = new_buckets[bucket];
+            new_buckets[bucket] = entry;
+
+            entry = next;
+        }
+    }
+
+    free(shard->buckets);
+
+    shard->buckets = new_buckets;
+    shard->buckets_count = new_buckets_count;
+}
+
+// Detaches least recently used entries until shard fits the budget, detached entries are chained through hash_next
+static struct grofs_cache_entry *grofs_cache_shard_evict(struct grofs_cache *cache, struct grofs_cache_shard *shard, size_t budget) {
+    struct grofs_cache_entry *evicted = NULL;
+
+    while (shard->cost > budget && NULL != shard->lru_tail) {
+        struct grofs_cache_entry *entry = shard->lru_tail;
+
+        grofs_cache_shard_lru_unlink(shard, entry);
+
+        *grofs_cache_shard_link(shard, &entry->oid) = entry->hash_next;
+
+        shard->count--;
+        shard->cost -= entry->cost;
+
+        atomic_fetch_sub(&cache->cost, entry->cost);
+
+        entry->cached = 0;
+        entry->hash_next = evicted;
+
+        evicted = entry;
+    }
+
+    return evicted;
+}
+
+// Returned entry has a reference which must be released with grofs_cache_release
+static struct grofs_cache_entry *grofs_cache_get(struct grofs_cache *cache, const git_oid *oid) {
+    struct grofs_cache_shard *shard = cache->shards + grofs_cache_shard_index(oid);
+
+    pthread_mutex_lock(&shard->lock);
+
+    struct grofs_cache_entry *entry = *grofs_cache_shard_link(shard, oid);
+
+    if (NULL != entry) {
+        atomic_fetch_add(&entry->refs, 1);
+
+        grofs_cache_shard_lru_unlink(shard, entry);
+        grofs_cache_shard_lru_push(shard, entry);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+
+    atomic_fetch_add(NULL == entry ? &cache->misses : &cache->hits, 1);
+
+    return entry;
+}
+
+// Unlike grofs_cache_get, doesn't count as a hit or a miss and doesn't affect eviction order
+static int grofs_cache_contains(struct grofs_cache *cache, const git_oid *oid) {
+    struct grofs_cache_shard *shard = cache->shards + grofs_cache_shard_index(oid);
+
+    pthread_mutex_lock(&shard->lock);
+
+    int found = NULL != *grofs_cache_shard_link(shard, oid);
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return found;
+}
+
+// Takes over caller's reference to the entry and returns entry which should be used instead of it,
+// either the same one or the one that was already cached, with a reference for the caller
+static struct grofs_cache_entry *grofs_cache_put(struct grofs_cache *cache, struct grofs_cache_entry *entry) {
+    size_t budget = atomic_load(&cache->limit) / GROFS_CACHE_SHARDS;
+
+    // too big to be cached so the caller keeps the only reference
+    if (entry->cost > budget) {
+        return entry;
+    }
+
+    struct grofs_cache_shard *shard = cache->shards + grofs_cache_shard_index(&entry->oid);
+
+    pthread_mutex_lock(&shard->lock);
+
+    struct grofs_cache_entry **link = grofs_cache_shard_link(shard, &entry->oid);
+
+    if (NULL != *link) {
+        struct grofs_cache_entry *cached_entry = *link;
+
+        atomic_fetch_add(&cached_entry->refs, 1);
+
+        pthread_mutex_unlock(&shard->lock);
+
+        grofs_cache_release(cache, entry);
+
+        return cached_entry;
+    }
+
+    *link = entry;
+
+    entry->hash_next = NULL;
+    entry->cached = 1;
+
+    atomic_fetch_add(&entry->refs, 1);
+
+    grofs_cache_shard_lru_push(shard, entry);
+
+    shard->count++;
+    shard->cost += entry->cost;
+
+    atomic_fetch_add(&cache->cost, entry->cost);
+
+    grofs_cache_shard_grow(shard);
+
+    struct grofs_cache_entry *evicted = grofs_cache_shard_evict(cache, shard, budget);
+
+    pthread_mutex_unlock(&shard->lock);
+
+    grofs_cache_release_evicted(cache, evicted);
+
+    return entry;
+}
+
+static void grofs_cache_release(struct grofs_cache *cache, struct grofs_cache_entry *entry) {
+    if (atomic_fetch_sub(&entry->refs, 1) == 1) {
+        cache->free_entry(entry);
+    }
+}
+
+static void grofs_cache_release_evicted(struct grofs_cache *cache, struct grofs_cache_entry *evicted) {
+    while (NULL != evicted) {
+        struct grofs_cache_entry *next = evicted->hash_next;
+
+        atomic_fetch_add(&cache->evictions, 1);
+
+        if (NULL != cache->evict_entry) {
+            cache->evict_entry(evicted);
+        }
+
+        grofs_cache_release(cache, evicted);
+
+        evicted = next;
+    }
+}
+
+// Lowered limit is enforced right away, entries still opened are freed once they're closed
+static void grofs_cache_set_limit(struct grofs_cache *cache, size_t limit) {
+    atomic_store(&cache->limit, limit);
+
+    int i;
+
+    for (i = 0; i < GROFS_CACHE_SHARDS; i++) {
+        struct grofs_cache_shard *shard = cache->shards + i;
+
+        if (NULL == shard->buckets) {
+            continue ;
+        }
+
+        pthread_mutex_lock(&shard->lock);
+
+        struct grofs_cache_entry *evicted = grofs_cache_shard_evict(cache, shard, limit / GROFS_CACHE_SHARDS);
+
+        pthread_mutex_unlock(&shard->lock);
+
+        grofs_cache_release_evicted(cache, evicted);
+    }
+}
+
+static void grofs_meta_entry_free(struct grofs_cache_entry *entry) {
+    free((struct grofs_meta_entry *) entry);
+}
+
+static void grofs_meta_cache_put(const git_oid *oid, git_otype type, size_t size) {
+    struct grofs_meta_entry *meta_entry = (struct grofs_meta_entry *) malloc(sizeof(struct grofs_meta_entry));
+
+    // it's only a cache so there is nothing else to do
+    if (NULL == meta_entry) {
+        return ;
+    }
+
+    grofs_cache_entry_init(&meta_entry->entry, oid, sizeof(struct grofs_meta_entry));
+
+    meta_entry->type = type;
+    meta_entry->size = size;
+
+    atomic_init(&meta_entry->binary, 0);
+
+    grofs_cache_release(&grofs_meta_cache, grofs_cache_put(&grofs_meta_cache, &meta_entry->entry));
+}
+
+// Caches are keyed by oid only, objects shared by repositories e.g. through alternates are cached once
+static int grofs_object_header_lookup(const struct grofs_repository *repo, const git_oid *oid, git_otype *type, size_t *size) {
+    struct grofs_cache_entry *entry = grofs_cache_get(&grofs_meta_cache, oid);
+
+    if (NULL != entry) {
+        struct grofs_meta_entry *meta_entry = (struct grofs_meta_entry *) entry;
+
+        *type = meta_entry->type;
+        *size = meta_entry->size;
+
+        grofs_cache_release(&grofs_meta_cache, entry);
+
+        return 0;
+    }
+
+    // unlike git_blob_lookup, this doesn't inflate the object
+    if (git_odb_read_header(size, type, repo->odb, oid) != 0) {
+        return ENOENT;
+    }
+
+    grofs_meta_cache_put(oid, *type, *size);
+
+    return 0;
+}
+
+static void grofs_blob_entry_free(struct grofs_cache_entry *entry) {
+    struct grofs_blob_entry *blob_entry = (struct grofs_blob_entry *) entry;
+
+    grofs_prefetch_mark_unused(blob_entry);
+
+    git_odb_object_free(blob_entry->object);
+
+    free(blob_entry);
+}
+
+static int grofs_blob_entry_read(const struct grofs_repository *repo, const git_oid *oid, struct grofs_blob_entry **blob_entry) {
+    git_odb_object *object;
+
+    GROFS_PROBE1(blob_read_entry, oid);
+
+    int ret = git_odb_read(&object, repo->odb, oid);
+
+    GROFS_PROBE3(blob_read_return, oid, ret, 0 == ret ? git_odb_object_size(object) : 0);
+
+    if (0 != ret) {
+        return ENOENT;
+    }
+
+    if (GIT_OBJ_BLOB != git_odb_object_type(object)) {
+        git_odb_object_free(object);
+
+        return ENOENT;
+    }
+
+    struct grofs_blob_entry *new_blob_entry = (struct grofs_blob_entry *) malloc(sizeof(struct grofs_blob_entry));
+
+    if (NULL == new_blob_entry) {
+        git_odb_object_free(object);
+
+        return ENOMEM;
+    }
+
+    // entry keeps the odb object alive instead of copying its content
+    new_blob_entry->object = object;
+    new_blob_entry->data = (const char *) git_odb_object_data(object);
+    new_blob_entry->len = git_odb_object_size(object);
+
+    atomic_init(&new_blob_entry->prefetched, 0);
+
+    grofs_cache_entry_init(&new_blob_entry->entry, oid, sizeof(struct grofs_blob_entry) + new_blob_entry->len);
+
+    *blob_entry = new_blob_entry;
+
+    return 0;
+}
+
+// Large blobs are inflated by bulk threads when there are any, entry is not cached
+static int grofs_blob_entry_inflate(const struct grofs_repository *repo, const git_oid *oid, struct grofs_blob_entry **blob_entry) {
+    git_otype type;
+    size_t size;
+
+    if (NULL != grofs_bulk_pool.threads && grofs_object_header_lookup(repo, oid, &type, &size) == 0 && size >= (size_t) grofs_options.bulk_min_kb * 1024) {
+        return grofs_bulk_blob_entry_read(repo, oid, blob_entry);
+    }
+
+    return grofs_blob_entry_read(repo, oid, blob_entry);
+}
+
+// Returned entry has a reference which must be released with grofs_cache_release
+static int grofs_blob_load(const struct grofs_repository *repo, const git_oid *oid, struct grofs_blob_entry **blob_entry) {
+    struct grofs_cache_entry *entry = grofs_cache_get(&grofs_blob_cache, oid);
+
+    if (NULL != entry) {
+        *blob_entry = (struct grofs_blob_entry *) entry;
+
+        return 0;
+    }
+
+    struct grofs_blob_entry *new_blob_entry;
+
+    int ret = grofs_zblob_load(oid, &new_blob_entry);
+
+    if (0 != ret) {
+        ret = grofs_blob_entry_inflate(repo, oid, &new_blob_entry);
+    }
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    grofs_meta_cache_put(oid, GIT_OBJ_BLOB, new_blob_entry->len);
+
+    if (NULL != grofs_spill_dir && new_blob_entry->len >= (size_t) grofs_options.spill_min_kb * 1024) {
+        grofs_spill_write(new_blob_entry);
+    }
+
+    *blob_entry = (struct grofs_blob_entry *) grofs_cache_put(&grofs_blob_cache, &new_blob_entry->entry);
+
+    return 0;
+}
+
+static void grofs_zblob_entry_free(struct grofs_cache_entry *entry) {
+    free((struct grofs_zblob_entry *) entry);
+}
+
+// Blobs evicted from blob cache get a second chance in compressed form, compressed on bg pool so that puts don't pay for it
+static void grofs_zblob_demote(struct grofs_cache_entry *entry) {
+#ifdef GROFS_HAVE_LZ4
+    struct grofs_blob_entry *blob_entry = (struct grofs_blob_entry *) entry;
+
+    // prefetched blobs which were never opened are not part of working set, under memory pressure nothing is worth keeping
+    if (atomic_load(&blob_entry->prefetched) || atomic_load(&grofs_memory_governor.level) > 0) {
+        return ;
+    }
+
+    if (0 == blob_entry->len || blob_entry->len > LZ4_MAX_INPUT_SIZE || grofs_cache_contains(&grofs_zblob_cache, &entry->oid)) {
+        return ;
+    }
+
+    if (atomic_load(&grofs_bg_pool.should_stop)) {
+        return ;
+    }
+
+    // queued blobs are held outside of blob cache budget, so when compression falls behind they're dropped
+    size_t pending = atomic_fetch_add(&grofs_zblob_demote_pending, blob_entry->len);
+
+    if (pending + blob_entry->len > atomic_load(&grofs_zblob_cache.limit)) {
+        atomic_fetch_sub(&grofs_zblob_demote_pending, blob_entry->len);
+        atomic_fetch_add(&grofs_zblob_demote_dropped, 1);
+
+        return ;
+    }
+
+    atomic_fetch_add(&entry->refs, 1);
+
+    grofs_pool_submit_with_free(&grofs_bg_pool, grofs_zblob_compress_job, grofs_zblob_compress_job_free, blob_entry);
+#else
+    (void) entry;
+#endif
+}
+
+static void grofs_zblob_compress_job(void *payload) {
+#ifdef GROFS_HAVE_LZ4
+    struct grofs_blob_entry *blob_entry = (struct grofs_blob_entry *) payload;
+
+    // pressure may have started or blob been demoted again while this was queued
+    if (atomic_load(&grofs_memory_governor.level) > 0 || grofs_cache_contains(&grofs_zblob_cache, &blob_entry->entry.oid)) {
+        return ;
+    }
+
+    int bound = LZ4_compressBound((int) blob_entry->len);
+
+    struct grofs_zblob_entry *zblob_entry = (struct grofs_zblob_entry *) malloc(sizeof(struct grofs_zblob_entry) + bound);
+
+    if (NULL == zblob_entry) {
+        return ;
+    }
+
+    int zlen = LZ4_compress_default(blob_entry->data, zblob_entry->zdata, (int) blob_entry->len, bound);
+
+    // already compressed content, e.g. images, is cheaper to inflate again from the odb
+    if (zlen <= 0 || (size_t) zlen >= blob_entry->len) {
+        free(zblob_entry);
+
+        return ;
+    }
+
+    struct grofs_zblob_entry *shrunk_zblob_entry = (struct grofs_zblob_entry *) realloc(zblob_entry, sizeof(struct grofs_zblob_entry) + zlen);
+
+    if (NULL != shrunk_zblob_entry) {
+        zblob_entry = shrunk_zblob_entry;
+    }
+
+    zblob_entry->len = blob_entry->len;
+    zblob_entry->zlen = zlen;
+
+    grofs_cache_entry_init(&zblob_entry->entry, &blob_entry->entry.oid, sizeof(struct grofs_zblob_entry) + zlen);
+
+    grofs_cache_release(&grofs_zblob_cache, grofs_cache_put(&grofs_zblob_cache, &zblob_entry->entry));
+#else
+    (void) payload;
+#endif
+}
+
+// Called after the job ran, or instead of it when bg pool is stopping, drops the reference taken by grofs_zblob_demote()
+static void grofs_zblob_compress_job_free(void *payload) {
+    struct grofs_blob_entry *blob_entry = (struct grofs_blob_entry *) payload;
+
+    atomic_fetch_sub(&grofs_zblob_demote_pending, blob_entry->len);
+
+    grofs_cache_release(&grofs_blob_cache, &blob_entry->entry);
+}
+
+// Decompresses straight into the buffer reads are served from, returns ENOENT when blob is not in compressed cache
+static int grofs_zblob_load(const git_oid *oid, struct grofs_blob_entry **blob_entry) {
+#ifdef GROFS_HAVE_LZ4
+    if (0 == grofs_zblob_cache.budget) {
+        return ENOENT;
+    }
+
+    struct grofs_cache_entry *entry = grofs_cache_get(&grofs_zblob_cache, oid);
+
+    if (NULL == entry) {
+        return ENOENT;
+    }
+
+    struct grofs_zblob_entry *zblob_entry = (struct grofs_zblob_entry *) entry;
+
+    struct grofs_blob_entry *new_blob_entry = (struct grofs_blob_entry *) malloc(sizeof(struct grofs_blob_entry) + zblob_entry->len);
+
+    int ret = ENOMEM;
+
+    if (NULL != new_blob_entry) {
+        ret = EIO;
+
+        if (LZ4_decompress_safe(zblob_entry->zdata, new_blob_entry->buff, zblob_entry->zlen, (int) zblob_entry->len) == (int) zblob_entry->len) {
+            new_blob_entry->object = NULL;
+            new_blob_entry->data = new_blob_entry->buff;
+            new_blob_entry->len = zblob_entry->len;
+
+            atomic_init(&new_blob_entry->prefetched, 0);
+
+            grofs_cache_entry_init(&new_blob_entry->entry, oid, sizeof(struct grofs_blob_entry) + new_blob_entry->len);
+
+            *blob_entry = new_blob_entry;
+
+            ret = 0;
+        } else {
+            free(new_blob_entry);
+        }
+    }
+
+    grofs_cache_release(&grofs_zblob_cache, entry);
+
+    return ret;
+#else
+    (void) oid;
+    (void) blob_entry;
+
+    return ENOENT;
+#endif
+}
+
+// Gear table only has to look random and be the same on each run, splitmix64 of a fixed seed is both
+static void grofs_chunk_gear_init(void) {
+    uint64_t state = GROFS_CHUNK_GEAR_SEED;
+
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+        grofs_chunk_gear[i] = z ^ (z >> 31);
+    }
+}
+
+// Length of the chunk data starts with, cut points depend only on the bytes around them so an edit moves the
+// boundaries of the chunks it touches and the rest are found again
+static size_t grofs_chunk_cut(const unsigned char *data, size_t len) {
+    if (len <= GROFS_CHUNK_MIN_LEN) {
+        return len;
+    }
+
+    size_t max_len = len < GROFS_CHUNK_MAX_LEN ? len : GROFS_CHUNK_MAX_LEN;
+    size_t avg_len = max_len < GROFS_CHUNK_AVG_LEN ? max_len : GROFS_CHUNK_AVG_LEN;
+
+    uint64_t hash = 0;
+
+    size_t i;
+
+    // bytes before minimal length can't end a chunk so they're not hashed at all
+    for (i = GROFS_CHUNK_MIN_LEN; i < avg_len; i++) {
+        hash = (hash << 1) + grofs_chunk_gear[data[i]];
+
+        if (0 == (hash & GROFS_CHUNK_MASK_HARD)) {
+            return i + 1;
+        }
+    }
+
+    for (; i < max_len; i++) {
+        hash = (hash << 1) + grofs_chunk_gear[data[i]];
+
+        if (0 == (hash & GROFS_CHUNK_MASK_EASY)) {
+            return i + 1;
+        }
+    }
+
+    return max_len;
+}
+
+static int grofs_chunk_wanted(const struct grofs_repository *repo, const git_oid *oid) {
+    git_otype type;
+    size_t size;
+
+    return grofs_options.chunk_min_kb > 0 && grofs_object_header_lookup(repo, oid, &type, &size) == 0 && size >= (size_t) grofs_options.chunk_min_kb * 1024;
+}
+
+static size_t grofs_chunk_index(const struct grofs_chunk_list_entry *chunk_list, uint64_t offset) {
+    size_t low = 0;
+    size_t high = chunk_list->count;
+
+    // last chunk starting at or before offset
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+
+        if (chunk_list->chunks[middle].offset <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static size_t grofs_chunk_len(const struct grofs_chunk_list_entry *chunk_list, size_t index) {
+    uint64_t end = index + 1 < chunk_list->count ? chunk_list->chunks[index + 1].offset : chunk_list->len;
+
+    return end - chunk_list->chunks[index].offset;
+}
+
+static void grofs_chunk_list_entry_free(struct grofs_cache_entry *entry) {
+    free((struct grofs_chunk_list_entry *) entry);
+}
+
+// Chunk which is already cached, e.g. as part of another version of the same file, is shared instead of copied
+static struct grofs_blob_entry *grofs_chunk_store(const git_oid *oid, const char *data, size_t len, int splitting) {
+    struct grofs_cache_entry *entry = grofs_cache_get(&grofs_blob_cache, oid);
+
+    if (NULL != entry) {
+        if (splitting) {
+            atomic_fetch_add(&grofs_chunk_stats.shared, 1);
+            atomic_fetch_add(&grofs_chunk_stats.shared_bytes, len);
+        }
+
+        return (struct grofs_blob_entry *) entry;
+    }
+
+    struct grofs_blob_entry *new_blob_entry = (struct grofs_blob_entry *) malloc(sizeof(struct grofs_blob_entry) + len);
+
+    if (NULL == new_blob_entry) {
+        return NULL;
+    }
+
+    memcpy(new_blob_entry->buff, data, len);
+
+    new_blob_entry->object = NULL;
+    new_blob_entry->data = new_blob_entry->buff;
+    new_blob_entry->len = len;
+
+    atomic_init(&new_blob_entry->prefetched, 0);
+
+    grofs_cache_entry_init(&new_blob_entry->entry, oid, sizeof(struct grofs_blob_entry) + len);
+
+    return (struct grofs_blob_entry *) grofs_cache_put(&grofs_blob_cache, &new_blob_entry->entry);
+}
+
+// Caches chunks of blob content from first on while they fit in a quarter of blob cache, so that reading on doesn't
+// inflate the blob again right away, yet a blob larger than the cache doesn't evict its own chunks being read
+static int grofs_chunks_store(const struct grofs_chunk_list_entry *chunk_list, const char *data, size_t first, struct grofs_blob_entry **first_chunk) {
+    size_t budget = atomic_load(&grofs_blob_cache.limit) / 4;
+    size_t stored = 0;
+    size_t i;
+
+    for (i = first; i < chunk_list->count && (i == first || stored < budget); i++) {
+        const struct grofs_chunk *chunk = chunk_list->chunks + i;
+
+        size_t len = grofs_chunk_len(chunk_list, i);
+
+        // only splitting passes no first_chunk, chunks it finds cached already are shared with other blobs
+        struct grofs_blob_entry *blob_entry = grofs_chunk_store(&chunk->oid, data + chunk->offset, len, NULL == first_chunk);
+
+        if (NULL == blob_entry) {
+            return ENOMEM;
+        }
+
+        if (i == first && NULL != first_chunk) {
+            *first_chunk = blob_entry;
+        } else {
+            grofs_cache_release(&grofs_blob_cache, &blob_entry->entry);
+        }
+
+        stored += len;
+    }
+
+    return 0;
+}
+
+static int grofs_chunks_split(const struct grofs_repository *repo, const git_oid *oid, struct grofs_chunk_list_entry **chunk_list) {
+    pthread_once(&grofs_chunk_gear_once, grofs_chunk_gear_init);
+
+    struct grofs_blob_entry *blob_entry;
+
+    int ret = grofs_blob_entry_inflate(repo, oid, &blob_entry);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    grofs_meta_cache_put(oid, GIT_OBJ_BLOB, blob_entry->len);
+
+    if (NULL != grofs_spill_dir && blob_entry->len >= (size_t) grofs_options.spill_min_kb * 1024) {
+        grofs_spill_write(blob_entry);
+    }
+
+    size_t capacity = blob_entry->len / GROFS_CHUNK_MIN_LEN + 1;
+
+    struct grofs_chunk_list_entry *new_chunk_list = (struct grofs_chunk_list_entry *) malloc(sizeof(struct grofs_chunk_list_entry) + capacity * sizeof(struct grofs_chunk));
+
+    if (NULL == new_chunk_list) {
+        grofs_cache_release(&grofs_blob_cache, &blob_entry->entry);
+
+        return ENOMEM;
+    }
+
+    new_chunk_list->len = blob_entry->len;
+    new_chunk_list->count = 0;
+
+    size_t offset = 0;
+
+    while (offset < blob_entry->len) {
+        const char *data = blob_entry->data + offset;
+
+        size_t len = grofs_chunk_cut((const unsigned char *) data, blob_entry->len - offset);
+
+        struct grofs_chunk *chunk = new_chunk_list->chunks + new_chunk_list->count;
+
+        chunk->offset = offset;
+
+        if (git_odb_hash(&chunk->oid, data, len, GIT_OBJ_BLOB) != 0) {
+            ret = EIO;
+
+            break;
+        }
+
+        new_chunk_list->count++;
+
+        offset += len;
+    }
+
+    if (0 == ret) {
+        ret = grofs_chunks_store(new_chunk_list, blob_entry->data, 0, NULL);
+    }
+
+    // whole blob was never cached so this frees it
+    grofs_cache_release(&grofs_blob_cache, &blob_entry->entry);
+
+    if (0 != ret) {
+        free(new_chunk_list);
+
+        return ret;
+    }
+
+    atomic_fetch_add(&grofs_chunk_stats.blobs, 1);
+    atomic_fetch_add(&grofs_chunk_stats.chunks, new_chunk_list->count);
+
+    size_t chunk_list_len = sizeof(struct grofs_chunk_list_entry) + new_chunk_list->count * sizeof(struct grofs_chunk);
+
+    struct grofs_chunk_list_entry *shrunk_chunk_list = (struct grofs_chunk_list_entry *) realloc(new_chunk_list, chunk_list_len);
+
+    if (NULL != shrunk_chunk_list) {
+        new_chunk_list = shrunk_chunk_list;
+    }
+
+    grofs_cache_entry_init(&new_chunk_list->entry, oid, chunk_list_len);
+
+    grofs_chunk_list_cache_fit(chunk_list_len);
+
+    // list cached meanwhile by another opener has the same chunks
+    *chunk_list = (struct grofs_chunk_list_entry *) grofs_cache_put(&grofs_chunk_list_cache, &new_chunk_list->entry);
+
+    return 0;
+}
+
+// Returned list has a reference which must be released with grofs_cache_release, lists take a fraction of memory
+// of their chunks and have a cache of their own, so they outlive chunks and the blob is split only when first opened
+static int grofs_chunks_load(const struct grofs_repository *repo, const git_oid *oid, struct grofs_chunk_list_entry **chunk_list) {
+    struct grofs_cache_entry *entry = grofs_cache_get(&grofs_chunk_list_cache, oid);
+
+    if (NULL != entry) {
+        *chunk_list = (struct grofs_chunk_list_entry *) entry;
+
+        return 0;
+    }
+
+    return grofs_chunks_split(repo, oid, chunk_list);
+}
+
+// A list which doesn't fit a shard wouldn't be cached and its blob would be split on every open, so the limit is
+// raised to fit it, lists are a fraction of their blob so it grows only as much as the largest blob split needs
+static void grofs_chunk_list_cache_fit(size_t cost) {
+    size_t min_limit = cost * GROFS_CACHE_SHARDS;
+    size_t current = atomic_load(&grofs_chunk_list_min_limit);
+
+    while (current < min_limit && !atomic_compare_exchange_weak(&grofs_chunk_list_min_limit, &current, min_limit));
+
+    if (atomic_load(&grofs_chunk_list_cache.limit) < min_limit) {
+        grofs_cache_set_limit(&grofs_chunk_list_cache, min_limit);
+    }
+}
+
+// Returned chunk has a reference which must be released with grofs_cache_release, an evicted chunk is taken from
+// the blob inflated again, which caches the chunks following it as well and is kept by the handle until it's closed,
+// so reading a file whose chunks don't fit blob cache inflates it once per open like a blob which is not chunked
+static int grofs_chunk_load(struct grofs_file *file, size_t index, struct grofs_blob_entry **chunk) {
+    const struct grofs_chunk_list_entry *chunk_list = file->chunk_list;
+    const git_oid *oid = &chunk_list->chunks[index].oid;
+
+    struct grofs_cache_entry *entry = grofs_cache_get(&grofs_blob_cache, oid);
+
+    if (NULL != entry) {
+        *chunk = (struct grofs_blob_entry *) entry;
+
+        return 0;
+    }
+
+    if (grofs_zblob_load(oid, chunk) == 0) {
+        *chunk = (struct grofs_blob_entry *) grofs_cache_put(&grofs_blob_cache, &(*chunk)->entry);
+
+        return 0;
+    }
+
+    struct grofs_blob_entry *blob_entry = atomic_load(&file->chunk_source);
+
+    if (NULL == blob_entry) {
+        int ret = grofs_blob_entry_inflate(file->repo, &chunk_list->entry.oid, &blob_entry);
+
+        if (0 != ret) {
+            return ret;
+        }
+
+        // content of a blob id never changes, so the list still tells where its chunks are
+        if (blob_entry->len != chunk_list->len) {
+            grofs_cache_release(&grofs_blob_cache, &blob_entry->entry);
+
+            return EIO;
+        }
+
+        atomic_fetch_add(&grofs_chunk_stats.refills, 1);
+
+        struct grofs_blob_entry *expected = NULL;
+
+        // another read of the same handle may have inflated it meanwhile
+        if (!atomic_compare_exchange_strong(&file->chunk_source, &expected, blob_entry)) {
+            grofs_cache_release(&grofs_blob_cache, &blob_entry->entry);
+
+            blob_entry = expected;
+        }
+    }
+
+    return grofs_chunks_store(chunk_list, blob_entry->data, index, chunk);
+}
+
+static void grofs_spill_path(char *path, const git_oid *oid) {
+    char hex[GIT_OID_HEXSZ + 1];
+
+    git_oid_tostr(hex, sizeof(hex), oid);
+
+    snprintf(path, PATH_MAX, "%s/%s", grofs_spill_dir, hex);
+}
+
+// Written once by the thread which inflated the blob, later opens read only requested ranges from it
+static void grofs_spill_write(const struct grofs_blob_entry *blob_entry) {
+    char path[PATH_MAX];
+
+    grofs_spill_path(path, &blob_entry->entry.oid);
+
+    if (access(path, F_OK) == 0) {
+        return ;
+    }
+
+    char tmp_path[PATH_MAX + sizeof(".XXXXXX")];
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+    int fd = mkstemp(tmp_path);
+
+    if (-1 == fd) {
+        atomic_fetch_add(&grofs_spill_stats.errors, 1);
+
+        return ;
+    }
+
+    size_t written = 0;
+
+    while (written < blob_entry->len) {
+        ssize_t ret = write(fd, blob_entry->data + written, blob_entry->len - written);
+
+        if (ret < 0 && EINTR == errno) {
+            continue ;
+        }
+
+        if (ret <= 0) {
+            break;
+        }
+
+        written += ret;
+    }
+
+    // rename makes it visible only once complete, so a crash or full disk can't leave a truncated blob behind
+    if (close(fd) != 0 || written != blob_entry->len || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+
+        atomic_fetch_add(&grofs_spill_stats.errors, 1);
+
+        return ;
+    }
+
+    atomic_fetch_add(&grofs_spill_stats.writes, 1);
+    atomic_fetch_add(&grofs_spill_stats.write_bytes, written);
+}
+
+// Returns ENOENT when blob should be loaded into memory instead, blobs already in blob cache are served from there
+static int grofs_spill_open(const struct grofs_repository *repo, const git_oid *oid, struct grofs_file **file) {
+    if (NULL == grofs_spill_dir || grofs_cache_contains(&grofs_blob_cache, oid)) {
+        return ENOENT;
+    }
+
+    git_otype type;
+    size_t size;
+
+    if (grofs_object_header_lookup(repo, oid, &type, &size) != 0 || GIT_OBJ_BLOB != type || size < (size_t) grofs_options.spill_min_kb * 1024) {
+        return ENOENT;
+    }
+
+    char path[PATH_MAX];
+
+    grofs_spill_path(path, oid);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (-1 == fd) {
+        return ENOENT;
+    }
+
+    struct stat st;
+
+    // spill directory outlives the mount, anything not matching the object is ignored
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size != size) {
+        close(fd);
+
+        atomic_fetch_add(&grofs_spill_stats.errors, 1);
+
+        return ENOENT;
+    }
+
+    struct grofs_file *file_handle = grofs_file_nandle_new(0);
+
+    if (NULL == file_handle) {
+        close(fd);
+
+        return ENOMEM;
+    }
+
+    file_handle->len = size;
+    file_handle->spill_fd = fd;
+
+    atomic_fetch_add(&grofs_spill_stats.opens, 1);
+
+    *file = file_handle;
+
+    return 0;
+}
+
+static void *grofs_pool_thread(void *data) {
+    struct grofs_pool *pool = (struct grofs_pool *) data;
+
+    // on Linux nice value is per thread
+    if (0 != pool->nice) {
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), pool->nice);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (1) {
+        while (NULL == pool->head && !atomic_load(&pool->should_stop)) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        if (atomic_load(&pool->should_stop)) {
+            break;
+        }
+
+        struct grofs_job *job = pool->head;
+
+        pool->head = job->next;
+
+        if (NULL == pool->head) {
+            pool->tail = NULL;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+
+        job->run(job->payload);
+
+        grofs_job_free(job);
+
+        pthread_mutex_lock(&pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static int grofs_pool_start(struct grofs_pool *pool, int threads_count, int nice) {
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->threads_count = 0;
+    pool->nice = nice;
+
+    atomic_init(&pool->should_stop, 0);
+
+    pool->threads = (pthread_t *) malloc(sizeof(pthread_t) * threads_count);
+
+    if (NULL == pool->threads) {
+        return ENOMEM;
+    }
+
+    int i;
+
+    for (i = 0; i < threads_count; i++) {
+        int ret = pthread_create(pool->threads + i, NULL, grofs_pool_thread, pool);
+
+        if (0 != ret) {
+            grofs_pool_stop(pool);
+
+            return ret;
+        }
+
+        pool->threads_count++;
+    }
+
+    return 0;
+}
+
+static int grofs_pool_submit(struct grofs_pool *pool, void (*run)(void *payload), void *payload) {
+    return grofs_pool_submit_with_free(pool, run, NULL, payload);
+}
+
+// Payload is freed with free_payload even when the job can't be taken or is dropped by grofs_pool_stop()
+static int grofs_pool_submit_with_free(struct grofs_pool *pool, void (*run)(void *payload), void (*free_payload)(void *payload), void *payload) {
+    struct grofs_job *job = (struct grofs_job *) malloc(sizeof(struct grofs_job));
+
+    if (NULL == job) {
+        if (NULL != free_payload) {
+            free_payload(payload);
+        } else {
+            free(payload);
+        }
+
+        return ENOMEM;
+    }
+
+    job->run = run;
+    job->free_payload = free_payload;
+    job->payload = payload;
+
+    if (NULL == pool->threads) {
+        grofs_job_free(job);
+
+        return ECANCELED;
+    }
+
+    job->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+
+    // checked under the lock so that a job can't be queued after grofs_pool_stop() has dropped the queue
+    if (atomic_load(&pool->should_stop)) {
+        pthread_mutex_unlock(&pool->lock);
+
+        grofs_job_free(job);
+
+        return ECANCELED;
+    }
+
+    if (NULL == pool->tail) {
+        pool->head = job;
+    } else {
+        pool->tail->next = job;
+    }
+
+    pool->tail = job;
+
+    pthread_cond_signal(&pool->cond);
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+static void grofs_job_free(struct grofs_job *job) {
+    if (NULL != job->free_payload) {
+        job->free_payload(job->payload);
+    } else {
+        free(job->payload);
+    }
+
+    free(job);
+}
+
+// Jobs which didn't start yet are dropped
+static void grofs_pool_stop(struct grofs_pool *pool) {
+    if (NULL == pool->threads) {
+        return ;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    atomic_store(&pool->should_stop, 1);
+
+    pthread_cond_broadcast(&pool->cond);
+
+    pthread_mutex_unlock(&pool->lock);
+
+    int i;
+
+    for (i = 0; i < pool->threads_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    while (NULL != pool->head) {
+        struct grofs_job *job = pool->head;
+
+        pool->head = job->next;
+
+        grofs_job_free(job);
+    }
+
+    pool->tail = NULL;
+
+    free(pool->threads);
+
+    pool->threads = NULL;
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+static long long grofs_now_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+static int grofs_pack_index_load(struct grofs_pack_index *index, const char *idx_path) {
+    int fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+
+    if (-1 == fd) {
+        return errno;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < GROFS_PACK_IDX_HEADER_LEN) {
+        close(fd);
+
+        return EINVAL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (MAP_FAILED == map) {
+        return errno;
+    }
+
+    const unsigned char *bytes = (const unsigned char *) map;
+
+    uint32_t version = (uint32_t) bytes[4] << 24 | (uint32_t) bytes[5] << 16 | (uint32_t) bytes[6] << 8 | bytes[7];
+
+    const unsigned char *last_fanout = bytes + GROFS_PACK_IDX_HEADER_LEN - 4;
+
+    uint32_t count = (uint32_t) last_fanout[0] << 24 | (uint32_t) last_fanout[1] << 16 | (uint32_t) last_fanout[2] << 8 | last_fanout[3];
+
+    // ids, CRCs and 32-bit offsets, 64-bit offsets and trailing checksums come after
+    if (memcmp(bytes, GROFS_PACK_IDX_MAGIC, 4) != 0 || 2 != version || (size_t) st.st_size < GROFS_PACK_IDX_HEADER_LEN + (size_t) count * (GIT_OID_RAWSZ + 8) + 2 * GIT_OID_RAWSZ) {
+        munmap(map, st.st_size);
+
+        return EINVAL;
+    }
+
+    index->map = bytes;
+    index->map_len = st.st_size;
+    index->count = count;
+
+    char pack_path[PATH_MAX];
+
+    size_t idx_path_len = strlen(idx_path);
+
+    snprintf(pack_path, PATH_MAX, "%.*s.pack", (int) (idx_path_len - strlen(".idx")), idx_path);
+
+    index->pack_fd = open(pack_path, O_RDONLY | O_CLOEXEC);
+
+    return 0;
+}
+
+static void grofs_pack_index_free(struct grofs_pack_index *index) {
+    munmap((void *) index->map, index->map_len);
+
+    if (-1 != index->pack_fd) {
+        close(index->pack_fd);
+    }
+}
+
+static int grofs_pack_index_find(const struct grofs_pack_index *index, const git_oid *oid, uint64_t *offset) {
+    const unsigned char *fanout = index->map + 8;
+    const unsigned char *ids = fanout + 256 * 4;
+
+    unsigned char first = oid->id[0];
+
+    const unsigned char *entry = fanout + first * 4;
+
+    size_t high = (uint32_t) entry[0] << 24 | (uint32_t) entry[1] << 16 | (uint32_t) entry[2] << 8 | entry[3];
+    size_t low = 0;
+
+    if (first > 0) {
+        entry -= 4;
+
+        low = (uint32_t) entry[0] << 24 | (uint32_t) entry[1] << 16 | (uint32_t) entry[2] << 8 | entry[3];
+    }
+
+    if (high > index->count) {
+        return 0;
+    }
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+
+        int cmp = memcmp(ids + mid * GIT_OID_RAWSZ, oid->id, GIT_OID_RAWSZ);
+
+        if (0 == cmp) {
+            const unsigned char *offsets = ids + (size_t) index->count * (GIT_OID_RAWSZ + 4);
+            const unsigned char *small = offsets + mid * 4;
+
+            uint32_t value = (uint32_t) small[0] << 24 | (uint32_t) small[1] << 16 | (uint32_t) small[2] << 8 | small[3];
+
+            if (!(value & 0x80000000U)) {
+                *offset = value;
+
+                return 1;
+            }
+
+            // offsets past 2GB are in a table of 64-bit ones that follows
+            const unsigned char *large = offsets + (size_t) index->count * 4 + (size_t) (value & 0x7fffffffU) * 8;
+
+            if (large + 8 > index->map + index->map_len) {
+                return 0;
+            }
+
+            *offset = 0;
+
+            int byte;
+
+            for (byte = 0; byte < 8; byte++) {
+                *offset = *offset << 8 | large[byte];
+            }
+
+            return 1;
+        }
+
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return 0;
+}
+
+static int grofs_pack_set_load(const char *dir_path, struct grofs_pack_set **set) {
+    char pattern[PATH_MAX];
+
+    snprintf(pattern, PATH_MAX, "%s/pack-*.idx", dir_path);
+
+    glob_t found;
+
+    *set = NULL;
+
+    int ret = glob(pattern, GLOB_NOSORT, NULL, &found);
+
+    // repository without packs
+    if (GLOB_NOMATCH == ret) {
+        return 0;
+    }
+
+    if (0 != ret) {
+        return GLOB_NOSPACE == ret ? ENOMEM : EIO;
+    }
+
+    struct grofs_pack_set *new_set = (struct grofs_pack_set *) malloc(sizeof(struct grofs_pack_set) + found.gl_pathc * sizeof(struct grofs_pack_index));
+
+    if (NULL == new_set) {
+        globfree(&found);
+
+        return ENOMEM;
+    }
+
+    atomic_init(&new_set->refs, 1);
+
+    new_set->count = 0;
+
+    size_t i;
+
+    for (i = 0; i < found.gl_pathc; i++) {
+        // packs with unknown .idx versions are read like loose objects are
+        if (grofs_pack_index_load(new_set->packs + new_set->count, found.gl_pathv[i]) == 0) {
+            new_set->count++;
+        }
+    }
+
+    globfree(&found);
+
+    *set = new_set;
+
+    return 0;
+}
+
+static void grofs_pack_set_release(struct grofs_pack_set *set) {
+    if (NULL == set || atomic_fetch_sub(&set->refs, 1) > 1) {
+        return ;
+    }
+
+    size_t i;
+
+    for (i = 0; i < set->count; i++) {
+        grofs_pack_index_free(set->packs + i);
+    }
+
+    free(set);
+}
+
+// Packs are listed again once objects/pack changes, e.g. after fetch or gc, checked at most once per second
+static struct grofs_pack_set *grofs_pack_set_acquire(const struct grofs_repository *repo) {
+    struct grofs_pack_order *order = repo->pack_order;
+
+    pthread_mutex_lock(&order->lock);
+
+    long long now_ms = grofs_now_ms();
+
+    if (0 == order->checked_ms || now_ms - order->checked_ms >= GROFS_PACK_REFRESH_MS) {
+        struct stat st;
+
+        order->checked_ms = now_ms;
+
+        if (stat(order->dir_path, &st) != 0) {
+            memset(&st, 0, sizeof(struct stat));
+        }
+
+        if (NULL == order->set || st.st_mtim.tv_sec != order->dir_mtime.tv_sec || st.st_mtim.tv_nsec != order->dir_mtime.tv_nsec) {
+            struct grofs_pack_set *set;
+
+            if (grofs_pack_set_load(order->dir_path, &set) == 0) {
+                grofs_pack_set_release(order->set);
+
+                order->set = set;
+                order->dir_mtime = st.st_mtim;
+            }
+        }
+    }
+
+    struct grofs_pack_set *set = order->set;
+
+    if (NULL != set) {
+        atomic_fetch_add(&set->refs, 1);
+    }
+
+    pthread_mutex_unlock(&order->lock);
+
+    return set;
+}
+
+static int grofs_pack_order_init(struct grofs_repository *repo) {
+    repo->pack_order = (struct grofs_pack_order *) calloc(1, sizeof(struct grofs_pack_order));
+
+    if (NULL == repo->pack_order) {
+        return ENOMEM;
+    }
+
+    pthread_mutex_init(&repo->pack_order->lock, NULL);
+
+    // common dir so that worktrees find packs of their main repository
+    snprintf(repo->pack_order->dir_path, PATH_MAX, "%sobjects/pack", git_repository_commondir(repo->repo));
+
+    return 0;
+}
+
+static void grofs_pack_order_free(struct grofs_repository *repo) {
+    if (NULL == repo->pack_order) {
+        return ;
+    }
+
+    grofs_pack_set_release(repo->pack_order->set);
+
+    pthread_mutex_destroy(&repo->pack_order->lock);
+
+    free(repo->pack_order);
+
+    repo->pack_order = NULL;
+}
+
+static int grofs_fetch_item_cmp(const void *a, const void *b) {
+    const struct grofs_fetch_item *item_a = (const struct grofs_fetch_item *) a;
+    const struct grofs_fetch_item *item_b = (const struct grofs_fetch_item *) b;
+
+    if (item_a->pack != item_b->pack) {
+        return item_a->pack < item_b->pack ? -1 : 1;
+    }
+
+    if (item_a->offset != item_b->offset) {
+        return item_a->offset < item_b->offset ? -1 : 1;
+    }
+
+    return git_oid_cmp(&item_a->oid, &item_b->oid);
+}
+
+// Asks kernel to start reading ranges of packs the batch needs, so disk works while earlier objects are inflated
+static void grofs_fetch_readahead(const struct grofs_pack_set *set, const struct grofs_fetch_item *items, size_t count) {
+    size_t start = 0;
+
+    while (start < count && UINT32_MAX != items[start].pack) {
+        size_t end = start + 1;
+
+        while (end < count && items[end].pack == items[start].pack && items[end].offset - items[end - 1].offset <= GROFS_FETCH_RUN_GAP) {
+            end++;
+        }
+
+        int pack_fd = set->packs[items[start].pack].pack_fd;
+
+        off_t len = items[end - 1].offset - items[start].offset + GROFS_FETCH_RUN_TAIL;
+
+        if (-1 != pack_fd && posix_fadvise(pack_fd, items[start].offset, len, POSIX_FADV_WILLNEED) == 0) {
+            atomic_fetch_add(&grofs_fetch_stats.readahead_bytes, len);
+        }
+
+        start = end;
+    }
+}
+
+// Calls cb for each object ordered by pack and offset in it, which turns scattered reads of a batch into mostly sequential ones
+static void grofs_fetch_batch(const struct grofs_repository *repo, const git_oid *oids, size_t count, grofs_fetch_cb cb, void *payload) {
+    if (0 == count) {
+        return ;
+    }
+
+    struct grofs_fetch_item *items = (struct grofs_fetch_item *) malloc(count * sizeof(struct grofs_fetch_item));
+
+    size_t i;
+
+    // ordering only makes it faster, without memory for it objects are read as given
+    if (NULL == items) {
+        for (i = 0; i < count && 0 == cb(repo, oids + i, payload); i++);
+
+        return ;
+    }
+
+    struct grofs_pack_set *set = grofs_pack_set_acquire(repo);
+
+    size_t packed = 0;
+
+    for (i = 0; i < count; i++) {
+        git_oid_cpy(&items[i].oid, oids + i);
+
+        items[i].pack = UINT32_MAX;
+        items[i].offset = 0;
+
+        size_t pack;
+
+        for (pack = 0; NULL != set && pack < set->count; pack++) {
+            if (grofs_pack_index_find(set->packs + pack, oids + i, &items[i].offset)) {
+                items[i].pack = pack;
+
+                packed++;
+
+                break;
+            }
+        }
+    }
+
+    qsort(items, count, sizeof(struct grofs_fetch_item), grofs_fetch_item_cmp);
+
+    if (NULL != set) {
+        grofs_fetch_readahead(set, items, count);
+    }
+
+    atomic_fetch_add(&grofs_fetch_stats.batches, 1);
+    atomic_fetch_add(&grofs_fetch_stats.objects, count);
+    atomic_fetch_add(&grofs_fetch_stats.packed, packed);
+
+    for (i = 0; i < count && 0 == cb(repo, &items[i].oid, payload); i++);
+
+    grofs_pack_set_release(set);
+
+    free(items);
+}
+
+// Called when blob is opened, prefetched blob that gets opened means prediction was right
+static void grofs_prefetch_mark_opened(struct grofs_blob_entry *blob_entry) {
+    if (!atomic_exchange(&blob_entry->prefetched, 0)) {
+        return ;
+    }
+
+    atomic_fetch_sub(&grofs_prefetch_stats.unused_bytes, blob_entry->len);
+    atomic_fetch_add(&grofs_prefetch_stats.hits, 1);
+
+    atomic_store(&grofs_prefetch_stats.misses_run, 0);
+    atomic_store(&grofs_prefetch_stats.backoff_ms, GROFS_PREFETCH_MIN_BACKOFF_MS);
+}
+
+// Called when blob leaves the cache, prefetched blob that was never opened means prediction was wrong
+static void grofs_prefetch_mark_unused(struct grofs_blob_entry *blob_entry) {
+    if (!atomic_exchange(&blob_entry->prefetched, 0)) {
+        return ;
+    }
+
+    atomic_fetch_sub(&grofs_prefetch_stats.unused_bytes, blob_entry->len);
+    atomic_fetch_add(&grofs_prefetch_stats.misses, 1);
+
+    if (atomic_fetch_add(&grofs_prefetch_stats.misses_run, 1) + 1 < GROFS_PREFETCH_BACKOFF_MISSES) {
+        return ;
+    }
+
+    long long backoff_ms = atomic_load(&grofs_prefetch_stats.backoff_ms);
+
+    atomic_store(&grofs_prefetch_stats.misses_run, 0);
+    atomic_store(&grofs_prefetch_stats.backoff_until_ms, grofs_now_ms() + backoff_ms);
+    atomic_store(&grofs_prefetch_stats.backoff_ms, backoff_ms << 1 < GROFS_PREFETCH_MAX_BACKOFF_MS ? backoff_ms << 1 : GROFS_PREFETCH_MAX_BACKOFF_MS);
+
+    atomic_fetch_add(&grofs_prefetch_stats.backoffs, 1);
+}
+
+static int grofs_prefetch_blob(const struct grofs_repository *repo, const git_oid *oid) {
+    if (grofs_cache_contains(&grofs_blob_cache, oid)) {
+        return 0;
+    }
+
+    struct grofs_blob_entry *blob_entry;
+
+    int ret = grofs_zblob_load(oid, &blob_entry);
+
+    if (0 != ret) {
+        ret = grofs_blob_entry_read(repo, oid, &blob_entry);
+    }
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    atomic_store(&blob_entry->prefetched, 1);
+
+    atomic_fetch_add(&grofs_prefetch_stats.unused_bytes, blob_entry->len);
+    atomic_fetch_add(&grofs_prefetch_stats.blobs, 1);
+
+    grofs_cache_release(&grofs_blob_cache, grofs_cache_put(&grofs_blob_cache, &blob_entry->entry));
+
+    return 0;
+}
+
+static int grofs_prefetch_fetch_cb(const struct grofs_repository *repo, const git_oid *oid, void *payload) {
+    struct grofs_prefetch_fetch_context *context = (struct grofs_prefetch_fetch_context *) payload;
+
+    if (atomic_load(&grofs_prefetch_pool.should_stop)) {
+        return 1;
+    }
+
+    git_otype type;
+    size_t size;
+
+    if (grofs_object_header_lookup(repo, oid, &type, &size) != 0) {
+        return 0;
+    }
+
+    // blob cache wouldn't keep it anyway, and chunked blobs are split on open only
+    if (sizeof(struct grofs_blob_entry) + size > atomic_load(&grofs_blob_cache.limit) / GROFS_CACHE_SHARDS || (grofs_options.chunk_min_kb > 0 && size >= (size_t) grofs_options.chunk_min_kb * 1024)) {
+        return 0;
+    }
+
+    if (atomic_load(&grofs_prefetch_stats.unused_bytes) + size > context->budget) {
+        return 1;
+    }
+
+    grofs_prefetch_blob(repo, oid);
+
+    return 0;
+}
+
+static void grofs_prefetch_tree_job(void *payload) {
+    struct grofs_tree_job *job = (struct grofs_tree_job *) payload;
+
+    git_tree *tree;
+
+    if (git_tree_lookup(&tree, job->repo->repo, &job->tree_oid) == 0) {
+        size_t count = git_tree_entrycount(tree);
+
+        git_oid *oids = (git_oid *) malloc(count * sizeof(git_oid));
+
+        if (NULL != oids) {
+            size_t oids_count = 0;
+
+            size_t i;
+
+            for (i = 0; i < count; i++) {
+                const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+
+                if (GIT_OBJ_BLOB == git_tree_entry_type(entry) && !grofs_cache_contains(&grofs_blob_cache, git_tree_entry_id(entry))) {
+                    git_oid_cpy(oids + oids_count++, git_tree_entry_id(entry));
+                }
+            }
+
+            struct grofs_prefetch_fetch_context context = {
+                .budget = (size_t) grofs_options.prefetch_budget_mb * GROFS_MB
+            };
+
+            grofs_fetch_batch(job->repo, oids, oids_count, grofs_prefetch_fetch_cb, &context);
+
+            free(oids);
+        }
+
+        git_tree_free(tree);
+    }
+
+    atomic_fetch_add(&grofs_prefetch_stats.jobs, 1);
+    atomic_fetch_sub(&grofs_prefetch_stats.pending_jobs, 1);
+}
+
+static struct grofs_tree_job *grofs_tree_job_new(const struct grofs_repository *repo, const git_oid *tree_oid) {
+    struct grofs_tree_job *job = (struct grofs_tree_job *) malloc(sizeof(struct grofs_tree_job));
+
+    if (NULL == job) {
+        return NULL;
+    }
+
+    job->repo = repo;
+
+    git_oid_cpy(&job->tree_oid, tree_oid);
+
+    return job;
+}
+
+// Second open within the same tree in a short window prefetches the rest of that tree
+static void grofs_prefetch_note_open(const struct grofs_repository *repo, const git_oid *tree_oid) {
+    if (NULL == grofs_prefetch_pool.threads) {
+        return ;
+    }
+
+    long long now_ms = grofs_now_ms();
+
+    if (now_ms < atomic_load(&grofs_prefetch_stats.backoff_until_ms)) {
+        return ;
+    }
+
+    struct grofs_prefetch_slot *slot = grofs_prefetch_slots + (grofs_oid_hash(tree_oid) & (GROFS_PREFETCH_SLOTS - 1));
+
+    int should_prefetch = 0;
+
+    pthread_mutex_lock(&grofs_prefetch_lock);
+
+    if (!git_oid_equal(&slot->tree_oid, tree_oid) || now_ms - slot->last_open_ms > GROFS_PREFETCH_WINDOW_MS) {
+        git_oid_cpy(&slot->tree_oid, tree_oid);
+
+        slot->opens = 0;
+        slot->triggered = 0;
+    }
+
+    slot->opens++;
+    slot->last_open_ms = now_ms;
+
+    if (!slot->triggered && slot->opens >= GROFS_PREFETCH_TRIGGER_OPENS) {
+        slot->triggered = 1;
+
+        should_prefetch = 1;
+    }
+
+    pthread_mutex_unlock(&grofs_prefetch_lock);
+
+    if (!should_prefetch) {
+        return ;
+    }
+
+    if (atomic_fetch_add(&grofs_prefetch_stats.pending_jobs, 1) >= GROFS_PREFETCH_MAX_PENDING) {
+        atomic_fetch_sub(&grofs_prefetch_stats.pending_jobs, 1);
+
+        return ;
+    }
+
+    struct grofs_tree_job *payload = grofs_tree_job_new(repo, tree_oid);
+
+    if (NULL == payload) {
+        atomic_fetch_sub(&grofs_prefetch_stats.pending_jobs, 1);
+
+        return ;
+    }
+
+    if (grofs_pool_submit(&grofs_prefetch_pool, grofs_prefetch_tree_job, payload) != 0) {
+        atomic_fetch_sub(&grofs_prefetch_stats.pending_jobs, 1);
+    }
+}
+
+static int grofs_attr_prefetch_fetch_cb(const struct grofs_repository *repo, const git_oid *oid, void *payload) {
+    (void) payload;
+
+    if (atomic_load(&grofs_bg_pool.should_stop)) {
+        return 1;
+    }
+
+    git_otype type;
+    size_t size;
+
+    if (grofs_object_header_lookup(repo, oid, &type, &size) == 0) {
+        atomic_fetch_add(&grofs_attr_prefetch_stats.headers, 1);
+    }
+
+    return 0;
+}
+
+static void grofs_attr_prefetch_tree_job(void *payload) {
+    struct grofs_tree_job *job = (struct grofs_tree_job *) payload;
+
+    git_tree *tree;
+
+    if (git_tree_lookup(&tree, job->repo->repo, &job->tree_oid) != 0) {
+        atomic_fetch_sub(&grofs_attr_prefetch_stats.pending_jobs, 1);
+
+        return ;
+    }
+
+    size_t count = git_tree_entrycount(tree);
+
+    git_oid *oids = (git_oid *) malloc(count * sizeof(git_oid));
+
+    if (NULL != oids) {
+        size_t oids_count = 0;
+
+        size_t i;
+
+        for (i = 0; i < count; i++) {
+            const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+
+            // type of every entry is already in the tree, only blob sizes need odb
+            if (GIT_OBJ_BLOB == git_tree_entry_type(entry) && !grofs_cache_contains(&grofs_meta_cache, git_tree_entry_id(entry))) {
+                git_oid_cpy(oids + oids_count++, git_tree_entry_id(entry));
+            }
+        }
+
+        grofs_fetch_batch(job->repo, oids, oids_count, grofs_attr_prefetch_fetch_cb, NULL);
+
+        free(oids);
+    }
+
+    git_tree_free(tree);
+
+    atomic_fetch_add(&grofs_attr_prefetch_stats.jobs, 1);
+    atomic_fetch_sub(&grofs_attr_prefetch_stats.pending_jobs, 1);
+}
+
+// Listing a tree is almost always followed by getattr of each of its entries
+static void grofs_attr_prefetch_start(const struct grofs_repository *repo, const git_oid *tree_oid) {
+    if (grofs_options.no_attr_prefetch) {
+        return ;
+    }
+
+    long long now_ms = grofs_now_ms();
+
+    struct grofs_attr_prefetch_slot *slot = grofs_attr_prefetch_slots + (grofs_oid_hash(tree_oid) & (GROFS_ATTR_PREFETCH_SLOTS - 1));
+
+    // a recursive listing opens trees faster than they are prefetched, bg pool is shared with preload so the queue is kept short
+    if (atomic_fetch_add(&grofs_attr_prefetch_stats.pending_jobs, 1) >= GROFS_ATTR_PREFETCH_MAX_PENDING) {
+        atomic_fetch_sub(&grofs_attr_prefetch_stats.pending_jobs, 1);
+        atomic_fetch_add(&grofs_attr_prefetch_stats.skipped, 1);
+
+        return ;
+    }
+
+    pthread_mutex_lock(&grofs_attr_prefetch_lock);
+
+    if (git_oid_equal(&slot->tree_oid, tree_oid) && now_ms - slot->started_ms < GROFS_ATTR_PREFETCH_WINDOW_MS) {
+        pthread_mutex_unlock(&grofs_attr_prefetch_lock);
+
+        atomic_fetch_sub(&grofs_attr_prefetch_stats.pending_jobs, 1);
+        atomic_fetch_add(&grofs_attr_prefetch_stats.skipped, 1);
+
+        return ;
+    }
+
+    git_oid_cpy(&slot->tree_oid, tree_oid);
+
+    slot->started_ms = now_ms;
+
+    pthread_mutex_unlock(&grofs_attr_prefetch_lock);
+
+    struct grofs_tree_job *payload = grofs_tree_job_new(repo, tree_oid);
+
+    if (NULL == payload) {
+        atomic_fetch_sub(&grofs_attr_prefetch_stats.pending_jobs, 1);
+
+        return ;
+    }
+
+    if (grofs_pool_submit(&grofs_bg_pool, grofs_attr_prefetch_tree_job, payload) != 0) {
+        atomic_fetch_sub(&grofs_attr_prefetch_stats.pending_jobs, 1);
+    }
+}
+
+// Copies the first line starting with prefix, or the first line when prefix is NULL
+static int grofs_read_file_line(const char *path, const char *prefix, char *line, size_t line_len) {
+    FILE *file = fopen(path, "r");
+
+    if (NULL == file) {
+        return ENOENT;
+    }
+
+    int ret = ENOENT;
+
+    while (fgets(line, line_len, file) != NULL) {
+        if (NULL == prefix || strncmp(line, prefix, strlen(prefix)) == 0) {
+            ret = 0;
+
+            break;
+        }
+    }
+
+    fclose(file);
+
+    return ret;
+}
+
+// Returns 0 for missing file or "max"
+static size_t grofs_read_file_size(const char *path) {
+    char line[64];
+
+    if ('\0' == *path || grofs_read_file_line(path, NULL, line, sizeof(line)) != 0) {
+        return 0;
+    }
+
+    return strtoull(line, NULL, 10);
+}
+
+// Prefers files of own cgroup so that pressure of the container is seen rather than of the whole host
+static void grofs_memory_governor_init_paths(struct grofs_memory_governor *governor) {
+    char line[PATH_MAX / 2]; // leaves room for cgroup root and file names
+
+    *governor->pressure_path = '\0';
+    *governor->cgroup_current_path = '\0';
+    *governor->cgroup_max_path = '\0';
+    *governor->cgroup_stat_path = '\0';
+
+    if (grofs_read_file_line("/proc/self/cgroup", "0::", line, sizeof(line)) == 0) {
+        line[strcspn(line, "\n")] = '\0';
+
+        const char *cgroup = line + strlen("0::");
+
+        snprintf(governor->cgroup_current_path, PATH_MAX, "%s%s/memory.current", GROFS_CGROUP_ROOT, cgroup);
+        snprintf(governor->cgroup_max_path, PATH_MAX, "%s%s/memory.max", GROFS_CGROUP_ROOT, cgroup);
+        snprintf(governor->cgroup_stat_path, PATH_MAX, "%s%s/memory.stat", GROFS_CGROUP_ROOT, cgroup);
+        snprintf(governor->pressure_path, PATH_MAX, "%s%s/memory.pressure", GROFS_CGROUP_ROOT, cgroup);
+
+        if (access(governor->cgroup_current_path, R_OK) != 0) {
+            *governor->cgroup_current_path = '\0';
+            *governor->cgroup_max_path = '\0';
+            *governor->cgroup_stat_path = '\0';
+        }
+
+        if (access(governor->pressure_path, R_OK) == 0) {
+            return ;
+        }
+    }
+
+    snprintf(governor->pressure_path, PATH_MAX, "%s", GROFS_PSI_MEMORY_PATH);
+
+    if (access(governor->pressure_path, R_OK) != 0) {
+        *governor->pressure_path = '\0';
+    }
+}
+
+// Returns non-zero when memory is under pressure
+static int grofs_memory_governor_poll(struct grofs_memory_governor *governor) {
+    int under_pressure = 0;
+
+    char line[256];
+
+    if ('\0' != *governor->pressure_path && grofs_read_file_line(governor->pressure_path, "some ", line, sizeof(line)) == 0) {
+        const char *avg10 = strstr(line, "avg10=");
+
+        if (NULL != avg10) {
+            size_t pressure_centi = (size_t) (strtod(avg10 + strlen("avg10="), NULL) * 100);
+
+            atomic_store(&governor->pressure_centi, pressure_centi);
+
+            under_pressure = pressure_centi >= (size_t) grofs_options.memory_pressure_pct * 100;
+        }
+    }
+
+    size_t cgroup_current = grofs_read_file_size(governor->cgroup_current_path);
+    size_t cgroup_max = grofs_read_file_size(governor->cgroup_max_path);
+    size_t cgroup_working_set = cgroup_current;
+
+    // a cgroup doing file I/O sits close to its limit with page cache, only inactive part of it is dropped for free
+    if ('\0' != *governor->cgroup_stat_path && grofs_read_file_line(governor->cgroup_stat_path, "inactive_file ", line, sizeof(line)) == 0) {
+        size_t inactive_file = strtoull(line + strlen("inactive_file "), NULL, 10);
+
+        cgroup_working_set = inactive_file < cgroup_current ? cgroup_current - inactive_file : 0;
+    }
+
+    atomic_store(&governor->cgroup_current, cgroup_current);
+    atomic_store(&governor->cgroup_working_set, cgroup_working_set);
+    atomic_store(&governor->cgroup_max, cgroup_max);
+
+    // active page cache counts as well, so this fires before reclaim shows up in PSI
+    if (cgroup_max > 0 && cgroup_working_set >= cgroup_max / 100 * GROFS_MEMORY_CGROUP_FULL_PCT) {
+        under_pressure = 1;
+    }
+
+    return under_pressure;
+}
+
+static void grofs_memory_governor_apply(struct grofs_memory_governor *governor, int level) {
+    atomic_store(&governor->level, level);
+
+    grofs_cache_set_limit(&grofs_meta_cache, grofs_meta_cache.budget >> level);
+    grofs_cache_set_limit(&grofs_blob_cache, grofs_blob_cache.budget >> level);
+    grofs_cache_set_limit(&grofs_zblob_cache, grofs_zblob_cache.budget >> level);
+    grofs_cache_set_limit(&grofs_grep_cache, grofs_grep_cache.budget >> level);
+
+    size_t chunk_list_limit = grofs_chunk_list_cache.budget >> level;
+    size_t chunk_list_min_limit = atomic_load(&grofs_chunk_list_min_limit);
+
+    grofs_cache_set_limit(&grofs_chunk_list_cache, chunk_list_limit > chunk_list_min_limit ? chunk_list_limit : chunk_list_min_limit);
+
+    if (governor->libgit2_cache_max > 0) {
+        git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, governor->libgit2_cache_max >> level);
+    }
+
+#ifdef __GLIBC__
+    // freed cache entries are mostly large blocks, give them back to the system right away
+    malloc_trim(0);
+#endif
+}
+
+static void *grofs_memory_governor_thread(void *data) {
+    struct grofs_memory_governor *governor = (struct grofs_memory_governor *) data;
+
+    int calm_polls = 0;
+
+    pthread_mutex_lock(&governor->lock);
+
+    while (!governor->should_stop) {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        deadline.tv_sec += GROFS_MEMORY_POLL_MS / 1000;
+        deadline.tv_nsec += (GROFS_MEMORY_POLL_MS % 1000) * 1000000L;
+
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&governor->cond, &governor->lock, &deadline);
+
+        if (governor->should_stop) {
+            break;
+        }
+
+        pthread_mutex_unlock(&governor->lock);
+
+        int level = atomic_load(&governor->level);
+
+        if (grofs_memory_governor_poll(governor)) {
+            calm_polls = 0;
+
+            if (level < GROFS_MEMORY_MAX_SHRINK_LEVEL) {
+                grofs_memory_governor_apply(governor, level + 1);
+
+                atomic_fetch_add(&governor->shrinks, 1);
+            }
+        } else if (level > 0 && ++calm_polls >= GROFS_MEMORY_CALM_POLLS) {
+            calm_polls = 0;
+
+            grofs_memory_governor_apply(governor, level - 1);
+
+            atomic_fetch_add(&governor->grows, 1);
+        }
+
+        pthread_mutex_lock(&governor->lock);
+    }
+
+    pthread_mutex_unlock(&governor->lock);
+
+    return NULL;
+}
+
+static int grofs_memory_governor_start(struct grofs_memory_governor *governor) {
+    grofs_memory_governor_init_paths(governor);
+
+    if ('\0' == *governor->pressure_path && '\0' == *governor->cgroup_current_path) {
+        return ENOTSUP;
+    }
+
+    ssize_t libgit2_cached = 0;
+
+    git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &libgit2_cached, &governor->libgit2_cache_max);
+
+    atomic_store(&governor->level, 0);
+
+    governor->should_stop = 0;
+
+    int ret = pthread_create(&governor->thread, NULL, grofs_memory_governor_thread, governor);
+
+    governor->running = 0 == ret;
+
+    return ret;
+}
+
+static void grofs_memory_governor_stop(struct grofs_memory_governor *governor) {
+    if (!governor->running) {
+        return ;
+    }
+
+    pthread_mutex_lock(&governor->lock);
+
+    governor->should_stop = 1;
+
+    pthread_cond_signal(&governor->cond);
+
+    pthread_mutex_unlock(&governor->lock);
+
+    pthread_join(governor->thread, NULL);
+
+    governor->running = 0;
+
+    // libgit2 limit is process wide so it must not stay lowered after close
+    if (atomic_load(&governor->level) > 0 && governor->libgit2_cache_max > 0) {
+        git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, governor->libgit2_cache_max);
+    }
+}
+
+static size_t grofs_memory_resident(void) {
+    char line[128];
+
+    if (grofs_read_file_line("/proc/self/statm", NULL, line, sizeof(line)) != 0) {
+        return 0;
+    }
+
+    unsigned long long size_pages;
+    unsigned long long resident_pages;
+
+    if (sscanf(line, "%llu %llu", &size_pages, &resident_pages) != 2) {
+        return 0;
+    }
+
+    return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+static void grofs_sched_enter(enum grofs_sched_class sched_class) {
+    struct grofs_sched_gate *gate = grofs_sched_gates + sched_class;
+
+    atomic_fetch_add(&gate->ops, 1);
+
+    if (0 == gate->limit) {
+        atomic_fetch_add(&gate->active, 1);
+
+        return ;
+    }
+
+    pthread_mutex_lock(&gate->lock);
+
+    if (atomic_load(&gate->active) >= gate->limit) {
+        struct timespec started;
+        struct timespec finished;
+
+        clock_gettime(CLOCK_MONOTONIC, &started);
+
+        while (atomic_load(&gate->active) >= gate->limit) {
+            pthread_cond_wait(&gate->cond, &gate->lock);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+
+        atomic_fetch_add(&gate->waits, 1);
+        atomic_fetch_add(&gate->wait_us, (finished.tv_sec - started.tv_sec) * 1000000ULL + (finished.tv_nsec - started.tv_nsec) / 1000);
+    }
+
+    atomic_fetch_add(&gate->active, 1);
+
+    pthread_mutex_unlock(&gate->lock);
+}
+
+static void grofs_sched_leave(enum grofs_sched_class sched_class) {
+    struct grofs_sched_gate *gate = grofs_sched_gates + sched_class;
+
+    if (0 == gate->limit) {
+        atomic_fetch_sub(&gate->active, 1);
+
+        return ;
+    }
+
+    pthread_mutex_lock(&gate->lock);
+
+    atomic_fetch_sub(&gate->active, 1);
+
+    pthread_cond_signal(&gate->cond);
+
+    pthread_mutex_unlock(&gate->lock);
+}
+
+static void grofs_bulk_read_job(void *payload) {
+    struct grofs_bulk_job *job = (struct grofs_bulk_job *) payload;
+    struct grofs_bulk_request *request = job->request;
+
+    int ret = grofs_blob_entry_read(request->repo, request->oid, &request->blob_entry);
+
+    // request is gone once it's marked done, job is freed after run and must not touch it
+    job->request = NULL;
+
+    pthread_mutex_lock(&request->lock);
+
+    request->ret = ret;
+    request->done = 1;
+
+    pthread_cond_signal(&request->cond);
+
+    pthread_mutex_unlock(&request->lock);
+}
+
+// Wakes up the opening thread when the job is dropped by grofs_pool_stop() instead of being run
+static void grofs_bulk_job_free(void *payload) {
+    struct grofs_bulk_job *job = (struct grofs_bulk_job *) payload;
+    struct grofs_bulk_request *request = job->request;
+
+    if (NULL != request) {
+        pthread_mutex_lock(&request->lock);
+
+        request->ret = ECANCELED;
+        request->done = 1;
+
+        pthread_cond_signal(&request->cond);
+
+        pthread_mutex_unlock(&request->lock);
+    }
+
+    free(job);
+}
+
+// Inflating a large blob takes long, low priority bulk threads do it so it can't starve metadata operations of CPU
+static int grofs_bulk_blob_entry_read(const struct grofs_repository *repo, const git_oid *oid, struct grofs_blob_entry **blob_entry) {
+    struct grofs_bulk_job *job = (struct grofs_bulk_job *) malloc(sizeof(struct grofs_bulk_job));
+
+    if (NULL == job) {
+        return ENOMEM;
+    }
+
+    struct grofs_bulk_request request = {
+        .repo = repo,
+        .oid = oid,
+        .blob_entry = NULL,
+        .ret = 0,
+        .done = 0
+    };
+
+    pthread_mutex_init(&request.lock, NULL);
+    pthread_cond_init(&request.cond, NULL);
+
+    job->request = &request;
+
+    grofs_sched_enter(GROFS_SCHED_BULK_READ);
+
+    // preload and prefetch jobs wait here too, so the pool is stopped after theirs, jobs it drops are done with ECANCELED
+    int ret = grofs_pool_submit_with_free(&grofs_bulk_pool, grofs_bulk_read_job, grofs_bulk_job_free, job);
+
+    if (0 == ret) {
+        pthread_mutex_lock(&request.lock);
+
+        while (!request.done) {
+            pthread_cond_wait(&request.cond, &request.lock);
+        }
+
+        pthread_mutex_unlock(&request.lock);
+
+        ret = request.ret;
+    } else {
+        ret = grofs_blob_entry_read(repo, oid, &request.blob_entry);
+    }
+
+    grofs_sched_leave(GROFS_SCHED_BULK_READ);
+
+    pthread_cond_destroy(&request.cond);
+    pthread_mutex_destroy(&request.lock);
+
+    *blob_entry = request.blob_entry;
+
+    return ret;
+}
+
+// Longest run of characters every match of an extended regex contains, a pattern with alternation has none
+static void grofs_grep_literal(const char *pattern, char *literal, size_t *literal_len) {
+    char run[NAME_MAX + 1];
+    size_t run_len = 0;
+
+    *literal_len = 0;
+
+    if (NULL != strchr(pattern, '|')) {
+        return ;
+    }
+
+    const char *c;
+
+    for (c = pattern; ; c++) {
+        if ('\0' != *c && NULL == strchr(".[]()*+?{}^$\\", *c)) {
+            run[run_len++] = *c;
+
+            continue ;
+        }
+
+        // \w, \b, \< and back references are not literals
+        if ('\\' == *c && '\0' != c[1] && NULL == strchr("<>`'", c[1]) && !isalnum((unsigned char) c[1])) {
+            run[run_len++] = *++c;
+
+            continue ;
+        }
+
+        // quantifier makes the character before it optional, all of it if it's multibyte
+        if ('*' == *c || '?' == *c || '{' == *c) {
+            if (run_len > 0 && (unsigned char) run[run_len - 1] < 0x80) {
+                run_len--;
+            } else {
+                while (run_len > 0 && (unsigned char) run[run_len - 1] >= 0x80) {
+                    run_len--;
+                }
+            }
+        }
+
+        if (run_len > *literal_len) {
+            memcpy(literal, run, run_len);
+
+            *literal_len = run_len;
+        }
+
+        run_len = 0;
+
+        if ('\0' == *c) {
+            break;
+        }
+
+        if ('\\' == *c) {
+            if ('\0' == c[1]) {
+                break;
+            }
+
+            c++;
+        } else if ('{' == *c) {
+            while ('\0' != c[1] && '}' != *c) {
+                c++;
+            }
+        } else if ('[' == *c) {
+            c++;
+
+            if ('^' == *c) {
+                c++;
+            }
+
+            if (']' == *c) {
+                c++;
+            }
+
+            // classes like [:alpha:] may hold ]
+            while ('\0' != *c && ']' != *c) {
+                if ('[' == *c && ('\0' != c[1] && NULL != strchr(":=.", c[1]))) {
+                    char kind = c[1];
+
+                    for (c += 2; '\0' != *c && !(kind == *c && ']' == c[1]); c++) {
+                    }
+
+                    if ('\0' != *c) {
+                        c++;
+                    }
+                }
+
+                if ('\0' != *c) {
+                    c++;
+                }
+            }
+
+            if ('\0' == *c) {
+                break;
+            }
+        } else if ('(' == *c) {
+            // group may be optional or repeated, so nothing inside it is required
+            int depth = 1;
+
+            while (depth > 0 && '\0' != c[1]) {
+                c++;
+
+                if ('\\' == *c && '\0' != c[1]) {
+                    c++;
+                } else if ('(' == *c) {
+                    depth++;
+                } else if (')' == *c) {
+                    depth--;
+                }
+            }
+        }
+    }
+}
+
+// Candidates are positions where both the first and the last byte of literal match, checked 16 at a time with SSE2
+static const char *grofs_grep_find(const char *data, size_t len, const char *literal, size_t literal_len) {
+    if (literal_len > len) {
+        return NULL;
+    }
+
+    if (1 == literal_len) {
+        return (const char *) memchr(data, literal[0], len);
+    }
+
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(literal[0]);
+    const __m128i last = _mm_set1_epi8(literal[literal_len - 1]);
+
+    for (; i + literal_len - 1 + 16 <= len; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *) (data + i + literal_len - 1));
+
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+
+        while (0 != mask) {
+            int bit = __builtin_ctz(mask);
+
+            if (memcmp(data + i + bit + 1, literal + 1, literal_len - 2) == 0) {
+                return data + i + bit;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    const char *end = data + len - literal_len + 1;
+    const char *c = data + i;
+
+    while (c < end && NULL != (c = (const char *) memchr(c, literal[0], end - c))) {
+        if (memcmp(c + 1, literal + 1, literal_len - 1) == 0) {
+            return c;
+        }
+
+        c++;
+    }
+
+    return NULL;
+}
+
+static size_t grofs_grep_count_lines(const char *data, size_t len) {
+    const char *end = data + len;
+    const char *c = data;
+
+    size_t count = 0;
+
+    while (c < end && NULL != (c = (const char *) memchr(c, '\n', end - c))) {
+        count++;
+        c++;
+    }
+
+    return count;
+}
+
+static int grofs_grep_known_binary(const git_oid *oid) {
+    struct grofs_cache_entry *entry = grofs_cache_get(&grofs_meta_cache, oid);
+
+    if (NULL == entry) {
+        return 0;
+    }
+
+    int binary = atomic_load(&((struct grofs_meta_entry *) entry)->binary);
+
+    grofs_cache_release(&grofs_meta_cache, entry);
+
+    return binary;
+}
+
+static void grofs_grep_mark_binary(const git_oid *oid, size_t size) {
+    struct grofs_cache_entry *entry = grofs_cache_get(&grofs_meta_cache, oid);
+
+    if (NULL == entry) {
+        grofs_meta_cache_put(oid, GIT_OBJ_BLOB, size);
+
+        entry = grofs_cache_get(&grofs_meta_cache, oid);
+    }
+
+    // it's only a cache so a blob which didn't fit is simply checked again
+    if (NULL == entry) {
+        return ;
+    }
+
+    atomic_store(&((struct grofs_meta_entry *) entry)->binary, 1);
+
+    grofs_cache_release(&grofs_meta_cache, entry);
+}
+
+static int grofs_grep_item_append(struct grofs_grep_item *item, const char *path, size_t line_no, const char *line, size_t line_len) {
+    char line_no_str[32];
+
+    int line_no_len = snprintf(line_no_str, sizeof(line_no_str), ":%zu:", line_no);
+
+    size_t path_len = strlen(path);
+    size_t needed = item->out_len + path_len + line_no_len + line_len + 1;
+
+    if (needed > item->out_capacity) {
+        size_t capacity = item->out_capacity < GROFS_GREP_MIN_CAPACITY ? GROFS_GREP_MIN_CAPACITY : item->out_capacity;
+
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+
+        char *out = (char *) realloc(item->out, capacity);
+
+        if (NULL == out) {
+            return ENOMEM;
+        }
+
+        item->out = out;
+        item->out_capacity = capacity;
+    }
+
+    memcpy(item->out + item->out_len, path, path_len);
+    memcpy(item->out + item->out_len + path_len, line_no_str, line_no_len);
+    memcpy(item->out + item->out_len + path_len + line_no_len, line, line_len);
+
+    item->out_len = needed;
+    item->out[needed - 1] = '\n';
+
+    return 0;
+}
+
+static void grofs_grep_item_run(struct grofs_grep_search *search, regex_t *regex, struct grofs_grep_item *item) {
+    atomic_fetch_add(&grofs_grep_stats.blobs, 1);
+
+    if (grofs_grep_known_binary(&item->oid)) {
+        atomic_fetch_add(&grofs_grep_stats.binary, 1);
+
+        return ;
+    }
+
+    struct grofs_blob_entry *blob_entry = (struct grofs_blob_entry *) grofs_cache_get(&grofs_blob_cache, &item->oid);
+
+    // blobs which are not cached are read past the cache, so that a search doesn't evict the working set
+    if (NULL == blob_entry && grofs_blob_entry_read(search->repo, &item->oid, &blob_entry) != 0) {
+        return ;
+    }
+
+    const char *data = blob_entry->data;
+    size_t len = blob_entry->len;
+
+    if (NULL != memchr(data, '\0', len < GROFS_GREP_BINARY_PEEK ? len : GROFS_GREP_BINARY_PEEK)) {
+        grofs_grep_mark_binary(&item->oid, len);
+
+        atomic_fetch_add(&grofs_grep_stats.binary, 1);
+
+        grofs_cache_release(&grofs_blob_cache, &blob_entry->entry);
+
+        return ;
+    }
+
+    const char *path = search->paths + item->path_offset;
+
+    size_t pos = 0;
+    size_t counted = 0;
+    size_t line_no = 1;
+
+    while (pos < len) {
+        size_t line_start = pos;
+
+        // only lines holding the literal can match, so the rest of the blob is skipped without regexec()
+        if (search->literal_len > 0) {
+            const char *hit = grofs_grep_find(data + pos, len - pos, search->literal, search->literal_len);
+
+            if (NULL == hit) {
+                if (0 == pos) {
+                    atomic_fetch_add(&grofs_grep_stats.prefiltered, 1);
+                }
+
+                break;
+            }
+
+            line_start = hit - data;
+
+            while (line_start > pos && '\n' != data[line_start - 1]) {
+                line_start--;
+            }
+        }
+
+        const char *line_end = (const char *) memchr(data + line_start, '\n', len - line_start);
+
+        size_t line_len = (NULL == line_end ? data + len : line_end) - (data + line_start);
+
+        line_no += grofs_grep_count_lines(data + counted, line_start - counted);
+        counted = line_start;
+
+        regmatch_t match = {
+            .rm_so = 0,
+            .rm_eo = line_len
+        };
+
+        if (regexec(regex, data + line_start, 1, &match, REG_STARTEND) == 0) {
+            atomic_fetch_add(&grofs_grep_stats.matches, 1);
+
+            if (grofs_grep_item_append(item, path, line_no, data + line_start, line_len) != 0) {
+                break;
+            }
+        }
+
+        pos = line_start + line_len + 1;
+    }
+
+    grofs_cache_release(&grofs_blob_cache, &blob_entry->entry);
+}
+
+// Threads take blobs one at a time off a shared cursor, so a thread stuck on a large blob doesn't hold up the others
+static void grofs_grep_search_run(struct grofs_grep_search *search) {
+    regex_t regex;
+
+    // glibc serializes regexec() calls on the same compiled pattern, each thread compiles its own
+    int compiled = regcomp(&regex, search->pattern, REG_EXTENDED | REG_NOSUB) == 0;
+
+    size_t index;
+
+    while ((index = atomic_fetch_add(&search->next, 1)) < search->count) {
+        struct grofs_grep_item *item = search->items + index;
+
+        // blobs are claimed in tree order, so what's left out is always the end of the results
+        if (!compiled || atomic_load(&search->out_len) >= GROFS_GREP_MAX_OUTPUT) {
+            atomic_store(&search->truncated, 1);
+        } else {
+            grofs_grep_item_run(search, &regex, item);
+
+            atomic_fetch_add(&search->out_len, item->out_len);
+        }
+
+        if (atomic_fetch_add(&search->done, 1) + 1 == search->count) {
+            pthread_mutex_lock(&search->lock);
+
+            pthread_cond_broadcast(&search->cond);
+
+            pthread_mutex_unlock(&search->lock);
+        }
+    }
+
+    if (compiled) {
+        regfree(&regex);
+    }
+}
+
+static void grofs_grep_search_release(struct grofs_grep_search *search) {
+    if (atomic_fetch_sub(&search->refs, 1) != 1) {
+        return ;
+    }
+
+    size_t i;
+
+    for (i = 0; i < search->count; i++) {
+        free(search->items[i].out);
+    }
+
+    pthread_cond_destroy(&search->cond);
+    pthread_mutex_destroy(&search->lock);
+
+    free(search->items);
+    free(search->paths);
+    free(search);
+}
+
+static void grofs_grep_job(void *payload) {
+    struct grofs_grep_job *job = (struct grofs_grep_job *) payload;
+
+    grofs_grep_search_run(job->search);
+}
+
+// Also frees jobs dropped by a stopping pool, which would otherwise keep the search
+static void grofs_grep_job_free(void *payload) {
+    struct grofs_grep_job *job = (struct grofs_grep_job *) payload;
+
+    grofs_grep_search_release(job->search);
+
+    free(job);
+}
+
+static int grofs_grep_walk_cb(const char *root, const git_tree_entry *entry, void *payload) {
+    struct grofs_grep_search *search = (struct grofs_grep_search *) payload;
+
+    // links are not followed and submodules have no blobs in this repository
+    if (GIT_OBJ_BLOB != git_tree_entry_type(entry) || GIT_FILEMODE_LINK == git_tree_entry_filemode(entry)) {
+        return 0;
+    }
+
+    size_t root_len = strlen(root);
+    size_t name_len = strlen(git_tree_entry_name(entry));
+
+    if (search->count == search->capacity) {
+        size_t capacity = 0 == search->capacity ? GROFS_GREP_MIN_CAPACITY : search->capacity * 2;
+
+        struct grofs_grep_item *items = (struct grofs_grep_item *) realloc(search->items, capacity * sizeof(struct grofs_grep_item));
+
+        if (NULL == items) {
+            search->ret = ENOMEM;
+
+            return -1;
+        }
+
+        search->items = items;
+        search->capacity = capacity;
+    }
+
+    if (search->paths_len + root_len + name_len + 1 > search->paths_capacity) {
+        size_t capacity = 0 == search->paths_capacity ? GROFS_GREP_MIN_CAPACITY * 32 : search->paths_capacity * 2;
+
+        while (capacity < search->paths_len + root_len + name_len + 1) {
+            capacity *= 2;
+        }
+
+        char *paths = (char *) realloc(search->paths, capacity);
+
+        if (NULL == paths) {
+            search->ret = ENOMEM;
+
+            return -1;
+        }
+
+        search->paths = paths;
+        search->paths_capacity = capacity;
+    }
+
+    struct grofs_grep_item *item = search->items + search->count++;
+
+    git_oid_cpy(&item->oid, git_tree_entry_id(entry));
+
+    item->path_offset = search->paths_len;
+    item->out = NULL;
+    item->out_len = 0;
+    item->out_capacity = 0;
+
+    memcpy(search->paths + search->paths_len, root, root_len);
+    memcpy(search->paths + search->paths_len + root_len, git_tree_entry_name(entry), name_len + 1);
+
+    search->paths_len += root_len + name_len + 1;
+
+    return 0;
+}
+
+static int grofs_grep_search_new(const struct grofs_repository *repo, const git_oid *tree_oid, const char *pattern, struct grofs_grep_search **search) {
+    regex_t regex;
+
+    // invalid pattern fails the open rather than giving no results
+    if (regcomp(&regex, pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+        return EINVAL;
+    }
+
+    regfree(&regex);
+
+    git_tree *tree;
+
+    if (git_tree_lookup(&tree, repo->repo, tree_oid) != 0) {
+        return ENOENT;
+    }
+
+    struct grofs_grep_search *new_search = (struct grofs_grep_search *) calloc(1, sizeof(struct grofs_grep_search));
+
+    if (NULL == new_search) {
+        git_tree_free(tree);
+
+        return ENOMEM;
+    }
+
+    new_search->repo = repo;
+
+    strcpy(new_search->pattern, pattern);
+
+    grofs_grep_literal(pattern, new_search->literal, &new_search->literal_len);
+
+    atomic_init(&new_search->next, 0);
+    atomic_init(&new_search->done, 0);
+    atomic_init(&new_search->out_len, 0);
+    atomic_init(&new_search->truncated, 0);
+    atomic_init(&new_search->refs, 1);
+
+    pthread_mutex_init(&new_search->lock, NULL);
+    pthread_cond_init(&new_search->cond, NULL);
+
+    int ret = git_tree_walk(tree, GIT_TREEWALK_PRE, grofs_grep_walk_cb, new_search);
+
+    git_tree_free(tree);
+
+    if (0 != ret) {
+        ret = 0 != new_search->ret ? new_search->ret : EIO;
+
+        grofs_grep_search_release(new_search);
+
+        return ret;
+    }
+
+    *search = new_search;
+
+    return 0;
+}
+
+static void grofs_grep_entry_free(struct grofs_cache_entry *entry) {
+    free((struct grofs_grep_entry *) entry);
+}
+
+static int grofs_grep_entry_new(struct grofs_grep_search *search, const git_oid *key, struct grofs_grep_entry **grep_entry) {
+    size_t len = 0;
+    size_t i;
+
+    for (i = 0; i < search->count; i++) {
+        len += search->items[i].out_len;
+    }
+
+    struct grofs_grep_entry *new_grep_entry = (struct grofs_grep_entry *) malloc(sizeof(struct grofs_grep_entry) + len);
+
+    if (NULL == new_grep_entry) {
+        return ENOMEM;
+    }
+
+    grofs_cache_entry_init(&new_grep_entry->entry, key, sizeof(struct grofs_grep_entry) + len);
+
+    new_grep_entry->len = 0;
+
+    for (i = 0; i < search->count; i++) {
+        if (search->items[i].out_len > 0) {
+            memcpy(new_grep_entry->data + new_grep_entry->len, search->items[i].out, search->items[i].out_len);
+
+            new_grep_entry->len += search->items[i].out_len;
+        }
+    }
+
+    *grep_entry = new_grep_entry;
+
+    return 0;
+}
+
+// Returned entry has a reference which must be released with grofs_cache_release, results are cached by tree
+// and pattern so that commits sharing a tree share them
+static int grofs_grep(const struct grofs_repository *repo, const git_oid *tree_oid, const char *pattern, struct grofs_grep_entry **grep_entry) {
+    unsigned char key_data[GIT_OID_RAWSZ + NAME_MAX];
+
+    size_t pattern_len = strlen(pattern);
+
+    if (pattern_len > NAME_MAX) {
+        return ENAMETOOLONG;
+    }
+
+    memcpy(key_data, tree_oid->id, GIT_OID_RAWSZ);
+    memcpy(key_data + GIT_OID_RAWSZ, pattern, pattern_len);
+
+    git_oid key;
+
+    if (git_odb_hash(&key, key_data, GIT_OID_RAWSZ + pattern_len, GIT_OBJ_BLOB) != 0) {
+        return EIO;
+    }
+
+    struct grofs_cache_entry *entry = grofs_cache_get(&grofs_grep_cache, &key);
+
+    if (NULL != entry) {
+        *grep_entry = (struct grofs_grep_entry *) entry;
+
+        return 0;
+    }
+
+    struct grofs_grep_search *search;
+
+    int ret = grofs_grep_search_new(repo, tree_oid, pattern, &search);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    atomic_fetch_add(&grofs_grep_stats.searches, 1);
+
+    size_t jobs = grofs_options.grep_threads < search->count ? grofs_options.grep_threads : search->count;
+    size_t i;
+
+    for (i = 0; i < jobs; i++) {
+        struct grofs_grep_job *job = (struct grofs_grep_job *) malloc(sizeof(struct grofs_grep_job));
+
+        if (NULL == job) {
+            break;
+        }
+
+        job->search = search;
+
+        atomic_fetch_add(&search->refs, 1);
+
+        // pool frees the job, releasing its reference, when it can't take it
+        if (grofs_pool_submit_with_free(&grofs_grep_pool, grofs_grep_job, grofs_grep_job_free, job) != 0) {
+            break;
+        }
+    }
+
+    // opening thread searches as well, without pool threads it's the only one
+    grofs_grep_search_run(search);
+
+    pthread_mutex_lock(&search->lock);
+
+    while (atomic_load(&search->done) < search->count) {
+        pthread_cond_wait(&search->cond, &search->lock);
+    }
+
+    pthread_mutex_unlock(&search->lock);
+
+    if (atomic_load(&search->truncated)) {
+        atomic_fetch_add(&grofs_grep_stats.truncated, 1);
+    }
+
+    struct grofs_grep_entry *new_grep_entry;
+
+    ret = grofs_grep_entry_new(search, &key, &new_grep_entry);
+
+    grofs_grep_search_release(search);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    *grep_entry = (struct grofs_grep_entry *) grofs_cache_put(&grofs_grep_cache, &new_grep_entry->entry);
+
+    return 0;
+}
+
+static void grofs_preload_job_done(void) {
+    if (atomic_fetch_sub(&grofs_preload_progress.pending_jobs, 1) == 1) {
+        clock_gettime(CLOCK_MONOTONIC, &grofs_preload_progress.finished);
+
+        atomic_store(&grofs_preload_progress.state, PRELOAD_DONE);
+    }
+}
+
+static int grofs_preload_submit(void (*run)(void *payload), void *payload) {
+    atomic_fetch_add(&grofs_preload_progress.pending_jobs, 1);
+
+    int ret = grofs_pool_submit(&grofs_bg_pool, run, payload);
+
+    if (0 != ret) {
+        atomic_fetch_add(&grofs_preload_progress.errors, 1);
+
+        grofs_preload_job_done();
+    }
+
+    return ret;
+}
+
+static int grofs_preload_path_matches(const char *path) {
+    if (0 == grofs_preload_paths.count) {
+        return 1;
+    }
+
+    size_t i;
+
+    for (i = 0; i < grofs_preload_paths.count; i++) {
+        if (fnmatch(grofs_preload_paths.items[i], path, 0) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Directory path ends with a slash, it may contain a match if it agrees with literal prefix of any glob
+static int grofs_preload_dir_may_match(const char *dir_path) {
+    if (0 == grofs_preload_paths.count) {
+        return 1;
+    }
+
+    size_t dir_path_len = strlen(dir_path);
+
+    size_t i;
+
+    for (i = 0; i < grofs_preload_paths.count; i++) {
+        size_t literal_len = strcspn(grofs_preload_paths.items[i], "*?[\\");
+
+        if (strncmp(grofs_preload_paths.items[i], dir_path, literal_len < dir_path_len ? literal_len : dir_path_len) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int grofs_preload_fetch_cb(const struct grofs_repository *repo, const git_oid *oid, void *payload) {
+    (void) payload;
+
+    if (atomic_load(&grofs_bg_pool.should_stop)) {
+        return 1;
+    }
+
+    if (grofs_options.preload_blobs && grofs_chunk_wanted(repo, oid)) {
+        struct grofs_chunk_list_entry *chunk_list;
+
+        if (grofs_chunks_load(repo, oid, &chunk_list) != 0) {
+            atomic_fetch_add(&grofs_preload_progress.errors, 1);
+
+            return 0;
+        }
+
+        atomic_fetch_add(&grofs_preload_progress.blob_bytes, chunk_list->len);
+
+        grofs_cache_release(&grofs_chunk_list_cache, &chunk_list->entry);
+    } else if (grofs_options.preload_blobs) {
+        struct grofs_blob_entry *blob_entry;
+
+        if (grofs_blob_load(repo, oid, &blob_entry) != 0) {
+            atomic_fetch_add(&grofs_preload_progress.errors, 1);
+
+            return 0;
+        }
+
+        atomic_fetch_add(&grofs_preload_progress.blob_bytes, blob_entry->len);
+
+        grofs_cache_release(&grofs_blob_cache, &blob_entry->entry);
+    } else {
+        git_otype type;
+        size_t size;
+
+        if (grofs_object_header_lookup(repo, oid, &type, &size) != 0) {
+            atomic_fetch_add(&grofs_preload_progress.errors, 1);
+
+            return 0;
+        }
+
+        atomic_fetch_add(&grofs_preload_progress.blob_bytes, size);
+    }
+
+    atomic_fetch_add(&grofs_preload_progress.blobs, 1);
+
+    return 0;
+}
+
+static void grofs_preload_batch_job(void *payload) {
+    struct grofs_preload_batch *batch = (struct grofs_preload_batch *) payload;
+
+    grofs_fetch_batch(batch->repo, batch->oids, batch->count, grofs_preload_fetch_cb, NULL);
+
+    grofs_preload_job_done();
+}
+
+static int grofs_preload_walk_cb(const char *root, const git_tree_entry *entry, void *payload) {
+    struct grofs_preload_walk_context *context = (struct grofs_preload_walk_context *) payload;
+
+    if (atomic_load(&grofs_bg_pool.should_stop)) {
+        return -1;
+    }
+
+    git_otype entry_type = git_tree_entry_type(entry);
+
+    int is_tree = GIT_OBJ_TREE == entry_type;
+
+    int len = snprintf(context->path, GROFS_PRELOAD_PATH_MAX, "%s%s%s", root, git_tree_entry_name(entry), is_tree ? "/" : "");
+
+    if (len < 0 || len >= GROFS_PRELOAD_PATH_MAX) {
+        return is_tree;
+    }
+
+    if (is_tree) {
+        if (!grofs_preload_dir_may_match(context->path)) {
+            return 1;
+        }
+
+        // walk itself loads the tree which is what ends up in libgit2's object cache,
+        // it's not held so it may be evicted from there like any other object
+        atomic_fetch_add(&grofs_preload_progress.trees, 1);
+
+        return 0;
+    }
+
+    if (GIT_OBJ_BLOB != entry_type || !grofs_preload_path_matches(context->path)) {
+        return 0;
+    }
+
+    if (NULL == context->batch) {
+        context->batch = (struct grofs_preload_batch *) malloc(sizeof(struct grofs_preload_batch));
+
+        if (NULL == context->batch) {
+            atomic_fetch_add(&grofs_preload_progress.errors, 1);
+
+            return 0;
+        }
+
+        context->batch->repo = context->repo;
+        context->batch->count = 0;
+    }
+
+    git_oid_cpy(context->batch->oids + context->batch->count++, git_tree_entry_id(entry));
+
+    if (GROFS_PRELOAD_BATCH_LEN == context->batch->count) {
+        grofs_preload_submit(grofs_preload_batch_job, context->batch);
+
+        context->batch = NULL;
+    }
+
+    return 0;
+}
+
+static void grofs_preload_rev_job(void *payload) {
+    const struct grofs_preload_rev *preload_rev = (const struct grofs_preload_rev *) payload;
+
+    const struct grofs_repository *repo = preload_rev->repo;
+    const char *rev = preload_rev->rev;
+
+    git_oid commit_oid;
+    git_commit *commit;
+
+    if (grofs_git_rev_commit_lookup(repo, rev, &commit_oid) != 0 || git_commit_lookup(&commit, repo->repo, &commit_oid) != 0) {
+        fprintf(stderr, "Failed to preload revision: %s\n", rev);
+
+        atomic_fetch_add(&grofs_preload_progress.errors, 1);
+
+        grofs_preload_job_done();
+
+        return ;
+    }
+
+    git_tree *tree;
+
+    if (git_commit_tree(&tree, commit) == 0) {
+        struct grofs_preload_walk_context context = {
+            .repo = repo,
+            .batch = NULL
+        };
+
+        git_tree_walk(tree, GIT_TREEWALK_PRE, grofs_preload_walk_cb, &context);
+
+        if (NULL != context.batch) {
+            grofs_preload_submit(grofs_preload_batch_job, context.batch);
+        }
+
+        git_tree_free(tree);
+
+        atomic_fetch_add(&grofs_preload_progress.revs, 1);
+    } else {
+        atomic_fetch_add(&grofs_preload_progress.errors, 1);
+    }
+
+    git_commit_free(commit);
+
+    grofs_preload_job_done();
+}
+
+// Every repository preloads the same revisions
+static void grofs_preload_start(const struct grofs *grofs) {
+    if (0 == grofs_preload_revs.count) {
+        return ;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &grofs_preload_progress.started);
+
+    atomic_store(&grofs_preload_progress.state, PRELOAD_RUNNING);
+
+    // held until every revision is submitted so that preload can't be marked as done too early
+    atomic_fetch_add(&grofs_preload_progress.pending_jobs, 1);
+
+    size_t i;
+
+    for (i = 0; i < grofs_preload_revs.count * grofs->repos_count; i++) {
+        const char *rev = grofs_preload_revs.items[i % grofs_preload_revs.count];
+
+        size_t rev_len = strlen(rev);
+
+        struct grofs_preload_rev *preload_rev = (struct grofs_preload_rev *) malloc(sizeof(struct grofs_preload_rev) + rev_len + 1);
+
+        if (NULL == preload_rev) {
+            atomic_fetch_add(&grofs_preload_progress.errors, 1);
+
+            continue ;
+        }
+
+        preload_rev->repo = grofs->repos + i / grofs_preload_revs.count;
+
+        memcpy(preload_rev->rev, rev, rev_len + 1);
+
+        grofs_preload_submit(grofs_preload_rev_job, preload_rev);
+    }
+
+    grofs_preload_job_done();
+}
+
+static const struct grofs_control_file *grofs_control_file_lookup(const char *name) {
+    const struct grofs_control_file *control_file;
+
+    for (control_file = grofs_control_files; NULL != control_file->name; control_file++) {
+        if (strcmp(control_file->name, name) == 0) {
+            return control_file;
+        }
+    }
+
+    return NULL;
+}
+
+static void grofs_control_write_preload(FILE *out) {
+    static const char *states[] = { "idle", "running", "done" };
+
+    int state = atomic_load(&grofs_preload_progress.state);
+
+    long long elapsed_ms = 0;
+
+    if (PRELOAD_IDLE != state) {
+        struct timespec end;
+
+        if (PRELOAD_DONE == state) {
+            end = grofs_preload_progress.finished;
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+        }
+
+        elapsed_ms = (end.tv_sec - grofs_preload_progress.started.tv_sec) * 1000LL + (end.tv_nsec - grofs_preload_progress.started.tv_nsec) / 1000000;
+    }
+
+    fprintf(out, "state: %s\n", states[state]);
+    fprintf(out, "revs: %zu/%zu\n", atomic_load(&grofs_preload_progress.revs), grofs_preload_revs.count * grofs_instance.repos_count);
+    fprintf(out, "trees: %zu\n", atomic_load(&grofs_preload_progress.trees));
+    fprintf(out, "blobs: %zu\n", atomic_load(&grofs_preload_progress.blobs));
+    fprintf(out, "blob_bytes: %zu\n", atomic_load(&grofs_preload_progress.blob_bytes));
+    fprintf(out, "errors: %zu\n", atomic_load(&grofs_preload_progress.errors));
+    fprintf(out, "elapsed_ms: %lld\n", elapsed_ms);
+}
+
+static void grofs_stats_thread_key_create(void) {
+    pthread_key_create(&grofs_stats_thread_key, grofs_stats_thread_release_cb);
+}
+
+static void grofs_stats_thread_release_cb(void *data) {
+    atomic_store(&((struct grofs_stats_thread *) data)->in_use, 0);
+}
+
+static struct grofs_stats_thread *grofs_stats_thread_acquire(void) {
+    struct grofs_stats_thread *thread_stats;
+
+    for (thread_stats = atomic_load(&grofs_stats_threads); NULL != thread_stats; thread_stats = thread_stats->next) {
+        int expected = 0;
+
+        if (atomic_compare_exchange_strong(&thread_stats->in_use, &expected, 1)) {
+            break;
+        }
+    }
+
+    if (NULL == thread_stats) {
+        thread_stats = (struct grofs_stats_thread *) calloc(1, sizeof(struct grofs_stats_thread));
+
+        if (NULL == thread_stats) {
+            return NULL;
+        }
+
+        atomic_init(&thread_stats->in_use, 1);
+
+        thread_stats->next = atomic_load(&grofs_stats_threads);
+
+        while (!atomic_compare_exchange_weak(&grofs_stats_threads, &thread_stats->next, thread_stats));
+    }
+
+    pthread_once(&grofs_stats_thread_key_once, grofs_stats_thread_key_create);
+
+    // key destructor gives counters back once the thread exits
+    pthread_setspecific(grofs_stats_thread_key, thread_stats);
+
+    return thread_stats;
+}
+
+void grofs_stats_set_extra_writer(void (*writer)(FILE *out)) {
+    grofs_stats_extra_writer = writer;
+}
+
+void grofs_stats_record(enum grofs_stats_op op, const struct timespec *started, const struct timespec *finished, int ret) {
+    if (NULL == grofs_stats_thread_local) {
+        grofs_stats_thread_local = grofs_stats_thread_acquire();
+
+        if (NULL == grofs_stats_thread_local) {
+            return ;
+        }
+    }
+
+    uint64_t elapsed_us = (finished->tv_sec - started->tv_sec) * 1000000ULL + (finished->tv_nsec - started->tv_nsec) / 1000;
+
+    int bucket = elapsed_us <= 1 ? 0 : 64 - __builtin_clzll(elapsed_us - 1);
+
+    if (bucket >= GROFS_STATS_BUCKETS) {
+        bucket = GROFS_STATS_BUCKETS - 1;
+    }
+
+    struct grofs_stats_op_counters *counters = grofs_stats_thread_local->ops + op;
+
+    // this thread is the only writer so there is no need for atomic increments
+    atomic_store_explicit(&counters->count, atomic_load_explicit(&counters->count, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&counters->total_us, atomic_load_explicit(&counters->total_us, memory_order_relaxed) + elapsed_us, memory_order_relaxed);
+    atomic_store_explicit(counters->buckets + bucket, atomic_load_explicit(counters->buckets + bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+
+    if (ret < 0) {
+        atomic_store_explicit(&counters->errors, atomic_load_explicit(&counters->errors, memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+}
+
+static void grofs_stats_write_caches(FILE *out, const char *metric, const char *type, size_t (*value)(const struct grofs_cache *cache)) {
+    fprintf(out, "# TYPE %s %s\n", metric, type);
+    fprintf(out, "%s{cache=\"%s\"} %zu\n", metric, grofs_meta_cache.name, value(&grofs_meta_cache));
+    fprintf(out, "%s{cache=\"%s\"} %zu\n", metric, grofs_blob_cache.name, value(&grofs_blob_cache));
+
+    if (grofs_zblob_cache.budget > 0) {
+        fprintf(out, "%s{cache=\"%s\"} %zu\n", metric, grofs_zblob_cache.name, value(&grofs_zblob_cache));
+    }
+
+    fprintf(out, "%s{cache=\"%s\"} %zu\n", metric, grofs_grep_cache.name, value(&grofs_grep_cache));
+
+    if (grofs_chunk_list_cache.budget > 0) {
+        fprintf(out, "%s{cache=\"%s\"} %zu\n", metric, grofs_chunk_list_cache.name, value(&grofs_chunk_list_cache));
+    }
+}
+
+static size_t grofs_stats_cache_hits(const struct grofs_cache *cache) {
+    return atomic_load(&cache->hits);
+}
+
+static size_t grofs_stats_cache_misses(const struct grofs_cache *cache) {
+    return atomic_load(&cache->misses);
+}
+
+static size_t grofs_stats_cache_evictions(const struct grofs_cache *cache) {
+    return atomic_load(&cache->evictions);
+}
+
+static size_t grofs_stats_cache_bytes(const struct grofs_cache *cache) {
+    return atomic_load(&cache->cost);
+}
+
+static size_t grofs_stats_cache_budget(const struct grofs_cache *cache) {
+    return cache->budget;
+}
+
+static size_t grofs_stats_cache_limit(const struct grofs_cache *cache) {
+    return atomic_load(&cache->limit);
+}
+
+static void grofs_stats_write_sched(FILE *out, const char *metric, const char *type, size_t (*value)(const struct grofs_sched_gate *gate)) {
+    fprintf(out, "# TYPE %s %s\n", metric, type);
+
+    int sched_class;
+
+    for (sched_class = 0; sched_class < GROFS_SCHED_COUNT; sched_class++) {
+        fprintf(out, "%s{class=\"%s\"} %zu\n", metric, grofs_sched_gates[sched_class].name, value(grofs_sched_gates + sched_class));
+    }
+}
+
+static size_t grofs_stats_sched_ops(const struct grofs_sched_gate *gate) {
+    return atomic_load(&gate->ops);
+}
+
+static size_t grofs_stats_sched_waits(const struct grofs_sched_gate *gate) {
+    return atomic_load(&gate->waits);
+}
+
+static size_t grofs_stats_sched_wait_us(const struct grofs_sched_gate *gate) {
+    return atomic_load(&gate->wait_us);
+}
+
+static size_t grofs_stats_sched_active(const struct grofs_sched_gate *gate) {
+    return atomic_load(&gate->active);
+}
+
+static size_t grofs_stats_sched_limit(const struct grofs_sched_gate *gate) {
+    return gate->limit;
+}
+
+static void grofs_control_write_stats(FILE *out) {
+    uint64_t count[GROFS_STATS_OP_COUNT] = { 0 };
+    uint64_t errors[GROFS_STATS_OP_COUNT] = { 0 };
+    uint64_t total_us[GROFS_STATS_OP_COUNT] = { 0 };
+    uint64_t buckets[GROFS_STATS_OP_COUNT][GROFS_STATS_BUCKETS] = { { 0 } };
+
+    struct grofs_stats_thread *thread_stats;
+
+    for (thread_stats = atomic_load(&grofs_stats_threads); NULL != thread_stats; thread_stats = thread_stats->next) {
+        int op;
+
+        for (op = 0; op < GROFS_STATS_OP_COUNT; op++) {
+            struct grofs_stats_op_counters *counters = thread_stats->ops + op;
+
+            count[op] += atomic_load_explicit(&counters->count, memory_order_relaxed);
+            errors[op] += atomic_load_explicit(&counters->errors, memory_order_relaxed);
+            total_us[op] += atomic_load_explicit(&counters->total_us, memory_order_relaxed);
+
+            int bucket;
+
+            for (bucket = 0; bucket < GROFS_STATS_BUCKETS; bucket++) {
+                buckets[op][bucket] += atomic_load_explicit(counters->buckets + bucket, memory_order_relaxed);
+            }
+        }
+    }
+
+    int op;
+
+    fprintf(out, "# TYPE grofs_op_latency_microseconds histogram\n");
+
+    for (op = 0; op < GROFS_STATS_OP_COUNT; op++) {
+        uint64_t cumulative = 0;
+
+        int bucket;
+
+        // last bucket also holds everything slower so it's only reported as +Inf
+        for (bucket = 0; bucket < GROFS_STATS_BUCKETS - 1; bucket++) {
+            cumulative += buckets[op][bucket];
+
+            fprintf(out, "grofs_op_latency_microseconds_bucket{op=\"%s\",le=\"%llu\"} %llu\n", grofs_stats_op_names[op], 1ULL << bucket, (unsigned long long) cumulative);
+        }
+
+        fprintf(out, "grofs_op_latency_microseconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n", grofs_stats_op_names[op], (unsigned long long) count[op]);
+        fprintf(out, "grofs_op_latency_microseconds_sum{op=\"%s\"} %llu\n", grofs_stats_op_names[op], (unsigned long long) total_us[op]);
+        fprintf(out, "grofs_op_latency_microseconds_count{op=\"%s\"} %llu\n", grofs_stats_op_names[op], (unsigned long long) count[op]);
+    }
+
+    fprintf(out, "# TYPE grofs_op_errors_total counter\n");
+
+    for (op = 0; op < GROFS_STATS_OP_COUNT; op++) {
+        fprintf(out, "grofs_op_errors_total{op=\"%s\"} %llu\n", grofs_stats_op_names[op], (unsigned long long) errors[op]);
+    }
+
+    grofs_stats_write_caches(out, "grofs_cache_hits_total", "counter", grofs_stats_cache_hits);
+    grofs_stats_write_caches(out, "grofs_cache_misses_total", "counter", grofs_stats_cache_misses);
+    grofs_stats_write_caches(out, "grofs_cache_evictions_total", "counter", grofs_stats_cache_evictions);
+    grofs_stats_write_caches(out, "grofs_cache_bytes", "gauge", grofs_stats_cache_bytes);
+    grofs_stats_write_caches(out, "grofs_cache_budget_bytes", "gauge", grofs_stats_cache_budget);
+    grofs_stats_write_caches(out, "grofs_cache_limit_bytes", "gauge", grofs_stats_cache_limit);
+
+    if (grofs_zblob_cache.budget > 0) {
+        fprintf(out, "# TYPE grofs_cache_demote_pending_bytes gauge\n");
+        fprintf(out, "grofs_cache_demote_pending_bytes %zu\n", atomic_load(&grofs_zblob_demote_pending));
+        fprintf(out, "# TYPE grofs_cache_demote_dropped_total counter\n");
+        fprintf(out, "grofs_cache_demote_dropped_total %zu\n", atomic_load(&grofs_zblob_demote_dropped));
+    }
+
+    ssize_t libgit2_cached = 0;
+    ssize_t libgit2_cache_limit = 0;
+
+    git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &libgit2_cached, &libgit2_cache_limit);
+
+    fprintf(out, "# TYPE grofs_libgit2_cached_bytes gauge\n");
+    fprintf(out, "grofs_libgit2_cached_bytes %zd\n", libgit2_cached);
+    fprintf(out, "# TYPE grofs_libgit2_cache_limit_bytes gauge\n");
+    fprintf(out, "grofs_libgit2_cache_limit_bytes %zd\n", libgit2_cache_limit);
+
+    size_t pressure_centi = atomic_load(&grofs_memory_governor.pressure_centi);
+
+    fprintf(out, "# TYPE grofs_memory_resident_bytes gauge\n");
+    fprintf(out, "grofs_memory_resident_bytes %zu\n", grofs_memory_resident());
+    fprintf(out, "# TYPE grofs_memory_pressure_some_avg10 gauge\n");
+    fprintf(out, "grofs_memory_pressure_some_avg10 %zu.%02zu\n", pressure_centi / 100, pressure_centi % 100);
+    fprintf(out, "# TYPE grofs_memory_cgroup_current_bytes gauge\n");
+    fprintf(out, "grofs_memory_cgroup_current_bytes %zu\n", atomic_load(&grofs_memory_governor.cgroup_current));
+    fprintf(out, "# TYPE grofs_memory_cgroup_working_set_bytes gauge\n");
+    fprintf(out, "grofs_memory_cgroup_working_set_bytes %zu\n", atomic_load(&grofs_memory_governor.cgroup_working_set));
+    fprintf(out, "# TYPE grofs_memory_cgroup_max_bytes gauge\n");
+    fprintf(out, "grofs_memory_cgroup_max_bytes %zu\n", atomic_load(&grofs_memory_governor.cgroup_max));
+    fprintf(out, "# TYPE grofs_memory_shrink_level gauge\n");
+    fprintf(out, "grofs_memory_shrink_level %d\n", atomic_load(&grofs_memory_governor.level));
+    fprintf(out, "# TYPE grofs_memory_shrinks_total counter\n");
+    fprintf(out, "grofs_memory_shrinks_total %zu\n", atomic_load(&grofs_memory_governor.shrinks));
+    fprintf(out, "# TYPE grofs_memory_grows_total counter\n");
+    fprintf(out, "grofs_memory_grows_total %zu\n", atomic_load(&grofs_memory_governor.grows));
+
+    fprintf(out, "# TYPE grofs_spill_writes_total counter\n");
+    fprintf(out, "grofs_spill_writes_total %zu\n", atomic_load(&grofs_spill_stats.writes));
+    fprintf(out, "# TYPE grofs_spill_write_bytes_total counter\n");
+    fprintf(out, "grofs_spill_write_bytes_total %zu\n", atomic_load(&grofs_spill_stats.write_bytes));
+    fprintf(out, "# TYPE grofs_spill_opens_total counter\n");
+    fprintf(out, "grofs_spill_opens_total %zu\n", atomic_load(&grofs_spill_stats.opens));
+    fprintf(out, "# TYPE grofs_spill_read_bytes_total counter\n");
+    fprintf(out, "grofs_spill_read_bytes_total %zu\n", atomic_load(&grofs_spill_stats.read_bytes));
+    fprintf(out, "# TYPE grofs_spill_errors_total counter\n");
+    fprintf(out, "grofs_spill_errors_total %zu\n", atomic_load(&grofs_spill_stats.errors));
+
+    fprintf(out, "# TYPE grofs_fetch_batches_total counter\n");
+    fprintf(out, "grofs_fetch_batches_total %zu\n", atomic_load(&grofs_fetch_stats.batches));
+    fprintf(out, "# TYPE grofs_fetch_objects_total counter\n");
+    fprintf(out, "grofs_fetch_objects_total %zu\n", atomic_load(&grofs_fetch_stats.objects));
+    fprintf(out, "# TYPE grofs_fetch_packed_objects_total counter\n");
+    fprintf(out, "grofs_fetch_packed_objects_total %zu\n", atomic_load(&grofs_fetch_stats.packed));
+    fprintf(out, "# TYPE grofs_fetch_readahead_bytes_total counter\n");
+    fprintf(out, "grofs_fetch_readahead_bytes_total %zu\n", atomic_load(&grofs_fetch_stats.readahead_bytes));
+
+    fprintf(out, "# TYPE grofs_object_index_builds_total counter\n");
+    fprintf(out, "grofs_object_index_builds_total %zu\n", atomic_load(&grofs_object_index_stats.builds));
+    fprintf(out, "# TYPE grofs_object_index_records gauge\n");
+    fprintf(out, "grofs_object_index_records %zu\n", atomic_load(&grofs_object_index_stats.records));
+    fprintf(out, "# TYPE grofs_object_index_bytes gauge\n");
+    fprintf(out, "grofs_object_index_bytes %zu\n", atomic_load(&grofs_object_index_stats.bytes));
+
+    size_t at_commits = 0;
+
+    pthread_mutex_lock(&grofs_at_lock);
+
+    int chain;
+
+    for (chain = 0; chain < GROFS_AT_CHAIN_SLOTS; chain++) {
+        at_commits += grofs_at_chains[chain].count;
+    }
+
+    pthread_mutex_unlock(&grofs_at_lock);
+
+    fprintf(out, "# TYPE grofs_at_lookups_total counter\n");
+    fprintf(out, "grofs_at_lookups_total %zu\n", atomic_load(&grofs_at_stats.lookups));
+    fprintf(out, "# TYPE grofs_at_commits_walked_total counter\n");
+    fprintf(out, "grofs_at_commits_walked_total %zu\n", atomic_load(&grofs_at_stats.walked));
+    fprintf(out, "# TYPE grofs_at_commits_spliced_total counter\n");
+    fprintf(out, "grofs_at_commits_spliced_total %zu\n", atomic_load(&grofs_at_stats.spliced));
+    fprintf(out, "# TYPE grofs_at_commits gauge\n");
+    fprintf(out, "grofs_at_commits %zu\n", at_commits);
+
+    fprintf(out, "# TYPE grofs_mtime_records_loaded_total counter\n");
+    fprintf(out, "grofs_mtime_records_loaded_total %zu\n", atomic_load(&grofs_mtime_stats.loaded));
+    fprintf(out, "# TYPE grofs_mtime_records_built_total counter\n");
+    fprintf(out, "grofs_mtime_records_built_total %zu\n", atomic_load(&grofs_mtime_stats.built));
+    fprintf(out, "# TYPE grofs_mtime_lookups_total counter\n");
+    fprintf(out, "grofs_mtime_lookups_total %zu\n", atomic_load(&grofs_mtime_stats.lookups));
+    fprintf(out, "# TYPE grofs_mtime_lookup_steps_total counter\n");
+    fprintf(out, "grofs_mtime_lookup_steps_total %zu\n", atomic_load(&grofs_mtime_stats.steps));
+
+    fprintf(out, "# TYPE grofs_readdir_threads gauge\n");
+    fprintf(out, "grofs_readdir_threads %d\n", atomic_load(&grofs_readdir_threads_count));
+
+    fprintf(out, "# TYPE grofs_prefetch_jobs_total counter\n");
+    fprintf(out, "grofs_prefetch_jobs_total %zu\n", atomic_load(&grofs_prefetch_stats.jobs));
+    fprintf(out, "# TYPE grofs_prefetch_blobs_total counter\n");
+    fprintf(out, "grofs_prefetch_blobs_total %zu\n", atomic_load(&grofs_prefetch_stats.blobs));
+    fprintf(out, "# TYPE grofs_prefetch_hits_total counter\n");
+    fprintf(out, "grofs_prefetch_hits_total %zu\n", atomic_load(&grofs_prefetch_stats.hits));
+    fprintf(out, "# TYPE grofs_prefetch_misses_total counter\n");
+    fprintf(out, "grofs_prefetch_misses_total %zu\n", atomic_load(&grofs_prefetch_stats.misses));
+    fprintf(out, "# TYPE grofs_prefetch_backoffs_total counter\n");
+    fprintf(out, "grofs_prefetch_backoffs_total %zu\n", atomic_load(&grofs_prefetch_stats.backoffs));
+    fprintf(out, "# TYPE grofs_prefetch_unused_bytes gauge\n");
+    fprintf(out, "grofs_prefetch_unused_bytes %zu\n", atomic_load(&grofs_prefetch_stats.unused_bytes));
+
+    grofs_stats_write_sched(out, "grofs_sched_ops_total", "counter", grofs_stats_sched_ops);
+    grofs_stats_write_sched(out, "grofs_sched_waits_total", "counter", grofs_stats_sched_waits);
+    grofs_stats_write_sched(out, "grofs_sched_wait_microseconds_total", "counter", grofs_stats_sched_wait_us);
+    grofs_stats_write_sched(out, "grofs_sched_active", "gauge", grofs_stats_sched_active);
+    grofs_stats_write_sched(out, "grofs_sched_limit", "gauge", grofs_stats_sched_limit);
+
+    fprintf(out, "# TYPE grofs_chunk_blobs_total counter\n");
+    fprintf(out, "grofs_chunk_blobs_total %zu\n", atomic_load(&grofs_chunk_stats.blobs));
+    fprintf(out, "# TYPE grofs_chunks_total counter\n");
+    fprintf(out, "grofs_chunks_total %zu\n", atomic_load(&grofs_chunk_stats.chunks));
+    fprintf(out, "# TYPE grofs_chunks_shared_total counter\n");
+    fprintf(out, "grofs_chunks_shared_total %zu\n", atomic_load(&grofs_chunk_stats.shared));
+    fprintf(out, "# TYPE grofs_chunk_shared_bytes_total counter\n");
+    fprintf(out, "grofs_chunk_shared_bytes_total %zu\n", atomic_load(&grofs_chunk_stats.shared_bytes));
+    fprintf(out, "# TYPE grofs_chunk_refills_total counter\n");
+    fprintf(out, "grofs_chunk_refills_total %zu\n", atomic_load(&grofs_chunk_stats.refills));
+
+    fprintf(out, "# TYPE grofs_grep_searches_total counter\n");
+    fprintf(out, "grofs_grep_searches_total %zu\n", atomic_load(&grofs_grep_stats.searches));
+    fprintf(out, "# TYPE grofs_grep_blobs_total counter\n");
+    fprintf(out, "grofs_grep_blobs_total %zu\n", atomic_load(&grofs_grep_stats.blobs));
+    fprintf(out, "# TYPE grofs_grep_binary_blobs_total counter\n");
+    fprintf(out, "grofs_grep_binary_blobs_total %zu\n", atomic_load(&grofs_grep_stats.binary));
+    fprintf(out, "# TYPE grofs_grep_prefiltered_blobs_total counter\n");
+    fprintf(out, "grofs_grep_prefiltered_blobs_total %zu\n", atomic_load(&grofs_grep_stats.prefiltered));
+    fprintf(out, "# TYPE grofs_grep_matches_total counter\n");
+    fprintf(out, "grofs_grep_matches_total %zu\n", atomic_load(&grofs_grep_stats.matches));
+    fprintf(out, "# TYPE grofs_grep_truncated_total counter\n");
+    fprintf(out, "grofs_grep_truncated_total %zu\n", atomic_load(&grofs_grep_stats.truncated));
+
+    fprintf(out, "# TYPE grofs_attr_prefetch_jobs_total counter\n");
+    fprintf(out, "grofs_attr_prefetch_jobs_total %zu\n", atomic_load(&grofs_attr_prefetch_stats.jobs));
+    fprintf(out, "# TYPE grofs_attr_prefetch_skipped_total counter\n");
+    fprintf(out, "grofs_attr_prefetch_skipped_total %zu\n", atomic_load(&grofs_attr_prefetch_stats.skipped));
+    fprintf(out, "# TYPE grofs_attr_prefetch_headers_total counter\n");
+    fprintf(out, "grofs_attr_prefetch_headers_total %zu\n", atomic_load(&grofs_attr_prefetch_stats.headers));
+
+    if (NULL != grofs_stats_extra_writer) {
+        grofs_stats_extra_writer(out);
+    }
+}
+
+static uint64_t grofs_path_hash_update(uint64_t hash, const char *str, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char) str[i]) * GROFS_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static int grofs_uint64_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t grofs_mtime_record_check(const struct grofs_mtime_record *record) {
+    uint64_t hash = grofs_path_hash_update(GROFS_FNV_OFFSET, (const char *) record->oid.id, GIT_OID_RAWSZ);
+
+    hash = grofs_path_hash_update(hash, (const char *) &record->time, sizeof(record->time));
+    hash = grofs_path_hash_update(hash, (const char *) record->hashes, sizeof(uint64_t) * record->count);
+
+    return (uint32_t) (hash ^ (hash >> 32));
+}
+
+static int grofs_read_full(int fd, void *buff, size_t len) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t ret = read(fd, (char *) buff + done, len - done);
+
+        if (ret < 0 && EINTR == errno) {
+            continue ;
+        }
+
+        if (ret <= 0) {
+            return EIO;
+        }
+
+        done += ret;
+    }
+
+    return 0;
+}
+
+// Index is append only, a record torn by a crash ends loading and is cut off so that appends follow the last valid one,
+// the file is locked meanwhile since other mounts may be appending to it
+static int grofs_mtime_index_load(struct grofs_mtime_index *index, int fd) {
+    if (flock(fd, LOCK_EX) != 0) {
+        return EIO;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        flock(fd, LOCK_UN);
+
+        return EIO;
+    }
+
+    char magic[sizeof(GROFS_MTIME_INDEX_MAGIC) - 1];
+
+    if (grofs_read_full(fd, magic, sizeof(magic)) != 0) {
+        int ret = ftruncate(fd, 0) == 0 && write(fd, GROFS_MTIME_INDEX_MAGIC, sizeof(magic)) == (ssize_t) sizeof(magic) ? 0 : EIO;
+
+        flock(fd, LOCK_UN);
+
+        return ret;
+    }
+
+    if (memcmp(magic, GROFS_MTIME_INDEX_MAGIC, sizeof(magic)) != 0) {
+        flock(fd, LOCK_UN);
+
+        return EINVAL;
+    }
+
+    off_t valid_len = sizeof(magic);
+
+    struct grofs_mtime_disk_record disk_record;
+
+    while (grofs_read_full(fd, &disk_record, sizeof(disk_record)) == 0) {
+        off_t left = st.st_size - valid_len - (off_t) sizeof(disk_record);
+
+        // count of a torn or corrupt record may be anything, it can't be larger than rest of the file though
+        if (left < 0 || (uint64_t) disk_record.count > (uint64_t) left / sizeof(uint64_t)) {
+            break;
+        }
+
+        struct grofs_mtime_record *record = (struct grofs_mtime_record *) malloc(sizeof(struct grofs_mtime_record) + sizeof(uint64_t) * disk_record.count);
+
+        if (NULL == record) {
+            flock(fd, LOCK_UN);
+
+            return ENOMEM;
+        }
+
+        git_oid_fromraw(&record->oid, disk_record.oid);
+        git_oid_fromraw(&record->parent_oid, disk_record.parent_oid);
+
+        record->time = disk_record.time;
+        record->count = disk_record.count;
+
+        if (grofs_read_full(fd, record->hashes, sizeof(uint64_t) * record->count) != 0 || grofs_mtime_record_check(record) != disk_record.check) {
+            free(record);
+
+            break;
+        }
+
+        grofs_mtime_index_insert(index, record);
+
+        valid_len += sizeof(disk_record) + sizeof(uint64_t) * record->count;
+
+        atomic_fetch_add(&grofs_mtime_stats.loaded, 1);
+    }
+
+    int ret = 0;
+
+    if ((valid_len < st.st_size && ftruncate(fd, valid_len) != 0) || lseek(fd, valid_len, SEEK_SET) != valid_len) {
+        ret = EIO;
+    }
+
+    flock(fd, LOCK_UN);
+
+    return ret;
+}
+
+static int grofs_mtime_index_open(struct grofs_repository *repo) {
+    struct grofs_mtime_index *index = (struct grofs_mtime_index *) calloc(1, sizeof(struct grofs_mtime_index));
+
+    if (NULL == index) {
+        return ENOMEM;
+    }
+
+    index->buckets = (struct grofs_mtime_record **) calloc(GROFS_MTIME_MIN_BUCKETS, sizeof(struct grofs_mtime_record *));
+
+    if (NULL == index->buckets) {
+        free(index);
+
+        return ENOMEM;
+    }
+
+    pthread_mutex_init(&index->lock, NULL);
+
+    index->buckets_count = GROFS_MTIME_MIN_BUCKETS;
+    index->fd = -1;
+
+    repo->mtime_index = index;
+
+    if (NULL == grofs_mtime_index_dir) {
+        return 0;
+    }
+
+    char path[PATH_MAX];
+
+    // records are keyed by commit id, so an index left by a mount of another repository under the same name is only larger
+    snprintf(path, PATH_MAX, "%s/%s%s", grofs_mtime_index_dir, NULL == repo->name ? GROFS_MTIME_INDEX_DEFAULT_NAME : repo->name, GROFS_MTIME_INDEX_SUFFIX);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (-1 == fd) {
+        fprintf(stderr, "Keeping mtime index in memory only, failed to open: %s\n", path);
+
+        return 0;
+    }
+
+    int ret = grofs_mtime_index_load(index, fd);
+
+    if (ENOMEM == ret) {
+        close(fd);
+
+        return ret;
+    }
+
+    if (0 != ret) {
+        fprintf(stderr, "Ignoring unreadable mtime index: %s\n", path);
+
+        close(fd);
+
+        return 0;
+    }
+
+    index->fd = fd;
+
+    return 0;
+}
+
+static void grofs_mtime_index_free(struct grofs_mtime_index *index) {
+    size_t i;
+
+    for (i = 0; i < index->buckets_count; i++) {
+        struct grofs_mtime_record *record = index->buckets[i];
+
+        while (NULL != record) {
+            struct grofs_mtime_record *next = record->next;
+
+            free(record);
+
+            record = next;
+        }
+    }
+
+    if (-1 != index->fd) {
+        close(index->fd);
+    }
+
+    pthread_mutex_destroy(&index->lock);
+
+    free(index->buckets);
+    free(index);
+}
+
+// Caller holds the lock
+static const struct grofs_mtime_record *grofs_mtime_index_find(const struct grofs_mtime_index *index, const git_oid *oid) {
+    const struct grofs_mtime_record *record = index->buckets[grofs_oid_hash(oid) & (index->buckets_count - 1)];
+
+    while (NULL != record && !git_oid_equal(&record->oid, oid)) {
+        record = record->next;
+    }
+
+    return record;
+}
+
+// Caller holds the lock, index takes over the record
+static void grofs_mtime_index_insert(struct grofs_mtime_index *index, struct grofs_mtime_record *record) {
+    if (index->count >= index->buckets_count) {
+        size_t buckets_count = index->buckets_count << 1;
+
+        struct grofs_mtime_record **buckets = (struct grofs_mtime_record **) calloc(buckets_count, sizeof(struct grofs_mtime_record *));
+
+        // keeps working with longer chains
+        if (NULL != buckets) {
+            size_t i;
+
+            for (i = 0; i < index->buckets_count; i++) {
+                struct grofs_mtime_record *moved = index->buckets[i];
+
+                while (NULL != moved) {
+                    struct grofs_mtime_record *next = moved->next;
+                    struct grofs_mtime_record **bucket = buckets + (grofs_oid_hash(&moved->oid) & (buckets_count - 1));
+
+                    moved->next = *bucket;
+                    *bucket = moved;
+
+                    moved = next;
+                }
+            }
+
+            free(index->buckets);
+
+            index->buckets = buckets;
+            index->buckets_count = buckets_count;
+        }
+    }
+
+    struct grofs_mtime_record **bucket = index->buckets + (grofs_oid_hash(&record->oid) & (index->buckets_count - 1));
+
+    record->next = *bucket;
+    *bucket = record;
+
+    index->count++;
+}
+
+// Caller holds the lock, a failed write only means the record is computed again after remount
+static void grofs_mtime_index_persist(struct grofs_mtime_index *index, const struct grofs_mtime_record *record) {
+    if (-1 == index->fd) {
+        return ;
+    }
+
+    size_t len = sizeof(struct grofs_mtime_disk_record) + sizeof(uint64_t) * record->count;
+
+    char *buff = (char *) malloc(len);
+
+    if (NULL == buff) {
+        return ;
+    }
+
+    struct grofs_mtime_disk_record *disk_record = (struct grofs_mtime_disk_record *) buff;
+
+    memset(disk_record, 0, sizeof(struct grofs_mtime_disk_record));
+
+    memcpy(disk_record->oid, record->oid.id, GIT_OID_RAWSZ);
+    memcpy(disk_record->parent_oid, record->parent_oid.id, GIT_OID_RAWSZ);
+
+    disk_record->time = record->time;
+    disk_record->count = record->count;
+    disk_record->check = grofs_mtime_record_check(record);
+
+    memcpy(buff + sizeof(struct grofs_mtime_disk_record), record->hashes, sizeof(uint64_t) * record->count);
+
+    // a mount loading the index meanwhile must not see the record half written, it would cut it off
+    int locked = flock(index->fd, LOCK_EX) == 0;
+
+    if (!locked || write(index->fd, buff, len) != (ssize_t) len) {
+        // a partial record would hide every later one
+        close(index->fd);
+
+        index->fd = -1;
+    } else {
+        flock(index->fd, LOCK_UN);
+    }
+
+    free(buff);
+}
+
+static int grofs_mtime_hashes_add(uint64_t **hashes, size_t *count, size_t *capacity, uint64_t hash) {
+    if (*count == *capacity) {
+        size_t new_capacity = 0 == *capacity ? 64 : *capacity << 1;
+
+        uint64_t *new_hashes = (uint64_t *) realloc(*hashes, sizeof(uint64_t) * new_capacity);
+
+        if (NULL == new_hashes) {
+            return ENOMEM;
+        }
+
+        *hashes = new_hashes;
+        *capacity = new_capacity;
+    }
+
+    (*hashes)[(*count)++] = hash;
+
+    return 0;
+}
+
+// Tree diff doesn't descend into subtrees whose oid didn't change, so cost follows size of the change
+static int grofs_mtime_record_build(const struct grofs_repository *repo, const git_oid *oid, struct grofs_mtime_record **record) {
+    git_commit *commit;
+
+    if (git_commit_lookup(&commit, repo->repo, oid) != 0) {
+        return ENOENT;
+    }
+
+    git_oid parent_oid;
+
+    memset(&parent_oid, 0, sizeof(git_oid));
+
+    uint64_t *hashes = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    int ret = 0;
+
+    // root commit added every path, so there's nothing to record
+    if (git_commit_parentcount(commit) > 0) {
+        git_oid_cpy(&parent_oid, git_commit_parent_id(commit, 0));
+
+        git_commit *parent = NULL;
+        git_tree *parent_tree = NULL;
+        git_tree *tree = NULL;
+        git_diff *diff = NULL;
+
+        if (
+            git_commit_parent(&parent, commit, 0) != 0
+            ||
+            git_commit_tree(&parent_tree, parent) != 0
+            ||
+            git_commit_tree(&tree, commit) != 0
+            ||
+            git_diff_tree_to_tree(&diff, repo->repo, parent_tree, tree, NULL) != 0
+        ) {
+            ret = EIO;
+        }
+
+        size_t deltas_count = 0 == ret ? git_diff_num_deltas(diff) : 0;
+
+        size_t i;
+
+        // root tree changed with any of its paths
+        if (deltas_count > 0) {
+            ret = grofs_mtime_hashes_add(&hashes, &count, &capacity, GROFS_FNV_OFFSET);
+        }
+
+        for (i = 0; i < deltas_count && 0 == ret; i++) {
+            const git_diff_delta *delta = git_diff_get_delta(diff, i);
+
+            const char *path = GIT_DELTA_DELETED == delta->status ? delta->old_file.path : delta->new_file.path;
+
+            uint64_t hash = GROFS_FNV_OFFSET;
+
+            const char *part = path;
+
+            // the path itself and each of its directories, hashes are computed incrementally as they share prefixes
+            while (0 == ret) {
+                size_t part_len = strcspn(part, "/");
+
+                hash = grofs_path_hash_update(hash, part, part_len);
+
+                ret = grofs_mtime_hashes_add(&hashes, &count, &capacity, hash);
+
+                if ('\0' == part[part_len]) {
+                    break;
+                }
+
+                hash = grofs_path_hash_update(hash, "/", 1);
+
+                part += part_len + 1;
+            }
+        }
+
+        git_diff_free(diff);
+        git_tree_free(tree);
+        git_tree_free(parent_tree);
+        git_commit_free(parent);
+    }
+
+    int64_t time = git_commit_time(commit);
+
+    git_commit_free(commit);
+
+    if (0 != ret) {
+        free(hashes);
+
+        return ret;
+    }
+
+    if (count > 0) {
+        qsort(hashes, count, sizeof(uint64_t), grofs_uint64_cmp);
+    }
+
+    size_t unique_count = 0;
+
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (0 == unique_count || hashes[unique_count - 1] != hashes[i]) {
+            hashes[unique_count++] = hashes[i];
+        }
+    }
+
+    struct grofs_mtime_record *new_record = (struct grofs_mtime_record *) malloc(sizeof(struct grofs_mtime_record) + sizeof(uint64_t) * unique_count);
+
+    if (NULL == new_record) {
+        free(hashes);
+
+        return ENOMEM;
+    }
+
+    git_oid_cpy(&new_record->oid, oid);
+    git_oid_cpy(&new_record->parent_oid, &parent_oid);
+
+    new_record->next = NULL;
+    new_record->time = time;
+    new_record->count = unique_count;
+
+    if (unique_count > 0) {
+        memcpy(new_record->hashes, hashes, sizeof(uint64_t) * unique_count);
+    }
+
+    free(hashes);
+
+    *record = new_record;
+
+    return 0;
+}
+
+// Records are freed only with the repository, so the returned one can be used without the lock
+static int grofs_mtime_record_get(const struct grofs_repository *repo, const git_oid *oid, const struct grofs_mtime_record **record) {
+    struct grofs_mtime_index *index = repo->mtime_index;
+
+    pthread_mutex_lock(&index->lock);
+
+    *record = grofs_mtime_index_find(index, oid);
+
+    pthread_mutex_unlock(&index->lock);
+
+    if (NULL != *record) {
+        return 0;
+    }
+
+    struct grofs_mtime_record *new_record;
+
+    // built without the lock, if another thread was faster its record is used
+    int ret = grofs_mtime_record_build(repo, oid, &new_record);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    atomic_fetch_add(&grofs_mtime_stats.built, 1);
+
+    pthread_mutex_lock(&index->lock);
+
+    *record = grofs_mtime_index_find(index, oid);
+
+    if (NULL == *record) {
+        grofs_mtime_index_insert(index, new_record);
+        grofs_mtime_index_persist(index, new_record);
+
+        *record = new_record;
+    } else {
+        free(new_record);
+    }
+
+    pthread_mutex_unlock(&index->lock);
+
+    return 0;
+}
+
+static int grofs_mtime_record_contains(const struct grofs_mtime_record *record, uint64_t hash) {
+    return NULL != bsearch(&hash, record->hashes, record->count, sizeof(uint64_t), grofs_uint64_cmp);
+}
+
+// Time of the last commit on first parent history which changed the path, looking at most --mtime-depth commits back
+static void grofs_mtime_node_init(struct grofs_node *node, const git_commit *commit, const struct grofs_path_spec *path_spec) {
+    if (NULL == node->repo->mtime_index) {
+        return ;
+    }
+
+    uint64_t hash = GROFS_FNV_OFFSET;
+
+    int level;
+
+    for (level = 3; level < path_spec->parts_count; level++) {
+        if (level > 3) {
+            hash = grofs_path_hash_update(hash, "/", 1);
+        }
+
+        hash = grofs_path_hash_update(hash, path_spec->parts[level], strlen(path_spec->parts[level]));
+    }
+
+    atomic_fetch_add(&grofs_mtime_stats.lookups, 1);
+
+    git_oid oid;
+
+    git_oid_cpy(&oid, git_commit_id(commit));
+
+    unsigned int depth;
+
+    for (depth = 0; depth < grofs_options.mtime_depth; depth++) {
+        const struct grofs_mtime_record *record;
+
+        // commit time stays when history can't be read
+        if (grofs_mtime_record_get(node->repo, &oid, &record) != 0) {
+            return ;
+        }
+
+        atomic_fetch_add(&grofs_mtime_stats.steps, 1);
+
+        node->time = record->time;
+
+        if (git_oid_iszero(&record->parent_oid) || grofs_mtime_record_contains(record, hash)) {
+            return ;
+        }
+
+        git_oid_cpy(&oid, &record->parent_oid);
+    }
+}
+
+static int grofs_resolve_node_for_path_spec_for_commit_children(struct grofs_node *node, const git_commit *commit, const struct grofs_path_spec *path_spec) {
+    node->time = git_commit_time(commit);
+
+    if (ID == path_spec->entry_type) {
+        node->type = DIR;
+
+        return 0;
+    }
+
+    git_tree *tree;
+
+    if (git_commit_tree(&tree, commit) != 0) {
+        return ENOENT;
+    }
+
+    if (TREE == path_spec->entry_type) {
+        node->type = DIR;
+
+        git_oid_cpy(&node->oid, git_tree_id(tree));
+
+        git_tree_free(tree);
+
+        grofs_mtime_node_init(node, commit, path_spec);
+
+        return 0;
+    }
+
+    // results depend on the tree only, it's what they're cached by
+    if (GREP == path_spec->entry_type || QUERY == path_spec->entry_type) {
+        node->type = GREP == path_spec->entry_type ? DIR : DATA;
+
+        git_oid_cpy(&node->oid, git_tree_id(tree));
+
+        git_tree_free(tree);
+
+        return 0;
+    }
+
+    if (PARENT == path_spec->entry_type) {
+        git_oid parent_oid;
+        if (grofs_git_commit_parent_lookup(node->repo, git_commit_id(commit), &parent_oid) != 0) {
+            return ENOENT;
+        }
+
+        git_oid_cpy(&node->oid, &parent_oid);
+
+        node->type = DATA;
+        node->size = GIT_OID_HEXSZ;
+
+        git_tree_free(tree);
+
+        return 0;
+    }
+
+    const git_tree_entry *tree_entry = NULL;
+
+    int level;
+
+    // walk one level at a time since the tree holding the entry is needed as well
+    for (level = 3; level < path_spec->parts_count; level++) {
+        tree_entry = git_tree_entry_byname(tree, path_spec->parts[level]);
+
+        if (NULL == tree_entry) {
+            git_tree_free(tree);
+
+            return ENOENT;
+        }
+
+        if (level == path_spec->parts_count - 1) {
+            break;
+        }
+
+        git_tree *sub_tree;
+
+        if (GIT_OBJ_TREE != git_tree_entry_type(tree_entry) || git_tree_lookup(&sub_tree, node->repo->repo, git_tree_entry_id(tree_entry)) != 0) {
+            git_tree_free(tree);
+
+            return ENOENT;
+        }
+
+        git_tree_free(tree);
+
+        tree = sub_tree;
+    }
+
+    git_oid_cpy(&node->parent_oid, git_tree_id(tree));
+    git_oid_cpy(&node->oid, git_tree_entry_id(tree_entry));
+
+    switch (git_tree_entry_type(tree_entry)) {
+        case GIT_OBJ_TREE:
+            node->type = DIR;
+
+            break;
+        case GIT_OBJ_BLOB:
+
+            node->type = DATA;
+
+            git_otype type;
+
+            if (grofs_object_header_lookup(node->repo, git_tree_entry_id(tree_entry), &type, &node->size) != 0) {
+                git_tree_free(tree);
+
+                return ENOENT;
+            }
+
+            break;
+        default:
+            GROFS_HALT_FMT("Unexpected %s (sha1 %s)", git_object_type2string(git_tree_entry_type(tree_entry)), git_oid_tostr_s(git_tree_entry_id(tree_entry)));
+    }
+
+    git_tree_free(tree);
+
+    grofs_mtime_node_init(node, commit, path_spec);
+
+    return 0;
+}
+
+static int grofs_resolve_node_for_path_spec_for_commit_type(struct grofs_node *node, const struct grofs_path_spec *path_spec) {
+    const char *id = path_spec_commit_name(path_spec);
+
+    git_commit *commit;
+
+    git_oid_fromstr(&node->oid, id);
+
+    if (!grofs_scope_contains(node->repo->scope, &node->oid, GIT_OBJ_COMMIT)) {
+        return ENOENT;
+    }
+
+    GROFS_PROBE1(commit_lookup_entry, &node->oid);
+
+    int ret = git_commit_lookup(&commit, node->repo->repo, &node->oid);
+
+    GROFS_PROBE2(commit_lookup_return, &node->oid, ret);
+
+    if (0 != ret) {
+        return ENOENT;
+    }
+
+    ret = grofs_resolve_node_for_path_spec_for_commit_children(node, commit, path_spec);
+
+    git_commit_free(commit);
+
+    return ret;
+}
+
+static int grofs_resolve_node_for_path_spec_for_blob_type(struct grofs_node *node, const struct grofs_path_spec *path_spec) {
+    if (ID != path_spec->entry_type) {
+        return ENOENT;
+    }
+
+    git_oid oid;
+    git_oid_fromstr(&oid, grofs_path_spec_blob_name(path_spec));
+
+    if (!grofs_scope_contains(node->repo->scope, &oid, GIT_OBJ_BLOB)) {
+        return ENOENT;
+    }
+
+    git_otype type;
+
+    if (grofs_object_header_lookup(node->repo, &oid, &type, &node->size) != 0 || GIT_OBJ_BLOB != type) {
+        return ENOENT;
+    }
+
+    // meta cache may know the blob from another repository
+    if (grofs_instance.repos_count > 1 && !git_odb_exists(node->repo->odb, &oid)) {
+        return ENOENT;
+    }
+
+    git_oid_cpy(&node->oid, &oid);
+
+    node->type = DATA;
+
+    return 0;
+}
+
+static int grofs_resolve_node_for_path_spec_for_control_type(struct grofs_node *node, const struct grofs_path_spec *path_spec) {
+    if (ID != path_spec->entry_type) {
+        return ENOENT;
+    }
+
+    node->control_file = grofs_control_file_lookup(path_spec->parts[1]);
+
+    if (NULL == node->control_file) {
+        return ENOENT;
+    }
+
+    // content is generated on open so size is not known upfront
+    node->type = DATA;
+
+    return 0;
+}
+
+static int grofs_resolve_node_for_path_spec_for_index_type(struct grofs_node *node, const struct grofs_path_spec *path_spec) {
+    const struct grofs_object_index *index = grofs_object_index_for(node->repo, path_spec->root_child_type);
+
+    // building scans the whole object database so stat leaves it to open and reports 0 until then
+    node->size = atomic_load(&index->built) ? index->len : 0;
+    node->type = DATA;
+
+    return 0;
+}
+
+static int grofs_resolve_node_for_path_spec_for_at_type(struct grofs_node *node, const struct grofs_path_spec *path_spec) {
+    node->type = DIR;
+
+    if (ID == path_spec->entry_type) {
+        return 0;
+    }
+
+    if (REF != path_spec->entry_type) {
+        return ENOENT;
+    }
+
+    char rev[GROFS_PATH_INLINE_LEN];
+
+    size_t rev_len = 0;
+
+    int i;
+
+    for (i = 2; i < path_spec->parts_count; i++) {
+        size_t part_len = strlen(path_spec->parts[i]);
+
+        if (rev_len + part_len + 1 >= sizeof(rev)) {
+            return ENAMETOOLONG;
+        }
+
+        if (rev_len > 0) {
+            rev[rev_len++] = '/';
+        }
+
+        memcpy(rev + rev_len, path_spec->parts[i], part_len);
+
+        rev_len += part_len;
+    }
+
+    rev[rev_len] = '\0';
+
+    git_oid tip_oid;
+
+    // ref which is also a prefix of others, like origin with origin/HEAD, is a link and others need full names
+    if (grofs_git_rev_commit_lookup(node->repo, rev, &tip_oid) != 0) {
+        return grofs_at_ref_prefix_exists(node->repo, rev) ? 0 : ENOENT;
+    }
+
+    int64_t time;
+
+    grofs_at_parse_time(path_spec->parts[1], &time);
+
+    int ret = grofs_at_resolve(node->repo, &tip_oid, time, &node->oid);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    if (!grofs_scope_contains(node->repo->scope, &node->oid, GIT_OBJ_COMMIT)) {
+        return ENOENT;
+    }
+
+    git_commit *commit;
+
+    if (git_commit_lookup(&commit, node->repo->repo, &node->oid) != 0) {
+        return ENOENT;
+    }
+
+    node->time = git_commit_time(commit);
+
+    git_commit_free(commit);
+
+    // target is ../ for each directory up to repository root followed by commits/<sha>
+    node->type = LINK;
+    node->link_depth = path_spec->parts_count - 1;
+    node->size = node->link_depth * strlen("../") + strlen(GROFS_STR_COMMITS "/") + GIT_OID_HEXSZ;
+
+    return 0;
+}
+
+static int grofs_resolve_node_for_path_spec(struct grofs_node *node, const struct grofs_path_spec *path_spec) {
+    int ret = ENOENT;
+
+    if (ROOT == path_spec->root_child_type || LIST == path_spec->entry_type) {
+        node->type = DIR;
+
+        return 0;
+    }
+
+    switch (path_spec->root_child_type) {
+        case COMMIT:
+            ret = grofs_resolve_node_for_path_spec_for_commit_type(node, path_spec);
+
+            break;
+        case BLOB:
+            ret = grofs_resolve_node_for_path_spec_for_blob_type(node, path_spec);
+
+            break;
+        case CONTROL:
+            ret = grofs_resolve_node_for_path_spec_for_control_type(node, path_spec);
+
+            break;
+        case COMMIT_INDEX:
+        case BLOB_INDEX:
+            ret = grofs_resolve_node_for_path_spec_for_index_type(node, path_spec);
+
+            break;
+        case AT:
+            ret = grofs_resolve_node_for_path_spec_for_at_type(node, path_spec);
+
+            break;
+        default:
+            GROFS_HALT_FMT("Unexpected %s for path %s", grofs_root_child_type_to_str(path_spec->root_child_type), grofs_path_spec_full_path(path_spec));
+    }
+
+    return ret;
+}
+
+// Strips /<name> from the path when repositories are named, .grofs and mount root belong to none of them
+static int grofs_repository_lookup_for_path(const struct grofs *grofs, const char **path, const struct grofs_repository **repo) {
+    if (NULL == grofs->repos[0].name) {
+        *repo = grofs->repos;
+
+        return 0;
+    }
+
+    *repo = NULL;
+
+    if ('/' != **path || '\0' == (*path)[1]) {
+        return 0;
+    }
+
+    const char *name = *path + 1;
+    const char *name_end = name + strcspn(name, "/");
+
+    size_t name_len = name_end - name;
+
+    if (strlen(GROFS_STR_CONTROL) == name_len && strncmp(GROFS_STR_CONTROL, name, name_len) == 0) {
+        return 0;
+    }
+
+    size_t i;
+
+    for (i = 0; i < grofs->repos_count; i++) {
+        if (strncmp(grofs->repos[i].name, name, name_len) == 0 && '\0' == grofs->repos[i].name[name_len]) {
+            *repo = grofs->repos + i;
+            *path = '\0' == *name_end ? "/" : name_end;
+
+            return 0;
+        }
+    }
+
+    return ENOENT;
+}
+
+static int grofs_node_init_from_path(const struct grofs *grofs, struct grofs_node *node, const char *path) {
+    struct grofs_path_storage path_storage;
+    struct grofs_path_spec path_spec;
+
+    const char *sub_path = path;
+
+    int ret = grofs_repository_lookup_for_path(grofs, &sub_path, &node->repo);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    GROFS_PROBE1(parse_path_entry, path);
+
+    ret = grofs_parse_path(&path_spec, &path_storage, sub_path);
+
+    GROFS_PROBE2(parse_path_return, path, ret);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    // .grofs is only at mount root and not inside named repositories
+    if (NULL != node->repo && NULL != node->repo->name && CONTROL == path_spec.root_child_type) {
+        grofs_free_path_spec(&path_spec);
+
+        return ENOENT;
+    }
+
+    node->root_child_type = path_spec.root_child_type;
+    node->entry_type = path_spec.entry_type;
+    node->size = 0;
+    node->time = grofs_started_time;
+    node->control_file = NULL;
+    node->link_depth = 0;
+    node->query = QUERY == path_spec.entry_type ? strrchr(sub_path, '/') + 1 : NULL;
+
+    GROFS_PROBE3(resolve_entry, path, node->root_child_type, node->entry_type);
+
+    ret = grofs_resolve_node_for_path_spec(node, &path_spec);
+
+    GROFS_PROBE3(resolve_return, path, ret, &node->oid);
+
+    grofs_free_path_spec(&path_spec);
+
+    return ret;
+}
+
+// Returns negative because of https://github.com/libgit2/libgit2/issues/4946
+static int grofs_readdir_git_collect_object_cb(const git_oid *id, void *payload) {
+    struct grofs_readdir_context *context = (struct grofs_readdir_context *) payload;
+
+    size_t size;
+    git_otype type;
+
+    // header gives the type without inflating the object
+    if (git_odb_read_header(&size, &type, context->repo->odb, id) != 0 || type != context->wanted_type) {
+        return 0;
+    }
+
+    return grofs_list_block_add_oid(context->block, id) ? GIT_EUSER : 0;
+}
+
+static int grofs_dir_iter_root(const struct grofs_dir *dir, grofs_list_cb cb, void *payload) {
+    int ret;
+
+    if (NULL == dir->repo) {
+        size_t i;
+
+        for (i = 0; i < dir->grofs->repos_count; i++) {
+            ret = cb(dir->grofs->repos[i].name, payload);
+
+            if (ret) {
+                return ret;
+            }
+        }
+
+        return cb(GROFS_STR_CONTROL, payload);
+    }
+
+    ret = cb(GROFS_STR_COMMITS, payload);
+
+    if (ret) {
+        return ret;
+    }
+
+    ret = cb(GROFS_STR_BLOBS, payload);
+
+    if (0 == ret) {
+        ret = cb(GROFS_STR_AT, payload);
+    }
+
+    if (0 == ret) {
+        ret = cb(GROFS_STR_COMMITS_INDEX, payload);
+    }
+
+    if (0 == ret) {
+        ret = cb(GROFS_STR_BLOBS_INDEX, payload);
+    }
+
+    if (ret || NULL != dir->repo->name) {
+        return ret;
+    }
+
+    return cb(GROFS_STR_CONTROL, payload);
+}
+
+static int grofs_dir_iter_commit_id(const struct grofs_dir *dir, grofs_list_cb cb, void *payload) {
+    int ret = cb(GROFS_STR_TREE, payload);
+
+    if (0 == ret && grofs_git_commit_has_parent(dir->repo, &dir->oid)) {
+        ret = cb(GROFS_STR_PARENT, payload);
+    }
+
+    if (0 == ret) {
+        ret = cb(GROFS_STR_GREP, payload);
+    }
+
+    return ret;
+}
+
+static int grofs_dir_iter_objects(const struct grofs_dir *dir, grofs_list_cb cb, void *payload, git_otype wanted_type) {
+    struct grofs_list_split_context context = {
+        .cb = cb,
+        .payload = payload
+    };
+
+    struct grofs_list_block block = {
+        .data = (char *) malloc(GROFS_LIST_BLOCK_LEN),
+        .len = 0,
+        .count = 0,
+        .cb = grofs_list_split_cb,
+        .payload = &context,
+        .ret = 0
+    };
+
+    if (NULL == block.data) {
+        return ENOMEM;
+    }
+
+    grofs_dir_iter_objects_blocks(dir, &block, wanted_type);
+
+    int ret = grofs_list_block_flush(&block);
+
+    free(block.data);
+
+    return ret;
+}
+
+static int grofs_dir_iter_commit_list(const struct grofs_dir *dir, grofs_list_cb cb, void *payload) {
+    return grofs_dir_iter_objects(dir, cb, payload, GIT_OBJ_COMMIT);
+}
+
+static int grofs_dir_iter_objects_blocks(const struct grofs_dir *dir, struct grofs_list_block *block, git_otype wanted_type) {
+    if (NULL != dir->repo->scope) {
+        return grofs_scope_list_objects(dir->repo->scope, wanted_type, block);
+    }
+
+    struct grofs_readdir_context context = {
+        .repo = dir->repo,
+        .block = block,
+        .wanted_type = wanted_type
+    };
+
+    grofs_sched_enter(GROFS_SCHED_LISTING);
+
+    git_odb_foreach(dir->repo->odb, grofs_readdir_git_collect_object_cb, &context);
+
+    grofs_sched_leave(GROFS_SCHED_LISTING);
+
+    return block->ret;
+}
+
+static int grofs_dir_iter_commit_list_blocks(const struct grofs_dir *dir, struct grofs_list_block *block) {
+    return grofs_dir_iter_objects_blocks(dir, block, GIT_OBJ_COMMIT);
+}
+
+static int grofs_dir_iter_for_blob_list(const struct grofs_dir *dir, grofs_list_cb cb, void *payload) {
+    return grofs_dir_iter_objects(dir, cb, payload, GIT_OBJ_BLOB);
+}
+
+static int grofs_dir_iter_for_blob_list_blocks(const struct grofs_dir *dir, struct grofs_list_block *block) {
+    return grofs_dir_iter_objects_blocks(dir, block, GIT_OBJ_BLOB);
+}
+
+static int grofs_dir_iter_for_blob_list_tree(const git_tree *tree, grofs_list_cb cb, void *payload) {
+    size_t count = git_tree_entrycount(tree);
+
+    size_t i = 0;
+
+    for (i = 0; i < count; i++) {
+        const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+
+        if (NULL == entry) {
+            return 0;
+        }
+
+        git_otype entry_type = git_tree_entry_type(entry);
+
+        if (GIT_OBJ_BLOB != entry_type && GIT_OBJ_TREE != entry_type) {
+            continue ;
+        }
+
+        int ret = cb(git_tree_entry_name(entry), payload);
+
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static int grofs_dir_iter_control(const struct grofs_dir *dir, grofs_list_cb cb, void *payload) {
+    (void) dir;
+
+    const struct grofs_control_file *control_file;
+
+    for (control_file = grofs_control_files; NULL != control_file->name; control_file++) {
+        int ret = cb(control_file->name, payload);
+
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+// Times and refs under at/ are only resolved by name, there are too many of them to list
+static int grofs_dir_iter_empty(const struct grofs_dir *dir, grofs_list_cb cb, void *payload) {
+    (void) dir;
+    (void) cb;
+    (void) payload;
+
+    return 0;
+}
+
+static int grofs_dir_iter_for_blob_list_tree_oid(const struct grofs_dir *dir, grofs_list_cb cb, void *payload) {
+    git_tree *tree;
+    if (git_tree_lookup(&tree, dir->repo->repo, &dir->oid) != 0) {
+        return 0;
+    }
+
+    int ret = grofs_dir_iter_for_blob_list_tree(tree, cb, payload);
+
+    git_tree_free(tree);
+
+    return ret;
+}
+
+static int grofs_dir_init_from_node(const struct grofs *grofs, struct grofs_dir *dir, const struct grofs_node *node) {
+    dir->grofs = grofs;
+    dir->repo = node->repo;
+    dir->iter_blocks = NULL;
+
+    if (ROOT == node->root_child_type) {
+        dir->iter = grofs_dir_iter_root;
+
+        return 0;
+    } else if (COMMIT == node->root_child_type && LIST == node->entry_type) {
+        dir->iter = grofs_dir_iter_commit_list;
+        dir->iter_blocks = grofs_dir_iter_commit_list_blocks;
+
+        return 0;
+    } else if (BLOB == node->root_child_type && LIST == node->entry_type) {
+        dir->iter = grofs_dir_iter_for_blob_list;
+        dir->iter_blocks = grofs_dir_iter_for_blob_list_blocks;
+
+        return 0;
+    } else if (CONTROL == node->root_child_type && LIST == node->entry_type) {
+        dir->iter = grofs_dir_iter_control;
+
+        return 0;
+    } else if ((AT == node->root_child_type && DIR == node->type) || (COMMIT == node->root_child_type && GREP == node->entry_type)) {
+        dir->iter = grofs_dir_iter_empty;
+
+        return 0;
+    } else if (COMMIT == node->root_child_type && ID == node->entry_type) {
+        git_oid_cpy(&dir->oid, &node->oid);
+
+        dir->iter = grofs_dir_iter_commit_id;
+
+        return 0;
+    } else if (
+        PATH_IN_GIT == node->entry_type
+        ||
+        (COMMIT == node->root_child_type && TREE == node->entry_type)
+    ) {
+        git_oid_cpy(&dir->oid, &node->oid);
+
+        dir->iter = grofs_dir_iter_for_blob_list_tree_oid;
+
+        return 0;
+    }
+
+    return ENOENT;
+}
+
+static struct grofs_file *grofs_file_nandle_new(size_t buff_len) {
+    void *buff = malloc(sizeof(struct grofs_file) + sizeof(char) * buff_len);
+
+    if (NULL == buff) {
+        return NULL;
+    }
+
+    struct grofs_file *file_handle = (struct grofs_file *) buff;
+
+    file_handle->buff = buff + sizeof(struct grofs_file);
+    file_handle->len = buff_len;
+    file_handle->blob_entry = NULL;
+    file_handle->grep_entry = NULL;
+    file_handle->chunk_list = NULL;
+    file_handle->repo = NULL;
+
+    atomic_init(&file_handle->chunk_source, NULL);
+
+    file_handle->spill_fd = -1;
+    file_handle->generated = 0;
+
+    return file_handle;
+}
+
+static struct grofs_file *grofs_file_handle_new_for_blob(struct grofs_blob_entry *blob_entry) {
+    struct grofs_file *file_handle = (struct grofs_file *) malloc(sizeof(struct grofs_file));
+
+    if (NULL == file_handle) {
+        return NULL;
+    }
+
+    // content is shared with the cache and is never written to
+    file_handle->buff = (char *) blob_entry->data;
+    file_handle->len = blob_entry->len;
+    file_handle->blob_entry = blob_entry;
+    file_handle->grep_entry = NULL;
+    file_handle->chunk_list = NULL;
+    file_handle->repo = NULL;
+
+    atomic_init(&file_handle->chunk_source, NULL);
+
+    file_handle->spill_fd = -1;
+    file_handle->generated = 0;
+
+    return file_handle;
+}
+
+static struct grofs_file *grofs_file_handle_new_for_index(const struct grofs_object_index *index) {
+    struct grofs_file *file_handle = (struct grofs_file *) malloc(sizeof(struct grofs_file));
+
+    if (NULL == file_handle) {
+        return NULL;
+    }
+
+    // index lives until unmount and is never written to once built
+    file_handle->buff = index->data;
+    file_handle->len = index->len;
+    file_handle->blob_entry = NULL;
+    file_handle->grep_entry = NULL;
+    file_handle->chunk_list = NULL;
+    file_handle->repo = NULL;
+
+    atomic_init(&file_handle->chunk_source, NULL);
+
+    file_handle->spill_fd = -1;
+    file_handle->generated = 1; // size may have been reported as 0 before the index was built
+
+    return file_handle;
+}
+
+static struct grofs_file *grofs_file_handle_new_for_grep(struct grofs_grep_entry *grep_entry) {
+    struct grofs_file *file_handle = (struct grofs_file *) malloc(sizeof(struct grofs_file));
+
+    if (NULL == file_handle) {
+        return NULL;
+    }
+
+    file_handle->buff = grep_entry->data;
+    file_handle->len = grep_entry->len;
+    file_handle->blob_entry = NULL;
+    file_handle->grep_entry = grep_entry;
+    file_handle->chunk_list = NULL;
+    file_handle->repo = NULL;
+
+    atomic_init(&file_handle->chunk_source, NULL);
+
+    file_handle->spill_fd = -1;
+
+    // size reported by grofs_stat() is 0 so reads must not be limited by it
+    file_handle->generated = 1;
+
+    return file_handle;
+}
+
+static struct grofs_file *grofs_file_handle_new_for_chunks(const struct grofs_repository *repo, struct grofs_chunk_list_entry *chunk_list) {
+    struct grofs_file *file_handle = (struct grofs_file *) malloc(sizeof(struct grofs_file));
+
+    if (NULL == file_handle) {
+        return NULL;
+    }
+
+    file_handle->buff = NULL;
+    file_handle->len = chunk_list->len;
+    file_handle->blob_entry = NULL;
+    file_handle->grep_entry = NULL;
+    file_handle->chunk_list = chunk_list;
+    file_handle->repo = repo;
+
+    atomic_init(&file_handle->chunk_source, NULL);
+
+    file_handle->spill_fd = -1;
+    file_handle->generated = 0;
+
+    return file_handle;
+}
+
+static void grofs_file_handle_free(struct grofs_file *file_handle) {
+    if (NULL != file_handle->blob_entry) {
+        grofs_cache_release(&grofs_blob_cache, &file_handle->blob_entry->entry);
+    }
+
+    if (NULL != file_handle->grep_entry) {
+        grofs_cache_release(&grofs_grep_cache, &file_handle->grep_entry->entry);
+    }
+
+    if (NULL != file_handle->chunk_list) {
+        grofs_cache_release(&grofs_chunk_list_cache, &file_handle->chunk_list->entry);
+    }
+
+    struct grofs_blob_entry *chunk_source = atomic_load(&file_handle->chunk_source);
+
+    // never cached so this frees it
+    if (NULL != chunk_source) {
+        grofs_cache_release(&grofs_blob_cache, &chunk_source->entry);
+    }
+
+    if (-1 != file_handle->spill_fd) {
+        close(file_handle->spill_fd);
+    }
+
+    free(file_handle);
+}
+
+static int grofs_open_node_commit_parent(const git_oid *oid, struct grofs_file **file) {
+    struct grofs_file *file_handle = grofs_file_nandle_new(GIT_OID_HEXSZ);
+
+    if (NULL == file_handle) {
+        return ENOMEM;
+    }
+
+    git_oid_nfmt(file_handle->buff, GIT_OID_HEXSZ, oid);
+
+    *file = file_handle;
+
+    return 0;
+}
+
+static int grofs_open_node_blob(const struct grofs_repository *repo, const git_oid *oid, struct grofs_file **file) {
+    struct grofs_blob_entry *blob_entry;
+
+    GROFS_PROBE1(open_blob_entry, oid);
+
+    int ret = grofs_spill_open(repo, oid, file);
+
+    if (0 == ret) {
+        GROFS_PROBE3(open_blob_return, oid, 0, (*file)->len);
+
+        return 0;
+    }
+
+    if (grofs_chunk_wanted(repo, oid)) {
+        struct grofs_chunk_list_entry *chunk_list;
+
+        ret = grofs_chunks_load(repo, oid, &chunk_list);
+
+        if (0 == ret) {
+            *file = grofs_file_handle_new_for_chunks(repo, chunk_list);
+
+            if (NULL == *file) {
+                grofs_cache_release(&grofs_chunk_list_cache, &chunk_list->entry);
+
+                ret = ENOMEM;
+            }
+        }
+
+        GROFS_PROBE3(open_blob_return, oid, ret, 0 == ret ? (*file)->len : 0);
+
+        return ret;
+    }
+
+    ret = grofs_blob_load(repo, oid, &blob_entry);
+
+    if (0 != ret) {
+        GROFS_PROBE3(open_blob_return, oid, ret, 0);
+
+        return ret;
+    }
+
+    grofs_prefetch_mark_opened(blob_entry);
+
+    struct grofs_file *file_handle = grofs_file_handle_new_for_blob(blob_entry);
+
+    if (NULL == file_handle) {
+        grofs_cache_release(&grofs_blob_cache, &blob_entry->entry);
+
+        GROFS_PROBE3(open_blob_return, oid, ENOMEM, 0);
+
+        return ENOMEM;
+    }
+
+    *file = file_handle;
+
+    GROFS_PROBE3(open_blob_return, oid, 0, blob_entry->len);
+
+    return 0;
+}
+
+static int grofs_open_node_control(const struct grofs_node *node, struct grofs_file **file) {
+    char *data = NULL;
+    size_t len = 0;
+
+    FILE *out = open_memstream(&data, &len);
+
+    if (NULL == out) {
+        return ENOMEM;
+    }
+
+    node->control_file->write(out);
+
+    if (fclose(out) != 0) {
+        free(data);
+
+        return ENOMEM;
+    }
+
+    struct grofs_file *file_handle = grofs_file_nandle_new(len);
+
+    if (NULL == file_handle) {
+        free(data);
+
+        return ENOMEM;
+    }
+
+    memcpy(file_handle->buff, data, len);
+
+    free(data);
+
+    // size reported by grofs_stat() is 0 so reads must not be limited by it
+    file_handle->generated = 1;
+
+    *file = file_handle;
+
+    return 0;
+}
+
+static int grofs_open_node_index(const struct grofs_node *node, struct grofs_file **file) {
+    const struct grofs_object_index *index;
+
+    int ret = grofs_object_index_get(node->repo, node->root_child_type, &index);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    struct grofs_file *file_handle = grofs_file_handle_new_for_index(index);
+
+    if (NULL == file_handle) {
+        return ENOMEM;
+    }
+
+    *file = file_handle;
+
+    return 0;
+}
+
+static int grofs_open_node_grep(const struct grofs_node *node, struct grofs_file **file) {
+    struct grofs_grep_entry *grep_entry;
+
+    int ret = grofs_grep(node->repo, &node->oid, node->query, &grep_entry);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    struct grofs_file *file_handle = grofs_file_handle_new_for_grep(grep_entry);
+
+    if (NULL == file_handle) {
+        grofs_cache_release(&grofs_grep_cache, &grep_entry->entry);
+
+        return ENOMEM;
+    }
+
+    *file = file_handle;
+
+    return 0;
+}
+
+static int grofs_open_node(const struct grofs_node *node, struct grofs_file **file) {
+    if (COMMIT == node->root_child_type && PARENT == node->entry_type) {
+        return grofs_open_node_commit_parent(&node->oid, file);
+    } else if (PATH_IN_GIT == node->entry_type) {
+        int ret = grofs_open_node_blob(node->repo, &node->oid, file);
+
+        if (0 == ret) {
+            grofs_prefetch_note_open(node->repo, &node->parent_oid);
+        }
+
+        return ret;
+    } else if (BLOB == node->root_child_type && ID == node->entry_type) {
+        return grofs_open_node_blob(node->repo, &node->oid, file);
+    } else if (CONTROL == node->root_child_type && ID == node->entry_type) {
+        return grofs_open_node_control(node, file);
+    } else if ((COMMIT_INDEX == node->root_child_type || BLOB_INDEX == node->root_child_type) && ID == node->entry_type) {
+        return grofs_open_node_index(node, file);
+    } else if (COMMIT == node->root_child_type && QUERY == node->entry_type) {
+        return grofs_open_node_grep(node, file);
+    }
+
+    return ENOENT;
+}
+
+static int grofs_str_list_add_all(struct grofs_str_list *list, char * const *items, size_t count) {
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        int ret = grofs_str_list_add(list, items[i]);
+
+        if (0 != ret) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static int grofs_repository_name_is_valid(const struct grofs_repo_spec *repos, size_t index) {
+    const char *name = repos[index].name;
+
+    if (NULL == name || '\0' == *name || NULL != strchr(name, '/')) {
+        return 0;
+    }
+
+    if (strcmp(".", name) == 0 || strcmp("..", name) == 0 || strcmp(GROFS_STR_CONTROL, name) == 0) {
+        return 0;
+    }
+
+    size_t i;
+
+    for (i = 0; i < index; i++) {
+        if (strcmp(repos[i].name, name) == 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int grofs_repository_open(struct grofs_repository *repo, const struct grofs_repo_spec *spec) {
+    if (grofs_object_indexes_init(repo) != 0) {
+        return ENOMEM;
+    }
+
+    if (NULL != spec->name) {
+        repo->name = strdup(spec->name);
+
+        if (NULL == repo->name) {
+            return ENOMEM;
+        }
+    }
+
+    if (0 != git_repository_open(&repo->repo, spec->path)) {
+        fprintf(stderr, "Failed to find Git repository at path: %s\n", spec->path);
+
+        return ENOENT;
+    }
+
+    if (grofs_scope_revs.count > 0 && grofs_scope_build(repo) != 0) {
+        return EINVAL;
+    }
+
+    if (git_repository_odb(&repo->odb, repo->repo) != 0) {
+        fprintf(stderr, "Failed to open object database of Git repository at path: %s\n", spec->path);
+
+        return EIO;
+    }
+
+    if (grofs_pack_order_init(repo) != 0) {
+        return ENOMEM;
+    }
+
+    if (grofs_options.mtime_depth > 0) {
+        return grofs_mtime_index_open(repo);
+    }
+
+    return 0;
+}
+
+static void grofs_repository_close(struct grofs_repository *repo) {
+    grofs_object_indexes_free(repo);
+    grofs_pack_order_free(repo);
+
+    if (NULL != repo->mtime_index) {
+        grofs_mtime_index_free(repo->mtime_index);
+
+        repo->mtime_index = NULL;
+    }
+
+    if (NULL != repo->odb) {
+        git_odb_free(repo->odb);
+
+        repo->odb = NULL;
+    }
+
+    if (NULL != repo->scope) {
+        grofs_scope_free(repo->scope);
+
+        repo->scope = NULL;
+    }
+
+    if (NULL != repo->repo) {
+        git_repository_free(repo->repo);
+
+        repo->repo = NULL;
+    }
+
+    free(repo->name);
+
+    repo->name = NULL;
+}
+
+static int grofs_load_repositories(struct grofs *grofs, const struct grofs_repo_spec *repos, size_t repos_count, const struct grofs_options *options) {
+    if (0 == options->bg_threads || 0 == repos_count) {
+        return EINVAL;
+    }
+
+    size_t i;
+
+    // a single repository may be served at mount root, otherwise each one needs its own directory
+    if (!(1 == repos_count && NULL == repos[0].name)) {
+        for (i = 0; i < repos_count; i++) {
+            if (!grofs_repository_name_is_valid(repos, i)) {
+                fprintf(stderr, "Invalid or duplicate repository name: %s\n", NULL == repos[i].name ? "" : repos[i].name);
+
+                return EINVAL;
+            }
+        }
+    }
+
+    grofs_options = *options;
+
+    grofs_sched_gates[GROFS_SCHED_BULK_READ].limit = grofs_options.bulk_threads;
+
+    if (NULL != options->spill_dir) {
+        if (access(options->spill_dir, W_OK | X_OK) != 0) {
+            fprintf(stderr, "Spill directory is not writable: %s\n", options->spill_dir);
+
+            return EINVAL;
+        }
+
+        grofs_spill_dir = strdup(options->spill_dir);
+
+        if (NULL == grofs_spill_dir) {
+            return ENOMEM;
+        }
+    }
+
+    if (NULL != options->mtime_index_dir) {
+        if (access(options->mtime_index_dir, W_OK | X_OK) != 0) {
+            fprintf(stderr, "Mtime index directory is not writable: %s\n", options->mtime_index_dir);
+
+            return EINVAL;
+        }
+
+        grofs_mtime_index_dir = strdup(options->mtime_index_dir);
+
+        if (NULL == grofs_mtime_index_dir) {
+            return ENOMEM;
+        }
+    }
+
+    // option strings belong to the caller
+    grofs_options.spill_dir = grofs_spill_dir;
+    grofs_options.mtime_index_dir = grofs_mtime_index_dir;
+    grofs_sched_gates[GROFS_SCHED_LISTING].limit = grofs_options.listing_slots;
+
+    if (
+        grofs_str_list_add_all(&grofs_scope_revs, options->scope_revs, options->scope_revs_count) != 0
+        ||
+        grofs_str_list_add_all(&grofs_preload_revs, options->preload_revs, options->preload_revs_count) != 0
+        ||
+        grofs_str_list_add_all(&grofs_preload_paths, options->preload_paths, options->preload_paths_count) != 0
+    ) {
+        return EINVAL;
+    }
+
+    grofs->repos = (struct grofs_repository *) calloc(repos_count, sizeof(struct grofs_repository));
+
+    if (NULL == grofs->repos) {
+        return ENOMEM;
+    }
+
+    grofs->repos_count = repos_count;
+
+    for (i = 0; i < repos_count; i++) {
+        int ret = grofs_repository_open(grofs->repos + i, repos + i);
+
+        if (0 != ret) {
+            return ret;
+        }
+    }
+
+    if (
+        grofs_cache_init(&grofs_meta_cache, "meta", (size_t) grofs_options.meta_cache_mb * GROFS_MB, grofs_meta_entry_free) != 0
+        ||
+        grofs_cache_init(&grofs_blob_cache, "blob", (size_t) grofs_options.blob_cache_mb * GROFS_MB, grofs_blob_entry_free) != 0
+        ||
+        grofs_cache_init(&grofs_zblob_cache, "blob_lz4", (size_t) grofs_options.compressed_cache_mb * GROFS_MB, grofs_zblob_entry_free) != 0
+        ||
+        grofs_cache_init(&grofs_grep_cache, "grep", (size_t) grofs_options.grep_cache_mb * GROFS_MB, grofs_grep_entry_free) != 0
+        ||
+        // lists are small next to chunks they point to, so they get as much memory as blob sizes do
+        grofs_cache_init(&grofs_chunk_list_cache, "chunk_list", grofs_options.chunk_min_kb > 0 ? (size_t) grofs_options.meta_cache_mb * GROFS_MB : 0, grofs_chunk_list_entry_free) != 0
+    ) {
+        fprintf(stderr, "Failed to allocate caches\n");
+
+        return ENOMEM;
+    }
+
+#ifndef GROFS_HAVE_LZ4
+    // built without LZ4, compressed cache stays empty and is not reported
+    grofs_zblob_cache.budget = 0;
+#endif
+
+    if (grofs_zblob_cache.budget > 0) {
+        grofs_blob_cache.evict_entry = grofs_zblob_demote;
+    }
+
+    git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, GIT_OBJ_TREE, (size_t) GROFS_TREE_CACHE_OBJECT_LIMIT);
+
+    return 0;
+}
+
+void grofs_options_init(struct grofs_options *options) {
+    memset(options, 0, sizeof(struct grofs_options));
+
+    options->bg_threads = GROFS_DEFAULT_BG_THREADS;
+    options->blob_cache_mb = GROFS_DEFAULT_BLOB_CACHE_MB;
+    options->compressed_cache_mb = GROFS_DEFAULT_COMPRESSED_CACHE_MB;
+    options->meta_cache_mb = GROFS_DEFAULT_META_CACHE_MB;
+    options->prefetch_threads = GROFS_DEFAULT_PREFETCH_THREADS;
+    options->prefetch_budget_mb = GROFS_DEFAULT_PREFETCH_BUDGET_MB;
+    options->bulk_threads = GROFS_DEFAULT_BULK_THREADS;
+    options->bulk_min_kb = GROFS_DEFAULT_BULK_MIN_KB;
+    options->listing_slots = GROFS_DEFAULT_LISTING_SLOTS;
+    options->spill_min_kb = GROFS_DEFAULT_SPILL_MIN_KB;
+    options->mtime_depth = GROFS_DEFAULT_MTIME_DEPTH;
+    options->memory_pressure_pct = GROFS_DEFAULT_MEMORY_PRESSURE_PCT;
+    options->grep_threads = GROFS_DEFAULT_GREP_THREADS;
+    options->grep_cache_mb = GROFS_DEFAULT_GREP_CACHE_MB;
+}
+
+int grofs_open_repositories(struct grofs **grofs, const struct grofs_repo_spec *repos, size_t repos_count, const struct grofs_options *options) {
+    int expected = 0;
+
+    // caches and pools are globals shared by all repositories so there is a single instance
+    if (!atomic_compare_exchange_strong(&grofs_instance_opened, &expected, 1)) {
+        return EBUSY;
+    }
+
+    git_libgit2_init();
+
+    grofs_started_time = time(NULL);
+
+    int ret = grofs_load_repositories(&grofs_instance, repos, repos_count, options);
+
+    if (0 != ret) {
+        grofs_close(&grofs_instance);
+
+        return ret;
+    }
+
+    *grofs = &grofs_instance;
+
+    return 0;
+}
+
+int grofs_start(struct grofs *grofs) {
+    int ret = grofs_pool_start(&grofs_bg_pool, grofs_options.bg_threads, 0);
+
+    if (0 == ret) {
+        grofs_preload_start(grofs);
+    }
+
+    atomic_store(&grofs_prefetch_stats.backoff_ms, GROFS_PREFETCH_MIN_BACKOFF_MS);
+
+    // prefetching is only an optimization so it's fine to run without it
+    if (grofs_options.prefetch_threads > 0 && grofs_pool_start(&grofs_prefetch_pool, grofs_options.prefetch_threads, GROFS_PREFETCH_NICE) != 0) {
+        fprintf(stderr, "Failed to start prefetch threads\n");
+    }
+
+    // without bulk threads large blobs are inflated on the thread opening them
+    if (grofs_options.bulk_threads > 0 && grofs_pool_start(&grofs_bulk_pool, grofs_options.bulk_threads, GROFS_BULK_NICE) != 0) {
+        fprintf(stderr, "Failed to start bulk threads\n");
+    }
+
+    // without grep threads a search runs on the thread opening its results only
+    if (grofs_options.grep_threads > 0 && grofs_pool_start(&grofs_grep_pool, grofs_options.grep_threads, 0) != 0) {
+        fprintf(stderr, "Failed to start grep threads\n");
+    }
+
+    if (!grofs_options.no_memory_governor && grofs_memory_governor_start(&grofs_memory_governor) != 0) {
+        fprintf(stderr, "Memory pressure is not available, caches won't shrink under pressure\n");
+    }
+
+    grofs->started = 1;
+
+    return ret;
+}
+
+void grofs_stop(struct grofs *grofs) {
+    grofs_memory_governor_stop(&grofs_memory_governor);
+    grofs_pool_stop(&grofs_grep_pool);
+    grofs_pool_stop(&grofs_prefetch_pool);
+    grofs_pool_stop(&grofs_bg_pool);
+    // last, jobs of the other pools may be waiting for bulk reads
+    grofs_pool_stop(&grofs_bulk_pool);
+
+    grofs->started = 0;
+}
+
+int grofs_open_repos(struct grofs **grofs, const struct grofs_repo_spec *repos, size_t repos_count, const struct grofs_options *options) {
+    int ret = grofs_open_repositories(grofs, repos, repos_count, options);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    ret = grofs_start(*grofs);
+
+    if (0 != ret) {
+        grofs_close(*grofs);
+    }
+
+    return ret;
+}
+
+int grofs_open(struct grofs **grofs, const char *repo_path, const struct grofs_options *options) {
+    struct grofs_repo_spec repo = {
+        .name = NULL,
+        .path = repo_path
+    };
+
+    return grofs_open_repos(grofs, &repo, 1, options);
+}
+
+void grofs_close(struct grofs *grofs) {
+    grofs_stop(grofs);
+
+    grofs_cache_destroy(&grofs_blob_cache);
+    grofs_cache_destroy(&grofs_zblob_cache);
+    grofs_cache_destroy(&grofs_grep_cache);
+    grofs_cache_destroy(&grofs_chunk_list_cache);
+    grofs_cache_destroy(&grofs_meta_cache);
+
+    grofs_str_list_free(&grofs_preload_revs);
+    grofs_str_list_free(&grofs_preload_paths);
+
+    free(grofs_spill_dir);
+    free(grofs_mtime_index_dir);
+
+    grofs_spill_dir = NULL;
+    grofs_mtime_index_dir = NULL;
+
+    grofs_at_chains_free();
+
+    size_t i;
+
+    for (i = 0; i < grofs->repos_count; i++) {
+        grofs_repository_close(grofs->repos + i);
+    }
+
+    free(grofs->repos);
+
+    grofs->repos = NULL;
+    grofs->repos_count = 0;
+
+    grofs_str_list_free(&grofs_scope_revs);
+
+    git_libgit2_shutdown();
+
+    atomic_store(&grofs_instance_opened, 0);
+}
+
+int grofs_stat(struct grofs *grofs, const char *path, struct grofs_attr *attr) {
+    struct grofs_node node;
+
+    int ret = grofs_node_init_from_path(grofs, &node, path);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    switch (node.type) {
+        case DATA:
+            attr->type = GROFS_ATTR_FILE;
+
+            break;
+        case DIR:
+            attr->type = GROFS_ATTR_DIR;
+
+            break;
+        case LINK:
+            attr->type = GROFS_ATTR_LINK;
+
+            break;
+        default:
+        GROFS_HALT_FMT("Unexpected %s for path %s", grofs_node_type_to_str(node.type), path);
+    }
+
+    attr->size = node.size;
+    attr->mtime = node.time;
+
+    return 0;
+}
+
+int grofs_readlink(struct grofs *grofs, const char *path, char *buff, size_t size) {
+    struct grofs_node node;
+
+    int ret = grofs_node_init_from_path(grofs, &node, path);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    if (LINK != node.type) {
+        return EINVAL;
+    }
+
+    if (0 == size) {
+        return ENAMETOOLONG;
+    }
+
+    char target[PATH_MAX];
+
+    // size of a link is the length of its target
+    if (node.size >= sizeof(target)) {
+        return ENAMETOOLONG;
+    }
+
+    size_t len = 0;
+
+    int i;
+
+    for (i = 0; i < node.link_depth; i++) {
+        memcpy(target + len, "../", strlen("../"));
+
+        len += strlen("../");
+    }
+
+    memcpy(target + len, GROFS_STR_COMMITS "/", strlen(GROFS_STR_COMMITS "/"));
+
+    len += strlen(GROFS_STR_COMMITS "/");
+
+    git_oid_nfmt(target + len, GIT_OID_HEXSZ, &node.oid);
+
+    len += GIT_OID_HEXSZ;
+
+    // truncated like readlink(2) does
+    if (len > size - 1) {
+        len = size - 1;
+    }
+
+    memcpy(buff, target, len);
+
+    buff[len] = '\0';
+
+    return 0;
+}
+
+int grofs_dir_open(struct grofs *grofs, const char *path, struct grofs_dir **dir) {
+    struct grofs_node node;
+
+    int ret = grofs_node_init_from_path(grofs, &node, path);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    if (DATA == node.type) {
+        return ENOTDIR;
+    }
+
+    struct grofs_dir *new_dir = (struct grofs_dir *) calloc(1, sizeof(struct grofs_dir));
+
+    if (NULL == new_dir) {
+        return ENOMEM;
+    }
+
+    ret = grofs_dir_init_from_node(grofs, new_dir, &node);
+
+    if (0 == ret) {
+        *dir = new_dir;
+
+        if (PATH_IN_GIT == node.entry_type || TREE == node.entry_type) {
+            grofs_attr_prefetch_start(node.repo, &node.oid);
+        }
+    } else {
+        free(new_dir);
+    }
+
+    return ret;
+}
+
+int grofs_dir_list(struct grofs_dir *dir, grofs_list_cb cb, void *payload) {
+    atomic_fetch_add(&grofs_readdir_threads_count, 1);
+
+    GROFS_PROBE1(readdir_iter_entry, &dir->oid);
+
+    int ret = dir->iter(dir, cb, payload);
+
+    GROFS_PROBE2(readdir_iter_return, &dir->oid, ret);
+
+    atomic_fetch_sub(&grofs_readdir_threads_count, 1);
+
+    return ret;
+}
+
+int grofs_dir_list_blocks(struct grofs_dir *dir, grofs_list_block_cb cb, void *payload) {
+    struct grofs_list_block block = {
+        .data = (char *) malloc(GROFS_LIST_BLOCK_LEN),
+        .len = 0,
+        .count = 0,
+        .cb = cb,
+        .payload = payload,
+        .ret = 0
+    };
+
+    if (NULL == block.data) {
+        return ENOMEM;
+    }
+
+    atomic_fetch_add(&grofs_readdir_threads_count, 1);
+
+    GROFS_PROBE1(readdir_iter_entry, &dir->oid);
+
+    if (NULL != dir->iter_blocks) {
+        dir->iter_blocks(dir, &block);
+    } else {
+        dir->iter(dir, grofs_list_block_add_name_cb, &block);
+    }
+
+    int ret = grofs_list_block_flush(&block);
+
+    GROFS_PROBE2(readdir_iter_return, &dir->oid, ret);
+
+    atomic_fetch_sub(&grofs_readdir_threads_count, 1);
+
+    free(block.data);
+
+    return ret;
+}
+
+void grofs_dir_close(struct grofs_dir *dir) {
+    free(dir);
+}
+
+int grofs_list(struct grofs *grofs, const char *path, grofs_list_cb cb, void *payload) {
+    struct grofs_dir *dir;
+
+    int ret = grofs_dir_open(grofs, path, &dir);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    ret = grofs_dir_list(dir, cb, payload);
+
+    grofs_dir_close(dir);
+
+    return ret;
+}
+
+int grofs_file_open(struct grofs *grofs, const char *path, struct grofs_file **file) {
+    struct grofs_node node;
+
+    int ret = grofs_node_init_from_path(grofs, &node, path);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    ret = ENOENT;
+
+    if (DIR == node.type) {
+        ret = EISDIR;
+    } else if (DATA == node.type) {
+        ret = grofs_open_node(&node, file);
+    }
+
+    return ret;
+}
+
+uint64_t grofs_file_size(const struct grofs_file *file) {
+    return file->len;
+}
+
+int grofs_file_is_generated(const struct grofs_file *file) {
+    return file->generated;
+}
+
+int grofs_file_read(struct grofs_file *file, char *buff, size_t size, uint64_t offset, size_t *read_len) {
+    *read_len = 0;
+
+    if (offset >= (uint64_t) file->len) {
+        return 0;
+    }
+
+    size_t to_read = file->len - offset;
+
+    if (to_read > size) {
+        to_read = size;
+    }
+
+    if (-1 != file->spill_fd) {
+        ssize_t ret = pread(file->spill_fd, buff, to_read, offset);
+
+        if (ret < 0) {
+            return errno;
+        }
+
+        atomic_fetch_add(&grofs_spill_stats.read_bytes, ret);
+
+        *read_len = ret;
+
+        return 0;
+    }
+
+    GROFS_PROBE3(read_copy, file->len, offset, to_read);
+
+    if (NULL != file->chunk_list) {
+        size_t index = grofs_chunk_index(file->chunk_list, offset);
+        size_t copied = 0;
+
+        // chunks are looked up for each read rather than held by the handle, which only keeps the blob inflated for evicted ones
+        for (; copied < to_read; index++) {
+            struct grofs_blob_entry *chunk;
+
+            int ret = grofs_chunk_load(file, index, &chunk);
+
+            if (0 != ret) {
+                return ret;
+            }
+
+            size_t chunk_offset = offset + copied - file->chunk_list->chunks[index].offset;
+            size_t len = chunk->len - chunk_offset < to_read - copied ? chunk->len - chunk_offset : to_read - copied;
+
+            memcpy(buff + copied, chunk->data + chunk_offset, len);
+
+            grofs_cache_release(&grofs_blob_cache, &chunk->entry);
+
+            copied += len;
+        }
+
+        *read_len = to_read;
+
+        return 0;
+    }
+
+    memcpy(buff, file->buff + offset, sizeof(char) * to_read);
+
+    *read_len = to_read;
+
+    return 0;
+}
+
+void grofs_file_close(struct grofs_file *file) {
+    grofs_file_handle_free(file);
+}
+
+int grofs_read(struct grofs *grofs, const char *path, char *buff, size_t size, uint64_t offset, size_t *read_len) {
+    struct grofs_file *file;
+
+    int ret = grofs_file_open(grofs, path, &file);
+
+    if (0 != ret) {
+        return ret;
+    }
+
+    ret = grofs_file_read(file, buff, size, offset, read_len);
+
+    grofs_file_close(file);
+
+    return ret;
+}